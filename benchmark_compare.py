@@ -0,0 +1,73 @@
+# Compares the results of two benchmark builds, see "Benchmarks" in README.md. Each file
+# holds the captured serial output, or just the line prefixed "BENCHMARK ":
+#
+# python benchmark_compare.py baseline.txt candidate.txt
+# python benchmark_compare.py baseline.txt candidate.txt --max-allocation-increase 0.5 --max-time-increase 10
+#
+# Fails (exit status 1) if any benchmark marked perReading makes more heap allocations
+# per operation than in the baseline, plus the allowed increase (none by default). Time
+# per operation is compared against --max-time-increase, as a percentage, if given.
+#
+# Only the standard library is used.
+
+import argparse
+import json
+import sys
+
+PREFIX = "BENCHMARK "
+
+
+def load_results(path):
+    with open(path, errors="replace") as results_file:
+        for line in results_file:
+            position = line.find(PREFIX)
+            if position >= 0:
+                results = json.loads(line[position + len(PREFIX):])
+                return {benchmark["name"]: benchmark for benchmark in results["benchmarks"]}
+    raise ValueError("No %sline found in %s" % (PREFIX.strip(), path))
+
+
+def compare(baseline, candidate, max_allocation_increase, max_time_increase):
+    """Prints a row per benchmark, returning the names of those that regressed"""
+    regressions = []
+    print("%-40s %12s %12s %10s %10s" % ("benchmark", "allocs/op", "was", "us/op", "was"))
+    for name, result in candidate.items():
+        base = baseline.get(name)
+        if base is None:
+            print("%-40s %12.2f %12s %10.1f %10s  new" % (name, result["allocationsPerOp"], "-", result["microsPerOp"], "-"))
+            continue
+        notes = []
+        if result.get("perReading") and result["allocationsPerOp"] > base["allocationsPerOp"] + max_allocation_increase:
+            notes.append("ALLOCATIONS")
+        if max_time_increase is not None and \
+                result["microsPerOp"] > base["microsPerOp"] * (1 + max_time_increase / 100.0):
+            notes.append("TIME")
+        if notes:
+            regressions.append(name)
+        print("%-40s %12.2f %12.2f %10.1f %10.1f  %s" % (name, result["allocationsPerOp"], base["allocationsPerOp"],
+                                                      result["microsPerOp"], base["microsPerOp"], " ".join(notes)))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two benchmark builds")
+    parser.add_argument("baseline", help="serial output of the baseline build")
+    parser.add_argument("candidate", help="serial output of the build being checked")
+    parser.add_argument("--max-allocation-increase", type=float, default=0,
+                        help="allowed increase in allocations per operation on the per-reading path")
+    parser.add_argument("--max-time-increase", type=float,
+                        help="allowed increase in time per operation, as a percentage")
+    args = parser.parse_args()
+    try:
+        regressions = compare(load_results(args.baseline), load_results(args.candidate),
+                              args.max_allocation_increase, args.max_time_increase)
+    except (OSError, ValueError, KeyError) as error:
+        print("Error: %s" % error, file=sys.stderr)
+        sys.exit(2)
+    if regressions:
+        print("Regressed: %s" % ", ".join(regressions), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,222 @@
+# Replays a controller's sensor recording against alternative sensor group parameters, to
+# see the pump schedule and water use they would have given. See "Recording and replay"
+# in README.md.
+#
+# The replay runs on this machine, in the replay runner built by "pio run -e replay_runner",
+# through the firmware's filtering and sensor group logic with a virtual clock. This script
+# fetches the recording and configuration from the controller, or takes them from files,
+# and sweeps parameters by passing each set to the runner:
+#
+# python sensor_replay.py <myESPipaddress> --dump
+# python sensor_replay.py <myESPipaddress> --group bed1 --min-moisture 30:60:5 --litres-per-minute 1.5
+# python sensor_replay.py --recording recording.bin --config config.json --group bed1 --pump-secs 10,20,30 --csv
+#
+# Only the standard library is used.
+
+import argparse
+import csv
+import json
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import urllib.error
+import urllib.request
+
+TAG_START = 0x01
+TAG_SAMPLE = 0x02
+TAG_PUMPS = 0x03
+ESCAPE = 0x80
+
+DEFAULT_RUNNER = os.path.join(os.path.dirname(os.path.abspath(__file__)), ".pio", "build", "replay_runner", "program")
+
+SWEEP_FIELDS = [("min_moisture", "minMoisture"), ("pump_secs", "pumpSecs"),
+                ("trigger_type", "triggerType"), ("moisture_check_period_ms", "moistureCheckPeriodMs")]
+
+
+class ReplayError(Exception):
+    pass
+
+
+def controller_url(host, path):
+    if ":" not in host:
+        host += ":8080"
+    return "http://%s%s" % (host, path)
+
+
+def decode_recording(data):
+    """Yields (tag, seconds, channel readings or pump outputs) for each record, in the
+    format written by SensorRecorder.h. Stops at a truncated or unknown record."""
+    position = 0
+    seconds = 0
+    channel_count = 0
+    readings = []
+    while position < len(data):
+        tag = data[position]
+        position += 1
+        if tag == TAG_START:
+            if position + 3 > len(data):
+                return
+            channel_count, sample_secs = struct.unpack_from("<BH", data, position)
+            position += 3
+            readings = [0] * channel_count
+            yield tag, seconds, sample_secs
+            continue
+        if tag not in (TAG_SAMPLE, TAG_PUMPS) or channel_count == 0 or position + 2 > len(data):
+            return
+        seconds += struct.unpack_from("<H", data, position)[0]
+        position += 2
+        if tag == TAG_PUMPS:
+            if position + 4 > len(data):
+                return
+            yield tag, seconds, struct.unpack_from("<I", data, position)[0]
+            position += 4
+            continue
+        for channel in range(channel_count):
+            if position >= len(data):
+                return
+            delta = data[position]
+            position += 1
+            if delta == ESCAPE:
+                if position + 2 > len(data):
+                    return
+                readings[channel] = struct.unpack_from("<h", data, position)[0]
+                position += 2
+            else:
+                readings[channel] += delta - 256 if delta > 127 else delta
+        yield tag, seconds, list(readings)
+
+
+def fetch(host, path):
+    with urllib.request.urlopen(controller_url(host, path)) as response:
+        return response.read()
+
+
+def load(args, file_name, path):
+    """Reads a file if given one, otherwise fetches it from the controller"""
+    if file_name:
+        with open(file_name, "rb") as file:
+            return file.read()
+    return fetch(args.host, path)
+
+
+def run_replays(runner, recording, config, params_list):
+    """Runs the replay runner over each set of parameters, returning their results"""
+    if not os.path.exists(runner):
+        raise ReplayError("No replay runner at %s, build it with \"pio run -e replay_runner\"" % runner)
+    with tempfile.TemporaryDirectory() as directory:
+        recording_file = os.path.join(directory, "recording.bin")
+        config_file = os.path.join(directory, "config.json")
+        with open(recording_file, "wb") as file:
+            file.write(recording)
+        with open(config_file, "wb") as file:
+            file.write(config)
+        stdin = "".join(json.dumps(params) + "\n" for params in params_list)
+        process = subprocess.run([runner, recording_file, config_file], input=stdin, capture_output=True, text=True)
+    if process.returncode != 0:
+        raise ReplayError(process.stderr.strip())
+    results = [json.loads(line) for line in process.stdout.splitlines() if line]
+    for result in results:
+        if "error" in result:
+            raise ReplayError(result["error"])
+    return results
+
+
+def parse_values(text, convert):
+    """Parses a comma separated list, or a first:last:step range, of values"""
+    if ":" in text:
+        first, last, step = (convert(part) for part in text.split(":"))
+        values = []
+        value = first
+        while value <= last:
+            values.append(value)
+            value += step
+        return values
+    return [convert(part) for part in text.split(",")]
+
+
+def parameter_sets(args):
+    sets = [{}]
+    for arg_name, field in SWEEP_FIELDS:
+        text = getattr(args, arg_name)
+        if text is None:
+            continue
+        values = text.split(",") if field == "triggerType" else parse_values(text, int)
+        sets = [dict(params, **{field: value}) for params in sets for value in values]
+    return sets
+
+
+def dump(recording):
+    for tag, seconds, value in decode_recording(recording):
+        if tag == TAG_START:
+            print("%8d start, sampled every %ds" % (seconds, value))
+        elif tag == TAG_SAMPLE:
+            print("%8d %s" % (seconds, " ".join("%4d" % reading for reading in value)))
+        else:
+            print("%8d pumps 0x%08x" % (seconds, value))
+
+
+def sweep(args):
+    columns = ["group"] + [field for _, field in SWEEP_FIELDS if getattr(args, _) is not None] + \
+              ["pumpStarts", "pumpSeconds", "litres", "recordedPumpStarts", "recordedPumpSeconds", "recordedLitres"]
+    recording = load(args, args.recording, "/recording")
+    config = load(args, args.config, "/config")
+    sets = parameter_sets(args)
+    params_list = []
+    for overrides in sets:
+        params = {"pumpLitresPerMinute": args.litres_per_minute}
+        if args.group:
+            params["groups"] = {args.group: overrides}
+        params_list.append(params)
+    rows = []
+    for overrides, result in zip(sets, run_replays(args.runner, recording, config, params_list)):
+        for name, group in result["groups"].items():
+            if args.group and name != args.group:
+                continue
+            row = dict(overrides, group=name, **group)
+            if isinstance(row["litres"], float):
+                row["litres"] = round(row["litres"], 2)
+                row["recordedLitres"] = round(row["recordedLitres"], 2)
+            rows.append([row.get(column, "") for column in columns])
+    if args.csv:
+        writer = csv.writer(sys.stdout)
+        writer.writerow(columns)
+        writer.writerows(rows)
+        return
+    widths = [max(len(str(value)) for value in [column] + [row[i] for row in rows]) for i, column in enumerate(columns)]
+    for row in [columns] + rows:
+        print("  ".join(str(value).rjust(width) for value, width in zip(row, widths)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay a controller's sensor recording with other parameters")
+    parser.add_argument("host", nargs="?", help="controller address, with :port if not 8080")
+    parser.add_argument("--recording", help="recording file, saved from /recording, rather than fetching it")
+    parser.add_argument("--config", help="configuration file, saved from /config, rather than fetching it")
+    parser.add_argument("--runner", default=DEFAULT_RUNNER, help="replay runner program")
+    parser.add_argument("--dump", action="store_true", help="print the decoded recording and stop")
+    parser.add_argument("--group", help="sensor group to override, otherwise the configured parameters are replayed")
+    parser.add_argument("--min-moisture", help="values to try, as a,b,c or first:last:step")
+    parser.add_argument("--pump-secs", help="values to try, as a,b,c or first:last:step")
+    parser.add_argument("--trigger-type", help="values to try, as any,all")
+    parser.add_argument("--moisture-check-period-ms", help="values to try, as a,b,c or first:last:step")
+    parser.add_argument("--litres-per-minute", type=float, default=0, help="pump flow, for the water use estimate")
+    parser.add_argument("--csv", action="store_true", help="print CSV rather than a table")
+    args = parser.parse_args()
+    if not args.host and not (args.recording and (args.config or args.dump)):
+        parser.error("a controller address is needed unless --recording and --config are given")
+    if args.dump:
+        dump(load(args, args.recording, "/recording"))
+        return
+    if not args.group and any(getattr(args, arg_name) is not None for arg_name, _ in SWEEP_FIELDS):
+        parser.error("--group is needed to sweep parameters")
+    sweep(args)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except (ReplayError, OSError) as error:
+        print("Error: %s" % error, file=sys.stderr)
+        sys.exit(1)
@@ -0,0 +1,27 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+#ifndef __WATERINGSYSTEM_ACTUATORBACKEND_H__
+#define __WATERINGSYSTEM_ACTUATORBACKEND_H__
+
+#define WATERINGSYSTEM_MAXACTUATORS 32
+
+//
+// Pure virtual base class representing the hardware driving the pump outputs. The
+// ActuatorOutputs class hands a backend the complete output state in one call whenever
+// something has changed, so backends that can (shift registers, I2C expanders) update
+// every output in a single transfer.
+//
+class ActuatorBackend
+{
+    public:
+        virtual const char* getType() = 0;
+        virtual uint8_t getOutputCount() = 0;
+        virtual void writeOutputs(uint32_t levels, uint32_t changedMask) = 0;
+        virtual ~ActuatorBackend() {};
+};
+
+#endif
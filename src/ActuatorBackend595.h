@@ -0,0 +1,60 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include "ActuatorBackend.h"
+
+#ifndef __WATERINGSYSTEM_ACTUATORBACKEND595_H__
+#define __WATERINGSYSTEM_ACTUATORBACKEND595_H__
+
+//
+// One or more chained 74HC595 shift registers, providing 8 outputs each from three
+// pins. The whole chain is shifted out and then latched, so every output changes at
+// the same instant. Output 0 is QA of the first register in the chain.
+//
+class ActuatorBackend595 : public ActuatorBackend
+{
+  private:
+    int _dataPin;
+    int _clockPin;
+    int _latchPin;
+    uint8_t _registerCount;
+
+  public:
+    ActuatorBackend595(int dataPin, int clockPin, int latchPin, uint8_t registerCount);
+    virtual const char* getType();
+    virtual uint8_t getOutputCount();
+    virtual void writeOutputs(uint32_t levels, uint32_t changedMask);
+};
+/****************************************/
+
+ActuatorBackend595::ActuatorBackend595(int dataPin, int clockPin, int latchPin, uint8_t registerCount) {
+    _dataPin = dataPin;
+    _clockPin = clockPin;
+    _latchPin = latchPin;
+    _registerCount = registerCount;
+    pinMode(_dataPin, OUTPUT);
+    pinMode(_clockPin, OUTPUT);
+    pinMode(_latchPin, OUTPUT);
+    return;
+}
+
+const char* ActuatorBackend595::getType() {
+    return "74hc595";
+}
+
+uint8_t ActuatorBackend595::getOutputCount() {
+    return _registerCount * 8;
+}
+
+void ActuatorBackend595::writeOutputs(uint32_t levels, uint32_t changedMask) {
+    digitalWrite(_latchPin, LOW);
+    // The last register in the chain is shifted out first
+    for (int reg = _registerCount - 1; reg >= 0; reg--) {
+        shiftOut(_dataPin, _clockPin, MSBFIRST, (uint8_t)(levels >> (reg * 8)));
+    }
+    digitalWrite(_latchPin, HIGH);
+}
+
+#endif
@@ -0,0 +1,58 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <vector>
+#include "ActuatorBackend.h"
+
+#ifndef __WATERINGSYSTEM_ACTUATORBACKENDGPIO_H__
+#define __WATERINGSYSTEM_ACTUATORBACKENDGPIO_H__
+
+//
+// Outputs driven directly from ESP8266 pins, one pin per output. Only pins whose
+// level has changed are written.
+//
+class ActuatorBackendGpio : public ActuatorBackend
+{
+  private:
+    std::vector<int> _pinIds;
+
+  public:
+    ActuatorBackendGpio(std::vector<int> pinIds);
+    int getPinId(uint8_t output);
+    virtual const char* getType();
+    virtual uint8_t getOutputCount();
+    virtual void writeOutputs(uint32_t levels, uint32_t changedMask);
+};
+/****************************************/
+
+ActuatorBackendGpio::ActuatorBackendGpio(std::vector<int> pinIds) {
+    _pinIds = pinIds;
+    for (auto & pinId : _pinIds) {
+        pinMode(pinId, OUTPUT);
+    }
+    return;
+}
+
+int ActuatorBackendGpio::getPinId(uint8_t output) {
+    return _pinIds.at(output);
+}
+
+const char* ActuatorBackendGpio::getType() {
+    return "gpio";
+}
+
+uint8_t ActuatorBackendGpio::getOutputCount() {
+    return _pinIds.size();
+}
+
+void ActuatorBackendGpio::writeOutputs(uint32_t levels, uint32_t changedMask) {
+    for (size_t output = 0; output < _pinIds.size(); output++) {
+        if (changedMask & (1UL << output)) {
+            digitalWrite(_pinIds[output], (levels >> output) & 1);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,58 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <vector>
+#include "ActuatorBackend.h"
+#include "SerialConsole.h"
+
+#ifndef __WATERINGSYSTEM_ACTUATORBACKENDPCF8574_H__
+#define __WATERINGSYSTEM_ACTUATORBACKENDPCF8574_H__
+
+//
+// One or more PCF8574 style I2C port expanders, providing 8 outputs each. Each expander
+// is updated with a single byte write, and only expanders with changed outputs are
+// written. Outputs 0-7 are on the first address listed, 8-15 on the second, and so on.
+//
+class ActuatorBackendPcf8574 : public ActuatorBackend
+{
+  private:
+    std::vector<uint8_t> _addresses;
+
+  public:
+    ActuatorBackendPcf8574(std::vector<uint8_t> addresses);
+    virtual const char* getType();
+    virtual uint8_t getOutputCount();
+    virtual void writeOutputs(uint32_t levels, uint32_t changedMask);
+};
+/****************************************/
+
+ActuatorBackendPcf8574::ActuatorBackendPcf8574(std::vector<uint8_t> addresses) {
+    _addresses = addresses;
+    return;
+}
+
+const char* ActuatorBackendPcf8574::getType() {
+    return "pcf8574";
+}
+
+uint8_t ActuatorBackendPcf8574::getOutputCount() {
+    return _addresses.size() * 8;
+}
+
+void ActuatorBackendPcf8574::writeOutputs(uint32_t levels, uint32_t changedMask) {
+    for (size_t expander = 0; expander < _addresses.size(); expander++) {
+        if (((changedMask >> (expander * 8)) & 0xFF) == 0) {
+            continue;
+        }
+        Wire.beginTransmission(_addresses[expander]);
+        Wire.write((uint8_t)(levels >> (expander * 8)));
+        if (Wire.endTransmission() != 0) {
+            serialConsole.println("Failed to write pump outputs to I2C expander");
+        }
+    }
+}
+
+#endif
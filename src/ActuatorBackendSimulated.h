@@ -0,0 +1,75 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include "ActuatorBackend.h"
+
+#ifndef __WATERINGSYSTEM_ACTUATORBACKENDSIMULATED_H__
+#define __WATERINGSYSTEM_ACTUATORBACKENDSIMULATED_H__
+
+#define WATERINGSYSTEM_SIMULATED_TRANSITIONS 32
+
+struct ActuatorTransition
+{
+    unsigned long timeMicros;
+    uint32_t levels;
+    uint32_t changedMask;
+};
+
+//
+// Simulated outputs for testing without hardware. Records the most recent output
+// transitions with their timestamps, so pump timing can be checked.
+//
+class ActuatorBackendSimulated : public ActuatorBackend
+{
+  private:
+    uint8_t _outputCount;
+    ActuatorTransition _transitions[WATERINGSYSTEM_SIMULATED_TRANSITIONS];
+    unsigned long _transitionCount = 0;
+
+  public:
+    ActuatorBackendSimulated(uint8_t outputCount);
+    unsigned long getTransitionCount();
+    bool getTransition(unsigned long index, ActuatorTransition* transition);
+    virtual const char* getType();
+    virtual uint8_t getOutputCount();
+    virtual void writeOutputs(uint32_t levels, uint32_t changedMask);
+};
+/****************************************/
+
+ActuatorBackendSimulated::ActuatorBackendSimulated(uint8_t outputCount) {
+    _outputCount = outputCount;
+    return;
+}
+
+unsigned long ActuatorBackendSimulated::getTransitionCount() {
+    return _transitionCount;
+}
+
+// Returns a transition by its index since creation, if it's still held
+bool ActuatorBackendSimulated::getTransition(unsigned long index, ActuatorTransition* transition) {
+    if (index >= _transitionCount || _transitionCount - index > WATERINGSYSTEM_SIMULATED_TRANSITIONS) {
+        return false;
+    }
+    *transition = _transitions[index % WATERINGSYSTEM_SIMULATED_TRANSITIONS];
+    return true;
+}
+
+const char* ActuatorBackendSimulated::getType() {
+    return "simulated";
+}
+
+uint8_t ActuatorBackendSimulated::getOutputCount() {
+    return _outputCount;
+}
+
+void ActuatorBackendSimulated::writeOutputs(uint32_t levels, uint32_t changedMask) {
+    ActuatorTransition& transition = _transitions[_transitionCount % WATERINGSYSTEM_SIMULATED_TRANSITIONS];
+    transition.timeMicros = micros();
+    transition.levels = levels;
+    transition.changedMask = changedMask;
+    _transitionCount++;
+}
+
+#endif
@@ -0,0 +1,104 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include "ActuatorBackend.h"
+#include "TraceRecorder.h"
+
+#ifndef __WATERINGSYSTEM_ACTUATOROUTPUTS_H__
+#define __WATERINGSYSTEM_ACTUATOROUTPUTS_H__
+
+//
+// Batched pump outputs. SensorGroups change the desired state of their outputs, and the
+// IrrigationService commits all pending changes to the backend once per loop, so pumps
+// switched together change together, and shift register or I2C backends need only one
+// transfer per loop.
+//
+class ActuatorOutputs
+{
+  private:
+    ActuatorBackend* _backend = NULL;
+    uint32_t _desiredOutputs = 0;   // Logical state, bit set means pump on
+    uint32_t _committedOutputs = 0; // Logical state last written to the backend
+    uint32_t _invertMask = 0;       // Outputs driven active low
+
+  public:
+    ActuatorOutputs();
+    ~ActuatorOutputs();
+    void setBackend(ActuatorBackend* backend, bool activeLow);
+    ActuatorBackend* getBackend();
+    uint8_t getOutputCount();
+    void setOutputs(uint32_t outputMask, bool on);
+    uint32_t getDesiredOutputs();
+    uint32_t getCommittedOutputs();
+    void commit();
+};
+/****************************************/
+
+ActuatorOutputs::ActuatorOutputs() {
+    return;
+}
+
+ActuatorOutputs::~ActuatorOutputs() {
+    delete _backend;
+}
+
+//
+// Replaces the backend, switching every output of the previous backend off first.
+// The ActuatorOutputs takes responsibility for destruction of the backend.
+//
+void ActuatorOutputs::setBackend(ActuatorBackend* backend, bool activeLow) {
+    if (_backend) {
+        _desiredOutputs = 0;
+        commit();
+        delete _backend;
+    }
+    _backend = backend;
+    _invertMask = activeLow ? 0xFFFFFFFF : 0;
+    _desiredOutputs = 0;
+    _committedOutputs = 0;
+    uint8_t outputCount = _backend->getOutputCount();
+    _backend->writeOutputs(_invertMask, outputCount >= 32 ? 0xFFFFFFFF : (1UL << outputCount) - 1);
+}
+
+ActuatorBackend* ActuatorOutputs::getBackend() {
+    return _backend;
+}
+
+uint8_t ActuatorOutputs::getOutputCount() {
+    return _backend ? _backend->getOutputCount() : 0;
+}
+
+void ActuatorOutputs::setOutputs(uint32_t outputMask, bool on) {
+    if (on) {
+        _desiredOutputs |= outputMask;
+    } else {
+        _desiredOutputs &= ~outputMask;
+    }
+}
+
+uint32_t ActuatorOutputs::getDesiredOutputs() {
+    return _desiredOutputs;
+}
+
+uint32_t ActuatorOutputs::getCommittedOutputs() {
+    return _committedOutputs;
+}
+
+// Writes any pending output changes to the backend in a single batch
+void ActuatorOutputs::commit() {
+    uint32_t changedMask = _desiredOutputs ^ _committedOutputs;
+    if (changedMask == 0 || !_backend) {
+        return;
+    }
+    _backend->writeOutputs(_desiredOutputs ^ _invertMask, changedMask);
+    _committedOutputs = _desiredOutputs;
+    for (uint8_t output = 0; output < 32; output++) {
+        if (changedMask & (1UL << output)) {
+            traceRecorder.record(TRACE_EVENT_PUMP, (_desiredOutputs & (1UL << output)) ? 'B' : 'E', output);
+        }
+    }
+}
+
+#endif
@@ -3,96 +3,392 @@
 //
 
 #include <array>
+#include <vector>
 #include <Arduino.h>
+#include "SensorHistory.h"
+#include "SensorSource.h"
+#include "SensorSourceMux.h"
+#include "TraceRecorder.h"
+#include "ChannelCalibration.h"
+#include "ChannelHealth.h"
 
 //
-// Code to read from sensors, handling multiplex
+// Code to read from sensors, across one or more sensor sources (see SensorSource.h).
+// Channels are numbered globally, in the order the sources were added.
 //
 
 #ifndef __WATERINGSYSTEM_ANALOGUESENSORHANDLER_H__
 #define __WATERINGSYSTEM_ANALOGUESENSORHANDLER_H__
 
 #define WATERINGSYSTEM_MAXSAMPLESLOTS 10
-#define WATERINGSYSTEM_NUMBEROFSENSORS 8
-
-//get a bit from a variable
-#define GETBIT(var, bit)  (((var) >> (bit)) & 1)
+#define WATERINGSYSTEM_MAXSENSORS 32
+#define WATERINGSYSTEM_NUMBEROFSENSORS 8 // Channels on the default single multiplexer
+static_assert(WATERINGSYSTEM_HISTORY_CHANNELS >= WATERINGSYSTEM_MAXSENSORS, "Every sensor channel must have history");
 
 class AnalogueSensorHandler 
 {
   private: 
-    short int _sensorReadings[WATERINGSYSTEM_NUMBEROFSENSORS][WATERINGSYSTEM_MAXSAMPLESLOTS] ; // Current sensor readings
-    short int _filledSensorSlots[WATERINGSYSTEM_NUMBEROFSENSORS] ; // Count of the number of readings
-    short int _currentSensorSlot[WATERINGSYSTEM_NUMBEROFSENSORS] ; // Count of the number of readings
-    std::array<int,3> _selectorPins;
-    const int _analogInPin = A0;   // ESP8266 Analog Pin ADC0 = A0
-    void setActiveChannel(int channelNumber);
+    short int _sensorReadings[WATERINGSYSTEM_MAXSENSORS][WATERINGSYSTEM_MAXSAMPLESLOTS] ; // Current sensor readings
+    short int _filledSensorSlots[WATERINGSYSTEM_MAXSENSORS] ; // Count of the number of readings
+    short int _currentSensorSlot[WATERINGSYSTEM_MAXSENSORS] ; // Count of the number of readings
+    int16_t _latestRawReadings[WATERINGSYSTEM_MAXSENSORS] = {}; // Most recent reading before calibration
+    std::array<int,3> _defaultSelectorPins;
+    std::vector<SensorSource*> _sources;
+    uint8_t _channelCount = 0;
+    uint8_t _channelSource[WATERINGSYSTEM_MAXSENSORS];  // Index into _sources for each global channel
+    uint8_t _channelLocal[WATERINGSYSTEM_MAXSENSORS];   // Channel number within its source
+    SensorHistory* _history = NULL; // Optional on-device history, fed from each poll
+    unsigned long _settleMicros[WATERINGSYSTEM_MAXSENSORS]; // Per channel wait after selecting the channel
+    uint8_t _oversampleCount[WATERINGSYSTEM_MAXSENSORS];    // Per channel conversions averaged per reading
+    uint8_t* _calibration[WATERINGSYSTEM_MAXSENSORS] = {};  // Per channel raw to percent table, NULL if uncalibrated
+    ChannelHealth _health[WATERINGSYSTEM_MAXSENSORS];       // Per channel statistics and fault detection
+    uint32_t _healthChanges = 0;                            // Channels whose health changed since last taken
+    uint32_t _updatedChannels = 0;                          // Channels with new readings since last taken
+    void storeReading(uint8_t channelNumber, int sensorReading);
+    int calibrate(uint8_t channelNumber, int rawReading);
 
 //    bool* _pCmdReceived;
     
   public: 
     AnalogueSensorHandler(std::array<int,3> selectorPins); 
+    AnalogueSensorHandler(SensorSource* source);
+    virtual ~AnalogueSensorHandler();
     int getAbsoluteSensorReading(int channelNumber);
     int getSensorSimpleMovingAverageReading(int channelNumber);
+    int getLatestReading(int channelNumber);
+    int getLatestRawReading(int channelNumber);
+    bool hasReadings(int channelNumber);
     void pollSensors();
+    void setHistory(SensorHistory* history);
+    SensorHistory* getHistory();
+
+    // Sensor sources
+    void addSensorSource(SensorSource* source);
+    void removeSensorSources();
+    void useDefaultSensorSource();
+    uint8_t getChannelCount();
+
+    // Settle time and oversampling, per channel
+    void setChannelSettings(int channelNumber, unsigned long settleMicros, uint8_t oversampleCount);
+    void resetChannelSettings();
+    unsigned long getSettleMicros(int channelNumber);
+    uint8_t getOversampleCount(int channelNumber);
+    bool startChannelCalibration(int channelNumber);
+    bool stepChannelCalibration(int channelNumber, unsigned long* settleMicros, uint8_t* oversampleCount);
+
+    // Conversion of raw readings to percent, per channel
+    void setChannelCalibration(int channelNumber, uint8_t* table);
+    bool isCalibrated(int channelNumber);
+    const uint8_t* getChannelCalibration(int channelNumber);
+
+    // Faulty channel detection, from the raw readings
+    bool isChannelHealthy(int channelNumber);
+    ChannelHealth* getChannelHealth(int channelNumber);
+    uint32_t takeHealthChanges();
+
+    // Channels whose moving averages have new readings
+    uint32_t takeUpdatedChannels();
 }; 
 /****************************************/
 
 
 AnalogueSensorHandler::AnalogueSensorHandler(std::array<int,3> selectorPins)
 {
-  _selectorPins = selectorPins;
-  pinMode(_selectorPins.at(0), OUTPUT);
-  pinMode(_selectorPins.at(1), OUTPUT);
-  pinMode(_selectorPins.at(2), OUTPUT);
-  memset(_filledSensorSlots, 0, WATERINGSYSTEM_NUMBEROFSENSORS*sizeof(_filledSensorSlots[0]));
-  memset(_currentSensorSlot, 0, WATERINGSYSTEM_NUMBEROFSENSORS*sizeof(_currentSensorSlot[0]));
+  _defaultSelectorPins = selectorPins;
+  useDefaultSensorSource();
   
   return;
 }
 
-void AnalogueSensorHandler::setActiveChannel(int channelNumber) {
-  digitalWrite(_selectorPins.at(0), GETBIT(channelNumber,0));
-  digitalWrite(_selectorPins.at(1), GETBIT(channelNumber,1));
-  digitalWrite(_selectorPins.at(2), GETBIT(channelNumber,2));
-  return;
-  
+// Reads from a single given source, such as simulated channels for a replay. The handler
+// takes responsibility for destruction of the source.
+AnalogueSensorHandler::AnalogueSensorHandler(SensorSource* source)
+{
+  _defaultSelectorPins = {-1, -1, -1};
+  addSensorSource(source);
+}
+
+AnalogueSensorHandler::~AnalogueSensorHandler() {
+  removeSensorSources();
+}
+
+//
+// Adds a source, allocating the next global channel numbers to its channels. The
+// handler takes responsibility for destruction of the source.
+//
+void AnalogueSensorHandler::addSensorSource(SensorSource* source) {
+  uint8_t sourceIndex = _sources.size();
+  _sources.push_back(source);
+  for (uint8_t local = 0; local < source->getChannelCount() && _channelCount < WATERINGSYSTEM_MAXSENSORS; local++) {
+    _channelSource[_channelCount] = sourceIndex;
+    _channelLocal[_channelCount] = local;
+    _settleMicros[_channelCount] = source->getDefaultSettleMicros();
+    _oversampleCount[_channelCount] = 1;
+    _filledSensorSlots[_channelCount] = 0;
+    _currentSensorSlot[_channelCount] = 0;
+    _health[_channelCount].reset();
+    _channelCount++;
+  }
+}
+
+void AnalogueSensorHandler::removeSensorSources() {
+  for (auto & source : _sources) {
+    delete source;
+  }
+  _sources.clear();
+  // Calibrations belong to the channels of the removed sources
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    delete[] _calibration[channel];
+    _calibration[channel] = NULL;
+  }
+  _channelCount = 0;
+}
+
+// Replaces any sources with the single multiplexer on A0 the board was designed around
+void AnalogueSensorHandler::useDefaultSensorSource() {
+  removeSensorSources();
+  addSensorSource(new SensorSourceMux(_defaultSelectorPins, std::vector<int>()));
+}
+
+uint8_t AnalogueSensorHandler::getChannelCount() {
+  return _channelCount;
 }
 
+//
+// Selects the channel, waits for its calibrated settle time, then averages
+// the configured number of conversions.
+//
 int AnalogueSensorHandler::getAbsoluteSensorReading(int channelNumber)
 {
-  int sensorValue;
-  setActiveChannel(channelNumber);
-  
-  unsigned long loop_time = millis();
-  // Yielding for 100ms
-  while((millis()-loop_time)< 50){
+  if (channelNumber < 0 || channelNumber >= _channelCount) {
+    return 0;
+  }
+  SensorSource* source = _sources[_channelSource[channelNumber]];
+  source->startConversion(_channelLocal[channelNumber], _settleMicros[channelNumber], _oversampleCount[channelNumber]);
+  while (!source->isConversionReady()) {
     yield();
   }
-  sensorValue = 1023 - analogRead(_analogInPin);
-  return sensorValue;
+  int rawReading = source->readConversion();
+  if (rawReading == WATERINGSYSTEM_READING_FAILED) {
+    return WATERINGSYSTEM_READING_FAILED;
+  }
+  return calibrate(channelNumber, rawReading);
 }
 
 int AnalogueSensorHandler::getSensorSimpleMovingAverageReading(int channelNumber) {
   int sumOfSensorsReadings = 0;
+  if (channelNumber < 0 || channelNumber >= _channelCount || _filledSensorSlots[channelNumber] == 0) {
+    return 0;
+  }
   for (short int slot = 0; slot < _filledSensorSlots[channelNumber]; slot ++) {
     sumOfSensorsReadings += _sensorReadings[channelNumber][slot];
   }
   return sumOfSensorsReadings / _filledSensorSlots[channelNumber];    
 }
 
+// Returns the reading from the most recent poll, or 0 if the channel hasn't been polled
+int AnalogueSensorHandler::getLatestReading(int channelNumber) {
+  if (channelNumber < 0 || channelNumber >= _channelCount || _filledSensorSlots[channelNumber] == 0) {
+    return 0;
+  }
+  short int latestSlot = (_currentSensorSlot[channelNumber] + WATERINGSYSTEM_MAXSAMPLESLOTS - 1) % WATERINGSYSTEM_MAXSAMPLESLOTS;
+  return _sensorReadings[channelNumber][latestSlot];
+}
+
+// Returns false until a channel has been polled, since its sources or calibration were set
+bool AnalogueSensorHandler::hasReadings(int channelNumber) {
+  return channelNumber >= 0 && channelNumber < _channelCount && _filledSensorSlots[channelNumber] > 0;
+}
+
+// Returns the most recent reading as converted, before any calibration
+int AnalogueSensorHandler::getLatestRawReading(int channelNumber) {
+  if (channelNumber < 0 || channelNumber >= _channelCount) {
+    return 0;
+  }
+  return _latestRawReadings[channelNumber];
+}
+
+// Converts a raw reading to percent for calibrated channels
+int AnalogueSensorHandler::calibrate(uint8_t sensorChannel, int rawReading) {
+  if (!_calibration[sensorChannel]) {
+    return rawReading;
+  }
+  return _calibration[sensorChannel][constrain(rawReading, 0, WATERINGSYSTEM_CALIBRATION_RANGE - 1)];
+}
+
+// Store a reading into the next sensor reading slot, keeping track of how many
+// readings we have, and which slot is next. The channel's health is checked against
+// the raw reading, so rails are detected whatever the calibration. A failed reading
+// isn't stored, and makes the channel faulty straight away.
+void AnalogueSensorHandler::storeReading(uint8_t sensorChannel, int sensorReading) {
+  if (sensorReading == WATERINGSYSTEM_READING_FAILED) {
+    if (_health[sensorChannel].recordFailure()) {
+      _healthChanges |= 1UL << sensorChannel;
+    }
+    return;
+  }
+  _latestRawReadings[sensorChannel] = sensorReading;
+  if (_health[sensorChannel].update(sensorReading)) {
+    _healthChanges |= 1UL << sensorChannel;
+  }
+  short int filledSlots = _filledSensorSlots[sensorChannel];
+  short int currentSlot = _currentSensorSlot[sensorChannel];
+  _sensorReadings[sensorChannel][currentSlot] = calibrate(sensorChannel, sensorReading);
+  _filledSensorSlots[sensorChannel] =
+                         (filledSlots < WATERINGSYSTEM_MAXSAMPLESLOTS)?(filledSlots+1):(WATERINGSYSTEM_MAXSAMPLESLOTS);
+  _currentSensorSlot[sensorChannel] = (currentSlot + 1) % WATERINGSYSTEM_MAXSAMPLESLOTS;
+  _updatedChannels |= 1UL << sensorChannel;
+}
+
+//
+// Scans every channel. Each source works through its own channels, and a conversion is
+// kept in flight on every source at once, so the scan takes as long as the slowest
+// source rather than the sum of all of them.
+//
 void AnalogueSensorHandler::pollSensors() {
-  // Loop through each sensor, reading a value into the next sensor reading slot
-  // Keep track of how many readings we have, and which slot is next
-  for (short int sensorChannel = 0; sensorChannel < WATERINGSYSTEM_NUMBEROFSENSORS; sensorChannel++) {
-    short int filledSlots = _filledSensorSlots[sensorChannel];
-    short int currentSlot = _currentSensorSlot[sensorChannel];
-    int sensorReading = getAbsoluteSensorReading(sensorChannel);
-    _sensorReadings[sensorChannel][currentSlot] = sensorReading;
-    _filledSensorSlots[sensorChannel] =
-                           (filledSlots < WATERINGSYSTEM_MAXSAMPLESLOTS)?(filledSlots+1):(WATERINGSYSTEM_MAXSAMPLESLOTS);
-    _currentSensorSlot[sensorChannel] = (currentSlot + 1) % WATERINGSYSTEM_MAXSAMPLESLOTS;
+  TRACE_SCOPE(TRACE_EVENT_POLLSENSORS, 0);
+  uint8_t sourceCount = _sources.size();
+  int8_t inFlight[WATERINGSYSTEM_MAXSENSORS]; // Global channel converting on each source, or -1 when done
+  uint8_t remaining = _channelCount;
+  memset(inFlight, -1, sizeof(inFlight));
+
+  // A source's channels are contiguous, so start each source on its first channel
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    uint8_t sourceIndex = _channelSource[channel];
+    if (channel == 0 || _channelSource[channel - 1] != sourceIndex) {
+      _sources[sourceIndex]->startConversion(_channelLocal[channel], _settleMicros[channel], _oversampleCount[channel]);
+      inFlight[sourceIndex] = channel;
+    }
+  }
+
+  // Collect completed conversions, moving each source on to its next channel
+  while (remaining > 0) {
+    for (uint8_t sourceIndex = 0; sourceIndex < sourceCount; sourceIndex++) {
+      int8_t channel = inFlight[sourceIndex];
+      if (channel < 0 || !_sources[sourceIndex]->isConversionReady()) {
+        continue;
+      }
+      storeReading(channel, _sources[sourceIndex]->readConversion());
+      remaining--;
+      inFlight[sourceIndex] = -1;
+      uint8_t nextChannel = channel + 1;
+      if (nextChannel < _channelCount && _channelSource[nextChannel] == sourceIndex) {
+        _sources[sourceIndex]->startConversion(_channelLocal[nextChannel], _settleMicros[nextChannel], _oversampleCount[nextChannel]);
+        inFlight[sourceIndex] = nextChannel;
+      }
+    }
+    yield();
+  }
+
+  // Feed the moving averages into the history, which decimates to its own sample period.
+  // Channels not yet read, or whose source can't be read, are left as gaps rather than
+  // recording an empty or stale average.
+  if (_history) {
+    uint32_t nowSecs = millis() / 1000;
+    for (short int sensorChannel = 0; sensorChannel < _channelCount; sensorChannel++) {
+      if (!hasReadings(sensorChannel) || _health[sensorChannel].getStatus() == CHANNEL_HEALTH_FAILED) {
+        continue;
+      }
+      _history->recordSample(sensorChannel, nowSecs, getSensorSimpleMovingAverageReading(sensorChannel));
+    }
+  }
+}
+
+void AnalogueSensorHandler::setHistory(SensorHistory* history) {
+  _history = history;
+}
+
+SensorHistory* AnalogueSensorHandler::getHistory() {
+  return _history;
+}
+
+void AnalogueSensorHandler::setChannelSettings(int channelNumber, unsigned long settleMicros, uint8_t oversampleCount) {
+  _settleMicros[channelNumber] = settleMicros;
+  _oversampleCount[channelNumber] = constrain(oversampleCount, 1, WATERINGSYSTEM_MAXOVERSAMPLE);
+}
+
+void AnalogueSensorHandler::resetChannelSettings() {
+  for (int channel = 0; channel < _channelCount; channel++) {
+    _settleMicros[channel] = _sources[_channelSource[channel]]->getDefaultSettleMicros();
+    _oversampleCount[channel] = 1;
+  }
+}
+
+//
+// Sets the lookup table converting a channel's raw readings to percent, built by
+// ChannelCalibration, or NULL to report raw readings. The handler takes responsibility
+// for destruction of the table. Readings taken in the old units are discarded.
+//
+void AnalogueSensorHandler::setChannelCalibration(int channelNumber, uint8_t* table) {
+  delete[] _calibration[channelNumber];
+  _calibration[channelNumber] = table;
+  _filledSensorSlots[channelNumber] = 0;
+  _currentSensorSlot[channelNumber] = 0;
+}
+
+bool AnalogueSensorHandler::isCalibrated(int channelNumber) {
+  return channelNumber >= 0 && channelNumber < _channelCount && _calibration[channelNumber] != NULL;
+}
+
+// Returns false for a channel currently detected as faulty
+bool AnalogueSensorHandler::isChannelHealthy(int channelNumber) {
+  if (channelNumber < 0 || channelNumber >= _channelCount) {
+    return false;
+  }
+  return _health[channelNumber].isHealthy();
+}
+
+ChannelHealth* AnalogueSensorHandler::getChannelHealth(int channelNumber) {
+  if (channelNumber < 0 || channelNumber >= _channelCount) {
+    return NULL;
+  }
+  return &_health[channelNumber];
+}
+
+// Returns a mask of the channels whose health changed since the last call, clearing it
+uint32_t AnalogueSensorHandler::takeHealthChanges() {
+  uint32_t changes = _healthChanges;
+  _healthChanges = 0;
+  return changes;
+}
+
+//
+// Returns a mask of the channels with new readings since the last call, clearing it, so
+// the sensor groups reading those channels can be told to evaluate
+//
+uint32_t AnalogueSensorHandler::takeUpdatedChannels() {
+  uint32_t updated = _updatedChannels;
+  _updatedChannels = 0;
+  return updated;
+}
+
+// Returns a channel's calibration table, or NULL if it is uncalibrated
+const uint8_t* AnalogueSensorHandler::getChannelCalibration(int channelNumber) {
+  return isCalibrated(channelNumber) ? _calibration[channelNumber] : NULL;
+}
+
+unsigned long AnalogueSensorHandler::getSettleMicros(int channelNumber) {
+  return _settleMicros[channelNumber];
+}
+
+uint8_t AnalogueSensorHandler::getOversampleCount(int channelNumber) {
+  return _oversampleCount[channelNumber];
+}
+
+// Starts calibrating a channel's settle time, returning false if its source has nothing to calibrate
+bool AnalogueSensorHandler::startChannelCalibration(int channelNumber) {
+  if (channelNumber < 0 || channelNumber >= _channelCount) {
+    return false;
+  }
+  return _sources[_channelSource[channelNumber]]->startCalibration(_channelLocal[channelNumber]);
+}
+
+// Runs one step of a started calibration, returning true with the results once it is done
+bool AnalogueSensorHandler::stepChannelCalibration(int channelNumber, unsigned long* settleMicros, uint8_t* oversampleCount) {
+  if (channelNumber < 0 || channelNumber >= _channelCount) {
+    return true;
   }
+  return _sources[_channelSource[channelNumber]]->stepCalibration(settleMicros, oversampleCount);
 }
 
 #endif
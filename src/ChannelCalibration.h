@@ -0,0 +1,77 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+#ifndef __WATERINGSYSTEM_CHANNELCALIBRATION_H__
+#define __WATERINGSYSTEM_CHANNELCALIBRATION_H__
+
+#define WATERINGSYSTEM_CALIBRATION_RANGE 1024     // Raw readings are 0-1023
+#define WATERINGSYSTEM_CALIBRATION_MAXPOINTS 8
+#define WATERINGSYSTEM_CALIBRATION_MAXCOEFFICIENTS 4
+#define WATERINGSYSTEM_CALIBRATION_MAXVALUE 100   // Calibrated readings are percent
+#define WATERINGSYSTEM_CALIBRATION_MAXCHANNELS 4  // Each calibrated channel's table takes 1KB of RAM
+
+//
+// Builds the lookup tables converting a channel's raw readings to calibrated percent
+// (volumetric water content, or how full a tank is). Tables are built once when the
+// configuration is applied, with floating point, so converting a reading as it is
+// sampled is a single array index.
+//
+class ChannelCalibration
+{
+  private:
+    static uint8_t toTableValue(float value);
+
+  public:
+    static void buildPiecewiseLinear(uint8_t* table, const int* raw, const float* value, uint8_t pointCount);
+    static void buildPolynomial(uint8_t* table, const float* coefficients, uint8_t coefficientCount);
+};
+/****************************************/
+
+uint8_t ChannelCalibration::toTableValue(float value) {
+    if (value <= 0) {
+        return 0;
+    }
+    if (value >= WATERINGSYSTEM_CALIBRATION_MAXVALUE) {
+        return WATERINGSYSTEM_CALIBRATION_MAXVALUE;
+    }
+    return (uint8_t)(value + 0.5f);
+}
+
+//
+// Interpolates between points with increasing raw readings. Two points give a two point
+// calibration. Readings outside the points take the value of the nearest point.
+//
+void ChannelCalibration::buildPiecewiseLinear(uint8_t* table, const int* raw, const float* value, uint8_t pointCount) {
+    uint8_t segment = 0;
+    for (int reading = 0; reading < WATERINGSYSTEM_CALIBRATION_RANGE; reading++) {
+        while (segment + 2 < pointCount && reading > raw[segment + 1]) {
+            segment++;
+        }
+        float calibrated;
+        if (reading <= raw[0]) {
+            calibrated = value[0];
+        } else if (reading >= raw[pointCount - 1]) {
+            calibrated = value[pointCount - 1];
+        } else {
+            float fraction = (float)(reading - raw[segment]) / (raw[segment + 1] - raw[segment]);
+            calibrated = value[segment] + fraction * (value[segment + 1] - value[segment]);
+        }
+        table[reading] = toTableValue(calibrated);
+    }
+}
+
+// Evaluates c0 + c1 * raw + c2 * raw^2 ..., clamped to 0-100
+void ChannelCalibration::buildPolynomial(uint8_t* table, const float* coefficients, uint8_t coefficientCount) {
+    for (int reading = 0; reading < WATERINGSYSTEM_CALIBRATION_RANGE; reading++) {
+        float calibrated = 0;
+        for (int8_t i = coefficientCount - 1; i >= 0; i--) {
+            calibrated = calibrated * reading + coefficients[i];
+        }
+        table[reading] = toTableValue(calibrated);
+    }
+}
+
+#endif
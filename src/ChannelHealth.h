@@ -0,0 +1,161 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+#ifndef __WATERINGSYSTEM_CHANNELHEALTH_H__
+#define __WATERINGSYSTEM_CHANNELHEALTH_H__
+
+#define WATERINGSYSTEM_HEALTH_RAILMARGIN 4       // Raw readings this close to 0 or 1023 are at a rail
+#define WATERINGSYSTEM_HEALTH_RAILSAMPLES 6      // Consecutive rail readings before a channel is faulty
+#define WATERINGSYSTEM_HEALTH_STUCKSAMPLES 240   // Consecutive identical readings before a channel is faulty
+#define WATERINGSYSTEM_HEALTH_RECOVERSAMPLES 3   // Consecutive good readings before a faulty channel recovers
+#define WATERINGSYSTEM_HEALTH_WINDOWSAMPLES 120  // Readings in each window of statistics
+
+enum ChannelHealthStatus : uint8_t {
+    CHANNEL_HEALTH_OK = 0,
+    CHANNEL_HEALTH_RAILLOW,  // Reading at 0, e.g. a shorted or disconnected probe
+    CHANNEL_HEALTH_RAILHIGH, // Reading at 1023
+    CHANNEL_HEALTH_STUCK,    // Reading not changing at all, e.g. a corroded probe
+    CHANNEL_HEALTH_FAILED,   // The source couldn't be read, e.g. an ADC not responding on I2C
+    CHANNEL_HEALTH_COUNT
+};
+
+const char* const channelHealthNames[CHANNEL_HEALTH_COUNT] = {
+    "ok", "rail-low", "rail-high", "stuck", "failed"
+};
+
+//
+// Streaming health check for one channel, updated in constant time and space as each
+// raw reading lands. Keeps Welford's running mean and variance, with the minimum and
+// maximum, over a window of readings, and counts consecutive rail and identical readings
+// to detect faulty probes.
+//
+class ChannelHealth
+{
+  private:
+    // Statistics for the current window
+    uint16_t _count;
+    float _mean;
+    float _m2;         // Sum of squared differences from the mean
+    int16_t _min;
+    int16_t _max;
+    // Fault detection
+    int16_t _lastReading;
+    uint16_t _stuckCount;
+    uint16_t _railCount;
+    uint16_t _goodCount;
+    ChannelHealthStatus _status;
+
+  public:
+    ChannelHealth();
+    void reset();
+    bool update(int rawReading);
+    bool recordFailure();
+    ChannelHealthStatus getStatus();
+    bool isHealthy();
+    float getMean();
+    float getStandardDeviation();
+    int getMin();
+    int getMax();
+};
+/****************************************/
+
+ChannelHealth::ChannelHealth() {
+    reset();
+}
+
+void ChannelHealth::reset() {
+    _count = 0;
+    _mean = 0;
+    _m2 = 0;
+    _min = 0;
+    _max = 0;
+    _lastReading = -1;
+    _stuckCount = 0;
+    _railCount = 0;
+    _goodCount = 0;
+    _status = CHANNEL_HEALTH_OK;
+}
+
+//
+// Adds a raw reading, returning true if the channel's status changed
+//
+bool ChannelHealth::update(int rawReading) {
+    if (_count >= WATERINGSYSTEM_HEALTH_WINDOWSAMPLES) {
+        _count = 0;
+        _mean = 0;
+        _m2 = 0;
+    }
+    _count++;
+    float delta = rawReading - _mean;
+    _mean += delta / _count;
+    _m2 += delta * (rawReading - _mean);
+    if (_count == 1 || rawReading < _min) {
+        _min = rawReading;
+    }
+    if (_count == 1 || rawReading > _max) {
+        _max = rawReading;
+    }
+
+    bool atRail = rawReading <= WATERINGSYSTEM_HEALTH_RAILMARGIN || rawReading >= 1023 - WATERINGSYSTEM_HEALTH_RAILMARGIN;
+    bool unchanged = rawReading == _lastReading;
+    _lastReading = rawReading;
+    _railCount = atRail ? min(_railCount + 1, 0xFFFF) : 0;
+    _stuckCount = unchanged ? min(_stuckCount + 1, 0xFFFF) : 0;
+    _goodCount = (atRail || unchanged) ? 0 : min(_goodCount + 1, 0xFFFF);
+
+    ChannelHealthStatus status = _status;
+    if (_railCount >= WATERINGSYSTEM_HEALTH_RAILSAMPLES) {
+        status = rawReading <= WATERINGSYSTEM_HEALTH_RAILMARGIN ? CHANNEL_HEALTH_RAILLOW : CHANNEL_HEALTH_RAILHIGH;
+    } else if (_stuckCount >= WATERINGSYSTEM_HEALTH_STUCKSAMPLES) {
+        status = CHANNEL_HEALTH_STUCK;
+    } else if (_goodCount >= WATERINGSYSTEM_HEALTH_RECOVERSAMPLES) {
+        status = CHANNEL_HEALTH_OK;
+    }
+    if (status == _status) {
+        return false;
+    }
+    _status = status;
+    return true;
+}
+
+//
+// Records a reading that failed, which makes the channel faulty straight away, returning
+// true if the channel's status changed. It recovers after enough good readings.
+//
+bool ChannelHealth::recordFailure() {
+    _goodCount = 0;
+    if (_status == CHANNEL_HEALTH_FAILED) {
+        return false;
+    }
+    _status = CHANNEL_HEALTH_FAILED;
+    return true;
+}
+
+ChannelHealthStatus ChannelHealth::getStatus() {
+    return _status;
+}
+
+bool ChannelHealth::isHealthy() {
+    return _status == CHANNEL_HEALTH_OK;
+}
+
+float ChannelHealth::getMean() {
+    return _mean;
+}
+
+float ChannelHealth::getStandardDeviation() {
+    return _count > 1 ? sqrt(_m2 / (_count - 1)) : 0;
+}
+
+int ChannelHealth::getMin() {
+    return _min;
+}
+
+int ChannelHealth::getMax() {
+    return _max;
+}
+
+#endif
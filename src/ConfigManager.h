@@ -6,6 +6,7 @@
 #include <uri/UriRegex.h>
 #include <ArduinoJson.h>
 #include "LittleFS.h"
+#include "JsonArena.h"
 #include "SensorGroup.h"
 #include "IrrigationTimer.h"
 #include "IrrigationService.h"
@@ -13,6 +14,16 @@
 #include "LoggerInterfaceMqtt.h"
 #include "LoggerInterfaceLoki.h"
 #include "LoggerInterfaceSerial.h"
+#include "SensorSourceMux.h"
+#include "SensorSourceAds1115.h"
+#include "SensorSourceSimulated.h"
+#include "ActuatorBackendGpio.h"
+#include "ActuatorBackend595.h"
+#include "ActuatorBackendPcf8574.h"
+#include "ActuatorBackendSimulated.h"
+#include "StaticConfig.h"
+#include "SerialConsole.h"
+#include <new>
 
 #ifndef __WATERINGSYSTEM_CONFIGMANAGER_H__
 #define __WATERINGSYSTEM_CONFIGMANAGER_H__
@@ -20,6 +31,10 @@
 #define LOKI_DEFAULT_PORT 3100
 #define MQTT_DEFAULT_PORT 1883
 #define LOKI_PATH "/loki/api/v1/push"
+#define WATERINGSYSTEM_MAXCOMMANDS 32          // Operations accepted in one POST /commands
+#define WATERINGSYSTEM_MAXCOMMANDPUMPSECS 3600 // Longest pump period a command can request
+#define WATERINGSYSTEM_CONFIG_VERSIONS 3        // Previous configurations kept for rollback
+#define WATERINGSYSTEM_CONFIG_HEALTHSECS 300    // Time a new configuration must run before it is trusted
 
 #define CHECK_FOUND(obj, key, friendly) {if (!obj.containsKey(key)) {return String("Failed to find field ") + String(friendly) + String(" in config");}}
 #define CHECK_ARRAY_FOUND(array, friendly) {if (!array) {return String("Failed to find field ") + String(friendly) + String(" in config");}}
@@ -32,21 +47,77 @@ class ConfigManager
 {
     private:
         const char* irrigationConfigFile = "/irrigationconfig.json";
+        const char* configTempFile = "/irrigationconfig.tmp";       // New configuration while it is written
+        const char* configPendingFile = "/irrigationconfig.pending"; // Present during a health window
         const char* defaultJsonStr = "{\"instance\": \"MyIrrigationServer\", \"loggers\": [{\"type\": \"serial\"}]}";
         ESP8266WebServer* _configServer;
         IrrigationService* _irrigationService; // The service we'll configure, set in constructor
         AnalogueSensorHandler* _analogueSensorHandler;
+        uint32_t _configHash = 0;        // FNV-1a of the active configuration document
+        bool _configHashValid = false;
+        bool _healthWindowActive = false;
+        unsigned long _healthWindowStartMillis = 0;
+        bool _reloadPending = false;
+        // Settle time calibration, run a step at a time from the scheduler
+        const char* _calibrationState = "idle";
+        int8_t _calibrationChannel = -1;    // Channel being calibrated, -1 when not running
+        bool _calibrationPersist = false;
+        String _calibrationError;
+        uint32_t _calibratedChannels = 0;   // Channels with results from the last calibration
+        unsigned long _calibrationSettleMicros[WATERINGSYSTEM_MAXSENSORS];
+        uint8_t _calibrationOversample[WATERINGSYSTEM_MAXSENSORS];
+        void startCalibrationFrom(int channel);
+        void sensorCalibrationStep();
+        void persistSensorCalibration();
+        void addCalibrationResults(JsonArray channelsJson);
+        static uint32_t hashConfig(const char* json, size_t length);
+        void setConfigHash(const char* json, size_t length);
+        String getConfigETag();
+        String configVersionFile(uint8_t version);
+        bool archiveConfiguration();
+        void applyNewConfiguration(JsonDocument& configDoc);
+        void startHealthWindow();
+        void endHealthWindow();
+        void checkHealthWindow();
+#ifdef WATERINGSYSTEM_STATIC_CONFIG
+        // Storage for the statically configured sensor groups, constructed on first use
+        alignas(SensorGroup) uint8_t _staticGroupStorage[staticGroups.size() ? staticGroups.size() : 1][sizeof(SensorGroup)];
+        bool _staticGroupsConstructed = false;
+        void applyStaticConfiguration();
+#endif
 
     public:
         ConfigManager(ESP8266WebServer *server, IrrigationService *irrigationService, AnalogueSensorHandler* analogueSensorHandler);
+        void startServer();
         void handleClient();
         void handleGet();
+        void handleGetVersion();
         void handlePost();
         void handleDelete();
+        void handleRollback();
         void handleSensorGroupTrigger();
+        void handleCommands();
+        void handleHistory();
+        void handleHeapStats();
+        void handleCounters();
+        void handleGetRecording();
+        void handleDeleteRecording();
+        void handleTrace();
+        void handleSensorCalibration();
+        void handleGetSensorCalibration();
+        void recoverConfiguration();
         void loadConfiguration();
+        bool rollbackConfiguration();
         void writeDefaultConfiguration();
+        bool writeConfiguration(const String& jsonString, bool* unchanged = NULL);
         String processJsonConfig(JsonDocument configDoc, bool applyConfig);
+        String processSensorSourcesConfig(JsonArray sourcesJson, bool applyConfig, uint8_t* channelCount);
+        String processLoggerFilterConfig(JsonVariant filterJson, LoggerFilter* filter);
+        String processLoggerRollupConfig(JsonVariant rollupJson, LoggerInterface* interface);
+        String processCalibrationConfig(JsonVariant calibrationJson, uint8_t* table);
+        String processCommand(JsonObject commandJson, bool applyCommand, const int* readings, JsonObject resultJson);
+        String processActuatorConfig(JsonVariant actuatorJson, bool applyConfig, uint8_t* outputCount, std::vector<int>* gpioPins);
+        static bool parsePinId(String pin, int* pinId);
 }; 
 
 
@@ -54,7 +125,7 @@ ConfigManager::ConfigManager(ESP8266WebServer *server,
                              IrrigationService *irrigationService,
                              AnalogueSensorHandler* analogueSensorHandler) {
     if(!LittleFS.begin()){
-        Serial.println("An Error has occurred while mounting LittleFS");
+        serialConsole.println("An Error has occurred while mounting LittleFS");
     }
 
     _irrigationService = irrigationService;
@@ -63,59 +134,209 @@ ConfigManager::ConfigManager(ESP8266WebServer *server,
     _configServer->on("/config",HTTP_GET,[this]() {
         this->handleGet();
     });
+    _configServer->on("/config/version",HTTP_GET,[this]() {
+        this->handleGetVersion();
+    });
     _configServer->on("/config",HTTP_POST,[this]() {
         this->handlePost();
     });
     _configServer->on("/config",HTTP_DELETE,[this]() {
         this->handleDelete();
     });
+    _configServer->on("/config/rollback",HTTP_POST,[this]() {
+        this->handleRollback();
+    });
     _configServer->on(UriRegex("/sensorgroup/(.+)/pump"),HTTP_POST,[this]() {
         this->handleSensorGroupTrigger();
     });
+    _configServer->on("/commands",HTTP_POST,[this]() {
+        this->handleCommands();
+    });
+    _configServer->on("/history",HTTP_GET,[this]() {
+        this->handleHistory();
+    });
+    _configServer->on("/heap",HTTP_GET,[this]() {
+        this->handleHeapStats();
+    });
+    _configServer->on("/trace",HTTP_GET,[this]() {
+        this->handleTrace();
+    });
+    _configServer->on("/counters",HTTP_GET,[this]() {
+        this->handleCounters();
+    });
+    _configServer->on("/recording",HTTP_GET,[this]() {
+        this->handleGetRecording();
+    });
+    _configServer->on("/recording",HTTP_DELETE,[this]() {
+        this->handleDeleteRecording();
+    });
+    // Request headers are only kept if asked for
+    static const char* collectedHeaders[] = {"If-None-Match"};
+    _configServer->collectHeaders(collectedHeaders, 1);
+    _configServer->on("/sensors/calibrate",HTTP_POST,[this]() {
+        this->handleSensorCalibration();
+    });
+    _configServer->on("/sensors/calibrate",HTTP_GET,[this]() {
+        this->handleGetSensorCalibration();
+    });
+    _irrigationService->getScheduler()->addTask("calibration", TASK_PRIORITY_SENSORS, 0, [this]() {
+        this->sensorCalibrationStep();
+        return false;
+    });
+}
+
+//
+// Starts serving configuration requests, once the network is up
+//
+void ConfigManager::startServer() {
     _configServer->begin();
 }
 
+//
+// Completes or undoes configuration file changes interrupted by a reset, and rolls back
+// a configuration that was still in its health window if the reset was a crash or the
+// watchdog. A configuration interrupted by a power cut, the reset button or a restart
+// is trusted. Called once at boot, before the configuration is loaded.
+//
+void ConfigManager::recoverConfiguration() {
+    // The temporary file only replaces the configuration once it is complete, so if the
+    // configuration is missing, the temporary file is the complete new one
+    if (LittleFS.exists(configTempFile)) {
+        if (LittleFS.exists(irrigationConfigFile)) {
+            LittleFS.remove(configTempFile);
+        } else {
+            LittleFS.rename(configTempFile, irrigationConfigFile);
+        }
+    }
+    if (LittleFS.exists(configPendingFile)) {
+        uint32_t reason = ESP.getResetInfoPtr()->reason;
+        if (reason != REASON_WDT_RST && reason != REASON_EXCEPTION_RST && reason != REASON_SOFT_WDT_RST) {
+            endHealthWindow();
+            return;
+        }
+        serialConsole.println("Crashed during the new configuration's health window, rolling back");
+        if (!rollbackConfiguration()) {
+            endHealthWindow();
+        }
+    }
+}
+
 //
 // Loads the configuration stored on LitteFS storage, configuring the IrrigationService.
 // If no configuration exists, it creates a default without any sensor groups setup.
 //
 void ConfigManager::loadConfiguration() {
-    JsonDocument jsonData;
+    HEAP_SCOPE(HEAP_TAG_CONFIG);
+#ifdef WATERINGSYSTEM_STATIC_CONFIG
+    if (!LittleFS.exists(irrigationConfigFile)) {
+        serialConsole.println("No configuration override stored, using static configuration");
+        applyStaticConfiguration();
+        _configHash = WATERINGSYSTEM_STATIC_CONFIGHASH;
+        _configHashValid = true;
+        return;
+    }
+#endif
+    JsonDocument jsonData(&configJsonArena);
     File file = LittleFS.open(irrigationConfigFile,"r");
 
     if (!file){
-        Serial.println("Failed to open config file for reading");
+        serialConsole.println("Failed to open config file for reading");
         writeDefaultConfiguration();
         file = LittleFS.open(irrigationConfigFile,"r");
     }
     // Check we have a file handle.
     if (!file) {
-        Serial.println("Failed to read or prepare default configuration file");
+        serialConsole.println("Failed to read or prepare default configuration file");
+        _configHashValid = false;
         return;
     }
     String configContents("");
     while (file.available()) {
         configContents.concat(file.readString());
     }
+    setConfigHash(configContents.c_str(), configContents.length());
     DeserializationError error = deserializeJson(jsonData, configContents);
     if (error) {
-        Serial.print("deserializeJson() failed during configuration load: ");
-        Serial.println(error.f_str());
+        serialConsole.println(String("deserializeJson() failed during configuration load: ") + error.c_str());
     } else {
         processJsonConfig(jsonData, true);
     }
 }
 
+#ifdef WATERINGSYSTEM_STATIC_CONFIG
+//
+// Applies the configuration compiled in from StaticConfigData.h. Sensor groups are
+// constructed in place the first time, and re-registered if a runtime override is
+// later removed.
+//
+void ConfigManager::applyStaticConfiguration() {
+    _irrigationService->removeSensorGroups();
+    _irrigationService->getLogger()->removeLoggerInterfaces();
+    for (size_t i = 0; i < staticLoggers.size(); i++) {
+        const StaticLoggerConfig& loggerConfig = staticLoggers[i];
+        LoggerInterface* interface;
+        if (loggerConfig.type == STATIC_LOGGER_LOKI) {
+            interface = new LoggerInterfaceLoki(WATERINGSYSTEM_STATIC_INSTANCE,
+                                                loggerConfig.port ? loggerConfig.port : LOKI_DEFAULT_PORT,
+                                                loggerConfig.server,
+                                                LOKI_PATH);
+        } else if (loggerConfig.type == STATIC_LOGGER_MQTT) {
+            interface = new LoggerInterfaceMqtt(WATERINGSYSTEM_STATIC_INSTANCE,
+                                                loggerConfig.server,
+                                                loggerConfig.port ? loggerConfig.port : MQTT_DEFAULT_PORT,
+                                                loggerConfig.topicPrefix);
+        } else {
+            interface = new LoggerInterfaceSerial(WATERINGSYSTEM_STATIC_INSTANCE);
+        }
+        _irrigationService->getLogger()->addLoggerInterface(interface);
+    }
+
+    if (_staticGroupsConstructed) {
+        // Restore the defaults a runtime override may have replaced
+        _analogueSensorHandler->useDefaultSensorSource();
+        _irrigationService->getActuatorOutputs()->setBackend(new ActuatorBackendGpio({D0, D1, D2, D3, D4}), false);
+    }
+    if (_analogueSensorHandler->getHistory()) {
+        _analogueSensorHandler->getHistory()->configure(WATERINGSYSTEM_HISTORY_DEFAULTSAMPLESECS, false);
+    }
+    if (_irrigationService->getRecorder()) {
+        _irrigationService->getRecorder()->configure(false, WATERINGSYSTEM_RECORDING_DEFAULTSAMPLESECS, WATERINGSYSTEM_RECORDING_DEFAULTMAXBYTES);
+    }
+
+    for (size_t i = 0; i < staticGroups.size(); i++) {
+        const StaticGroupConfig& groupConfig = staticGroups[i];
+        SensorGroup* group = reinterpret_cast<SensorGroup*>(_staticGroupStorage[i]);
+        if (!_staticGroupsConstructed) {
+            new (group) SensorGroup(_irrigationService->getLogger(),
+                                    _analogueSensorHandler,
+                                    _irrigationService->getActuatorOutputs(),
+                                    groupConfig.name,
+                                    groupConfig.triggerMode,
+                                    groupConfig.waterSensorChannel,
+                                    groupConfig.moistureSensorChannelMask,
+                                    groupConfig.pumpOutputMask,
+                                    groupConfig.minMoisture,
+                                    groupConfig.pumpSecs,
+                                    groupConfig.waterCheckPeriodMs,
+                                    groupConfig.pumpCheckPeriodMs,
+                                    groupConfig.moistureCheckPeriodMs);
+        }
+        _irrigationService->registerStaticSensorGroup(group);
+    }
+    _staticGroupsConstructed = true;
+}
+#endif
+
 //
 // Writes a default configuration to LittleFS storage
 //
 void ConfigManager::writeDefaultConfiguration() {
     File file = LittleFS.open(irrigationConfigFile,"w");
     if (!file) {
-        Serial.println("Failed to open config file for writing");
+        serialConsole.println("Failed to open config file for writing");
     } else {
         if (!file.write(defaultJsonStr,strlen(defaultJsonStr))) {
-            Serial.println("Failed to write default configuration file");
+            serialConsole.println("Failed to write default configuration file");
             return;         
         }
         file.close();
@@ -123,14 +344,186 @@ void ConfigManager::writeDefaultConfiguration() {
     return;
 }
 
+//
+// Writes a configuration document to LittleFS storage, returning true on success. A
+// document the same as the active configuration isn't written, setting unchanged.
+// Otherwise the document is written to a temporary file, the active configuration
+// becomes the newest previous version, and the temporary file is renamed in its place,
+// so a reset at any point leaves a complete configuration. The configuration hash is
+// updated to match.
+//
+bool ConfigManager::writeConfiguration(const String& jsonString, bool* unchanged) {
+    if (unchanged) {
+        *unchanged = false;
+    }
+    if (_configHashValid && hashConfig(jsonString.c_str(), jsonString.length()) == _configHash &&
+        LittleFS.exists(irrigationConfigFile)) {
+        if (unchanged) {
+            *unchanged = true;
+        }
+        return true;
+    }
+    File file = LittleFS.open(configTempFile,"w");
+    if (!file) {
+        serialConsole.println("Failed to open config file for writing");
+        return false;
+    }
+    bool success = file.write(jsonString.c_str(),jsonString.length()) == jsonString.length();
+    file.close();
+    if (!success) {
+        LittleFS.remove(configTempFile);
+        return false;
+    }
+    archiveConfiguration();
+    if (!LittleFS.rename(configTempFile, irrigationConfigFile)) {
+        _configHashValid = false;
+        return false;
+    }
+    setConfigHash(jsonString.c_str(), jsonString.length());
+    return true;
+}
+
+String ConfigManager::configVersionFile(uint8_t version) {
+    return String("/irrigationconfig.") + version + ".json";
+}
+
+//
+// Moves the active configuration file to be the newest previous version, dropping the
+// oldest, returning false if there is no configuration file
+//
+bool ConfigManager::archiveConfiguration() {
+    if (!LittleFS.exists(irrigationConfigFile)) {
+        return false;
+    }
+    LittleFS.remove(configVersionFile(WATERINGSYSTEM_CONFIG_VERSIONS));
+    for (uint8_t version = WATERINGSYSTEM_CONFIG_VERSIONS - 1; version >= 1; version--) {
+        if (LittleFS.exists(configVersionFile(version))) {
+            LittleFS.rename(configVersionFile(version), configVersionFile(version + 1));
+        }
+    }
+    return LittleFS.rename(irrigationConfigFile, configVersionFile(1));
+}
+
+//
+// Replaces the configuration file with the newest previous version, returning false if
+// there isn't one. The caller loads the restored configuration. The previous version
+// goes via the temporary file, so recoverConfiguration() completes the swap if a
+// reset interrupts it.
+//
+bool ConfigManager::rollbackConfiguration() {
+    if (!LittleFS.exists(configVersionFile(1))) {
+        return false;
+    }
+    endHealthWindow();
+    LittleFS.remove(configTempFile);
+    LittleFS.rename(configVersionFile(1), configTempFile);
+    LittleFS.remove(irrigationConfigFile);
+    LittleFS.rename(configTempFile, irrigationConfigFile);
+    for (uint8_t version = 2; version <= WATERINGSYSTEM_CONFIG_VERSIONS; version++) {
+        if (LittleFS.exists(configVersionFile(version))) {
+            LittleFS.rename(configVersionFile(version), configVersionFile(version - 1));
+        }
+    }
+    _configHashValid = false;
+    return true;
+}
+
+//
+// Applies a newly written configuration. If it fails to apply, the previous version is
+// restored straight away. Otherwise it must run for WATERINGSYSTEM_CONFIG_HEALTHSECS,
+// and a reset before then, such as from a crash or the watchdog, rolls it back at boot.
+//
+void ConfigManager::applyNewConfiguration(JsonDocument& configDoc) {
+    String error = processJsonConfig(configDoc, true);
+    if (error.isEmpty()) {
+        startHealthWindow();
+    } else {
+        serialConsole.println("Failed to apply new configuration, rolling back: " + error);
+        if (rollbackConfiguration()) {
+            loadConfiguration();
+        }
+    }
+}
+
+void ConfigManager::startHealthWindow() {
+    File marker = LittleFS.open(configPendingFile, "w");
+    if (marker) {
+        marker.close();
+    }
+    _healthWindowStartMillis = millis();
+    _healthWindowActive = true;
+}
+
+void ConfigManager::endHealthWindow() {
+    LittleFS.remove(configPendingFile);
+    _healthWindowActive = false;
+}
+
+// Trusts the new configuration once it has run through its health window
+void ConfigManager::checkHealthWindow() {
+    if (_healthWindowActive && millis() - _healthWindowStartMillis >= WATERINGSYSTEM_CONFIG_HEALTHSECS * 1000UL) {
+        serialConsole.println("New configuration passed its health window");
+        endHealthWindow();
+    }
+}
+
 void ConfigManager::handleClient() {
+    HEAP_SCOPE(HEAP_TAG_HTTP);
+    TRACE_SCOPE(TRACE_EVENT_HTTP, 0);
     _configServer->handleClient();
+    // Reloads are run after the request that asked for them has been answered
+    if (_reloadPending) {
+        _reloadPending = false;
+        loadConfiguration();
+    }
+    checkHealthWindow();
 }
 
 //
-// Callback handler for retrieval of the configuration via the web service
+// Records the hash of the active configuration document, as stored and served
+//
+void ConfigManager::setConfigHash(const char* json, size_t length) {
+    _configHash = hashConfig(json, length);
+    _configHashValid = true;
+}
+
+// FNV-1a of a configuration document
+uint32_t ConfigManager::hashConfig(const char* json, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)json[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the quoted entity tag for the active configuration
+String ConfigManager::getConfigETag() {
+    char etag[11];
+    snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)_configHash);
+    return String(etag);
+}
+
+//
+// Callback handler for retrieval of the configuration via the web service. Responses
+// carry an ETag, and a request with a matching If-None-Match gets a 304 without
+// reading the file.
 //
 void ConfigManager::handleGet() {
+    HEAP_SCOPE(HEAP_TAG_CONFIG);
+    if (_configHashValid) {
+        String etag = getConfigETag();
+        _configServer->sendHeader("ETag", etag);
+        if (_configServer->header("If-None-Match").equals(etag)) {
+            _configServer->send(304);
+            return;
+        }
+    }
+#ifdef WATERINGSYSTEM_STATIC_CONFIG
+    if (!LittleFS.exists(irrigationConfigFile)) {
+        _configServer->send_P(200, "application/json", staticConfigJson);
+        return;
+    }
+#endif
     File file = LittleFS.open(irrigationConfigFile,"r");
 
     if (!file || file.isDirectory()){
@@ -145,20 +538,35 @@ void ConfigManager::handleGet() {
     }
 }
 
+//
+// Callback handler returning just the hash of the active configuration, for pollers
+// checking for drift
+//
+void ConfigManager::handleGetVersion() {
+    if (!_configHashValid) {
+        _configServer->send(503, "text/plain", "No configuration loaded");
+        return;
+    }
+    String etag = getConfigETag();
+    _configServer->sendHeader("ETag", etag);
+    _configServer->send(200, "application/json", "{\"version\":" + etag + "}");
+}
+
 //
 // Callback handler for receiving new Json configuration via a web server POST message.
 // Validates, persists to LittleFS, and then reconfigures the running IrrigationService.
+// A configuration the same as the active one isn't written again.
 //
 void ConfigManager::handlePost() {
-    JsonDocument jsonData;
+    HEAP_SCOPE(HEAP_TAG_CONFIG);
+    JsonDocument jsonData(&configJsonArena);
     // Deserialize the JSON document
     String jsonString = _configServer->arg("plain");
     DeserializationError error = deserializeJson(jsonData, jsonString);
 
     // Test if parsing succeeds.
     if (error) {
-        Serial.print("deserializeJson() failed: ");
-        Serial.println(error.f_str());
+        serialConsole.println(String("deserializeJson() failed: ") + error.c_str());
         _configServer->send(500,"application/json",String("Error parsing JSON configuration: ") + String(jsonString));
     } else {
         // Try and parse the config without applying it
@@ -167,34 +575,59 @@ void ConfigManager::handlePost() {
             _configServer->send(500,"application/json","Invalid configuration JSON document: " + error);
         } else {
             // Parse successful, so write to persistent storage
-            File file = LittleFS.open(irrigationConfigFile,"w");
-            if (!file) {
-                Serial.println("Failed to open config file for writing");
-                _configServer->send(500,"application/json","Failed to open config file for writing");
+            bool unchanged = false;
+            bool written = writeConfiguration(jsonString, &unchanged);
+            if (written) {
+                _configServer->sendHeader("ETag", getConfigETag());
+                _configServer->send(200,"application/json",unchanged ? "Config file unchanged" : "Config file writen");
             } else {
-                if (file.write(jsonString.c_str(),jsonString.length())) {
-                    _configServer->send(200,"application/json","Config file writen");
-                } else {
-                    _configServer->send(500,"application/json","Config file write failed");            
-                }
-                file.close();
+                _configServer->send(500,"application/json","Config file write failed");
+            }
+            // Now apply the config to the running application, unless it's already running
+            if (written && !unchanged) {
+                applyNewConfiguration(jsonData);
+            } else if (!written) {
+                processJsonConfig(jsonData, true);
             }
-            // Now apply the config to the running application
-            String error = processJsonConfig(jsonData, true);
         }
     }
     return;
 }
 
+//
+// Callback handler removing the configuration. The removed configuration is kept as the
+// newest previous version, so it can be rolled back to. The default configuration is
+// loaded after the response is sent.
+//
 void ConfigManager::handleDelete() {
-    if (LittleFS.remove(irrigationConfigFile)) {
+    HEAP_SCOPE(HEAP_TAG_CONFIG);
+    endHealthWindow();
+    if (archiveConfiguration()) {
         _configServer->send(200,"application/json","Config file removed. Default configuration now used.");
     } else {
         _configServer->send(500,"application/json","Failed to delete configuration file");   
     }
-    loadConfiguration();
+    _configHashValid = false;
+    _reloadPending = true;
 } 
 
+//
+// Callback handler restoring the previous configuration version, for when a new
+// configuration doesn't do what was intended
+//
+void ConfigManager::handleRollback() {
+    HEAP_SCOPE(HEAP_TAG_CONFIG);
+    if (!rollbackConfiguration()) {
+        _configServer->send(404,"application/json","No previous configuration to roll back to");
+        return;
+    }
+    loadConfiguration();
+    if (_configHashValid) {
+        _configServer->sendHeader("ETag", getConfigETag());
+    }
+    _configServer->send(200,"application/json","Configuration rolled back");
+}
+
 //
 // Code to parse out configuration from a Json document.
 // Optionally writes this configuration to runtime service.
@@ -204,6 +637,7 @@ void ConfigManager::handleDelete() {
 // error code.
 //
 String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig) {
+    HEAP_SCOPE(HEAP_TAG_CONFIG);
     JsonString instanceName = configDoc["instance"];
     JsonArray groupsJson = configDoc["groups"];
     JsonArray loggersJson = configDoc["loggers"];
@@ -212,6 +646,12 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
     if (applyConfig) {
 //        _irrigationService->setInstanceName(String(instanceName.c_str()));
         _irrigationService->removeSensorGroups();
+        // The channels being calibrated may not survive the new sensor sources
+        if (_calibrationChannel >= 0) {
+            _calibrationChannel = -1;
+            _calibrationState = "failed";
+            _calibrationError = "Cancelled by a new configuration";
+        }
     }
 
     if (applyConfig) {
@@ -221,6 +661,19 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
         for (JsonVariant loggerJson : loggersJson) {
             CHECK_FOUND(loggerJson,"type","loggers.type");
             String typeStr = loggerJson["type"].as<String>();
+            if (loggerJson.containsKey("filter")) {
+                String error = processLoggerFilterConfig(loggerJson["filter"], NULL);
+                if (!error.isEmpty()) {
+                    return error;
+                }
+            }
+            if (loggerJson.containsKey("rollup")) {
+                String error = processLoggerRollupConfig(loggerJson["rollup"], NULL);
+                if (!error.isEmpty()) {
+                    return error;
+                }
+            }
+            LoggerInterface* interface = NULL;
             if (typeStr.equals("loki")) {
                 // Process loki config
                 int lokiPort = LOKI_DEFAULT_PORT;
@@ -229,13 +682,22 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
                 }
                 CHECK_FOUND(loggerJson,"server","loggers.server");
                 String lokiServer = loggerJson["server"];
+                uint8_t encoding = LOKI_ENCODING_JSON;
+                if (loggerJson.containsKey("encoding")) {
+                    String encodingStr = loggerJson["encoding"].as<String>();
+                    if (encodingStr.equals("protobuf")) {
+                        encoding = LOKI_ENCODING_PROTOBUF;
+                    } else if (!encodingStr.equals("json")) {
+                        return String("Invalid loki encoding ") + encodingStr;
+                    }
+                }
                 if (applyConfig) {
 //                    _irrigationService->getLogger()->setLokiConfig(lokiPort, lokiServer, LOKI_PATH);
-                    LoggerInterface* interface = new LoggerInterfaceLoki(instanceName.c_str(),
-                                                                         lokiPort,
-                                                                         lokiServer.c_str(),
-                                                                         LOKI_PATH);
-                    _irrigationService->getLogger()->addLoggerInterface(interface);
+                    interface = new LoggerInterfaceLoki(instanceName.c_str(),
+                                                        lokiPort,
+                                                        lokiServer.c_str(),
+                                                        LOKI_PATH,
+                                                        encoding);
                 }
             } else if (typeStr.equals("mqtt")) {
                 // Process mqtt config
@@ -247,26 +709,175 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
                 CHECK_FOUND(loggerJson,"topicPrefix","loggers.topicPrefix");
                 String mqttServer = loggerJson["server"];
                 String topicPrefix = loggerJson["topicPrefix"];
+                if (topicPrefix.length() >= WATERINGSYSTEM_MQTT_MAXTOPIC) {
+                    return String("Mqtt topicPrefix too long");
+                }
+                uint8_t encoding = MQTT_ENCODING_JSON;
+                if (loggerJson.containsKey("encoding")) {
+                    String encodingStr = loggerJson["encoding"].as<String>();
+                    if (encodingStr.equals("msgpack")) {
+                        encoding = MQTT_ENCODING_MSGPACK;
+                    } else if (encodingStr.equals("struct")) {
+                        encoding = MQTT_ENCODING_STRUCT;
+                    } else if (!encodingStr.equals("json")) {
+                        return String("Invalid mqtt encoding ") + encodingStr;
+                    }
+                }
                 if (applyConfig) {
-                    LoggerInterface* interface = new LoggerInterfaceMqtt(instanceName.c_str(),
-                                                                         mqttServer.c_str(),
-                                                                         mqttPort,
-                                                                         topicPrefix);
-                    _irrigationService->getLogger()->addLoggerInterface(interface);
+                    interface = new LoggerInterfaceMqtt(instanceName.c_str(),
+                                                        mqttServer.c_str(),
+                                                        mqttPort,
+                                                        topicPrefix,
+                                                        encoding);
                 }
             } else if (typeStr.equals("serial")) {
+                uint8_t format = SERIAL_FORMAT_JSON;
+                if (loggerJson.containsKey("format")) {
+                    String formatStr = loggerJson["format"].as<String>();
+                    if (formatStr.equals("compact")) {
+                        format = SERIAL_FORMAT_COMPACT;
+                    } else if (!formatStr.equals("json")) {
+                        return String("Invalid serial format ") + formatStr;
+                    }
+                }
+                uint8_t overflow = SERIAL_OVERFLOW_DROPNEWEST;
+                if (loggerJson.containsKey("overflow")) {
+                    String overflowStr = loggerJson["overflow"].as<String>();
+                    if (overflowStr.equals("drop-oldest")) {
+                        overflow = SERIAL_OVERFLOW_DROPOLDEST;
+                    } else if (!overflowStr.equals("drop-newest")) {
+                        return String("Invalid serial overflow policy ") + overflowStr;
+                    }
+                }
                 if (applyConfig) {
-                    LoggerInterface* interface = new LoggerInterfaceSerial(instanceName.c_str());
-                    _irrigationService->getLogger()->addLoggerInterface(interface);
+                    interface = new LoggerInterfaceSerial(instanceName.c_str(), format, overflow);
                 }
             } else {
                 String error("Invalid logger type ");
                 error += typeStr;
                 return error;
             }
+            if (interface) {
+                if (loggerJson.containsKey("filter")) {
+                    processLoggerFilterConfig(loggerJson["filter"], interface->getFilter());
+                }
+                if (loggerJson.containsKey("rollup")) {
+                    processLoggerRollupConfig(loggerJson["rollup"], interface);
+                }
+                _irrigationService->getLogger()->addLoggerInterface(interface);
+            }
+        }
+    }
+
+    // Sensor sources determine the channels available to everything that follows
+    uint8_t channelCount = WATERINGSYSTEM_NUMBEROFSENSORS;
+    if (configDoc.containsKey("sensorSources")) {
+        String error = processSensorSourcesConfig(configDoc["sensorSources"], applyConfig, &channelCount);
+        if (!error.isEmpty()) {
+            return error;
+        }
+    } else if (applyConfig) {
+        _analogueSensorHandler->useDefaultSensorSource();
+    }
+
+    if (configDoc.containsKey("sensorChannels")) {
+        uint8_t calibratedChannels = 0;
+        for (JsonVariant channelJson : configDoc["sensorChannels"].as<JsonArray>()) {
+            CHECK_FOUND(channelJson,"channel","sensorChannels.channel");
+            int channel = channelJson["channel"].as<int>();
+            if (channel < 0 || channel >= channelCount) {
+                return String("Invalid sensor channel identifier ") + channelJson["channel"].as<String>();
+            }
+            int oversample = 1;
+            if (channelJson.containsKey("oversample")) {
+                oversample = channelJson["oversample"].as<int>();
+            }
+            if (oversample < 1 || oversample > WATERINGSYSTEM_MAXOVERSAMPLE) {
+                return String("Invalid oversample count ") + channelJson["oversample"].as<String>();
+            }
+            if (channelJson.containsKey("calibration")) {
+                if (++calibratedChannels > WATERINGSYSTEM_CALIBRATION_MAXCHANNELS) {
+                    return String("Too many calibrated sensor channels, the most is ") + WATERINGSYSTEM_CALIBRATION_MAXCHANNELS;
+                }
+                uint8_t* table = applyConfig ? new uint8_t[WATERINGSYSTEM_CALIBRATION_RANGE] : NULL;
+                String error = processCalibrationConfig(channelJson["calibration"], table);
+                if (!error.isEmpty()) {
+                    delete[] table;
+                    return error;
+                }
+                if (applyConfig) {
+                    _analogueSensorHandler->setChannelCalibration(channel, table);
+                }
+            }
+            if (applyConfig) {
+                // Channels without a settle time keep the default for their source
+                unsigned long settleMicros = _analogueSensorHandler->getSettleMicros(channel);
+                if (channelJson.containsKey("settleMicros")) {
+                    settleMicros = channelJson["settleMicros"].as<unsigned long>();
+                }
+                _analogueSensorHandler->setChannelSettings(channel, settleMicros, oversample);
+            }
         }
     }
 
+    unsigned long historySampleSecs = WATERINGSYSTEM_HISTORY_DEFAULTSAMPLESECS;
+    bool historySpillToFlash = false;
+    if (configDoc.containsKey("history")) {
+        JsonVariant historyJson = configDoc["history"];
+        if (historyJson.containsKey("sampleSecs")) {
+            historySampleSecs = historyJson["sampleSecs"].as<unsigned long>();
+            if (historySampleSecs == 0) {
+                return String("Invalid history sample period ") + historyJson["sampleSecs"].as<String>();
+            }
+        }
+        if (historyJson.containsKey("spillToFlash")) {
+            historySpillToFlash = historyJson["spillToFlash"].as<bool>();
+        }
+    }
+    if (applyConfig && _analogueSensorHandler->getHistory()) {
+        _analogueSensorHandler->getHistory()->configure(historySampleSecs, historySpillToFlash);
+    }
+
+    bool recordingEnabled = false;
+    unsigned long recordingSampleSecs = WATERINGSYSTEM_RECORDING_DEFAULTSAMPLESECS;
+    unsigned long recordingMaxBytes = WATERINGSYSTEM_RECORDING_DEFAULTMAXBYTES;
+    if (configDoc.containsKey("recording")) {
+        JsonVariant recordingJson = configDoc["recording"];
+        recordingEnabled = true;
+        if (recordingJson.containsKey("enabled")) {
+            recordingEnabled = recordingJson["enabled"].as<bool>();
+        }
+        if (recordingJson.containsKey("sampleSecs")) {
+            recordingSampleSecs = recordingJson["sampleSecs"].as<unsigned long>();
+            if (recordingSampleSecs == 0 || recordingSampleSecs > 0xFFFF) {
+                return String("Invalid recording sample period ") + recordingJson["sampleSecs"].as<String>();
+            }
+        }
+        if (recordingJson.containsKey("maxBytes")) {
+            recordingMaxBytes = recordingJson["maxBytes"].as<unsigned long>();
+            if (recordingMaxBytes < 1024) {
+                return String("Invalid recording size ") + recordingJson["maxBytes"].as<String>();
+            }
+        }
+    }
+    if (applyConfig && _irrigationService->getRecorder()) {
+        _irrigationService->getRecorder()->configure(recordingEnabled, recordingSampleSecs, recordingMaxBytes);
+    }
+
+    // The actuator backend determines the pump outputs groups can drive
+    uint8_t outputCount;
+    std::vector<int> gpioPins;
+    String actuatorError = processActuatorConfig(configDoc["actuator"], applyConfig, &outputCount, &gpioPins);
+    if (!actuatorError.isEmpty()) {
+        return actuatorError;
+    }
+
+    // Series each metric can have, for sizing the logger filters: one per group, channel or both
+    uint16_t seriesPerMetric[LOG_METRIC_COUNT] = {};
+    seriesPerMetric[LOG_METRIC_BOOT] = 1;
+    seriesPerMetric[LOG_METRIC_SYSTEMSTATS] = 1;
+    seriesPerMetric[LOG_METRIC_CONFIGLOAD] = 1;
+    seriesPerMetric[LOG_METRIC_SENSORHEALTH] = channelCount;
     if (configDoc.containsKey("groups")) {
         for (JsonVariant groupJson : groupsJson) {
             CHECK_FOUND(groupJson,"name","groups.name");
@@ -280,6 +891,9 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
             CHECK_FOUND(groupJson,"pumpCheckPeriodMs","groups.pumpCheckPeriodMs");
             CHECK_FOUND(groupJson,"moistureCheckPeriodMs","groups.moistureCheckPeriodMs");
             String name = groupJson["name"].as<String>();
+            if (name.length() > WATERINGSYSTEM_GROUPNAME_MAXLENGTH) {
+                return String("Sensor group names can be at most ") + WATERINGSYSTEM_GROUPNAME_MAXLENGTH + " characters";
+            }
             String typeStr = groupJson["triggerType"].as<String>();
             int type;
             if      (typeStr.equals("any")) {type = MOISTURE_CONTROLLER_TRIGGER_ANY;}
@@ -289,7 +903,7 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
             }
             
             uint8_t waterSensorChannel = groupJson["waterSensorChannel"].as<uint8_t>();
-            if (waterSensorChannel < 0 || waterSensorChannel > 7) {
+            if (waterSensorChannel >= channelCount) {
                 return String("Invalid water sensor channel identifier ") + String(waterSensorChannel);
             }
             int minMoisture = groupJson["minMoisture"].as<int>();
@@ -298,38 +912,52 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
             unsigned long pumpCheckPeriodMs = groupJson["pumpCheckPeriodMs"].as<unsigned long>();
             unsigned long moistureCheckPeriodMs = groupJson["moistureCheckPeriodMs"].as<unsigned long>();
             
+            // Pumps are actuator outputs P0, P1... or, for gpio outputs, the pin name
             JsonArray pumpPinIdsArray = groupJson["pumpPinIds"];
-            std::list<uint8_t> pumpPinIds;
+            uint32_t pumpOutputMask = 0;
             for (JsonVariant v : pumpPinIdsArray) {
                 String pin = v.as<String>();
-                if      (pin.equals("D0")) {pumpPinIds.push_back(D0);}
-                else if (pin.equals("D1")) {pumpPinIds.push_back(D1);}
-                else if (pin.equals("D2")) {pumpPinIds.push_back(D2);}
-                else if (pin.equals("D3")) {pumpPinIds.push_back(D3);}
-                else if (pin.equals("D4")) {pumpPinIds.push_back(D4);}
-                else {
+                int output = -1;
+                int pinId;
+                if (pin.length() > 1 && pin.charAt(0) == 'P' && isDigit(pin.charAt(1))) {
+                    output = pin.substring(1).toInt();
+                } else if (parsePinId(pin, &pinId)) {
+                    for (size_t i = 0; i < gpioPins.size(); i++) {
+                        if (gpioPins[i] == pinId) {
+                            output = i;
+                        }
+                    }
+                }
+                if (output < 0 || output >= outputCount) {
                     return String("Invalid pump pin identifier ") + v.as<String>();
                 }
+                pumpOutputMask |= 1UL << output;
             }
 
             JsonArray moistureSensorChannelsArray = groupJson["moistureSensorChannels"];
-            std::list<uint8_t> moistureSensorChannels;
+            uint32_t moistureSensorChannelMask = 0;
             for (JsonVariant v : moistureSensorChannelsArray) {
                 uint8_t channel = v.as<uint8_t>();
-                if (channel < 0 || channel > 7) {
+                if (channel >= channelCount) {
                     return String("Invalid moisture sensor channel identifier ") + v.as<String>();
                 } else {
-                    moistureSensorChannels.push_back(channel);
+                    moistureSensorChannelMask |= 1UL << channel;
                 }
             }
+            seriesPerMetric[LOG_METRIC_PUMPSTATUS]++;
+            seriesPerMetric[LOG_METRIC_WATER]++;
+            seriesPerMetric[LOG_METRIC_MOISTUREALARMSTATUS]++;
+            seriesPerMetric[LOG_METRIC_MOISTURE] += __builtin_popcount(moistureSensorChannelMask);
             if (applyConfig) {
+                HEAP_SCOPE(HEAP_TAG_SENSORGROUP);
                 SensorGroup* group = new SensorGroup(_irrigationService->getLogger(),
                                                     _analogueSensorHandler,
+                                                    _irrigationService->getActuatorOutputs(),
                                                     name,
                                                     type,
                                                     waterSensorChannel,
-                                                    moistureSensorChannels,
-                                                    pumpPinIds,
+                                                    moistureSensorChannelMask,
+                                                    pumpOutputMask,
                                                     minMoisture,
                                                     pumpSecs,
                                                     waterCheckPeriodMs,
@@ -340,9 +968,367 @@ String ConfigManager::processJsonConfig(JsonDocument configDoc, bool applyConfig
             }
         }
     }
+    if (applyConfig) {
+        _irrigationService->getLogger()->reserveFilterSeries(seriesPerMetric);
+    }
     return "";
 }
 
+//
+// Parses the sensor sources, which are allocated global channel numbers in the order
+// listed. Returns the total channel count, so channel references can be validated.
+//
+String ConfigManager::processSensorSourcesConfig(JsonArray sourcesJson, bool applyConfig, uint8_t* channelCount) {
+    *channelCount = 0;
+    bool wireStarted = false;
+    if (sourcesJson.size() > WATERINGSYSTEM_MAXSENSORS) {
+        return String("Too many sensor sources, maximum is ") + String(WATERINGSYSTEM_MAXSENSORS);
+    }
+    if (applyConfig) {
+        _analogueSensorHandler->removeSensorSources();
+    }
+    for (JsonVariant sourceJson : sourcesJson) {
+        CHECK_FOUND(sourceJson,"type","sensorSources.type");
+        String typeStr = sourceJson["type"].as<String>();
+        SensorSource* source = NULL;
+        size_t sourceChannels; // Wide, as a misconfigured source can give more than 255
+        if (typeStr.equals("mux")) {
+            CHECK_FOUND(sourceJson,"selectorPins","sensorSources.selectorPins");
+            JsonArray selectorPinsJson = sourceJson["selectorPins"];
+            if (selectorPinsJson.size() != 3) {
+                return String("Mux sensor sources need three selector pins");
+            }
+            std::array<int,3> selectorPins;
+            for (size_t i = 0; i < 3; i++) {
+                if (!parsePinId(selectorPinsJson[i].as<String>(), &selectorPins[i])) {
+                    return String("Invalid mux selector pin identifier ") + selectorPinsJson[i].as<String>();
+                }
+            }
+            std::vector<int> enablePins;
+            for (JsonVariant v : sourceJson["enablePins"].as<JsonArray>()) {
+                int pin;
+                if (!parsePinId(v.as<String>(), &pin)) {
+                    return String("Invalid mux enable pin identifier ") + v.as<String>();
+                }
+                enablePins.push_back(pin);
+            }
+            sourceChannels = WATERINGSYSTEM_MUX_CHANNELS * max((size_t)1, enablePins.size());
+            if (applyConfig) {
+                source = new SensorSourceMux(selectorPins, enablePins);
+            }
+        } else if (typeStr.equals("ads1115")) {
+            uint8_t address = ADS1115_DEFAULT_ADDRESS;
+            if (sourceJson.containsKey("address")) {
+                address = sourceJson["address"].as<uint8_t>();
+            }
+            unsigned long supplyMillivolts = ADS1115_DEFAULT_SUPPLY_MILLIVOLTS;
+            if (sourceJson.containsKey("supplyMillivolts")) {
+                supplyMillivolts = sourceJson["supplyMillivolts"].as<unsigned long>();
+            }
+            CHECK_FOUND(sourceJson,"sdaPin","sensorSources.sdaPin");
+            CHECK_FOUND(sourceJson,"sclPin","sensorSources.sclPin");
+            int sdaPin, sclPin;
+            if (!parsePinId(sourceJson["sdaPin"].as<String>(), &sdaPin) ||
+                !parsePinId(sourceJson["sclPin"].as<String>(), &sclPin)) {
+                return String("Invalid I2C pin identifier for ads1115 sensor source");
+            }
+            sourceChannels = ADS1115_CHANNELS;
+            if (applyConfig) {
+                if (!wireStarted) {
+                    Wire.begin(sdaPin, sclPin);
+                    wireStarted = true;
+                }
+                source = new SensorSourceAds1115(address, supplyMillivolts);
+            }
+        } else if (typeStr.equals("simulated")) {
+            CHECK_FOUND(sourceJson,"channels","sensorSources.channels");
+            long channels = sourceJson["channels"].as<long>();
+            if (channels < 1 || channels > WATERINGSYSTEM_MAXSENSORS) {
+                return String("Invalid simulated sensor source channel count ") + sourceJson["channels"].as<String>();
+            }
+            sourceChannels = channels;
+            SensorSourceSimulated* simulated = applyConfig ? new SensorSourceSimulated(sourceChannels) : NULL;
+            size_t profileChannel = 0;
+            for (JsonVariant profileJson : sourceJson["profiles"].as<JsonArray>()) {
+                SimulatedChannelProfile profile;
+                if (profileJson.containsKey("base"))       { profile.base = profileJson["base"]; }
+                if (profileJson.containsKey("amplitude"))  { profile.amplitude = profileJson["amplitude"]; }
+                if (profileJson.containsKey("periodSecs")) { profile.periodSecs = profileJson["periodSecs"]; }
+                if (profileJson.containsKey("noise"))      { profile.noise = profileJson["noise"]; }
+                if (profile.periodSecs == 0 || profileChannel >= sourceChannels) {
+                    delete simulated;
+                    return String("Invalid simulated sensor source profile");
+                }
+                if (simulated) {
+                    simulated->setProfile(profileChannel, profile);
+                }
+                profileChannel++;
+            }
+            source = simulated;
+        } else {
+            return String("Invalid sensor source type ") + typeStr;
+        }
+
+        if (*channelCount + sourceChannels > WATERINGSYSTEM_MAXSENSORS) {
+            delete source;
+            return String("Too many sensor channels, maximum is ") + String(WATERINGSYSTEM_MAXSENSORS);
+        }
+        *channelCount += sourceChannels;
+        if (source) {
+            _analogueSensorHandler->addSensorSource(source);
+        }
+    }
+    return "";
+}
+
+//
+// Parses a channel calibration, either "points", a list of [raw, percent] pairs with raw
+// readings increasing (two points for a two point calibration), or "polynomial", the
+// coefficients c0, c1... of percent = c0 + c1 * raw + c2 * raw^2... If table is given,
+// the lookup table for the channel is built into it, otherwise the calibration is only
+// validated.
+//
+String ConfigManager::processCalibrationConfig(JsonVariant calibrationJson, uint8_t* table) {
+    if (calibrationJson.containsKey("points")) {
+        JsonArray pointsJson = calibrationJson["points"].as<JsonArray>();
+        CHECK_ARRAY_FOUND(pointsJson, "sensorChannels.calibration.points");
+        if (pointsJson.size() < 2 || pointsJson.size() > WATERINGSYSTEM_CALIBRATION_MAXPOINTS) {
+            return String("Calibrations need 2 to ") + WATERINGSYSTEM_CALIBRATION_MAXPOINTS + " points";
+        }
+        int raw[WATERINGSYSTEM_CALIBRATION_MAXPOINTS];
+        float value[WATERINGSYSTEM_CALIBRATION_MAXPOINTS];
+        uint8_t pointCount = 0;
+        for (JsonVariant pointJson : pointsJson) {
+            if (!pointJson.is<JsonArray>() || pointJson.size() != 2) {
+                return String("Calibration points must be [raw, percent] pairs");
+            }
+            raw[pointCount] = pointJson[0].as<int>();
+            value[pointCount] = pointJson[1].as<float>();
+            if (raw[pointCount] < 0 || raw[pointCount] >= WATERINGSYSTEM_CALIBRATION_RANGE ||
+                (pointCount > 0 && raw[pointCount] <= raw[pointCount - 1])) {
+                return String("Calibration raw readings must be 0-1023 and increasing");
+            }
+            pointCount++;
+        }
+        if (table) {
+            ChannelCalibration::buildPiecewiseLinear(table, raw, value, pointCount);
+        }
+    } else if (calibrationJson.containsKey("polynomial")) {
+        JsonArray coefficientsJson = calibrationJson["polynomial"].as<JsonArray>();
+        CHECK_ARRAY_FOUND(coefficientsJson, "sensorChannels.calibration.polynomial");
+        if (coefficientsJson.size() < 1 || coefficientsJson.size() > WATERINGSYSTEM_CALIBRATION_MAXCOEFFICIENTS) {
+            return String("Calibration polynomials need 1 to ") + WATERINGSYSTEM_CALIBRATION_MAXCOEFFICIENTS + " coefficients";
+        }
+        float coefficients[WATERINGSYSTEM_CALIBRATION_MAXCOEFFICIENTS];
+        uint8_t coefficientCount = 0;
+        for (JsonVariant coefficientJson : coefficientsJson) {
+            coefficients[coefficientCount++] = coefficientJson.as<float>();
+        }
+        if (table) {
+            ChannelCalibration::buildPolynomial(table, coefficients, coefficientCount);
+        }
+    } else {
+        return String("Failed to find field sensorChannels.calibration.points or polynomial in config");
+    }
+    return String();
+}
+
+//
+// Parses a logger's event filter. Validates only when filter is NULL.
+//
+String ConfigManager::processLoggerFilterConfig(JsonVariant filterJson, LoggerFilter* filter) {
+    if (filterJson.containsKey("allow") && filterJson.containsKey("deny")) {
+        return String("Logger filters can have an allow or a deny list, not both");
+    }
+    const char* listKeys[] = {"allow", "deny", "changesOnly"};
+    uint32_t listMasks[3] = {0, 0, 0};
+    for (int list = 0; list < 3; list++) {
+        for (JsonVariant v : filterJson[listKeys[list]].as<JsonArray>()) {
+            int metric = LoggerFilter::parseMetric(v.as<String>());
+            if (metric < 0) {
+                return String("Invalid logger filter metric ") + v.as<String>();
+            }
+            listMasks[list] |= 1UL << metric;
+        }
+    }
+    for (JsonPair samplePair : filterJson["sample"].as<JsonObject>()) {
+        int metric = LoggerFilter::parseMetric(samplePair.key().c_str());
+        int every = samplePair.value().as<int>();
+        if (metric < 0 || every < 1 || every > 65535) {
+            return String("Invalid logger filter sampling for ") + samplePair.key().c_str();
+        }
+        if (filter) {
+            filter->setSampling((LogMetric)metric, every);
+        }
+    }
+    uint32_t ratePerMinute = 0;
+    uint32_t burst = 1;
+    if (filterJson.containsKey("ratePerMinute")) {
+        ratePerMinute = filterJson["ratePerMinute"].as<uint32_t>();
+        if (ratePerMinute == 0) {
+            return String("Invalid logger filter ratePerMinute ") + filterJson["ratePerMinute"].as<String>();
+        }
+    }
+    if (filterJson.containsKey("burst")) {
+        burst = filterJson["burst"].as<uint32_t>();
+        if (burst == 0 || burst > 10000) {
+            return String("Invalid logger filter burst ") + filterJson["burst"].as<String>();
+        }
+    }
+    if (filter) {
+        if (filterJson.containsKey("allow")) {
+            filter->setAllowedMetrics(listMasks[0]);
+        } else if (filterJson.containsKey("deny")) {
+            filter->setAllowedMetrics(~listMasks[1]);
+        }
+        filter->setChangesOnly(listMasks[2]);
+        if (ratePerMinute) {
+            filter->setRateLimit(ratePerMinute, burst);
+        }
+    }
+    return "";
+}
+
+//
+// Parses a logger's rollup of numeric metrics. Only moisture and water levels can be
+// rolled up, other events being state changes that are sent as they happen. Validates
+// only when interface is NULL.
+//
+String ConfigManager::processLoggerRollupConfig(JsonVariant rollupJson, LoggerInterface* interface) {
+    unsigned long windowSecs = WATERINGSYSTEM_ROLLUP_DEFAULTWINDOWSECS;
+    if (rollupJson.containsKey("windowSecs")) {
+        windowSecs = rollupJson["windowSecs"].as<unsigned long>();
+        if (windowSecs < 10 || windowSecs > 86400) {
+            return String("Invalid logger rollup windowSecs ") + rollupJson["windowSecs"].as<String>();
+        }
+    }
+    uint32_t metricMask = (1UL << LOG_METRIC_MOISTURE) | (1UL << LOG_METRIC_WATER);
+    if (rollupJson.containsKey("metrics")) {
+        if (!rollupJson["metrics"].is<JsonArray>()) {
+            return String("Invalid logger rollup metrics ") + rollupJson["metrics"].as<String>();
+        }
+        metricMask = 0;
+        for (JsonVariant v : rollupJson["metrics"].as<JsonArray>()) {
+            int metric = LoggerFilter::parseMetric(v.as<String>());
+            if (metric != LOG_METRIC_MOISTURE && metric != LOG_METRIC_WATER) {
+                return String("Invalid logger rollup metric ") + v.as<String>();
+            }
+            metricMask |= 1UL << metric;
+        }
+    }
+    if (interface) {
+        interface->setRollup(new TelemetryRollup(metricMask, windowSecs));
+    }
+    return "";
+}
+
+//
+// Parses the actuator backend driving the pump outputs. Without an actuator entry, pumps
+// are driven directly from pins D0-D4. Returns the number of outputs, and for gpio
+// backends the pin driving each output, so groups can refer to pumps by pin name.
+//
+String ConfigManager::processActuatorConfig(JsonVariant actuatorJson, bool applyConfig, uint8_t* outputCount, std::vector<int>* gpioPins) {
+    String typeStr("gpio");
+    if (!actuatorJson.isNull()) {
+        CHECK_FOUND(actuatorJson,"type","actuator.type");
+        typeStr = actuatorJson["type"].as<String>();
+    }
+    bool activeLow = false;
+    if (!actuatorJson.isNull() && actuatorJson.containsKey("activeLow")) {
+        activeLow = actuatorJson["activeLow"].as<bool>();
+    }
+
+    ActuatorBackend* backend = NULL;
+    size_t outputs; // Wide, so a count over 255 isn't narrowed before it's checked
+    if (typeStr.equals("gpio")) {
+        if (!actuatorJson.isNull() && actuatorJson.containsKey("pins")) {
+            for (JsonVariant v : actuatorJson["pins"].as<JsonArray>()) {
+                int pin;
+                if (!parsePinId(v.as<String>(), &pin)) {
+                    return String("Invalid actuator pin identifier ") + v.as<String>();
+                }
+                gpioPins->push_back(pin);
+            }
+        } else {
+            *gpioPins = {D0, D1, D2, D3, D4};
+        }
+        outputs = gpioPins->size();
+        if (applyConfig && outputs <= WATERINGSYSTEM_MAXACTUATORS) {
+            backend = new ActuatorBackendGpio(*gpioPins);
+        }
+    } else if (typeStr.equals("74hc595")) {
+        CHECK_FOUND(actuatorJson,"dataPin","actuator.dataPin");
+        CHECK_FOUND(actuatorJson,"clockPin","actuator.clockPin");
+        CHECK_FOUND(actuatorJson,"latchPin","actuator.latchPin");
+        int dataPin, clockPin, latchPin;
+        if (!parsePinId(actuatorJson["dataPin"].as<String>(), &dataPin) ||
+            !parsePinId(actuatorJson["clockPin"].as<String>(), &clockPin) ||
+            !parsePinId(actuatorJson["latchPin"].as<String>(), &latchPin)) {
+            return String("Invalid pin identifier for 74hc595 actuator");
+        }
+        long registerCount = 1;
+        if (actuatorJson.containsKey("registers")) {
+            registerCount = actuatorJson["registers"].as<long>();
+            if (registerCount < 1 || registerCount > WATERINGSYSTEM_MAXACTUATORS / 8) {
+                return String("Invalid 74hc595 register count ") + actuatorJson["registers"].as<String>();
+            }
+        }
+        outputs = registerCount * 8;
+        if (applyConfig && outputs <= WATERINGSYSTEM_MAXACTUATORS) {
+            backend = new ActuatorBackend595(dataPin, clockPin, latchPin, registerCount);
+        }
+    } else if (typeStr.equals("pcf8574")) {
+        CHECK_FOUND(actuatorJson,"addresses","actuator.addresses");
+        CHECK_FOUND(actuatorJson,"sdaPin","actuator.sdaPin");
+        CHECK_FOUND(actuatorJson,"sclPin","actuator.sclPin");
+        int sdaPin, sclPin;
+        if (!parsePinId(actuatorJson["sdaPin"].as<String>(), &sdaPin) ||
+            !parsePinId(actuatorJson["sclPin"].as<String>(), &sclPin)) {
+            return String("Invalid I2C pin identifier for pcf8574 actuator");
+        }
+        std::vector<uint8_t> addresses;
+        for (JsonVariant v : actuatorJson["addresses"].as<JsonArray>()) {
+            addresses.push_back(v.as<uint8_t>());
+        }
+        outputs = addresses.size() * 8;
+        if (applyConfig && outputs <= WATERINGSYSTEM_MAXACTUATORS) {
+            Wire.begin(sdaPin, sclPin);
+            backend = new ActuatorBackendPcf8574(addresses);
+        }
+    } else if (typeStr.equals("simulated")) {
+        CHECK_FOUND(actuatorJson,"outputs","actuator.outputs");
+        long simulatedOutputs = actuatorJson["outputs"].as<long>();
+        outputs = simulatedOutputs < 0 ? 0 : simulatedOutputs;
+        if (applyConfig && outputs > 0 && outputs <= WATERINGSYSTEM_MAXACTUATORS) {
+            backend = new ActuatorBackendSimulated(outputs);
+        }
+    } else {
+        return String("Invalid actuator type ") + typeStr;
+    }
+
+    if (outputs == 0 || outputs > WATERINGSYSTEM_MAXACTUATORS) {
+        delete backend;
+        return String("Invalid actuator output count, maximum is ") + String(WATERINGSYSTEM_MAXACTUATORS);
+    }
+    *outputCount = outputs;
+    if (backend) {
+        _irrigationService->getActuatorOutputs()->setBackend(backend, activeLow);
+    }
+    return "";
+}
+
+//
+// Maps a NodeMCU pin name (D0-D8) to its GPIO number
+//
+bool ConfigManager::parsePinId(String pin, int* pinId) {
+    static const int pinIds[] = {D0,D1,D2,D3,D4,D5,D6,D7,D8};
+    if (pin.length() != 2 || pin.charAt(0) != 'D' || pin.charAt(1) < '0' || pin.charAt(1) > '8') {
+        return false;
+    }
+    *pinId = pinIds[pin.charAt(1) - '0'];
+    return true;
+}
+
 void ConfigManager::handleSensorGroupTrigger() {
   SensorGroup* sensorGroup = _irrigationService->getSensorGroupByName(_configServer->pathArg(0));
   if (sensorGroup) {
@@ -357,4 +1343,497 @@ void ConfigManager::handleSensorGroupTrigger() {
   }
 }
 
+//
+// Callback handler for a batch of operations across sensor groups. The whole batch is
+// validated first, and nothing runs if any operation is invalid. The sensors are then
+// polled once, and every operation runs against that one set of readings, with pump
+// changes applied together at the end.
+//
+void ConfigManager::handleCommands() {
+    HEAP_SCOPE(HEAP_TAG_HTTP);
+    JsonDocument commandsDoc(&configJsonArena);
+    DeserializationError error = deserializeJson(commandsDoc, _configServer->arg("plain"));
+    if (error || !commandsDoc.is<JsonArray>()) {
+        _configServer->send(400, "text/plain", "Expected a Json array of commands");
+        return;
+    }
+    JsonArray commandsJson = commandsDoc.as<JsonArray>();
+    if (commandsJson.size() > WATERINGSYSTEM_MAXCOMMANDS) {
+        _configServer->send(400, "text/plain", String("At most ") + WATERINGSYSTEM_MAXCOMMANDS + " commands per request");
+        return;
+    }
+
+    JsonDocument resultsDoc(&configJsonArena);
+    JsonArray errorsJson = resultsDoc["errors"].to<JsonArray>();
+    bool needsReadings = false;
+    int index = 0;
+    for (JsonVariant commandJson : commandsJson) {
+        String commandError = commandJson.is<JsonObject>() ?
+                              processCommand(commandJson.as<JsonObject>(), false, NULL, JsonObject()) :
+                              String("Command is not a Json object");
+        if (!commandError.isEmpty()) {
+            JsonObject errorJson = errorsJson.add<JsonObject>();
+            errorJson["index"] = index;
+            errorJson["error"] = commandError;
+        }
+        String op = commandJson["op"].as<String>();
+        needsReadings = needsReadings || op.equals("pump") || op.equals("read");
+        index++;
+    }
+    String response;
+    if (errorsJson.size() > 0) {
+        serializeJson(resultsDoc, response);
+        _configServer->send(400, "application/json", response);
+        return;
+    }
+
+    // One scan of every channel, shared by the whole batch
+    int readings[WATERINGSYSTEM_MAXSENSORS];
+    if (needsReadings) {
+        _analogueSensorHandler->pollSensors();
+        for (int channel = 0; channel < WATERINGSYSTEM_MAXSENSORS; channel++) {
+            readings[channel] = _analogueSensorHandler->getLatestReading(channel);
+        }
+    }
+    resultsDoc.clear();
+    JsonArray resultsJson = resultsDoc["results"].to<JsonArray>();
+    for (JsonVariant commandJson : commandsJson) {
+        JsonObject resultJson = resultsJson.add<JsonObject>();
+        resultJson["op"] = commandJson["op"];
+        String commandError = processCommand(commandJson.as<JsonObject>(), true, readings, resultJson);
+        resultJson["ok"] = commandError.isEmpty();
+        if (!commandError.isEmpty()) {
+            resultJson["error"] = commandError;
+        }
+    }
+    _irrigationService->getActuatorOutputs()->commit();
+    serializeJson(resultsDoc, response);
+    _configServer->send(200, "application/json", response);
+}
+
+//
+// Validates one command, or with applyCommand runs it against the batch's sensor
+// readings, adding its results to resultJson. Returns an error, or an empty string.
+// Operations are:
+// - pump: start a group's pumps, for "secs" or the group's pump period
+// - stop: stop a group's pumps
+// - read: sensor readings for a group, or every channel if no group is given
+// - threshold: change a group's "minMoisture" until the configuration is reloaded
+//
+String ConfigManager::processCommand(JsonObject commandJson, bool applyCommand, const int* readings, JsonObject resultJson) {
+    CHECK_FOUND(commandJson, "op", "op");
+    String op = commandJson["op"].as<String>();
+    SensorGroup* group = NULL;
+    if (commandJson.containsKey("group")) {
+        String groupName = commandJson["group"].as<String>();
+        group = _irrigationService->getSensorGroupByName(groupName);
+        if (!group) {
+            return String("Sensor group ") + groupName + " not found";
+        }
+        if (applyCommand) {
+            resultJson["group"] = groupName;
+        }
+    } else if (!op.equals("read")) {
+        return String("Failed to find field group in command");
+    }
+
+    if (op.equals("pump")) {
+        int pumpSecs = 0;
+        if (commandJson.containsKey("secs")) {
+            pumpSecs = commandJson["secs"];
+            if (pumpSecs <= 0 || pumpSecs > WATERINGSYSTEM_MAXCOMMANDPUMPSECS) {
+                return String("Invalid pump secs ") + pumpSecs;
+            }
+        }
+        if (applyCommand) {
+            int waterLevel = readings[group->getWaterLevelChannel()];
+            resultJson["waterLevel"] = waterLevel;
+            if (!group->hasWaterAtLevel(waterLevel)) {
+                return String("Sensor group has no water");
+            }
+            if (pumpSecs) {
+                group->startPumpingFor(pumpSecs);
+            } else {
+                group->startPumping();
+            }
+        }
+    } else if (op.equals("stop")) {
+        if (applyCommand) {
+            group->finishPumping();
+        }
+    } else if (op.equals("read")) {
+        if (applyCommand) {
+            if (group) {
+                resultJson["waterLevel"] = readings[group->getWaterLevelChannel()];
+                JsonObject moistureJson = resultJson["moisture"].to<JsonObject>();
+                uint32_t remainingChannels = group->getMoistureSensorChannelMask();
+                while (remainingChannels) {
+                    uint8_t channel = __builtin_ctz(remainingChannels);
+                    remainingChannels &= remainingChannels - 1;
+                    moistureJson[String(channel)] = readings[channel];
+                }
+            } else {
+                JsonArray channelsJson = resultJson["channels"].to<JsonArray>();
+                for (int channel = 0; channel < _analogueSensorHandler->getChannelCount(); channel++) {
+                    channelsJson.add(readings[channel]);
+                }
+            }
+        }
+    } else if (op.equals("threshold")) {
+        CHECK_FOUND(commandJson, "minMoisture", "minMoisture");
+        int minMoisture = commandJson["minMoisture"];
+        if (minMoisture < 0 || minMoisture > 1023) {
+            return String("Invalid minMoisture ") + minMoisture;
+        }
+        if (applyCommand) {
+            group->setMinThreshold(minMoisture);
+        }
+    } else {
+        return String("Invalid command op ") + op;
+    }
+    return String();
+}
+
+//
+// Streams the on-device history for a channel as Json, optionally downsampled into
+// step second buckets (the mean of each bucket is reported). from/to are seconds since
+// boot, and the current uptime is included so callers can map these to wall clock time.
+//
+void ConfigManager::handleHistory() {
+    HEAP_SCOPE(HEAP_TAG_HTTP);
+    SensorHistory* history = _analogueSensorHandler->getHistory();
+    if (!history) {
+        _configServer->send(404, "text/plain", "History not enabled");
+        return;
+    }
+    if (!_configServer->hasArg("channel")) {
+        _configServer->send(400, "text/plain", "Missing channel parameter");
+        return;
+    }
+    long channel = _configServer->arg("channel").toInt();
+    if (channel < 0 || channel >= WATERINGSYSTEM_HISTORY_CHANNELS) {
+        _configServer->send(400, "text/plain", "Invalid channel " + _configServer->arg("channel"));
+        return;
+    }
+    uint32_t now = millis() / 1000;
+    long fromArg = _configServer->hasArg("from") ? _configServer->arg("from").toInt() : 0;
+    long toArg = _configServer->hasArg("to") ? _configServer->arg("to").toInt() : now;
+    long stepArg = _configServer->hasArg("step") ? _configServer->arg("step").toInt() : 0;
+    if (fromArg < 0 || toArg < 0 || stepArg < 0) {
+        _configServer->send(400, "text/plain", "Invalid from, to or step, times can't be negative");
+        return;
+    }
+    uint32_t from = fromArg;
+    uint32_t to = toArg;
+    uint32_t step = stepArg;
+
+    _configServer->setContentLength(CONTENT_LENGTH_UNKNOWN);
+    _configServer->send(200, "application/json", "");
+    String chunk;
+    chunk.reserve(512);
+    chunk += "{\"channel\":";
+    chunk += channel;
+    chunk += ",\"now\":";
+    chunk += now;
+    chunk += ",\"step\":";
+    chunk += step;
+    chunk += ",\"points\":[";
+
+    // Bucket state for on the fly downsampling
+    bool first = true;
+    bool bucketOpen = false;
+    uint32_t bucketStart = 0;
+    long bucketSum = 0;
+    long bucketCount = 0;
+    auto emitPoint = [&](uint32_t timestamp, int value) {
+        if (!first) {
+            chunk += ",";
+        }
+        first = false;
+        chunk += "[";
+        chunk += timestamp;
+        chunk += ",";
+        chunk += value;
+        chunk += "]";
+        if (chunk.length() > 480) {
+            _configServer->sendContent(chunk);
+            chunk = "";
+        }
+    };
+    history->forEachSample((uint8_t)channel, from, to, [&](uint32_t timestamp, int value) {
+        if (step == 0) {
+            emitPoint(timestamp, value);
+            return;
+        }
+        uint32_t bucket = from + ((timestamp - from) / step) * step;
+        if (bucketOpen && bucket != bucketStart) {
+            emitPoint(bucketStart, bucketSum / bucketCount);
+            bucketSum = 0;
+            bucketCount = 0;
+        }
+        bucketOpen = true;
+        bucketStart = bucket;
+        bucketSum += value;
+        bucketCount++;
+    });
+    if (bucketOpen) {
+        emitPoint(bucketStart, bucketSum / bucketCount);
+    }
+    chunk += "]}";
+    _configServer->sendContent(chunk);
+    _configServer->sendContent("");
+}
+
+//
+// Starts settle time calibration of every multiplexed sensor channel, which runs from the
+// scheduler, with its progress and results reported by GET /sensors/calibrate. Unless
+// started with persist=false, the results are stored as the sensorChannels entry of the
+// active configuration, and applied.
+//
+void ConfigManager::handleSensorCalibration() {
+    if (_calibrationChannel >= 0) {
+        _configServer->send(409, "application/json", "Calibration already running");
+        return;
+    }
+    _calibrationPersist = !_configServer->arg("persist").equals("false");
+    _calibrationError = "";
+    _calibratedChannels = 0;
+    _calibrationState = "running";
+    startCalibrationFrom(0);
+    _configServer->send(202, "application/json", String("{\"state\":\"") + _calibrationState + "\"}");
+}
+
+// Callback handler returning the state of the last calibration, with the results so far
+void ConfigManager::handleGetSensorCalibration() {
+    JsonDocument statusDoc(&configJsonArena);
+    statusDoc["state"] = _calibrationState;
+    if (!_calibrationError.isEmpty()) {
+        statusDoc["error"] = _calibrationError;
+    }
+    addCalibrationResults(statusDoc["channels"].to<JsonArray>());
+    String statusString;
+    serializeJson(statusDoc, statusString);
+    _configServer->send(200, "application/json", statusString);
+}
+
+void ConfigManager::addCalibrationResults(JsonArray channelsJson) {
+    uint32_t channels = _calibratedChannels;
+    while (channels) {
+        uint8_t channel = __builtin_ctz(channels);
+        channels &= channels - 1;
+        JsonObject channelJson = channelsJson.add<JsonObject>();
+        channelJson["channel"] = channel;
+        channelJson["settleMicros"] = _calibrationSettleMicros[channel];
+        channelJson["oversample"] = _calibrationOversample[channel];
+    }
+}
+
+//
+// Moves the calibration on to the first channel from the one given whose source has a
+// settle time to calibrate, finishing once there are none left
+//
+void ConfigManager::startCalibrationFrom(int channel) {
+    while (channel < _analogueSensorHandler->getChannelCount()) {
+        if (_analogueSensorHandler->startChannelCalibration(channel)) {
+            _calibrationChannel = channel;
+            return;
+        }
+        channel++;
+    }
+    _calibrationChannel = -1;
+    _calibrationState = "complete";
+    if (_calibrationPersist) {
+        persistSensorCalibration();
+    }
+}
+
+// Runs one step of a calibration in progress. Each step is bounded by a single calibration window.
+void ConfigManager::sensorCalibrationStep() {
+    if (_calibrationChannel < 0) {
+        return;
+    }
+    unsigned long settleMicros;
+    uint8_t oversample;
+    if (!_analogueSensorHandler->stepChannelCalibration(_calibrationChannel, &settleMicros, &oversample)) {
+        return;
+    }
+    _calibrationSettleMicros[_calibrationChannel] = settleMicros;
+    _calibrationOversample[_calibrationChannel] = oversample;
+    _calibratedChannels |= 1UL << _calibrationChannel;
+    startCalibrationFrom(_calibrationChannel + 1);
+}
+
+//
+// Stores the calibration results in the active configuration, and applies it. The updated
+// configuration is validated before it is written, as a hand edited configuration may not be.
+//
+void ConfigManager::persistSensorCalibration() {
+    HEAP_SCOPE(HEAP_TAG_CONFIG);
+    JsonDocument resultsDoc(&configJsonArena);
+    JsonArray channelsJson = resultsDoc.to<JsonArray>();
+    addCalibrationResults(channelsJson);
+
+    File file = LittleFS.open(irrigationConfigFile,"r");
+    JsonDocument configDoc(&configJsonArena);
+    if (!file || deserializeJson(configDoc, file)) {
+        _calibrationState = "failed";
+        _calibrationError = "Failed to read configuration to update";
+        return;
+    }
+    file.close();
+    // Merge the results into the channels' existing entries, keeping their other
+    // settings and the entries of channels that weren't calibrated
+    JsonArray existingChannelsJson = configDoc["sensorChannels"];
+    if (existingChannelsJson.isNull()) {
+        existingChannelsJson = configDoc["sensorChannels"].to<JsonArray>();
+    }
+    for (JsonObject channelJson : channelsJson) {
+        JsonObject existingJson;
+        for (JsonObject entryJson : existingChannelsJson) {
+            if (entryJson["channel"].as<int>() == channelJson["channel"].as<int>()) {
+                existingJson = entryJson;
+                break;
+            }
+        }
+        if (existingJson.isNull()) {
+            existingJson = existingChannelsJson.add<JsonObject>();
+            existingJson["channel"] = channelJson["channel"];
+        }
+        existingJson["settleMicros"] = channelJson["settleMicros"];
+        existingJson["oversample"] = channelJson["oversample"];
+    }
+    String error = processJsonConfig(configDoc, false);
+    if (!error.isEmpty()) {
+        _calibrationState = "failed";
+        _calibrationError = "Invalid configuration JSON document: " + error;
+        return;
+    }
+    String configString;
+    serializeJson(configDoc, configString);
+    bool unchanged = false;
+    if (!writeConfiguration(configString, &unchanged)) {
+        _calibrationState = "failed";
+        _calibrationError = "Config file write failed";
+        return;
+    }
+    if (unchanged) {
+        processJsonConfig(configDoc, true);
+    } else {
+        applyNewConfiguration(configDoc);
+    }
+}
+
+//
+// Reports per subsystem heap usage, when built with heap accounting enabled
+//
+void ConfigManager::handleHeapStats() {
+#ifdef WATERINGSYSTEM_HEAP_ACCOUNTING
+    JsonDocument heapDoc(&configJsonArena);
+    heapDoc["getFreeHeap"] = ESP.getFreeHeap();
+    heapDoc["getHeapFragmentation"] = ESP.getHeapFragmentation();
+    heapDoc["getMaxFreeBlockSize"] = ESP.getMaxFreeBlockSize();
+    reportHeapAccounting(heapDoc["tags"].to<JsonObject>());
+    JsonArray arenasJson = heapDoc["jsonArenas"].to<JsonArray>();
+    loggerJsonArena.reportStats(arenasJson.add<JsonObject>());
+    configJsonArena.reportStats(arenasJson.add<JsonObject>());
+    String heapString;
+    serializeJson(heapDoc, heapString);
+    _configServer->send(200, "application/json", heapString);
+#else
+    _configServer->send(404, "text/plain", "Heap accounting not enabled in this build");
+#endif
+}
+
+// Callback handler returning the lifetime pump counters, including any not yet flushed
+void ConfigManager::handleCounters() {
+    HEAP_SCOPE(HEAP_TAG_HTTP);
+    JsonDocument countersDoc(&configJsonArena);
+    _irrigationService->getCounters()->report(countersDoc.to<JsonObject>());
+    String countersString;
+    serializeJson(countersDoc, countersString);
+    _configServer->send(200, "application/json", countersString);
+}
+
+//
+// Callback handler streaming the sensor recording, oldest first, as the binary records
+// described in SensorRecorder.h. Buffered records are written out first.
+//
+void ConfigManager::handleGetRecording() {
+    HEAP_SCOPE(HEAP_TAG_HTTP);
+    SensorRecorder* recorder = _irrigationService->getRecorder();
+    if (!recorder) {
+        _configServer->send(404, "text/plain", "Recording not available");
+        return;
+    }
+    recorder->flush();
+    _configServer->setContentLength(CONTENT_LENGTH_UNKNOWN);
+    _configServer->send(200, "application/octet-stream", "");
+    char chunk[256];
+    for (uint8_t i = 0; i < 2; i++) {
+        String fileName = SensorRecorder::getFileName(i == 0);
+        if (!LittleFS.exists(fileName)) {
+            continue;
+        }
+        File file = LittleFS.open(fileName, "r");
+        if (!file) {
+            continue;
+        }
+        size_t length;
+        while ((length = file.read((uint8_t*)chunk, sizeof(chunk))) > 0) {
+            _configServer->sendContent(chunk, length);
+        }
+        file.close();
+    }
+    _configServer->sendContent("");
+}
+
+void ConfigManager::handleDeleteRecording() {
+    SensorRecorder* recorder = _irrigationService->getRecorder();
+    if (!recorder) {
+        _configServer->send(404, "text/plain", "Recording not available");
+        return;
+    }
+    recorder->clear();
+    _configServer->send(200, "application/json", "Recording cleared");
+}
+
+//
+// Callback handler streaming the trace ring as Chrome trace_event Json, for loading
+// into a trace viewer such as Perfetto or chrome://tracing. The response is sent in
+// chunks so the whole trace is never held in memory.
+//
+void ConfigManager::handleTrace() {
+    HEAP_SCOPE(HEAP_TAG_HTTP);
+    uint32_t first = traceRecorder.getFirst();
+    uint32_t last = traceRecorder.getRecorded();
+    uint32_t baseMicros = first != last ? traceRecorder.getRecord(first).micros : 0;
+
+    _configServer->setContentLength(CONTENT_LENGTH_UNKNOWN);
+    _configServer->send(200, "application/json", "");
+    String chunk("{\"displayTimeUnit\":\"ms\",\"otherData\":{\"recorded\":");
+    chunk += last;
+    chunk += ",\"held\":";
+    chunk += last - first;
+    chunk += "},\"traceEvents\":[{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"loop\"}}";
+    uint8_t outputCount = _irrigationService->getActuatorOutputs()->getOutputCount();
+    for (uint8_t output = 0; output < outputCount; output++) {
+        chunk += ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+        chunk += 1 + output;
+        chunk += ",\"args\":{\"name\":\"pump P";
+        chunk += output;
+        chunk += "\"}}";
+    }
+    for (uint32_t sequence = first; sequence != last; sequence++) {
+        chunk += ",";
+        TraceRecorder::appendChromeEvent(chunk, traceRecorder.getRecord(sequence), baseMicros);
+        if (chunk.length() > 1024) {
+            _configServer->sendContent(chunk);
+            chunk = "";
+        }
+    }
+    chunk += "]}";
+    _configServer->sendContent(chunk);
+    _configServer->sendContent("");
+}
+
 #endif
\ No newline at end of file
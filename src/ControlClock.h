@@ -0,0 +1,48 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+#ifndef __WATERINGSYSTEM_CONTROLCLOCK_H__
+#define __WATERINGSYSTEM_CONTROLCLOCK_H__
+
+//
+// Time source for the watering decisions: the sensor group timers and pump periods.
+// Normally this is millis(). While a recording is replayed it is a virtual clock,
+// stepped by the replay, so days of control logic run in seconds.
+//
+class ControlClock
+{
+  private:
+    bool _virtual = false;
+    unsigned long _virtualMillis = 0;
+
+  public:
+    unsigned long millis();
+    void startVirtual(unsigned long startMillis);
+    void advance(unsigned long stepMillis);
+    void stopVirtual();
+};
+/****************************************/
+
+unsigned long ControlClock::millis() {
+    return _virtual ? _virtualMillis : ::millis();
+}
+
+void ControlClock::startVirtual(unsigned long startMillis) {
+    _virtualMillis = startMillis;
+    _virtual = true;
+}
+
+void ControlClock::advance(unsigned long stepMillis) {
+    _virtualMillis += stepMillis;
+}
+
+void ControlClock::stopVirtual() {
+    _virtual = false;
+}
+
+ControlClock controlClock;
+
+#endif
@@ -0,0 +1,255 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+//
+// Opt-in per subsystem heap accounting. When built with WATERINGSYSTEM_HEAP_ACCOUNTING,
+// malloc/calloc/realloc/free are wrapped at link time, and each allocation is tagged with
+// the subsystem scope that is active when it is made (see HEAP_SCOPE). Live bytes, peak
+// live bytes and allocation counts are kept per tag, so fragmentation can be attributed
+// to the subsystem holding memory.
+//
+// Live allocations are tracked in a fixed size open addressing table keyed on pointer,
+// so no memory is allocated by the accounting itself. If the table fills, further
+// allocations are counted but not tracked, and reported as untracked.
+//
+// The HeapAccounting class itself has no Arduino dependencies, so it can be built and
+// exercised on a host.
+//
+
+#ifndef __WATERINGSYSTEM_HEAPACCOUNTING_H__
+#define __WATERINGSYSTEM_HEAPACCOUNTING_H__
+
+#define WATERINGSYSTEM_HEAP_TRACKEDBLOCKS 512 // Must be a power of two
+
+enum HeapTag : uint8_t {
+    HEAP_TAG_OTHER = 0,
+    HEAP_TAG_LOGGER,
+    HEAP_TAG_LOKI,
+    HEAP_TAG_MQTT,
+    HEAP_TAG_SERIAL,
+    HEAP_TAG_CONFIG,
+    HEAP_TAG_SENSORGROUP,
+    HEAP_TAG_HTTP,
+    HEAP_TAG_COUNT
+};
+
+const char* const heapTagNames[HEAP_TAG_COUNT] = {
+    "other", "logger", "loki", "mqtt", "serial", "config", "sensorgroup", "http"
+};
+
+struct HeapTagStats
+{
+    uint32_t liveBytes;
+    uint32_t peakBytes;
+    uint32_t allocations;
+    uint32_t frees;
+};
+
+struct HeapTrackedBlock
+{
+    void*    ptr;
+    uint32_t size : 24;
+    uint32_t tag  : 8;
+};
+
+//
+// Deliberately has no constructor, so a global instance is zero initialised before any
+// other static constructors run and allocate.
+//
+class HeapAccounting
+{
+  private:
+    HeapTrackedBlock _blocks[WATERINGSYSTEM_HEAP_TRACKEDBLOCKS];
+    HeapTagStats _stats[HEAP_TAG_COUNT];
+    uint32_t _untrackedAllocations;
+    uint32_t _totalAllocations;
+    uint8_t  _currentTag;
+
+    static uint32_t slotFor(void* ptr);
+
+  public:
+    void recordAlloc(void* ptr, size_t size);
+    void recordFree(void* ptr);
+    uint8_t setCurrentTag(uint8_t tag);
+    const HeapTagStats& getStats(uint8_t tag) { return _stats[tag]; }
+    uint32_t getUntrackedAllocations() { return _untrackedAllocations; }
+    uint32_t getTotalAllocations() { return _totalAllocations; }
+};
+/****************************************/
+
+uint32_t HeapAccounting::slotFor(void* ptr) {
+    // Heap blocks are at least 8 byte aligned, so discard the low bits before mixing
+    uint32_t key = (uint32_t)(uintptr_t)ptr >> 3;
+    key *= 2654435761u;
+    return (key >> 16) & (WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 1);
+}
+
+void HeapAccounting::recordAlloc(void* ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    uint8_t tag = _currentTag;
+    _totalAllocations++;
+    _stats[tag].allocations++;
+
+    uint32_t slot = slotFor(ptr);
+    for (uint32_t probe = 0; probe < WATERINGSYSTEM_HEAP_TRACKEDBLOCKS; probe++) {
+        HeapTrackedBlock& block = _blocks[slot];
+        if (block.ptr == NULL) {
+            block.ptr = ptr;
+            block.size = size;
+            block.tag = tag;
+            _stats[tag].liveBytes += size;
+            if (_stats[tag].liveBytes > _stats[tag].peakBytes) {
+                _stats[tag].peakBytes = _stats[tag].liveBytes;
+            }
+            return;
+        }
+        slot = (slot + 1) & (WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 1);
+    }
+    _untrackedAllocations++;
+}
+
+//
+// Removes a block from the table, shifting back any entries in the same probe run
+// so lookups never need tombstones.
+//
+void HeapAccounting::recordFree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    uint32_t slot = slotFor(ptr);
+    for (uint32_t probe = 0; probe < WATERINGSYSTEM_HEAP_TRACKEDBLOCKS; probe++) {
+        HeapTrackedBlock& block = _blocks[slot];
+        if (block.ptr == NULL) {
+            return; // Untracked allocation
+        }
+        if (block.ptr == ptr) {
+            _stats[block.tag].liveBytes -= block.size;
+            _stats[block.tag].frees++;
+            block.ptr = NULL;
+
+            uint32_t hole = slot;
+            uint32_t next = (slot + 1) & (WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 1);
+            while (_blocks[next].ptr != NULL) {
+                uint32_t home = slotFor(_blocks[next].ptr);
+                // Move the entry into the hole if its home slot is not between the hole and itself
+                if (((next - home) & (WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 1)) >=
+                    ((next - hole) & (WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 1))) {
+                    _blocks[hole] = _blocks[next];
+                    _blocks[next].ptr = NULL;
+                    hole = next;
+                }
+                next = (next + 1) & (WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 1);
+            }
+            return;
+        }
+        slot = (slot + 1) & (WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 1);
+    }
+}
+
+uint8_t HeapAccounting::setCurrentTag(uint8_t tag) {
+    uint8_t previousTag = _currentTag;
+    _currentTag = tag;
+    return previousTag;
+}
+
+#ifdef WATERINGSYSTEM_HEAP_ACCOUNTING
+
+HeapAccounting heapAccounting;
+
+//
+// RAII helper to tag allocations made within a block of code. Scopes nest, the
+// innermost scope wins.
+//
+class HeapScope
+{
+  private:
+    uint8_t _previousTag;
+  public:
+    HeapScope(uint8_t tag);
+    ~HeapScope();
+};
+
+HeapScope::HeapScope(uint8_t tag) {
+    _previousTag = heapAccounting.setCurrentTag(tag);
+}
+
+HeapScope::~HeapScope() {
+    heapAccounting.setCurrentTag(_previousTag);
+}
+
+#define HEAP_SCOPE_CONCAT(a, b) a##b
+#define HEAP_SCOPE_NAME(line) HEAP_SCOPE_CONCAT(heapScope, line)
+#define HEAP_SCOPE(tag) HeapScope HEAP_SCOPE_NAME(__LINE__)(tag)
+
+#ifdef ARDUINO
+#include <interrupts.h>
+#include <ArduinoJson.h>
+
+//
+// Adds per tag heap usage to a Json object, for system stats and the /heap endpoint
+//
+void reportHeapAccounting(JsonObject heapJson) {
+    heapJson["totalAllocations"] = heapAccounting.getTotalAllocations();
+    heapJson["untrackedAllocations"] = heapAccounting.getUntrackedAllocations();
+    for (uint8_t tag = 0; tag < HEAP_TAG_COUNT; tag++) {
+        const HeapTagStats& stats = heapAccounting.getStats(tag);
+        JsonObject tagJson = heapJson[heapTagNames[tag]].to<JsonObject>();
+        tagJson["liveBytes"] = stats.liveBytes;
+        tagJson["peakBytes"] = stats.peakBytes;
+        tagJson["allocations"] = stats.allocations;
+        tagJson["frees"] = stats.frees;
+    }
+}
+
+extern "C" {
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t count, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+    void  __real_free(void* ptr);
+
+    void* __wrap_malloc(size_t size) {
+        esp8266::InterruptLock lock;
+        void* ptr = __real_malloc(size);
+        heapAccounting.recordAlloc(ptr, size);
+        return ptr;
+    }
+
+    void* __wrap_calloc(size_t count, size_t size) {
+        esp8266::InterruptLock lock;
+        void* ptr = __real_calloc(count, size);
+        heapAccounting.recordAlloc(ptr, count * size);
+        return ptr;
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size) {
+        esp8266::InterruptLock lock;
+        void* newPtr = __real_realloc(ptr, size);
+        if (newPtr || size == 0) {
+            heapAccounting.recordFree(ptr);
+        }
+        heapAccounting.recordAlloc(newPtr, size);
+        return newPtr;
+    }
+
+    void __wrap_free(void* ptr) {
+        esp8266::InterruptLock lock;
+        heapAccounting.recordFree(ptr);
+        __real_free(ptr);
+    }
+}
+#endif
+
+#else
+
+#define HEAP_SCOPE(tag)
+
+#endif
+
+#endif
@@ -0,0 +1,232 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "IrrigationLogger.h"
+#include "LoggerInterfaceSerial.h"
+#include "LoggerInterfaceLoki.h"
+#include "LoggerInterfaceMqtt.h"
+#include "AnalogueSensorHandler.h"
+#include "SensorSourceSimulated.h"
+#include "ConfigManager.h"
+#include "HeapAccounting.h"
+#include "SerialConsole.h"
+
+//
+// On-device microbenchmarks for the logger, config and sensor hot paths, built by the
+// nodemcuv2_benchmark environment. Network I/O is stubbed out, and heap allocations are
+// counted by the heap accounting build (see HeapAccounting.h). Results are written to
+// Serial as a single line of Json prefixed with "BENCHMARK ", so builds can be compared.
+// Benchmarks of the per-reading path are marked perReading, and benchmark_compare.py
+// fails a build whose per-reading allocations are above those of a baseline build.
+//
+
+#ifndef __WATERINGSYSTEM_IRRIGATIONBENCHMARK_H__
+#define __WATERINGSYSTEM_IRRIGATIONBENCHMARK_H__
+
+#ifdef WATERINGSYSTEM_BENCHMARK
+
+#define BENCHMARK_LOG_ITERATIONS 200
+#define BENCHMARK_CONFIG_ITERATIONS 20
+#define BENCHMARK_SENSOR_ITERATIONS 200
+
+#ifndef WATERINGSYSTEM_HEAP_ACCOUNTING
+#error The benchmark build requires WATERINGSYSTEM_HEAP_ACCOUNTING to count allocations
+#endif
+
+//
+// Loki logger with the HTTP POST and NTP lookup stubbed out
+//
+class BenchmarkLoggerInterfaceLoki : public LoggerInterfaceLoki
+{
+  public:
+    unsigned long payloadBytes = 0;
+    BenchmarkLoggerInterfaceLoki(uint8_t encoding) : LoggerInterfaceLoki("benchmark", LOKI_DEFAULT_PORT, "127.0.0.1", LOKI_PATH, encoding) {};
+  protected:
+    virtual time_t getEpoch() { return 1700000000; }
+    virtual bool postPayload(const String& json) { payloadBytes += json.length(); return true; }
+    virtual bool postProtobuf(const uint8_t* payload, size_t length) { payloadBytes += length; return true; }
+};
+
+//
+// Mqtt logger with the broker connection and publish stubbed out
+//
+class BenchmarkLoggerInterfaceMqtt : public LoggerInterfaceMqtt
+{
+  public:
+    unsigned long payloadBytes = 0;
+    BenchmarkLoggerInterfaceMqtt(uint8_t encoding) : LoggerInterfaceMqtt("benchmark", "127.0.0.1", MQTT_DEFAULT_PORT, "benchmark/", encoding) {};
+  protected:
+    virtual bool isConnected() { return true; }
+    virtual bool publish(const char* topic, const uint8_t* payload, size_t length) { payloadBytes += length; return true; }
+};
+
+class IrrigationBenchmark
+{
+  private:
+    JsonDocument _resultsDoc;
+    JsonObject recordResult(const char* name, unsigned long iterations, unsigned long elapsedMicros, unsigned long allocations, bool perReading);
+    void benchmarkLogMoistureLevel(const char* name, LoggerInterface* interface, const unsigned long* payloadBytes = NULL);
+    void benchmarkLokiEncoding(const char* name, uint8_t encoding);
+    void benchmarkMqttEncoding(const char* name, uint8_t encoding);
+    void benchmarkProcessJsonConfig(int groupCount, std::array<int,3> selectorPins);
+    void benchmarkSensors(std::array<int,3> selectorPins);
+
+  public:
+    void run(std::array<int,3> selectorPins);
+};
+/****************************************/
+
+JsonObject IrrigationBenchmark::recordResult(const char* name, unsigned long iterations, unsigned long elapsedMicros, unsigned long allocations, bool perReading) {
+    JsonObject resultJson = _resultsDoc["benchmarks"].add<JsonObject>();
+    resultJson["name"] = name;
+    resultJson["iterations"] = iterations;
+    resultJson["microsPerOp"] = (float)elapsedMicros / iterations;
+    resultJson["allocationsPerOp"] = (float)allocations / iterations;
+    resultJson["perReading"] = perReading;
+    return resultJson;
+}
+
+//
+// Logs moisture readings through one interface. If payloadBytes is given, the interface's
+// byte count is also reported per reading, before the logger deletes the interface.
+//
+void IrrigationBenchmark::benchmarkLogMoistureLevel(const char* name, LoggerInterface* interface, const unsigned long* payloadBytes) {
+    IrrigationLogger logger;
+    logger.setNetworkAvailable(true); // Network I/O is stubbed, so don't buffer
+    logger.addLoggerInterface(interface);
+    String group("benchmark");
+
+    unsigned long startAllocations = heapAccounting.getTotalAllocations();
+    unsigned long startMicros = micros();
+    for (int i = 0; i < BENCHMARK_LOG_ITERATIONS; i++) {
+        logger.logMoistureLevel(group, i % WATERINGSYSTEM_NUMBEROFSENSORS, 400 + i, 250);
+        while (logger.sendPendingEvent()) {}
+        yield();
+    }
+    JsonObject resultJson = recordResult(name, BENCHMARK_LOG_ITERATIONS, micros() - startMicros, heapAccounting.getTotalAllocations() - startAllocations, true);
+    if (payloadBytes) {
+        resultJson["payloadBytesPerOp"] = (float)*payloadBytes / BENCHMARK_LOG_ITERATIONS;
+    }
+}
+
+//
+// As benchmarkLogMoistureLevel, also reporting the Loki push request size per entry
+//
+void IrrigationBenchmark::benchmarkLokiEncoding(const char* name, uint8_t encoding) {
+    BenchmarkLoggerInterfaceLoki* interface = new BenchmarkLoggerInterfaceLoki(encoding);
+    benchmarkLogMoistureLevel(name, interface, &interface->payloadBytes);
+}
+
+//
+// As benchmarkLogMoistureLevel, also reporting the Mqtt payload size per reading
+//
+void IrrigationBenchmark::benchmarkMqttEncoding(const char* name, uint8_t encoding) {
+    BenchmarkLoggerInterfaceMqtt* interface = new BenchmarkLoggerInterfaceMqtt(encoding);
+    benchmarkLogMoistureLevel(name, interface, &interface->payloadBytes);
+}
+
+//
+// Applies configs to a service of its own, with its own sensor handler and a web server
+// that is never started, so the running service and its loggers are left alone
+//
+void IrrigationBenchmark::benchmarkProcessJsonConfig(int groupCount, std::array<int,3> selectorPins) {
+    JsonDocument configDoc;
+    configDoc["instance"] = "benchmark";
+    JsonArray groupsJson = configDoc["groups"].to<JsonArray>();
+    for (int i = 0; i < groupCount; i++) {
+        JsonObject groupJson = groupsJson.add<JsonObject>();
+        groupJson["name"] = String("group") + i;
+        groupJson["triggerType"] = (i % 2) ? "all" : "any";
+        groupJson["waterSensorChannel"] = 0;
+        JsonArray channelsJson = groupJson["moistureSensorChannels"].to<JsonArray>();
+        channelsJson.add(1 + (i % 7));
+        JsonArray pinsJson = groupJson["pumpPinIds"].to<JsonArray>();
+        pinsJson.add("D4");
+        groupJson["minMoisture"] = 250;
+        groupJson["pumpSecs"] = 2;
+        groupJson["waterCheckPeriodMs"] = 1200000;
+        groupJson["pumpCheckPeriodMs"] = 1000;
+        groupJson["moistureCheckPeriodMs"] = 60000;
+    }
+
+    AnalogueSensorHandler* sensorHandler = new AnalogueSensorHandler(selectorPins);
+    IrrigationService* service = new IrrigationService(sensorHandler);
+    ESP8266WebServer* server = new ESP8266WebServer(0);
+    ConfigManager* configManager = new ConfigManager(server, service, sensorHandler);
+
+    unsigned long startAllocations = heapAccounting.getTotalAllocations();
+    unsigned long startMicros = micros();
+    for (int i = 0; i < BENCHMARK_CONFIG_ITERATIONS; i++) {
+        configManager->processJsonConfig(configDoc, true);
+        yield();
+    }
+    String name("processJsonConfig/");
+    name += groupCount;
+    recordResult(name.c_str(), BENCHMARK_CONFIG_ITERATIONS, micros() - startMicros, heapAccounting.getTotalAllocations() - startAllocations, false);
+
+    delete configManager;
+    delete server;
+    delete service;
+    delete sensorHandler;
+}
+
+void IrrigationBenchmark::benchmarkSensors(std::array<int,3> selectorPins) {
+    // Synthetic readings, without multiplexer settle delays
+    AnalogueSensorHandler sensorHandler(selectorPins);
+    SensorSourceSimulated* simulated = new SensorSourceSimulated(WATERINGSYSTEM_NUMBEROFSENSORS);
+    for (uint8_t channel = 0; channel < WATERINGSYSTEM_NUMBEROFSENSORS; channel++) {
+        SimulatedChannelProfile profile;
+        profile.base = 300 + channel * 50;
+        profile.amplitude = 100;
+        profile.noise = 5;
+        simulated->setProfile(channel, profile);
+    }
+    sensorHandler.removeSensorSources();
+    sensorHandler.addSensorSource(simulated);
+
+    unsigned long startAllocations = heapAccounting.getTotalAllocations();
+    unsigned long startMicros = micros();
+    for (int i = 0; i < BENCHMARK_SENSOR_ITERATIONS; i++) {
+        sensorHandler.pollSensors();
+        yield();
+    }
+    recordResult("pollSensors", BENCHMARK_SENSOR_ITERATIONS, micros() - startMicros, heapAccounting.getTotalAllocations() - startAllocations, true);
+
+    volatile int sum = 0;
+    startAllocations = heapAccounting.getTotalAllocations();
+    startMicros = micros();
+    for (int i = 0; i < BENCHMARK_SENSOR_ITERATIONS; i++) {
+        sum += sensorHandler.getSensorSimpleMovingAverageReading(i % WATERINGSYSTEM_NUMBEROFSENSORS);
+    }
+    recordResult("getSensorSimpleMovingAverageReading", BENCHMARK_SENSOR_ITERATIONS, micros() - startMicros, heapAccounting.getTotalAllocations() - startAllocations, true);
+}
+
+// Runs all benchmarks and prints the results
+void IrrigationBenchmark::run(std::array<int,3> selectorPins) {
+    _resultsDoc["build"] = buildDate;
+    _resultsDoc["benchmarks"].to<JsonArray>();
+
+    benchmarkLogMoistureLevel("logMoistureLevel/serial", new LoggerInterfaceSerial("benchmark"));
+    benchmarkLokiEncoding("logMoistureLevel/loki", LOKI_ENCODING_JSON);
+    benchmarkLokiEncoding("logMoistureLevel/loki-protobuf", LOKI_ENCODING_PROTOBUF);
+    benchmarkMqttEncoding("logMoistureLevel/mqtt", MQTT_ENCODING_JSON);
+    benchmarkMqttEncoding("logMoistureLevel/mqtt-msgpack", MQTT_ENCODING_MSGPACK);
+    benchmarkMqttEncoding("logMoistureLevel/mqtt-struct", MQTT_ENCODING_STRUCT);
+
+    benchmarkProcessJsonConfig(1, selectorPins);
+    benchmarkProcessJsonConfig(4, selectorPins);
+    benchmarkProcessJsonConfig(16, selectorPins);
+
+    benchmarkSensors(selectorPins);
+
+    String results;
+    serializeJson(_resultsDoc, results);
+    serialConsole.println("BENCHMARK " + results);
+}
+
+#endif
+
+#endif
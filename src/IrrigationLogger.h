@@ -3,6 +3,12 @@
 //
 
 #include "LoggerInterface.h"
+#include "TraceRecorder.h"
+#include "TaskScheduler.h"
+#include "LogEventQueue.h"
+#include "ChannelHealth.h"
+#include "PersistentCounters.h"
+#include <list>
 
 #ifndef __WATERINGSYSTEM_IRRIGATIONLOGGER_H__
 #define __WATERINGSYSTEM_IRRIGATIONLOGGER_H__
@@ -13,6 +19,18 @@ class IrrigationLogger
 {
   private: 
       std::list<LoggerInterface*> _interfaces{};
+      unsigned long _lastSystemStatsMillis = 0;
+      bool _networkAvailable = false;
+      LogEventQueue _queuedEvents;
+      unsigned long _replayedEvents = 0;
+
+      uint32_t selectRecipients(LogMetric metric, const String& group, int channel, int value, uint32_t rolledUp = 0);
+      uint32_t rollUp(LogMetric metric, const String& group, int channel, int value);
+      void closeRollupWindows();
+      void logMetric(LogMetric metric, JsonDocument& valueDoc, uint32_t recipients);
+      void logGroupMetric(LogMetric metric, const String& group, JsonDocument& valueDoc, uint32_t recipients);
+      void dispatchEvent(LogMetric metric, bool isGroupMetric, const String& group, JsonDocument& valueDoc, uint32_t recipients);
+      void sendEvent(LoggerInterface* interface, LogMetric metric, bool isGroupMetric, const String& group, JsonDocument& valueDoc);
 
   public:
       IrrigationLogger();
@@ -22,16 +40,20 @@ class IrrigationLogger
       // Config methods
       void addLoggerInterface(LoggerInterface* interface);
       void removeLoggerInterfaces();
+      void reserveFilterSeries(const uint16_t* seriesPerMetric);
+      void setNetworkAvailable(bool available);
+      bool sendPendingEvent();
       void loop();
 
       // Context specific log methods
-      void logStartup(IPAddress ipAddress);
-      void logSystemStats();
+      void logStartup(IPAddress ipAddress, unsigned long firstControlMillis, unsigned long networkReadyMillis);
+      void logSystemStats(TaskScheduler* scheduler, PersistentCounters* counters);
       void logConfigLoad();
       void logPumpStatus(String group, bool status);
       void logMoistureLevel(String group, int channelNumber, int level, int minLevel);
       void logWaterLevel(String group, int value);
       void logMoistureAlarmStatus(String group, bool status);
+      void logSensorHealth(int channelNumber, ChannelHealth* health);
 };
 /****************************************/
 
@@ -48,90 +70,312 @@ void IrrigationLogger::removeLoggerInterfaces() {
         delete interface;
     }
     _interfaces.clear();
+    // Queued events refer to interfaces by position
+    _queuedEvents.clear();
 }
 
+// Interfaces beyond the 32nd receive no events
 void IrrigationLogger::addLoggerInterface(LoggerInterface* interface) {
     _interfaces.push_back(interface);
 }
 
-void IrrigationLogger::logStartup(IPAddress ipAddress) {
+// Sizes each interface's filter to the series, per metric, of the applied configuration
+void IrrigationLogger::reserveFilterSeries(const uint16_t* seriesPerMetric) {
+    for (auto & interface : _interfaces) {
+        interface->getFilter()->reserveSeries(seriesPerMetric);
+    }
+}
+
+//
+// Network loggers only receive events once the network is available. Until then, events
+// are queued (dropping the oldest when full), and sent once it becomes available.
+//
+void IrrigationLogger::setNetworkAvailable(bool available) {
+    if (available && !_networkAvailable) {
+        _replayedEvents = _queuedEvents.size(); // Held while the network was down
+    }
+    _networkAvailable = available;
+}
+
+//
+// Runs each interface's filter, returning a bit per interface that wants the event.
+// Called before an event's Json is built, so filtered events cost little. Interfaces
+// that have rolled the value up are skipped, leaving their filters untouched.
+//
+uint32_t IrrigationLogger::selectRecipients(LogMetric metric, const String& group, int channel, int value, uint32_t rolledUp) {
+    uint32_t recipients = 0;
+    uint8_t index = 0;
+    for (auto & interface : _interfaces) {
+        if (index < 32 && !(rolledUp & (1UL << index)) && interface->getFilter()->accept(metric, group, channel, value)) {
+            recipients |= 1UL << index;
+        }
+        index++;
+    }
+    return recipients;
+}
+
+//
+// Adds a value to the rollup of each interface rolling up the metric, returning a bit per
+// interface that took it. Rollups see every reading, before any filtering, so the
+// summaries cover the whole window.
+//
+uint32_t IrrigationLogger::rollUp(LogMetric metric, const String& group, int channel, int value) {
+    uint32_t rolledUp = 0;
+    uint8_t index = 0;
+    for (auto & interface : _interfaces) {
+        TelemetryRollup* rollup = interface->getRollup();
+        if (index < 32 && rollup && rollup->rollsUp(metric) && rollup->add(metric, group, channel, value)) {
+            rolledUp |= 1UL << index;
+        }
+        index++;
+    }
+    return rolledUp;
+}
+
+//
+// Sends each logger whose rollup window has closed the events summarising it. The
+// events go to that logger alone, unfiltered, as its filter is for readings sent as
+// they are.
+//
+void IrrigationLogger::closeRollupWindows() {
+    uint8_t index = 0;
+    for (auto & interface : _interfaces) {
+        TelemetryRollup* rollup = interface->getRollup();
+        if (index < 32 && rollup && rollup->isWindowClosed()) {
+            HEAP_SCOPE(HEAP_TAG_LOGGER);
+            rollup->closeWindow();
+            JsonDocument valueDoc(&loggerJsonArena);
+            while (rollup->takeEvent(valueDoc)) {
+                logMetric(LOG_METRIC_ROLLUP, valueDoc, 1UL << index);
+                valueDoc.clear();
+            }
+        }
+        index++;
+    }
+}
+
+void IrrigationLogger::sendEvent(LoggerInterface* interface, LogMetric metric, bool isGroupMetric, const String& group, JsonDocument& valueDoc) {
+    TRACE_SCOPE(TRACE_EVENT_LOGGERSEND, metric);
+    if (isGroupMetric) {
+        interface->logJsonGroupMetric(logMetricNames[metric], group, valueDoc);
+    } else {
+        interface->logJsonMetric(logMetricNames[metric], valueDoc);
+    }
+}
+
+void IrrigationLogger::logMetric(LogMetric metric, JsonDocument& valueDoc, uint32_t recipients) {
+    dispatchEvent(metric, false, String(), valueDoc, recipients);
+}
+
+void IrrigationLogger::logGroupMetric(LogMetric metric, const String& group, JsonDocument& valueDoc, uint32_t recipients) {
+    dispatchEvent(metric, true, group, valueDoc, recipients);
+}
+
+//
+// Sends an event to the selected interfaces. Events for network interfaces are queued,
+// and sent one at a time by sendPendingEvent() from the telemetry task, so a slow
+// network send never holds up pump control.
+//
+void IrrigationLogger::dispatchEvent(LogMetric metric, bool isGroupMetric, const String& group, JsonDocument& valueDoc, uint32_t recipients) {
+    uint32_t deferred = 0;
+    uint8_t index = 0;
+    for (auto & interface : _interfaces) {
+        if (recipients & (1UL << index)) {
+            if (!interface->requiresNetwork()) {
+                sendEvent(interface, metric, isGroupMetric, group, valueDoc);
+            } else {
+                deferred |= 1UL << index;
+            }
+        }
+        index++;
+    }
+    if (deferred) {
+        _queuedEvents.push(metric, isGroupMetric, group, valueDoc, deferred);
+    }
+}
+
+//
+// Sends the oldest queued event to its network loggers, with its age so loggers that
+// timestamp events can backdate them. Returns true if more events are pending.
+//
+bool IrrigationLogger::sendPendingEvent() {
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    LogEventHeader event;
+    String group;
+    JsonDocument valueDoc(&loggerJsonArena);
+    if (!_networkAvailable || !_queuedEvents.front(&event, &group, valueDoc)) {
+        return false;
+    }
+    unsigned long age = millis() - event.timeMillis;
+    uint8_t index = 0;
+    for (auto & interface : _interfaces) {
+        if (event.recipients & (1UL << index)) {
+            interface->setEventAge(age);
+            sendEvent(interface, (LogMetric)event.metric, event.isGroupMetric, group, valueDoc);
+            interface->setEventAge(0);
+        }
+        index++;
+    }
+    _queuedEvents.pop();
+    return !_queuedEvents.empty();
+}
+
+//
+// Reports the boot, once the network is up. Irrigation control starts before the
+// network, so the time to the first control decision and the time the network took
+// are reported separately, along with the events buffered in between.
+//
+void IrrigationLogger::logStartup(IPAddress ipAddress, unsigned long firstControlMillis, unsigned long networkReadyMillis) {
+      HEAP_SCOPE(HEAP_TAG_LOGGER);
+      uint32_t recipients = selectRecipients(LOG_METRIC_BOOT, String(), -1, 0);
+      if (!recipients) {
+          return;
+      }
       // Build value
-      JsonDocument valuesDoc;
+      JsonDocument valuesDoc(&loggerJsonArena);
       String valueString;
-      JsonDocument valueDoc = JsonObject();
+      JsonDocument valueDoc(&loggerJsonArena);
       valueDoc["ipAddress"] = ipAddress.toString();
       valueDoc["buildDate"] = buildDate;
+      if (firstControlMillis) {
+          valueDoc["firstControlMillis"] = firstControlMillis;
+      }
+      valueDoc["networkReadyMillis"] = networkReadyMillis;
+      valueDoc["bufferedEvents"] = _replayedEvents;
+      valueDoc["droppedEvents"] = _queuedEvents.getDroppedEvents();
     //  serializeJson(valueDoc,valueString);
 
-      for (auto & interface : _interfaces) {
-          interface->logJsonMetric("boot",valueDoc);
-      }
+      logMetric(LOG_METRIC_BOOT,valueDoc,recipients);
   //  logString(streamDoc, valueString);
   }
 
-  void IrrigationLogger::logSystemStats() {
+  //
+  // Reports heap, Json arena use, loop and per task cost, lifetime pump counters, plus per logger
+  // telemetry volume since the previous report, which gives the ingestion load each
+  // device places on the logging backends.
+  //
+  void IrrigationLogger::logSystemStats(TaskScheduler* scheduler, PersistentCounters* counters) {
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    uint32_t recipients = selectRecipients(LOG_METRIC_SYSTEMSTATS, String(), -1, 0);
+    if (!recipients) {
+        return;
+    }
     // Build stream value
     // JsonDocument valuesDoc;
     // String valueString;
-    JsonDocument valueDoc = JsonObject();
+    JsonDocument valueDoc(&loggerJsonArena);
     valueDoc["getHeapFragmentation"] = ESP.getHeapFragmentation();
     valueDoc["getFreeHeap"] = ESP.getFreeHeap();
     valueDoc["getFreeSketchSpace"] = ESP.getFreeSketchSpace();
     valueDoc["getMaxFreeBlockSize"] = ESP.getMaxFreeBlockSize();
+    scheduler->reportStats(valueDoc.as<JsonObject>());
+    valueDoc["droppedEvents"] = _queuedEvents.getDroppedEvents();
+    counters->report(valueDoc["counters"].to<JsonObject>());
+    JsonArray arenasJson = valueDoc["jsonArenas"].to<JsonArray>();
+    loggerJsonArena.reportStats(arenasJson.add<JsonObject>());
+    configJsonArena.reportStats(arenasJson.add<JsonObject>());
+#ifdef WATERINGSYSTEM_HEAP_ACCOUNTING
+    reportHeapAccounting(valueDoc["heap"].to<JsonObject>());
+#endif
 
+    unsigned long now = millis();
+    JsonArray loggersJson = valueDoc["loggers"].to<JsonArray>();
     for (auto & interface : _interfaces) {
-        interface->logJsonMetric("system-stats",valueDoc);
+        interface->reportStats(loggersJson.add<JsonObject>(), now - _lastSystemStatsMillis);
     }
+    _lastSystemStatsMillis = now;
+
+    logMetric(LOG_METRIC_SYSTEMSTATS,valueDoc,recipients);
 }
 
 void IrrigationLogger::logConfigLoad() {
-    JsonDocument valuesDoc;
-
-    for (auto & interface : _interfaces) {
-        interface->logJsonMetric("config-load",valuesDoc);
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    uint32_t recipients = selectRecipients(LOG_METRIC_CONFIGLOAD, String(), -1, 0);
+    if (!recipients) {
+        return;
     }
+    JsonDocument valuesDoc(&loggerJsonArena);
+
+    logMetric(LOG_METRIC_CONFIGLOAD,valuesDoc,recipients);
 }
 
 void IrrigationLogger::logPumpStatus(String group, bool status) {
-    JsonDocument valueDoc = JsonObject();
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    uint32_t recipients = selectRecipients(LOG_METRIC_PUMPSTATUS, group, -1, status);
+    if (!recipients) {
+        return;
+    }
+    JsonDocument valueDoc(&loggerJsonArena);
     valueDoc["status"] = status;
 
-    for (auto & interface : _interfaces) {
-        interface->logJsonGroupMetric("pump-status",group,valueDoc);
-    }
+    logGroupMetric(LOG_METRIC_PUMPSTATUS,group,valueDoc,recipients);
 }
 
 void IrrigationLogger::logMoistureLevel(String group, int channelNumber, int level, int minLevel) {
-    JsonDocument valueDoc = JsonObject();
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    uint32_t rolledUp = rollUp(LOG_METRIC_MOISTURE, group, channelNumber, level);
+    uint32_t recipients = selectRecipients(LOG_METRIC_MOISTURE, group, channelNumber, level, rolledUp);
+    if (!recipients) {
+        return;
+    }
+    JsonDocument valueDoc(&loggerJsonArena);
     valueDoc["channel"] = channelNumber;
     valueDoc["level"] = level;
     valueDoc["minLevel"] = minLevel;
 
-    for (auto & interface : _interfaces) {
-        interface->logJsonGroupMetric("moisture",group,valueDoc);
-    }
+    logGroupMetric(LOG_METRIC_MOISTURE,group,valueDoc,recipients);
 }
 
 void IrrigationLogger::logWaterLevel(String group, int value) {
-    JsonDocument valueDoc = JsonObject();
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    uint32_t rolledUp = rollUp(LOG_METRIC_WATER, group, -1, value);
+    uint32_t recipients = selectRecipients(LOG_METRIC_WATER, group, -1, value, rolledUp);
+    if (!recipients) {
+        return;
+    }
+    JsonDocument valueDoc(&loggerJsonArena);
     valueDoc["level"] = value;
 
-    for (auto & interface : _interfaces) {
-        interface->logJsonGroupMetric("water",group,valueDoc);
-    }
+    logGroupMetric(LOG_METRIC_WATER,group,valueDoc,recipients);
 }
 
 void IrrigationLogger::logMoistureAlarmStatus(String group, bool status) {
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    uint32_t recipients = selectRecipients(LOG_METRIC_MOISTUREALARMSTATUS, group, -1, status);
+    if (!recipients) {
+        return;
+    }
 
-    JsonDocument valueDoc = JsonObject();
+    JsonDocument valueDoc(&loggerJsonArena);
     valueDoc["status"] = status;
 
-    for (auto & interface : _interfaces) {
-        interface->logJsonGroupMetric("moisture-alarm-status",group,valueDoc);
+    logGroupMetric(LOG_METRIC_MOISTUREALARMSTATUS,group,valueDoc,recipients);
+}
+
+//
+// Reports a channel becoming faulty or recovering, with the statistics of its recent
+// raw readings
+//
+void IrrigationLogger::logSensorHealth(int channelNumber, ChannelHealth* health) {
+    HEAP_SCOPE(HEAP_TAG_LOGGER);
+    uint32_t recipients = selectRecipients(LOG_METRIC_SENSORHEALTH, String(), channelNumber, health->getStatus());
+    if (!recipients) {
+        return;
     }
+
+    JsonDocument valueDoc(&loggerJsonArena);
+    valueDoc["channel"] = channelNumber;
+    valueDoc["status"] = channelHealthNames[health->getStatus()];
+    valueDoc["mean"] = health->getMean();
+    valueDoc["stddev"] = health->getStandardDeviation();
+    valueDoc["min"] = health->getMin();
+    valueDoc["max"] = health->getMax();
+
+    logMetric(LOG_METRIC_SENSORHEALTH,valueDoc,recipients);
 }
 
 void IrrigationLogger::loop() {
+    closeRollupWindows();
     for (auto & interface : _interfaces) {
         interface->loop();
     }
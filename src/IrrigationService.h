@@ -9,33 +9,59 @@
 #include <WiFiUdp.h>
 #include <ArduinoJson.h>
 #include <list>
+#include <algorithm>
 #include "SensorGroup.h"
 #include "AnalogueSensorHandler.h"
+#include "ActuatorOutputs.h"
+#include "ActuatorBackendGpio.h"
+#include "TaskScheduler.h"
+#include "PersistentCounters.h"
+#include "SensorRecorder.h"
 
 #ifndef __WATERINGSYSTEM_IRRIGATIONSERVICE_H__
 #define __WATERINGSYSTEM_IRRIGATIONSERVICE_H__
 
 #define WATERINGSYSTEM_SENSORPOLLSECS 5 // How often to background poll the sensors
 #define WATERINGSYSTEM_SYSTEMSTATSREPORTSECS 600 // How often to report system stats
+#define WATERINGSYSTEM_TELEMETRYBUDGETMICROS 20000 // Time per loop pass for sending log events
   
 class IrrigationService 
 {
   private:
       IrrigationLogger* _logger;
       std::list<SensorGroup*> _sensorGroups{};
+      std::list<SensorGroup*> _staticSensorGroups{}; // Registered groups not owned by the service
       IrrigationTimer _systemStatsTimer = IrrigationTimer("systemStats");
       IrrigationTimer _sensorPollTimer = IrrigationTimer("sensorPollTimer");
       AnalogueSensorHandler* _analogueSensorHandler;
+      ActuatorOutputs* _actuatorOutputs;
+      TaskScheduler _scheduler;
+      PersistentCounters _counters;
+      SensorRecorder* _recorder = NULL; // Optional recording of readings and pump changes
+      uint32_t _recordedOutputs = 0;
+      unsigned long _firstControlMillis = 0; // Uptime at the first control pass with groups configured
+
+      void controlStep();
+      void sensorStep();
+      bool telemetryStep();
 
   public:
       IrrigationService(AnalogueSensorHandler* analogueSensorHandler);
       ~IrrigationService();
       // Configuration methods
       void registerSensorGroup(SensorGroup *group);
+      void registerStaticSensorGroup(SensorGroup *group);
       SensorGroup* getSensorGroupByName(String groupName);
+      const std::list<SensorGroup*>& getSensorGroups();
       void removeSensorGroups();
       void setInstanceName(String instanceName);
       IrrigationLogger *getLogger();
+      ActuatorOutputs *getActuatorOutputs();
+      TaskScheduler *getScheduler();
+      PersistentCounters *getCounters();
+      void setRecorder(SensorRecorder* recorder);
+      SensorRecorder *getRecorder();
+      unsigned long getFirstControlMillis();
       
       
       // Operation methods
@@ -48,11 +74,25 @@ class IrrigationService
 IrrigationService::IrrigationService(AnalogueSensorHandler* analogueSensorHandler) {
     _logger = new IrrigationLogger();
     _analogueSensorHandler = analogueSensorHandler;
+    _actuatorOutputs = new ActuatorOutputs();
+    _actuatorOutputs->setBackend(new ActuatorBackendGpio({D0, D1, D2, D3, D4}), false);
+    _scheduler.addTask("control", TASK_PRIORITY_CONTROL, 0, [this]() {
+        this->controlStep();
+        return false;
+    });
+    _scheduler.addTask("sensors", TASK_PRIORITY_SENSORS, 0, [this]() {
+        this->sensorStep();
+        return false;
+    });
+    _scheduler.addTask("telemetry", TASK_PRIORITY_TELEMETRY, WATERINGSYSTEM_TELEMETRYBUDGETMICROS, [this]() {
+        return this->telemetryStep();
+    });
     return;
 }
 
 IrrigationService::~IrrigationService() {
     removeSensorGroups();
+    delete _actuatorOutputs;
     delete _logger;
     return;
 }
@@ -61,9 +101,44 @@ IrrigationLogger *IrrigationService::getLogger() {
     return _logger;
 }
 
+ActuatorOutputs *IrrigationService::getActuatorOutputs() {
+    return _actuatorOutputs;
+}
+
+// The main loop's scheduler, for adding the network tasks
+TaskScheduler *IrrigationService::getScheduler() {
+    return &_scheduler;
+}
+
+// Lifetime pump counters, loaded with begin() before the sensor groups are registered
+PersistentCounters *IrrigationService::getCounters() {
+    return &_counters;
+}
+
+void IrrigationService::setRecorder(SensorRecorder* recorder) {
+    _recorder = recorder;
+}
+
+SensorRecorder *IrrigationService::getRecorder() {
+    return _recorder;
+}
+
+unsigned long IrrigationService::getFirstControlMillis() {
+    return _firstControlMillis;
+}
+
 // Register a sensor group with the service. IrrigationService takes
 // responsibilty for destruction of a registered SensorGroup object
 void IrrigationService::registerSensorGroup(SensorGroup *sensorGroup) {
+    sensorGroup->setCounters(&_counters);
+    _sensorGroups.push_back(sensorGroup);
+}
+
+// Register a statically allocated sensor group. These are taken out of service, but
+// not destroyed, when the sensor groups are removed.
+void IrrigationService::registerStaticSensorGroup(SensorGroup *sensorGroup) {
+    sensorGroup->setCounters(&_counters);
+    _staticSensorGroups.push_back(sensorGroup);
     _sensorGroups.push_back(sensorGroup);
 }
 
@@ -76,15 +151,26 @@ SensorGroup* IrrigationService::getSensorGroupByName(String groupName) {
   return NULL;
 }
 
+const std::list<SensorGroup*>& IrrigationService::getSensorGroups() {
+    return _sensorGroups;
+}
+
 void IrrigationService::setInstanceName(String instanceName) {
 //    _logger->setJobName(instanceName);
 }
 
 void IrrigationService::removeSensorGroups() {
     for (auto & group : _sensorGroups) {
-      delete group;
+      if (std::find(_staticSensorGroups.begin(), _staticSensorGroups.end(), group) != _staticSensorGroups.end()) {
+        group->stopPumping();
+      } else {
+        delete group;
+      }
     }
     _sensorGroups.clear();
+    _staticSensorGroups.clear();
+    // Make sure pumps of removed groups are switched off straight away
+    _actuatorOutputs->commit();
 }
 
 
@@ -98,28 +184,74 @@ bool IrrigationService::isPumping() {
 }
 
 //
-// Main logic function
+// Main logic function, running one pass of the scheduled tasks
 //
 void IrrigationService::loop() {
-    _logger->loop();
-   
-    // Poll the analogue sensors
-    if (_sensorPollTimer.hasLapsed()) {
-        _analogueSensorHandler->pollSensors();
-        _sensorPollTimer.setTimer(WATERINGSYSTEM_SENSORPOLLSECS*1000);
-    }
+    _scheduler.loop();
+}
 
-    // Loop throughh each group, triggering any required actions
+//
+// Runs each group's control logic, then applies all pump changes from the pass in a
+// single write
+//
+void IrrigationService::controlStep() {
+    uint16_t groupIndex = 0;
     for (auto & group : _sensorGroups) {
+        TRACE_SCOPE(TRACE_EVENT_SENSORGROUP, groupIndex++);
         group->loop();
     }
+    _actuatorOutputs->commit();
+    uint32_t outputs = _actuatorOutputs->getCommittedOutputs();
+    if (_recorder && outputs != _recordedOutputs) {
+        _recorder->recordPumps(millis() / 1000, outputs);
+        _recordedOutputs = outputs;
+    }
+    if (_firstControlMillis == 0 && !_sensorGroups.empty()) {
+        _firstControlMillis = millis();
+    }
+}
 
-    // Report system stats to help monitor heap and available memory
+// Background polls the analogue sensors, telling the sensor groups reading the updated
+// channels to evaluate, recording the readings if enabled, and reporting any channels
+// found faulty or recovered
+void IrrigationService::sensorStep() {
+    if (_sensorPollTimer.hasLapsed()) {
+        _analogueSensorHandler->pollSensors();
+        _sensorPollTimer.setTimer(WATERINGSYSTEM_SENSORPOLLSECS*1000);
+        uint32_t updatedChannels = _analogueSensorHandler->takeUpdatedChannels();
+        for (auto & group : _sensorGroups) {
+            group->notifyMoistureUpdate(updatedChannels);
+        }
+        if (_recorder && _recorder->isEnabled()) {
+            int16_t readings[WATERINGSYSTEM_MAXSENSORS];
+            uint8_t channelCount = _analogueSensorHandler->getChannelCount();
+            for (uint8_t channel = 0; channel < channelCount; channel++) {
+                readings[channel] = _analogueSensorHandler->getLatestRawReading(channel);
+            }
+            _recorder->recordSample(millis() / 1000, readings, channelCount);
+        }
+        uint32_t healthChanges = _analogueSensorHandler->takeHealthChanges();
+        while (healthChanges) {
+            uint8_t channelNumber = __builtin_ctz(healthChanges);
+            healthChanges &= healthChanges - 1;
+            _logger->logSensorHealth(channelNumber, _analogueSensorHandler->getChannelHealth(channelNumber));
+        }
+    }
+}
+
+//
+// Sends one queued log event, returning true if more are waiting. System stats, to help
+// monitor heap, memory and loop cost, are queued here too, and the pump counters flushed
+// to flash when due.
+//
+bool IrrigationService::telemetryStep() {
+    _logger->loop();
     if (_systemStatsTimer.hasLapsed()) {
-        _logger->logSystemStats();
+        _logger->logSystemStats(&_scheduler, &_counters);
         _systemStatsTimer.setTimer(WATERINGSYSTEM_SYSTEMSTATSREPORTSECS*1000); // Report stats every 10 minutes
     }
-
+    _counters.flushIfDue();
+    return _logger->sendPendingEvent();
 }
 
 #endif
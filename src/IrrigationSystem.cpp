@@ -9,12 +9,18 @@
 #include "IrrigationLogger.h"
 #include "LoggerInterface.h"
 #include "AnalogueSensorHandler.h"
+#include "SensorHistory.h"
+#include "SensorRecorder.h"
 #include "ConfigManager.h"
 #include <list>
 #include <DNSServer.h>
 #include <ESP8266WebServer.h>
 #include <WiFiManager.h> 
 #include <ElegantOTA.h>
+#ifdef WATERINGSYSTEM_BENCHMARK
+#include "IrrigationBenchmark.h"
+#include "SerialConsole.h"
+#endif
 
 fauxmoESP fauxmo;
 WiFiManager wifiManager;
@@ -22,17 +28,26 @@ WiFiManager wifiManager;
 // Irrigation service setup
 std::array<int,3> analogueSelectorPinIds = {D5,D6,D7};
 AnalogueSensorHandler analogueSensorHandler(analogueSelectorPinIds);
+SensorHistory sensorHistory;
+SensorRecorder sensorRecorder;
 ESP8266WebServer server(8080);
 IrrigationService irrigationService = IrrigationService(&analogueSensorHandler);
 ConfigManager configManager(&server, &irrigationService, &analogueSensorHandler);
 
 #define SERIAL_BAUD_RATE    115200
+#define WATERINGSYSTEM_WIFICONNECTSECS 30 // How long to try saved Wi-Fi credentials before starting the config portal
 
 //
 // Network connection status LED
 int NETWORK_STATUS_LED = D8; 
 bool serviceActive = false;
 
+// Staged boot state. Irrigation control runs from the stored configuration straight away,
+// and network services are attached once Wi-Fi connects.
+bool networkAttached = false;
+bool configPortalStarted = false;
+void connectNetwork();
+
 /*---------------------------------------*/
 //Runs once, when device is powered on or code has just been flashed 
 void setup()
@@ -45,9 +60,34 @@ void setup()
     }
     
     Serial.begin(SERIAL_BAUD_RATE);
-  
-//    wifiManager.setConfigPortalTimeout(120);
-    wifiManager.autoConnect();
+    analogueSensorHandler.setHistory(&sensorHistory);
+    irrigationService.setRecorder(&sensorRecorder);
+
+#ifdef WATERINGSYSTEM_BENCHMARK
+    IrrigationBenchmark().run(analogueSelectorPinIds);
+#endif
+    // Start irrigation control from flash, without waiting for the network. The pump
+    // counters are loaded first, so the sensor groups pick up their lifetime counts.
+    irrigationService.getCounters()->begin();
+    configManager.recoverConfiguration();
+    configManager.loadConfiguration();
+
+    // Connect with the saved credentials in the background. If these don't connect,
+    // the config portal is started from loop() without blocking.
+    WiFi.mode(WIFI_STA);
+    WiFi.begin();
+    wifiManager.setConfigPortalBlocking(false);
+
+    // HTTP, OTA and Wi-Fi run at the lowest priority, after pump control, sensors and telemetry
+    irrigationService.getScheduler()->addTask("network", TASK_PRIORITY_NETWORK, 0, []() {
+        if (networkAttached) {
+            configManager.handleClient();
+            ElegantOTA.loop();
+        } else {
+            connectNetwork();
+        }
+        return false;
+    });
 
     // fauxmo.addDevice("irigation system");
     // fauxmo.setPort(80); // required for gen3 devices
@@ -57,20 +97,51 @@ void setup()
     //   digitalWrite(NETWORK_STATUS_LED, state); // turn the LED off
     //   serviceActive = state;   
     // });
+}
+
+/*---------------------------------------*/
+// Brings up the services needing the network, once Wi-Fi has connected. Events
+// logged before now are replayed to the network loggers.
+void attachNetworkServices()
+{
+    unsigned long networkReadyMillis = millis();
+    configManager.startServer();
     ElegantOTA.begin(&server);
     ElegantOTA.setAutoReboot(true);
+    ElegantOTA.onStart([]() {
+        irrigationService.getCounters()->flush();
+    });
+    serialConsole.println(WiFi.localIP().toString());
+    irrigationService.getLogger()->setNetworkAvailable(true);
+    irrigationService.getLogger()->logStartup(WiFi.localIP(), irrigationService.getFirstControlMillis(), networkReadyMillis);
+    networkAttached = true;
+}
 
-    configManager.loadConfiguration();
-    Serial.println(WiFi.localIP().toString());
-    irrigationService.getLogger()->logStartup(WiFi.localIP());
+/*---------------------------------------*/
+// Waits for Wi-Fi without blocking, falling back to the config portal if the
+// saved network can't be joined
+void connectNetwork()
+{
+    if (configPortalStarted) {
+        wifiManager.process();
+    }
+    if (WiFi.status() == WL_CONNECTED) {
+        if (wifiManager.getConfigPortalActive()) {
+            wifiManager.stopConfigPortal();
+        }
+        attachNetworkServices();
+    } else if (!configPortalStarted &&
+               (!wifiManager.getWiFiIsSaved() || millis() > WATERINGSYSTEM_WIFICONNECTSECS * 1000)) {
+        serialConsole.println("Unable to join saved Wi-Fi network, starting config portal");
+        wifiManager.startConfigPortal();
+        configPortalStarted = true;
+    }
 }
 
 /*---------------------------------------*/
-//Runs constantly 
+//Runs constantly, each call running one pass of the scheduled tasks
 void loop()
 {
 //    fauxmo.handle();
-    configManager.handleClient();
     irrigationService.loop();
-    ElegantOTA.loop();
 }
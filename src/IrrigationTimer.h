@@ -8,6 +8,7 @@
 #include <NTPClient.h>
 #include <WiFiUdp.h>
 #include <ArduinoJson.h>
+#include "ControlClock.h"
 
 #ifndef __WATERINGSYSTEM_IRRIGATIONTIMER_H__
 #define __WATERINGSYSTEM_IRRIGATIONTIMER_H__
@@ -31,13 +32,13 @@ IrrigationTimer::IrrigationTimer(String name) {
 }
 
 void IrrigationTimer::setTimer(unsigned long timeInFutureMs) {
-    _stopTimeMillis = millis() + timeInFutureMs;
+    _stopTimeMillis = controlClock.millis() + timeInFutureMs;
 }
 
 bool IrrigationTimer::hasLapsed() {
     if (_stopTimeMillis == 0) {
         return true;
-    } else if (millis() >= _stopTimeMillis) {
+    } else if (controlClock.millis() >= _stopTimeMillis) {
         _stopTimeMillis = 0;
         return true;
     } else {
@@ -0,0 +1,168 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#ifndef __WATERINGSYSTEM_JSONARENA_H__
+#define __WATERINGSYSTEM_JSONARENA_H__
+
+#define WATERINGSYSTEM_JSONARENA_LOGGERBYTES 3072 // Documents built for one log event, through every logger
+#define WATERINGSYSTEM_JSONARENA_CONFIGBYTES 4096 // Documents for configuration and HTTP requests
+#define WATERINGSYSTEM_JSONARENA_ALIGN 8
+#define WATERINGSYSTEM_JSONARENA_NOBLOCK 0xFFFFFFFF
+
+// Header before each block, kept to the alignment so the blocks stay aligned
+struct JsonArenaBlock
+{
+    uint32_t size : 31; // Bytes after this header, rounded up to the alignment
+    uint32_t freed : 1;
+    uint32_t previous;  // Offset of the block before, or WATERINGSYSTEM_JSONARENA_NOBLOCK
+};
+static_assert(sizeof(JsonArenaBlock) == WATERINGSYSTEM_JSONARENA_ALIGN, "JsonArenaBlock must keep blocks aligned");
+
+//
+// ArduinoJson allocator handing out memory from a fixed buffer, so the short lived
+// documents built for each log event or request don't break up the heap. Blocks are
+// taken from the top of the buffer. The top block can grow and shrink in place, which
+// is how ArduinoJson builds strings and trims pools, and freeing blocks from the top
+// gives their space back, so nested documents are reclaimed as they go out of scope.
+// Other frees are just marked, and the whole arena is reset once nothing in it is live,
+// which for these paths is at the end of every event or request.
+//
+// Requests that don't fit fall back to the heap, and are counted, so the arena sizes can
+// be tuned from the high water marks in the system stats.
+//
+class JsonArena : public ArduinoJson::Allocator
+{
+  private:
+    const char* _name;
+    uint8_t* _buffer;
+    size_t _capacity;
+    size_t _top = 0;
+    uint32_t _lastBlock = WATERINGSYSTEM_JSONARENA_NOBLOCK;
+    uint16_t _liveBlocks = 0;
+    size_t _highWaterBytes = 0;
+    unsigned long _resets = 0;
+    unsigned long _heapFallbacks = 0;
+
+    bool contains(void* pointer);
+    JsonArenaBlock* blockAt(uint32_t offset);
+    JsonArenaBlock* blockFor(void* pointer);
+
+  public:
+    JsonArena(const char* name, uint8_t* buffer, size_t capacity);
+    void* allocate(size_t size) override;
+    void deallocate(void* pointer) override;
+    void* reallocate(void* pointer, size_t newSize) override;
+    void reportStats(JsonObject statsJson);
+};
+/****************************************/
+
+JsonArena::JsonArena(const char* name, uint8_t* buffer, size_t capacity) {
+    _name = name;
+    _buffer = buffer;
+    _capacity = capacity;
+}
+
+bool JsonArena::contains(void* pointer) {
+    return (uint8_t*)pointer >= _buffer && (uint8_t*)pointer < _buffer + _capacity;
+}
+
+JsonArenaBlock* JsonArena::blockAt(uint32_t offset) {
+    return (JsonArenaBlock*)(_buffer + offset);
+}
+
+JsonArenaBlock* JsonArena::blockFor(void* pointer) {
+    return (JsonArenaBlock*)((uint8_t*)pointer - sizeof(JsonArenaBlock));
+}
+
+void* JsonArena::allocate(size_t size) {
+    size_t alignedSize = (size + WATERINGSYSTEM_JSONARENA_ALIGN - 1) & ~(size_t)(WATERINGSYSTEM_JSONARENA_ALIGN - 1);
+    if (_top + sizeof(JsonArenaBlock) + alignedSize > _capacity) {
+        _heapFallbacks++;
+        return malloc(size);
+    }
+    JsonArenaBlock* block = blockAt(_top);
+    block->size = alignedSize;
+    block->previous = _lastBlock;
+    block->freed = 0;
+    _lastBlock = _top;
+    _top += sizeof(JsonArenaBlock) + alignedSize;
+    _liveBlocks++;
+    if (_top > _highWaterBytes) {
+        _highWaterBytes = _top;
+    }
+    return (uint8_t*)block + sizeof(JsonArenaBlock);
+}
+
+void JsonArena::deallocate(void* pointer) {
+    if (!pointer) {
+        return;
+    }
+    if (!contains(pointer)) {
+        free(pointer);
+        return;
+    }
+    blockFor(pointer)->freed = 1;
+    _liveBlocks--;
+    if (_liveBlocks == 0) {
+        _top = 0;
+        _lastBlock = WATERINGSYSTEM_JSONARENA_NOBLOCK;
+        _resets++;
+        return;
+    }
+    // Give back freed blocks from the top
+    while (_lastBlock != WATERINGSYSTEM_JSONARENA_NOBLOCK && blockAt(_lastBlock)->freed) {
+        _top = _lastBlock;
+        _lastBlock = blockAt(_lastBlock)->previous;
+    }
+}
+
+//
+// The top block is resized in place if there's room. Otherwise the contents are moved to
+// a new block, which may be on the heap.
+//
+void* JsonArena::reallocate(void* pointer, size_t newSize) {
+    if (!pointer) {
+        return allocate(newSize);
+    }
+    if (!contains(pointer)) {
+        return realloc(pointer, newSize);
+    }
+    JsonArenaBlock* block = blockFor(pointer);
+    size_t alignedSize = (newSize + WATERINGSYSTEM_JSONARENA_ALIGN - 1) & ~(size_t)(WATERINGSYSTEM_JSONARENA_ALIGN - 1);
+    if ((uint8_t*)block == _buffer + _lastBlock && _lastBlock + sizeof(JsonArenaBlock) + alignedSize <= _capacity) {
+        block->size = alignedSize;
+        _top = _lastBlock + sizeof(JsonArenaBlock) + alignedSize;
+        if (_top > _highWaterBytes) {
+            _highWaterBytes = _top;
+        }
+        return pointer;
+    }
+    if (alignedSize <= block->size) {
+        return pointer;
+    }
+    void* moved = allocate(newSize);
+    if (moved) {
+        memcpy(moved, pointer, block->size);
+        deallocate(pointer);
+    }
+    return moved;
+}
+
+void JsonArena::reportStats(JsonObject statsJson) {
+    statsJson["name"] = _name;
+    statsJson["capacity"] = _capacity;
+    statsJson["highWaterBytes"] = _highWaterBytes;
+    statsJson["resets"] = _resets;
+    statsJson["heapFallbacks"] = _heapFallbacks;
+}
+
+uint8_t loggerJsonArenaBuffer[WATERINGSYSTEM_JSONARENA_LOGGERBYTES] __attribute__((aligned(WATERINGSYSTEM_JSONARENA_ALIGN)));
+uint8_t configJsonArenaBuffer[WATERINGSYSTEM_JSONARENA_CONFIGBYTES] __attribute__((aligned(WATERINGSYSTEM_JSONARENA_ALIGN)));
+JsonArena loggerJsonArena("logger", loggerJsonArenaBuffer, sizeof(loggerJsonArenaBuffer));
+JsonArena configJsonArena("config", configJsonArenaBuffer, sizeof(configJsonArenaBuffer));
+
+#endif
@@ -0,0 +1,124 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "LoggerFilter.h"
+
+#ifndef __WATERINGSYSTEM_LOGEVENTQUEUE_H__
+#define __WATERINGSYSTEM_LOGEVENTQUEUE_H__
+
+#define WATERINGSYSTEM_LOGQUEUEBYTES 2048 // Space for events queued for the network loggers
+
+struct LogEventHeader
+{
+    unsigned long timeMillis;
+    uint32_t recipients;  // Bit per interface, by position in the interface list
+    uint16_t length;      // Whole record, including this header
+    uint8_t  metric;
+    uint8_t  groupLength;
+    bool     isGroupMetric;
+};
+
+//
+// First in, first out queue of log events, held in a fixed buffer as a header, the group
+// name and the value as MessagePack, so queueing an event doesn't allocate. When full, the
+// oldest events are dropped to make room. Records are kept packed from the start of the
+// buffer, so removing one moves the rest down, which for a buffer this size is cheap.
+//
+class LogEventQueue
+{
+  private:
+    uint8_t _buffer[WATERINGSYSTEM_LOGQUEUEBYTES];
+    size_t _length = 0;
+    uint16_t _count = 0;
+    unsigned long _droppedEvents = 0;
+
+  public:
+    bool push(LogMetric metric, bool isGroupMetric, const String& group, JsonDocument& valueDoc, uint32_t recipients);
+    bool front(LogEventHeader* header, String* group, JsonDocument& valueDoc);
+    void pop();
+    void clear();
+    uint16_t size();
+    bool empty();
+    unsigned long getDroppedEvents();
+};
+/****************************************/
+
+//
+// Queues an event, returning false if it is too large to ever fit
+//
+bool LogEventQueue::push(LogMetric metric, bool isGroupMetric, const String& group, JsonDocument& valueDoc, uint32_t recipients) {
+    size_t groupLength = min((size_t)group.length(), (size_t)255);
+    size_t valueLength = measureMsgPack(valueDoc);
+    size_t length = sizeof(LogEventHeader) + groupLength + valueLength;
+    if (length > WATERINGSYSTEM_LOGQUEUEBYTES) {
+        _droppedEvents++;
+        return false;
+    }
+    while (_length + length > WATERINGSYSTEM_LOGQUEUEBYTES) {
+        pop();
+        _droppedEvents++;
+    }
+
+    LogEventHeader header;
+    header.timeMillis = millis();
+    header.recipients = recipients;
+    header.length = length;
+    header.metric = metric;
+    header.groupLength = groupLength;
+    header.isGroupMetric = isGroupMetric;
+    uint8_t* out = _buffer + _length;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), group.c_str(), groupLength);
+    serializeMsgPack(valueDoc, out + sizeof(header) + groupLength, valueLength);
+    _length += length;
+    _count++;
+    return true;
+}
+
+//
+// Reads the oldest event, returning false if the queue is empty
+//
+bool LogEventQueue::front(LogEventHeader* header, String* group, JsonDocument& valueDoc) {
+    if (_count == 0) {
+        return false;
+    }
+    memcpy(header, _buffer, sizeof(LogEventHeader));
+    const uint8_t* groupStart = _buffer + sizeof(LogEventHeader);
+    group->concat((const char*)groupStart, header->groupLength);
+    const uint8_t* valueStart = groupStart + header->groupLength;
+    deserializeMsgPack(valueDoc, valueStart, header->length - sizeof(LogEventHeader) - header->groupLength);
+    return true;
+}
+
+void LogEventQueue::pop() {
+    if (_count == 0) {
+        return;
+    }
+    LogEventHeader header;
+    memcpy(&header, _buffer, sizeof(header));
+    _length -= header.length;
+    memmove(_buffer, _buffer + header.length, _length);
+    _count--;
+}
+
+void LogEventQueue::clear() {
+    _length = 0;
+    _count = 0;
+}
+
+uint16_t LogEventQueue::size() {
+    return _count;
+}
+
+bool LogEventQueue::empty() {
+    return _count == 0;
+}
+
+unsigned long LogEventQueue::getDroppedEvents() {
+    return _droppedEvents;
+}
+
+#endif
@@ -0,0 +1,242 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+#ifndef __WATERINGSYSTEM_LOGGERFILTER_H__
+#define __WATERINGSYSTEM_LOGGERFILTER_H__
+
+#define WATERINGSYSTEM_LOGFILTER_SERIES 16 // Series (metric, group and channel) tracked by filters not sized to a configuration
+#define WATERINGSYSTEM_GROUPNAME_MAXLENGTH 23 // Longest sensor group name, so series can be keyed by the whole name
+
+//
+// The metrics logged by the IrrigationLogger
+//
+enum LogMetric : uint8_t {
+    LOG_METRIC_BOOT = 0,
+    LOG_METRIC_SYSTEMSTATS,
+    LOG_METRIC_CONFIGLOAD,
+    LOG_METRIC_PUMPSTATUS,
+    LOG_METRIC_MOISTURE,
+    LOG_METRIC_WATER,
+    LOG_METRIC_MOISTUREALARMSTATUS,
+    LOG_METRIC_SENSORHEALTH,
+    LOG_METRIC_ROLLUP,
+    LOG_METRIC_COUNT
+};
+
+const char* const logMetricNames[LOG_METRIC_COUNT] = {
+    "boot", "system-stats", "config-load", "pump-status", "moisture", "water", "moisture-alarm-status", "sensor-health", "rollup"
+};
+
+struct LoggerFilterSeries
+{
+    char     group[WATERINGSYSTEM_GROUPNAME_MAXLENGTH + 1];
+    int8_t   channel;
+    uint8_t  metric;
+    bool     hasValue;
+    int16_t  lastValue;
+    uint16_t sampleCount;
+};
+
+//
+// Per logger event filter, evaluated by the IrrigationLogger before an event's Json is
+// built. Events pass, in order:
+// - the metric allow list
+// - changes only, for metrics where only changes in value are wanted
+// - 1 in N sampling, counted separately per group and channel
+// - a token bucket rate limit across all metrics
+// A default filter passes everything.
+//
+// Changes only and sampling keep state per series. The series table is sized to the
+// series the configuration can produce, once it is known, so series are only evicted
+// (oldest first, and counted) if more turn up than were reserved.
+//
+class LoggerFilter
+{
+  private:
+    uint32_t _allowMask = 0xFFFFFFFF;
+    uint32_t _changesOnlyMask = 0;
+    uint16_t _sampleEvery[LOG_METRIC_COUNT];
+    // Token bucket, in 1/60000ths of a token so refill is exact per millisecond
+    uint32_t _ratePerMinute = 0;      // 0 when not rate limited
+    uint32_t _bucketCapacity = 0;
+    uint32_t _bucketLevel = 0;
+    unsigned long _lastRefillMillis = 0;
+    LoggerFilterSeries* _series = NULL;
+    uint16_t _seriesCapacity = 0;
+    uint16_t _seriesCount = 0;
+    uint16_t _nextSeriesEviction = 0;
+    unsigned long _seriesEvictions = 0;
+    unsigned long _rateLimitedEvents = 0;
+
+    bool tracksSeries(uint8_t metric);
+    LoggerFilterSeries* findSeries(LogMetric metric, const String& group, int channel);
+    bool takeToken();
+
+  public:
+    LoggerFilter();
+    ~LoggerFilter();
+    static int parseMetric(const String& name);
+    void setAllowedMetrics(uint32_t metricMask);
+    void setChangesOnly(uint32_t metricMask);
+    void setSampling(LogMetric metric, uint16_t every);
+    void setRateLimit(uint32_t perMinute, uint32_t burst);
+    void reserveSeries(const uint16_t* seriesPerMetric);
+    bool accept(LogMetric metric, const String& group, int channel, int value);
+    unsigned long getRateLimitedEvents();
+    unsigned long getSeriesEvictions();
+};
+/****************************************/
+
+LoggerFilter::LoggerFilter() {
+    for (uint8_t metric = 0; metric < LOG_METRIC_COUNT; metric++) {
+        _sampleEvery[metric] = 1;
+    }
+}
+
+LoggerFilter::~LoggerFilter() {
+    delete[] _series;
+}
+
+// Returns the LogMetric for a metric name, or -1 if unknown
+int LoggerFilter::parseMetric(const String& name) {
+    for (uint8_t metric = 0; metric < LOG_METRIC_COUNT; metric++) {
+        if (name.equals(logMetricNames[metric])) {
+            return metric;
+        }
+    }
+    return -1;
+}
+
+void LoggerFilter::setAllowedMetrics(uint32_t metricMask) {
+    _allowMask = metricMask;
+}
+
+void LoggerFilter::setChangesOnly(uint32_t metricMask) {
+    _changesOnlyMask = metricMask;
+}
+
+void LoggerFilter::setSampling(LogMetric metric, uint16_t every) {
+    _sampleEvery[metric] = every ? every : 1;
+}
+
+void LoggerFilter::setRateLimit(uint32_t perMinute, uint32_t burst) {
+    _ratePerMinute = perMinute;
+    _bucketCapacity = max(burst, (uint32_t)1) * 60000;
+    _bucketLevel = _bucketCapacity;
+    _lastRefillMillis = millis();
+}
+
+unsigned long LoggerFilter::getRateLimitedEvents() {
+    return _rateLimitedEvents;
+}
+
+// Series evicted to make room for others, each losing its changes only and sampling state
+unsigned long LoggerFilter::getSeriesEvictions() {
+    return _seriesEvictions;
+}
+
+bool LoggerFilter::tracksSeries(uint8_t metric) {
+    return (_changesOnlyMask & (1UL << metric)) || _sampleEvery[metric] > 1;
+}
+
+//
+// Sizes the series table to the series of the metrics this filter tracks, given the
+// number of series the configuration produces for each metric. Called once the
+// filter's settings and the configuration are both known.
+//
+void LoggerFilter::reserveSeries(const uint16_t* seriesPerMetric) {
+    uint16_t capacity = 0;
+    for (uint8_t metric = 0; metric < LOG_METRIC_COUNT; metric++) {
+        if (tracksSeries(metric)) {
+            capacity += seriesPerMetric[metric];
+        }
+    }
+    delete[] _series;
+    _series = capacity ? new LoggerFilterSeries[capacity] : NULL;
+    _seriesCapacity = capacity;
+    _seriesCount = 0;
+    _nextSeriesEviction = 0;
+}
+
+//
+// Finds the tracked state for a series, by metric, channel and the whole group name,
+// replacing the oldest tracked series if full
+//
+LoggerFilterSeries* LoggerFilter::findSeries(LogMetric metric, const String& group, int channel) {
+    for (uint16_t i = 0; i < _seriesCount; i++) {
+        if (_series[i].metric == metric && _series[i].channel == channel && strcmp(_series[i].group, group.c_str()) == 0) {
+            return &_series[i];
+        }
+    }
+    if (!_series) {
+        _seriesCapacity = WATERINGSYSTEM_LOGFILTER_SERIES;
+        _series = new LoggerFilterSeries[_seriesCapacity];
+    }
+    uint16_t slot;
+    if (_seriesCount < _seriesCapacity) {
+        slot = _seriesCount++;
+    } else {
+        slot = _nextSeriesEviction;
+        _nextSeriesEviction = (_nextSeriesEviction + 1) % _seriesCapacity;
+        _seriesEvictions++;
+    }
+    LoggerFilterSeries& series = _series[slot];
+    strncpy(series.group, group.c_str(), WATERINGSYSTEM_GROUPNAME_MAXLENGTH);
+    series.group[WATERINGSYSTEM_GROUPNAME_MAXLENGTH] = '\0';
+    series.channel = channel;
+    series.metric = metric;
+    series.hasValue = false;
+    series.lastValue = 0;
+    series.sampleCount = 0;
+    return &series;
+}
+
+bool LoggerFilter::takeToken() {
+    unsigned long now = millis();
+    _bucketLevel = min((uint64_t)_bucketCapacity, _bucketLevel + (uint64_t)(now - _lastRefillMillis) * _ratePerMinute);
+    _lastRefillMillis = now;
+    if (_bucketLevel < 60000) {
+        return false;
+    }
+    _bucketLevel -= 60000;
+    return true;
+}
+
+//
+// Returns true if an event should be sent. group is empty and channel -1 for events
+// not specific to a group or channel.
+//
+bool LoggerFilter::accept(LogMetric metric, const String& group, int channel, int value) {
+    if (!(_allowMask & (1UL << metric))) {
+        return false;
+    }
+    bool changesOnly = _changesOnlyMask & (1UL << metric);
+    if (!changesOnly && _sampleEvery[metric] == 1 && _ratePerMinute == 0) {
+        return true;
+    }
+
+    LoggerFilterSeries* series = NULL;
+    if (changesOnly || _sampleEvery[metric] > 1) {
+        series = findSeries(metric, group, channel);
+        if (changesOnly && series->hasValue && series->lastValue == value) {
+            return false;
+        }
+        if ((series->sampleCount++ % _sampleEvery[metric]) != 0) {
+            return false;
+        }
+    }
+    if (_ratePerMinute && !takeToken()) {
+        _rateLimitedEvents++;
+        return false;
+    }
+    if (series) {
+        series->hasValue = true;
+        series->lastValue = value;
+    }
+    return true;
+}
+
+#endif
@@ -4,10 +4,16 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include "HeapAccounting.h"
+#include "JsonArena.h"
+#include "LoggerFilter.h"
+#include "TelemetryRollup.h"
 
 #ifndef __WATERINGSYSTEM_LOGGERINTERFACE_H__
 #define __WATERINGSYSTEM_LOGGERINTERFACE_H__
 
+#define WATERINGSYSTEM_LOGGERTIMEOUTMS 2000 // Longest a network logger waits on the server per send or connect, which bounds a telemetry step
+
 //
 // Pure virtual base class representing an interface to an external logging capability.
 // The ConfigManager is responsible for creating derived versions of this class (Loki/Mqtt
@@ -16,17 +22,112 @@
 class LoggerInterface
 {
     private: 
+        unsigned long _messagesSent = 0;
+        unsigned long _bytesSent = 0;
+        unsigned long _sendFailures = 0;
+        unsigned long _lastReportMessages = 0;
+        unsigned long _lastReportBytes = 0;
+        LoggerFilter _filter;
+        TelemetryRollup* _rollup = NULL;
+
+    protected:
+        unsigned long _eventAgeMillis = 0; // Age of a buffered event being replayed, 0 when live
+        void recordSend(size_t bytes, bool success);
+        void recordLateFailure();
+        virtual void reportTransportStats(JsonObject statsJson);
 
     public:
         virtual void logJsonMetric(String metric, JsonDocument valueJsonDoc) = 0;
         virtual void logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc) = 0;
+        virtual const char* getType() = 0;
         virtual void loop();
-        virtual ~LoggerInterface() {};
+        virtual bool requiresNetwork();
+        LoggerFilter* getFilter();
+        TelemetryRollup* getRollup();
+        void setRollup(TelemetryRollup* rollup);
+        void setEventAge(unsigned long ageMillis);
+        void reportStats(JsonObject statsJson, unsigned long elapsedMs);
+        virtual ~LoggerInterface();
 };
 /****************************************/
 
+LoggerInterface::~LoggerInterface() {
+  delete _rollup;
+}
+
 void LoggerInterface::loop() {
   return;
 }
 
+//
+// Interfaces needing the network only receive events once it is up. Events logged
+// before then are buffered by the IrrigationLogger, and replayed with their age set.
+//
+bool LoggerInterface::requiresNetwork() {
+  return true;
+}
+
+// Adds any statistics particular to the transport to the system stats
+void LoggerInterface::reportTransportStats(JsonObject statsJson) {
+  return;
+}
+
+void LoggerInterface::setEventAge(unsigned long ageMillis) {
+  _eventAgeMillis = ageMillis;
+}
+
+LoggerFilter* LoggerInterface::getFilter() {
+  return &_filter;
+}
+
+// Returns the rollup of numeric metrics for this logger, or NULL if they're sent as logged
+TelemetryRollup* LoggerInterface::getRollup() {
+  return _rollup;
+}
+
+// Takes ownership of the rollup
+void LoggerInterface::setRollup(TelemetryRollup* rollup) {
+  delete _rollup;
+  _rollup = rollup;
+}
+
+//
+// Called by derived classes for each message handed to the transport, so that
+// telemetry volume can be reported and backend ingestion load estimated.
+//
+void LoggerInterface::recordSend(size_t bytes, bool success) {
+    _messagesSent++;
+    _bytesSent += bytes;
+    if (!success) {
+        _sendFailures++;
+    }
+}
+
+// Counts a failure for a message already recorded as sent, such as one dropped from a queue
+void LoggerInterface::recordLateFailure() {
+    _sendFailures++;
+}
+
+//
+// Adds totals, and rates since the previous report, to a system stats Json object
+//
+void LoggerInterface::reportStats(JsonObject statsJson, unsigned long elapsedMs) {
+    statsJson["type"] = getType();
+    statsJson["messages"] = _messagesSent;
+    statsJson["bytes"] = _bytesSent;
+    statsJson["failures"] = _sendFailures;
+    statsJson["rateLimited"] = _filter.getRateLimitedEvents();
+    statsJson["filterEvictions"] = _filter.getSeriesEvictions();
+    if (elapsedMs > 0) {
+        statsJson["messagesPerSec"] = (_messagesSent - _lastReportMessages) * 1000.0 / elapsedMs;
+        statsJson["bytesPerSec"] = (_bytesSent - _lastReportBytes) * 1000.0 / elapsedMs;
+    }
+    _lastReportMessages = _messagesSent;
+    _lastReportBytes = _bytesSent;
+    if (_rollup) {
+        _rollup->reportStats(statsJson);
+    }
+    reportTransportStats(statsJson);
+}
+
 #endif
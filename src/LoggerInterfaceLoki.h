@@ -9,10 +9,15 @@
 #include <WiFiUdp.h>
 #include <ArduinoJson.h>
 #include "LoggerInterface.h"
+#include "LokiPushEncoder.h"
+#include "SerialConsole.h"
 
 #ifndef __WATERINGSYSTEM_LOGGERINTERFACELOKI_H__
 #define __WATERINGSYSTEM_LOGGERINTERFACELOKI_H__
 
+#define LOKI_ENCODING_JSON     0
+#define LOKI_ENCODING_PROTOBUF 1 // Snappy compressed protobuf
+
 // NTP client to get Epoch
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, "pool.ntp.org");
@@ -27,31 +32,47 @@ class LoggerInterfaceLoki : public LoggerInterface
     int    _lokiPort;
     String _lokiServer;
     String _lokiPath;
-    time_t getEpoch();
+    LokiPushEncoder* _encoder = NULL; // Only allocated for protobuf encoding
+
+    bool logEncoded(const String& labels, JsonDocument& valueJsonDoc);
+
+  protected:
+    virtual time_t getEpoch();
+    virtual bool postPayload(const String& json);
+    virtual bool postProtobuf(const uint8_t* payload, size_t length);
 
   public:
-    LoggerInterfaceLoki(String instanceName, int lokiPort, String lokiServer, String lokiPath);
+    LoggerInterfaceLoki(String instanceName, int lokiPort, String lokiServer, String lokiPath, uint8_t encoding = LOKI_ENCODING_JSON);
     ~LoggerInterfaceLoki();
 
     virtual void logJsonMetric(String metric, JsonDocument valueJsonDoc);
     virtual void logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc);
+    virtual const char* getType();
     void logString(JsonDocument streamDoc, String value);
 };
 /****************************************/
 
-LoggerInterfaceLoki::LoggerInterfaceLoki(String instanceName, int lokiPort, String lokiServer, String lokiPath) {
+LoggerInterfaceLoki::LoggerInterfaceLoki(String instanceName, int lokiPort, String lokiServer, String lokiPath, uint8_t encoding) {
     _job = instanceName;
     _lokiPort = lokiPort;
     _lokiServer  = lokiServer;
     _lokiPath = lokiPath;
+    if (encoding == LOKI_ENCODING_PROTOBUF) {
+        _encoder = new LokiPushEncoder();
+    }
     timeClient.begin();
     return;
 }
 
 LoggerInterfaceLoki::~LoggerInterfaceLoki() {
+    delete _encoder;
     return;
 }
 
+const char* LoggerInterfaceLoki::getType() {
+    return "loki";
+}
+
 time_t LoggerInterfaceLoki::getEpoch() {
     timeClient.update();
     time_t epochTime = timeClient.getEpochTime();
@@ -60,7 +81,17 @@ time_t LoggerInterfaceLoki::getEpoch() {
 
 // Function to log a Json structure
 void LoggerInterfaceLoki::logJsonMetric(String metric, JsonDocument valueJsonDoc) {
-    JsonDocument streamDoc;
+    HEAP_SCOPE(HEAP_TAG_LOKI);
+    if (_encoder) {
+        String labels;
+        LokiPushEncoder::appendLabel(labels, "job", _job);
+        LokiPushEncoder::appendLabel(labels, "metric", metric);
+        labels += "}";
+        if (logEncoded(labels, valueJsonDoc)) {
+            return;
+        }
+    }
+    JsonDocument streamDoc(&loggerJsonArena);
     streamDoc["stream"]["job"]   = _job;
     streamDoc["stream"]["metric"]   = metric;
     // Build stream value
@@ -71,7 +102,18 @@ void LoggerInterfaceLoki::logJsonMetric(String metric, JsonDocument valueJsonDoc
 }
 
 void LoggerInterfaceLoki::logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc) {
-    JsonDocument streamDoc;
+    HEAP_SCOPE(HEAP_TAG_LOKI);
+    if (_encoder) {
+        String labels;
+        LokiPushEncoder::appendLabel(labels, "job", _job);
+        LokiPushEncoder::appendLabel(labels, "metric", metric);
+        LokiPushEncoder::appendLabel(labels, "group", group);
+        labels += "}";
+        if (logEncoded(labels, valueJsonDoc)) {
+            return;
+        }
+    }
+    JsonDocument streamDoc(&loggerJsonArena);
     streamDoc["stream"]["job"]     = _job;
     streamDoc["stream"]["metric"]  = metric;
     streamDoc["stream"]["group"]   = group;
@@ -87,40 +129,81 @@ void LoggerInterfaceLoki::logJsonGroupMetric(String metric, String group, JsonDo
 //
 void LoggerInterfaceLoki::logString(JsonDocument streamDoc, String value) {
     streamDoc["stream"]["job"]   = _job;
-    JsonDocument valuesDoc;
-    JsonDocument valuesContainerDoc;
+    JsonDocument valuesDoc(&loggerJsonArena);
+    JsonDocument valuesContainerDoc(&loggerJsonArena);
     JsonArray valuesContainerArray = valuesContainerDoc.to<JsonArray>();
     JsonArray valuesArray = valuesDoc.to<JsonArray>();
     // create an object
     
-    valuesArray.add(String(getEpoch())+"000000000");
+    valuesArray.add(String(getEpoch() - (time_t)(_eventAgeMillis / 1000))+"000000000");
     valuesArray.add(value);  // Sensor value
 
     valuesContainerArray.add(valuesArray);
     streamDoc["values"] = valuesContainerArray;
 
     // Build the overall Json document
-    JsonDocument doc;
-    JsonDocument streamsListDoc;
+    JsonDocument doc(&loggerJsonArena);
+    JsonDocument streamsListDoc(&loggerJsonArena);
     JsonArray streamsListArray = streamsListDoc.to<JsonArray>();
     streamsListArray.add(streamDoc);
     doc["streams"] = streamsListArray;
     String json;
     serializeJson(doc, json);
-    
-    // Send HTTP POST request to Loki
+
+    bool success = postPayload(json);
+    recordSend(json.length(), success);
+}
+
+//
+// Sends an entry as a snappy compressed protobuf push request. Returns false, so the
+// caller falls back to Json, if the entry is too large to encode.
+//
+bool LoggerInterfaceLoki::logEncoded(const String& labels, JsonDocument& valueJsonDoc) {
+    time_t seconds = getEpoch() - (time_t)(_eventAgeMillis / 1000);
+    if (!_encoder->encode(labels, seconds, valueJsonDoc)) {
+        return false;
+    }
+    bool success = postProtobuf(_encoder->getPayload(), _encoder->getPayloadLength());
+    recordSend(_encoder->getPayloadLength(), success);
+    return true;
+}
+
+bool LoggerInterfaceLoki::postProtobuf(const uint8_t* payload, size_t length) {
+    WiFiClient client;
+    HTTPClient http;
+    String serverPath = "http://" + _lokiServer + ":" + _lokiPort + _lokiPath;
+    http.begin(client, serverPath);
+    http.setTimeout(WATERINGSYSTEM_LOGGERTIMEOUTMS);
+    http.addHeader("Content-Type", "application/x-protobuf");
+
+    int httpResponseCode = http.POST((uint8_t*)payload, length);
+    bool success = httpResponseCode >= 200 && httpResponseCode <= 299;
+    if (!success) {
+        serialConsole.printf("Loki returned unexpected return code %d (%s)",httpResponseCode,http.getString().c_str());
+    }
+    http.end();
+    return success;
+}
+
+//
+// Sends a serialised push request to Loki, returning true on a 2xx response
+//
+bool LoggerInterfaceLoki::postPayload(const String& json) {
     WiFiClient client;
     HTTPClient http;
     String serverPath = "http://" + _lokiServer + ":" + _lokiPort + _lokiPath;
     http.begin(client, serverPath);
+    http.setTimeout(WATERINGSYSTEM_LOGGERTIMEOUTMS);
     http.addHeader("Content-Type", "application/json");
 
     int httpResponseCode = http.POST(json);
-    if (httpResponseCode < 200 || httpResponseCode > 299) {
-        Serial.printf("Payload: %s",json.c_str());
-        Serial.printf("Loki returned unexpected return code %d (%s)",httpResponseCode,http.getString().c_str());
+    bool success = httpResponseCode >= 200 && httpResponseCode <= 299;
+    if (!success) {
+        serialConsole.println("Payload: " + json);
+        serialConsole.printf("Loki returned unexpected return code %d (%s)",httpResponseCode,http.getString().c_str());
     }
     http.end();
+    return success;
 }
 
 #endif
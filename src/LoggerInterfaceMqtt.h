@@ -3,6 +3,7 @@
 //
 
 #include "LoggerInterface.h"
+#include "SerialConsole.h"
 #include <ESP8266WiFi.h>
 #include <PubSubClient.h>
 
@@ -13,37 +14,87 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
   // Unused, as we won't be receiving MQTT messages
 }
 
+#define MQTT_ENCODING_JSON    0
+#define MQTT_ENCODING_MSGPACK 1
+#define MQTT_ENCODING_STRUCT  2 // Packed little endian fields, for metrics with a layout below
+
+#define WATERINGSYSTEM_MQTT_MAXTOPIC   128
+#define WATERINGSYSTEM_MQTT_MAXPAYLOAD 512
+
 //
-// Concrete interface class to support logging to Mqtt
+// Struct encoded payloads start with a format byte. MQTT_STRUCT_FORMAT_STRUCT is followed
+// by the metric's fields as laid out below, in order, with booleans as 1 byte and
+// integers as 4 bytes little endian. Metrics without a layout, or events not matching
+// it, are sent as MQTT_STRUCT_FORMAT_MSGPACK followed by MessagePack.
+//
+#define MQTT_STRUCT_FORMAT_STRUCT  1
+#define MQTT_STRUCT_FORMAT_MSGPACK 2
+#define MQTT_STRUCT_MAXFIELDS      3
+
+struct MqttStructLayout
+{
+    const char* metric;
+    bool booleans;                             // Fields are booleans rather than integers
+    const char* fields[MQTT_STRUCT_MAXFIELDS]; // In payload order, NULL after the last
+};
+
+const MqttStructLayout mqttStructLayouts[] = {
+    {"moisture", false, {"channel", "level", "minLevel"}},   // 1 + 12 bytes
+    {"water", false, {"level", NULL, NULL}},                 // 1 + 4 bytes
+    {"pump-status", true, {"status", NULL, NULL}},           // 1 + 1 byte
+    {"moisture-alarm-status", true, {"status", NULL, NULL}}  // 1 + 1 byte
+};
+
+//
+// Concrete interface class to support logging to Mqtt. Topics are written into a fixed
+// buffer holding the topic prefix, and payloads into a fixed publish buffer, so
+// publishing doesn't build Strings.
 //
 class LoggerInterfaceMqtt : public LoggerInterface 
 {
   private: 
       WiFiClient _wifiClient;
       PubSubClient*  _mqttClient;
-      String        _topicPrefix;
       String        _instanceName;
+      uint8_t       _encoding;
+      char          _topic[WATERINGSYSTEM_MQTT_MAXTOPIC];
+      size_t        _topicPrefixLength;
+      uint8_t       _payload[WATERINGSYSTEM_MQTT_MAXPAYLOAD];
+
+      bool setTopic(const String& group, const String& metric);
+      size_t encodePayload(const String& metric, JsonDocument& valueJsonDoc);
+      size_t encodeStruct(const String& metric, JsonDocument& valueJsonDoc);
+      void publishValue(const String& metric, JsonDocument& valueJsonDoc);
+
+  protected:
+      virtual bool isConnected();
+      virtual bool publish(const char* topic, const uint8_t* payload, size_t length);
 
-      bool isConnected();
   public:
       virtual void logJsonMetric(String metric, JsonDocument valueJsonDoc);
       virtual void logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc);
+      virtual const char* getType();
       virtual void loop();
 
-      LoggerInterfaceMqtt(String instanceName, const char* server, int port, String topicPrefix);
+      LoggerInterfaceMqtt(String instanceName, const char* server, int port, String topicPrefix, uint8_t encoding = MQTT_ENCODING_JSON);
       ~LoggerInterfaceMqtt();
 };
 
-LoggerInterfaceMqtt::LoggerInterfaceMqtt(String instanceName, const char* server, int port, String topicPrefix) {
+LoggerInterfaceMqtt::LoggerInterfaceMqtt(String instanceName, const char* server, int port, String topicPrefix, uint8_t encoding) {
     _instanceName = instanceName;
+    _encoding = encoding;
+    // A reconnect waits on both the TCP connection, bounded by the client's timeout, and
+    // the broker's acknowledgement, bounded by the socket timeout, so each gets half
+    _wifiClient.setTimeout(WATERINGSYSTEM_LOGGERTIMEOUTMS / 2);
     _mqttClient = new PubSubClient(_wifiClient);
     _mqttClient->setServer(server, port);
-    
-    if (!isConnected()) {
-        Serial.println("Failed to connect toMQTT broker in constructor");
-    }
-    _topicPrefix = topicPrefix;
-
+    _mqttClient->setSocketTimeout(max(WATERINGSYSTEM_LOGGERTIMEOUTMS / 2000, 1));
+    // Room for the largest topic and payload, plus the Mqtt packet header
+    _mqttClient->setBufferSize(WATERINGSYSTEM_MQTT_MAXTOPIC + WATERINGSYSTEM_MQTT_MAXPAYLOAD + 8);
+    // The broker is connected on first publish, so construction never blocks on the network
+    _topicPrefixLength = min((size_t)topicPrefix.length(), (size_t)WATERINGSYSTEM_MQTT_MAXTOPIC - 1);
+    memcpy(_topic, topicPrefix.c_str(), _topicPrefixLength);
+    _topic[_topicPrefixLength] = '\0';
 }
 
 LoggerInterfaceMqtt::~LoggerInterfaceMqtt() {
@@ -52,50 +103,136 @@ LoggerInterfaceMqtt::~LoggerInterfaceMqtt() {
 
 
 void LoggerInterfaceMqtt::logJsonMetric(String metric, JsonDocument valueJsonDoc) {
-    String topic = _topicPrefix;
-    topic += metric;
-    String valueString;
-    serializeJson(valueJsonDoc,valueString);
+    HEAP_SCOPE(HEAP_TAG_MQTT);
+    if (setTopic(String(), metric)) {
+        publishValue(metric, valueJsonDoc);
+    }
+}
 
-    if (isConnected()) {
-        if (!_mqttClient->publish(topic.c_str(), valueString.c_str())) {
-            Serial.println("Publish failed");
+void LoggerInterfaceMqtt::logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc) {
+    HEAP_SCOPE(HEAP_TAG_MQTT);
+    if (setTopic(group, metric)) {
+        publishValue(metric, valueJsonDoc);
+    }
+}
+
+//
+// Completes the topic after the prefix, as <prefix><metric> or <prefix><group>/<metric>
+//
+bool LoggerInterfaceMqtt::setTopic(const String& group, const String& metric) {
+    size_t length = _topicPrefixLength;
+    size_t required = length + metric.length() + (group.isEmpty() ? 0 : group.length() + 1);
+    if (required >= WATERINGSYSTEM_MQTT_MAXTOPIC) {
+        serialConsole.println("MQTT topic too long");
+        recordSend(0, false);
+        return false;
+    }
+    if (!group.isEmpty()) {
+        memcpy(_topic + length, group.c_str(), group.length());
+        length += group.length();
+        _topic[length++] = '/';
+    }
+    memcpy(_topic + length, metric.c_str(), metric.length());
+    length += metric.length();
+    _topic[length] = '\0';
+    return true;
+}
+
+//
+// Packs the event after the struct format byte, following the metric's layout in
+// mqttStructLayouts. Returns 0 if the metric has no layout, or the event doesn't match
+// it, for the event to be sent as MessagePack instead.
+//
+size_t LoggerInterfaceMqtt::encodeStruct(const String& metric, JsonDocument& valueJsonDoc) {
+    for (const MqttStructLayout& layout : mqttStructLayouts) {
+        if (!metric.equals(layout.metric)) {
+            continue;
         }
-    } else {
-        Serial.println("MQTT not currently connected");
+        size_t length = 0;
+        _payload[length++] = MQTT_STRUCT_FORMAT_STRUCT;
+        for (uint8_t field = 0; field < MQTT_STRUCT_MAXFIELDS && layout.fields[field]; field++) {
+            JsonVariant value = valueJsonDoc[layout.fields[field]];
+            if (layout.booleans && value.is<bool>()) {
+                _payload[length++] = value.as<bool>() ? 1 : 0;
+            } else if (!layout.booleans && value.is<long>()) {
+                int32_t integer = value.as<long>();
+                for (int i = 0; i < 4; i++) {
+                    _payload[length++] = (uint8_t)(integer >> (8 * i));
+                }
+            } else {
+                return 0;
+            }
+        }
+        return length;
     }
+    return 0;
 }
 
-void LoggerInterfaceMqtt::logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc) {
-    String topic = _topicPrefix;
-    topic += group;
-    topic += "/";
-    topic += metric;
-    String valueString;
-    serializeJson(valueJsonDoc,valueString);
+// Returns the encoded length in the publish buffer, or 0 if it doesn't fit
+size_t LoggerInterfaceMqtt::encodePayload(const String& metric, JsonDocument& valueJsonDoc) {
+    if (_encoding == MQTT_ENCODING_JSON) {
+        // The serialiser needs room for its terminator
+        if (measureJson(valueJsonDoc) >= WATERINGSYSTEM_MQTT_MAXPAYLOAD) {
+            return 0;
+        }
+        return serializeJson(valueJsonDoc, _payload, WATERINGSYSTEM_MQTT_MAXPAYLOAD);
+    }
+    size_t offset = 0;
+    if (_encoding == MQTT_ENCODING_STRUCT) {
+        size_t length = encodeStruct(metric, valueJsonDoc);
+        if (length > 0) {
+            return length;
+        }
+        _payload[offset++] = MQTT_STRUCT_FORMAT_MSGPACK;
+    }
+    if (offset + measureMsgPack(valueJsonDoc) > WATERINGSYSTEM_MQTT_MAXPAYLOAD) {
+        return 0;
+    }
+    return offset + serializeMsgPack(valueJsonDoc, _payload + offset, WATERINGSYSTEM_MQTT_MAXPAYLOAD - offset);
+}
+
+void LoggerInterfaceMqtt::publishValue(const String& metric, JsonDocument& valueJsonDoc) {
+    size_t length = encodePayload(metric, valueJsonDoc);
+    if (length == 0) {
+        serialConsole.println("MQTT payload too large");
+        recordSend(0, false);
+        return;
+    }
 
     if (isConnected()) {
-        if (!_mqttClient->publish(topic.c_str(), valueString.c_str())) {
-            Serial.println("Publish failed");
+        bool success = publish(_topic, _payload, length);
+        if (!success) {
+            serialConsole.println("Publish failed");
         }
+        recordSend(strlen(_topic) + length, success);
     } else {
-        Serial.println("MQTT not currently connected");
+        serialConsole.println("MQTT not currently connected");
+        recordSend(strlen(_topic) + length, false);
     }
 }
 
+bool LoggerInterfaceMqtt::publish(const char* topic, const uint8_t* payload, size_t length) {
+    return _mqttClient->publish(topic, payload, length);
+}
+
+const char* LoggerInterfaceMqtt::getType() {
+    return "mqtt";
+}
+
 bool LoggerInterfaceMqtt::isConnected() {
     // If we're not currently connected, try to reconnect
     if (!_mqttClient->connected()) {
         if (_mqttClient->connect((char*) _instanceName.c_str())) {
-            Serial.println("Reconnected to MQTT broker");
+            serialConsole.println("Reconnected to MQTT broker");
         } else {
-            Serial.println("MQTT reconnect failed");
+            serialConsole.println("MQTT reconnect failed");
         }
     }
     return _mqttClient->connected();
 }
 
 void LoggerInterfaceMqtt::loop() {
+    HEAP_SCOPE(HEAP_TAG_MQTT);
     _mqttClient->loop();
 }
 
@@ -4,60 +4,261 @@
 
 #include <ArduinoJson.h>
 #include "LoggerInterface.h"
+#include "SerialConsole.h"
 
 #ifndef __WATERINGSYSTEM_LOGGERINTERFACESERIAL_H__
 #define __WATERINGSYSTEM_LOGGERINTERFACESERIAL_H__
 
+#define SERIAL_FORMAT_JSON    0 // {"instance":...,"group":...,"metric":...,"value":{...}}
+#define SERIAL_FORMAT_COMPACT 1 // <metric> [<group> ]{...}
+
+#define SERIAL_OVERFLOW_DROPNEWEST 0 // Lines that don't fit are dropped
+#define SERIAL_OVERFLOW_DROPOLDEST 1 // The oldest unsent lines are dropped to make room
+
+#define WATERINGSYSTEM_SERIAL_BUFFERBYTES 2048 // Lines waiting for the UART
+#define WATERINGSYSTEM_SERIAL_MAXLINE 512      // Longer lines are dropped
 
 //
-// Concrete interface class to support logging to Serial
+// Concrete interface class to support logging to Serial. Lines are formatted into a fixed
+// buffer and queued in a ring buffer, which loop() drains using only the space free in
+// the UART transmit FIFO, so logging never waits on the serial port. When the ring is
+// full, lines are dropped according to the overflow policy and counted. Console messages
+// are queued with the logged lines, so they're never written part way through one.
 //
-class LoggerInterfaceSerial : public LoggerInterface 
+class LoggerInterfaceSerial : public LoggerInterface, public SerialConsoleSink
 {
-  private: 
+  private:
     String _instanceName;
+    uint8_t _format;
+    uint8_t _overflow;
+    char _line[WATERINGSYSTEM_SERIAL_MAXLINE];
+    uint8_t _ring[WATERINGSYSTEM_SERIAL_BUFFERBYTES];
+    size_t _tail = 0;            // Next byte to send
+    size_t _length = 0;          // Bytes waiting
+    bool _midLine = false;       // Part of the oldest line has been sent
+    size_t _peakLength = 0;
+    unsigned long _droppedLines = 0;
+    unsigned long _droppedBytes = 0;
+
+    size_t formatLine(const String& metric, const String& group, JsonDocument& valueJsonDoc);
+    void queueLine(size_t length);
+    bool copyLine(size_t length);
+    size_t lineLengthAt(size_t offset);
+    bool dropOldestLine();
+
+  protected:
+    virtual int availableForWrite();
+    virtual size_t writeOutput(const uint8_t* buffer, size_t length);
+    virtual void reportTransportStats(JsonObject statsJson);
 
   public:
-    LoggerInterfaceSerial(String instanceName);
+    LoggerInterfaceSerial(String instanceName, uint8_t format = SERIAL_FORMAT_JSON, uint8_t overflow = SERIAL_OVERFLOW_DROPNEWEST);
     ~LoggerInterfaceSerial();
 
     virtual void logJsonMetric(String metric, JsonDocument valueJsonDoc);
     virtual void logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc);
+    virtual const char* getType();
+    virtual bool requiresNetwork();
+    virtual void loop();
+    virtual void queueConsoleLine(const char* line, size_t length);
 };
 /****************************************/
 
-LoggerInterfaceSerial::LoggerInterfaceSerial(String instanceName) {
+LoggerInterfaceSerial::LoggerInterfaceSerial(String instanceName, uint8_t format, uint8_t overflow) {
     _instanceName = instanceName;
+    _format = format;
+    _overflow = overflow;
+    serialConsole.addSink(this);
     return;
 }
 
+//
+// Lines still queued are written out, blocking, so nothing logged before a configuration
+// change is lost
+//
 LoggerInterfaceSerial::~LoggerInterfaceSerial() {
+    serialConsole.removeSink(this);
+    while (_length > 0) {
+        size_t chunk = min(_length, WATERINGSYSTEM_SERIAL_BUFFERBYTES - _tail);
+        writeOutput(_ring + _tail, chunk);
+        _tail = (_tail + chunk) % WATERINGSYSTEM_SERIAL_BUFFERBYTES;
+        _length -= chunk;
+    }
     return;
 }
 
-void LoggerInterfaceSerial::logJsonMetric(String metric, JsonDocument valueJsonDoc) {
-    JsonDocument logDoc;
-    logDoc["instance"]   = _instanceName;
-    logDoc["metric"]   = metric;
-    logDoc["value"]   = valueJsonDoc;
+const char* LoggerInterfaceSerial::getType() {
+    return "serial";
+}
+
+bool LoggerInterfaceSerial::requiresNetwork() {
+    return false;
+}
 
-    String logString;
-    serializeJson(logDoc,logString);
+int LoggerInterfaceSerial::availableForWrite() {
+    return Serial.availableForWrite();
+}
 
-    Serial.println(logString.c_str());
+size_t LoggerInterfaceSerial::writeOutput(const uint8_t* buffer, size_t length) {
+    return Serial.write(buffer, length);
+}
+
+void LoggerInterfaceSerial::logJsonMetric(String metric, JsonDocument valueJsonDoc) {
+    HEAP_SCOPE(HEAP_TAG_SERIAL);
+    queueLine(formatLine(metric, String(), valueJsonDoc));
 }
 
 void LoggerInterfaceSerial::logJsonGroupMetric(String metric, String group, JsonDocument valueJsonDoc) {
-    JsonDocument logDoc;
-    logDoc["instance"]  = _instanceName;
-    logDoc["group"]     = group;
-    logDoc["metric"]    = metric;
-    logDoc["value"]     = valueJsonDoc;
+    HEAP_SCOPE(HEAP_TAG_SERIAL);
+    queueLine(formatLine(metric, group, valueJsonDoc));
+}
+
+//
+// Formats an event into the line buffer, returning its length including the newline, or
+// 0 if it doesn't fit
+//
+size_t LoggerInterfaceSerial::formatLine(const String& metric, const String& group, JsonDocument& valueJsonDoc) {
+    size_t length = 0;
+    if (_format == SERIAL_FORMAT_COMPACT) {
+        size_t prefixLength = metric.length() + 1 + (group.isEmpty() ? 0 : group.length() + 1);
+        if (prefixLength + measureJson(valueJsonDoc) + 1 >= WATERINGSYSTEM_SERIAL_MAXLINE) {
+            return 0;
+        }
+        memcpy(_line, metric.c_str(), metric.length());
+        length = metric.length();
+        _line[length++] = ' ';
+        if (!group.isEmpty()) {
+            memcpy(_line + length, group.c_str(), group.length());
+            length += group.length();
+            _line[length++] = ' ';
+        }
+        length += serializeJson(valueJsonDoc, _line + length, WATERINGSYSTEM_SERIAL_MAXLINE - length);
+    } else {
+        JsonDocument logDoc(&loggerJsonArena);
+        logDoc["instance"] = _instanceName;
+        if (!group.isEmpty()) {
+            logDoc["group"] = group;
+        }
+        logDoc["metric"] = metric;
+        logDoc["value"] = valueJsonDoc;
+        if (measureJson(logDoc) + 1 >= WATERINGSYSTEM_SERIAL_MAXLINE) {
+            return 0;
+        }
+        length = serializeJson(logDoc, _line, WATERINGSYSTEM_SERIAL_MAXLINE);
+    }
+    _line[length++] = '\n';
+    return length;
+}
+
+// Returns the length of the queued line starting at an offset from the tail, with its newline
+size_t LoggerInterfaceSerial::lineLengthAt(size_t offset) {
+    size_t length = 0;
+    while (offset + length < _length && _ring[(_tail + offset + length) % WATERINGSYSTEM_SERIAL_BUFFERBYTES] != '\n') {
+        length++;
+    }
+    return min(length + 1, _length - offset);
+}
+
+//
+// Drops the oldest queued line. If that line is part way through being sent, the line
+// after it is dropped instead, moving the rest of the part sent line up over it, so the
+// output never has a line cut short.
+//
+bool LoggerInterfaceSerial::dropOldestLine() {
+    size_t kept = _midLine ? lineLengthAt(0) : 0;
+    if (kept >= _length) {
+        return false;
+    }
+    size_t lineLength = lineLengthAt(kept);
+    for (size_t i = kept; i > 0; i--) {
+        _ring[(_tail + lineLength + i - 1) % WATERINGSYSTEM_SERIAL_BUFFERBYTES] = _ring[(_tail + i - 1) % WATERINGSYSTEM_SERIAL_BUFFERBYTES];
+    }
+    _tail = (_tail + lineLength) % WATERINGSYSTEM_SERIAL_BUFFERBYTES;
+    _length -= lineLength;
+    _droppedLines++;
+    _droppedBytes += lineLength;
+    recordLateFailure();
+    return true;
+}
+
+//
+// Copies the line buffer into the ring, making room for it according to the overflow
+// policy. Returns false, counting the line as dropped, if it doesn't fit.
+//
+bool LoggerInterfaceSerial::copyLine(size_t length) {
+    while (_length + length > WATERINGSYSTEM_SERIAL_BUFFERBYTES) {
+        if (_overflow != SERIAL_OVERFLOW_DROPOLDEST || !dropOldestLine()) {
+            _droppedLines++;
+            _droppedBytes += length;
+            return false;
+        }
+    }
+    size_t head = (_tail + _length) % WATERINGSYSTEM_SERIAL_BUFFERBYTES;
+    size_t first = min(length, WATERINGSYSTEM_SERIAL_BUFFERBYTES - head);
+    memcpy(_ring + head, _line, first);
+    memcpy(_ring, _line + first, length - first);
+    _length += length;
+    if (_length > _peakLength) {
+        _peakLength = _length;
+    }
+    return true;
+}
+
+//
+// Queues a formatted line, then sends what the UART has room for straight away
+//
+void LoggerInterfaceSerial::queueLine(size_t length) {
+    if (length == 0) {
+        _droppedLines++;
+        recordSend(0, false);
+        return;
+    }
+    bool queued = copyLine(length);
+    recordSend(length, queued);
+    if (queued) {
+        loop();
+    }
+}
+
+//
+// Queues a console message as a line of its own. Messages aren't telemetry, so they're
+// left out of the message counts, but are dropped by the same overflow policy.
+//
+void LoggerInterfaceSerial::queueConsoleLine(const char* line, size_t length) {
+    length = min(length, (size_t)WATERINGSYSTEM_SERIAL_MAXLINE - 1);
+    memcpy(_line, line, length);
+    _line[length++] = '\n';
+    if (copyLine(length)) {
+        loop();
+    }
+}
 
-    String logString;
-    serializeJson(logDoc,logString);
+//
+// Sends as much of the ring as fits in the UART transmit FIFO without blocking. Called
+// from the telemetry task, and after each line is queued.
+//
+void LoggerInterfaceSerial::loop() {
+    while (_length > 0) {
+        int space = availableForWrite();
+        if (space <= 0) {
+            return;
+        }
+        size_t chunk = min(min(_length, (size_t)space), WATERINGSYSTEM_SERIAL_BUFFERBYTES - _tail);
+        size_t written = writeOutput(_ring + _tail, chunk);
+        if (written == 0) {
+            return;
+        }
+        _midLine = _ring[(_tail + written - 1) % WATERINGSYSTEM_SERIAL_BUFFERBYTES] != '\n';
+        _tail = (_tail + written) % WATERINGSYSTEM_SERIAL_BUFFERBYTES;
+        _length -= written;
+    }
+}
 
-    Serial.println(logString.c_str());
+void LoggerInterfaceSerial::reportTransportStats(JsonObject statsJson) {
+    statsJson["droppedLines"] = _droppedLines;
+    statsJson["droppedBytes"] = _droppedBytes;
+    statsJson["bufferedBytes"] = _length;
+    statsJson["peakBufferedBytes"] = _peakLength;
 }
 
 #endif
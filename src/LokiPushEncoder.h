@@ -0,0 +1,228 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#ifndef __WATERINGSYSTEM_LOKIPUSHENCODER_H__
+#define __WATERINGSYSTEM_LOKIPUSHENCODER_H__
+
+#define WATERINGSYSTEM_LOKI_MAXPROTOBUF 1024 // Largest push request encoded, larger ones are sent as Json
+#define WATERINGSYSTEM_LOKI_MAXSNAPPY (32 + WATERINGSYSTEM_LOKI_MAXPROTOBUF + WATERINGSYSTEM_LOKI_MAXPROTOBUF / 6)
+#define WATERINGSYSTEM_SNAPPY_HASHBITS 8
+
+//
+// Encodes a single entry Loki push request (logproto.PushRequest) as snappy compressed
+// protobuf, for Loki's application/x-protobuf push endpoint. The request is written
+// directly into buffers owned by the encoder and reused for every entry, so encoding
+// makes no heap allocations.
+//
+// PushRequest     { repeated StreamAdapter streams = 1; }
+// StreamAdapter   { string labels = 1; repeated EntryAdapter entries = 2; }
+// EntryAdapter    { Timestamp timestamp = 1; string line = 2; }
+// Timestamp       { int64 seconds = 1; int32 nanos = 2; }
+//
+class LokiPushEncoder
+{
+  private:
+    uint8_t _protobuf[WATERINGSYSTEM_LOKI_MAXPROTOBUF];
+    uint8_t _snappy[WATERINGSYSTEM_LOKI_MAXSNAPPY];
+    uint16_t _hashTable[1 << WATERINGSYSTEM_SNAPPY_HASHBITS];
+    size_t _protobufLength = 0;
+    size_t _snappyLength = 0;
+
+    static size_t varintSize(uint64_t value);
+    static uint8_t* writeVarint(uint8_t* out, uint64_t value);
+    static uint8_t* writeLengthDelimited(uint8_t* out, uint8_t field, size_t length);
+    static uint32_t load32(const uint8_t* in);
+    static uint8_t* writeSnappyLiteral(uint8_t* out, const uint8_t* literal, size_t length);
+    static uint8_t* writeSnappyCopy(uint8_t* out, size_t offset, size_t length);
+    size_t snappyCompress(const uint8_t* input, size_t length, uint8_t* out);
+
+  public:
+    static void appendLabel(String& labels, const char* name, const String& value);
+    bool encode(const String& labels, uint64_t seconds, JsonDocument& lineDoc);
+    const uint8_t* getPayload();
+    size_t getPayloadLength();
+    size_t getUncompressedLength();
+};
+/****************************************/
+
+size_t LokiPushEncoder::varintSize(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+uint8_t* LokiPushEncoder::writeVarint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+uint8_t* LokiPushEncoder::writeLengthDelimited(uint8_t* out, uint8_t field, size_t length) {
+    *out++ = (field << 3) | 2;
+    return writeVarint(out, length);
+}
+
+//
+// Adds a label to a Prometheus style label set, e.g. {job="a", metric="b"}. Call with
+// an empty string to start a set, and append "}" after the last label.
+//
+void LokiPushEncoder::appendLabel(String& labels, const char* name, const String& value) {
+    labels += labels.isEmpty() ? "{" : ", ";
+    labels += name;
+    labels += "=\"";
+    for (unsigned int i = 0; i < value.length(); i++) {
+        char c = value.charAt(i);
+        if (c == '"' || c == '\\') {
+            labels += '\\';
+        }
+        labels += c;
+    }
+    labels += "\"";
+}
+
+//
+// Encodes a push request holding one entry, with the Json document serialised as the log
+// line, returning false if it doesn't fit the buffers. Nested message lengths are
+// calculated up front, so the request is written in one pass, and the line is serialised
+// straight into place.
+//
+bool LokiPushEncoder::encode(const String& labels, uint64_t seconds, JsonDocument& lineDoc) {
+    size_t lineLength = measureJson(lineDoc);
+    size_t timestampSize = 1 + varintSize(seconds);
+    size_t entrySize = 1 + varintSize(timestampSize) + timestampSize +
+                       1 + varintSize(lineLength) + lineLength;
+    size_t streamSize = 1 + varintSize(labels.length()) + labels.length() +
+                        1 + varintSize(entrySize) + entrySize;
+    size_t requestSize = 1 + varintSize(streamSize) + streamSize;
+    if (requestSize + 1 > WATERINGSYSTEM_LOKI_MAXPROTOBUF) { // Room for the serialiser's terminator
+        return false;
+    }
+
+    uint8_t* out = _protobuf;
+    out = writeLengthDelimited(out, 1, streamSize);           // PushRequest.streams
+    out = writeLengthDelimited(out, 1, labels.length());      // StreamAdapter.labels
+    memcpy(out, labels.c_str(), labels.length());
+    out += labels.length();
+    out = writeLengthDelimited(out, 2, entrySize);            // StreamAdapter.entries
+    out = writeLengthDelimited(out, 1, timestampSize);        // EntryAdapter.timestamp
+    *out++ = (1 << 3) | 0;                                    // Timestamp.seconds
+    out = writeVarint(out, seconds);
+    out = writeLengthDelimited(out, 2, lineLength);           // EntryAdapter.line
+    serializeJson(lineDoc, (char*)out, lineLength + 1);
+    out += lineLength;
+    _protobufLength = out - _protobuf;
+
+    _snappyLength = snappyCompress(_protobuf, _protobufLength, _snappy);
+    return true;
+}
+
+const uint8_t* LokiPushEncoder::getPayload() {
+    return _snappy;
+}
+
+size_t LokiPushEncoder::getPayloadLength() {
+    return _snappyLength;
+}
+
+size_t LokiPushEncoder::getUncompressedLength() {
+    return _protobufLength;
+}
+
+uint32_t LokiPushEncoder::load32(const uint8_t* in) {
+    uint32_t value;
+    memcpy(&value, in, 4);
+    return value;
+}
+
+uint8_t* LokiPushEncoder::writeSnappyLiteral(uint8_t* out, const uint8_t* literal, size_t length) {
+    if (length == 0) {
+        return out;
+    }
+    size_t n = length - 1;
+    if (n < 60) {
+        *out++ = n << 2;
+    } else if (n < 256) {
+        *out++ = 60 << 2;
+        *out++ = n;
+    } else {
+        *out++ = 61 << 2;
+        *out++ = n & 0xFF;
+        *out++ = n >> 8;
+    }
+    memcpy(out, literal, length);
+    return out + length;
+}
+
+//
+// Emits a back reference, split into copies of at most 64 bytes. Short, near copies
+// use the one byte offset form.
+//
+uint8_t* LokiPushEncoder::writeSnappyCopy(uint8_t* out, size_t offset, size_t length) {
+    while (length >= 68) {
+        *out++ = ((64 - 1) << 2) | 2;
+        *out++ = offset & 0xFF;
+        *out++ = offset >> 8;
+        length -= 64;
+    }
+    if (length > 64) {
+        *out++ = ((60 - 1) << 2) | 2;
+        *out++ = offset & 0xFF;
+        *out++ = offset >> 8;
+        length -= 60;
+    }
+    if (length < 12 && offset < 2048) {
+        *out++ = ((offset >> 8) << 5) | ((length - 4) << 2) | 1;
+        *out++ = offset & 0xFF;
+    } else {
+        *out++ = ((length - 1) << 2) | 2;
+        *out++ = offset & 0xFF;
+        *out++ = offset >> 8;
+    }
+    return out;
+}
+
+//
+// Snappy block compression: a preamble holding the uncompressed length, then literals
+// and back references found through a small hash table of 4 byte sequences.
+//
+size_t LokiPushEncoder::snappyCompress(const uint8_t* input, size_t length, uint8_t* out) {
+    uint8_t* start = out;
+    out = writeVarint(out, length);
+    memset(_hashTable, 0, sizeof(_hashTable));
+
+    size_t literalStart = 0;
+    size_t position = 0;
+    while (position + 4 <= length) {
+        uint32_t bytes = load32(input + position);
+        uint32_t hash = (bytes * 0x1E35A7BD) >> (32 - WATERINGSYSTEM_SNAPPY_HASHBITS);
+        size_t candidate = _hashTable[hash];   // Stored plus one, so zero is empty
+        _hashTable[hash] = position + 1;
+        if (candidate == 0 || load32(input + candidate - 1) != bytes) {
+            position++;
+            continue;
+        }
+        candidate--;
+        size_t matchLength = 4;
+        while (position + matchLength < length && input[candidate + matchLength] == input[position + matchLength]) {
+            matchLength++;
+        }
+        out = writeSnappyLiteral(out, input + literalStart, position - literalStart);
+        out = writeSnappyCopy(out, position - candidate, matchLength);
+        position += matchLength;
+        literalStart = position;
+    }
+    out = writeSnappyLiteral(out, input + literalStart, length - literalStart);
+    return out - start;
+}
+
+#endif
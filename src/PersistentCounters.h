@@ -0,0 +1,282 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "LittleFS.h"
+#include "SerialConsole.h"
+
+#ifndef __WATERINGSYSTEM_PERSISTENTCOUNTERS_H__
+#define __WATERINGSYSTEM_PERSISTENTCOUNTERS_H__
+
+#define WATERINGSYSTEM_COUNTERS_GROUPS 16          // Sensor groups counted, besides the totals
+#define WATERINGSYSTEM_COUNTERS_NAMELENGTH 24      // Including the terminator, longer group names are truncated
+#define WATERINGSYSTEM_COUNTERS_LOGBYTES 4096      // Log size at which it is compacted rather than appended to
+#define WATERINGSYSTEM_COUNTERS_FLUSHSECS 21600    // Flush changes at least this often
+#define WATERINGSYSTEM_COUNTERS_FLUSHPUMPSECS 300  // Flush sooner once this much pumping is unsaved
+#define WATERINGSYSTEM_COUNTERS_MINFLUSHSECS 1800  // Never flush more often, so at most 48 flushes a day
+#define WATERINGSYSTEM_COUNTERS_MAGIC 0xC0A7
+
+struct CounterValues
+{
+    uint32_t pumpStarts;
+    uint32_t pumpSeconds;
+    uint32_t lowWaterCutoffs;
+};
+
+struct CounterRecord
+{
+    uint16_t magic;
+    char name[WATERINGSYSTEM_COUNTERS_NAMELENGTH]; // Empty for the totals
+    CounterValues values;
+    uint32_t checksum; // FNV-1a of the record up to here
+};
+
+//
+// Lifetime pump counters, per sensor group and in total, kept across reboots and OTA
+// updates. Counting is done in RAM. Changed counters are flushed as absolute values,
+// appended to a log file, so a flush is one small write rather than rewriting a file,
+// and a torn write at power loss only loses the last record. Flushes are rate limited,
+// bounding flash writes per day. On boot, the log is read with the last record for each
+// group winning, and compacted to one record per group. The log is also compacted
+// whenever it reaches WATERINGSYSTEM_COUNTERS_LOGBYTES.
+//
+// Counters are kept by group name, so they follow a group across configuration changes.
+// Slot 0 holds the totals, which include groups that didn't fit in the table.
+//
+class PersistentCounters
+{
+  private:
+    const char* _logFile = "/counters.log";
+    const char* _compactFile = "/counters.tmp";
+    char _names[WATERINGSYSTEM_COUNTERS_GROUPS + 1][WATERINGSYSTEM_COUNTERS_NAMELENGTH] = {};
+    CounterValues _values[WATERINGSYSTEM_COUNTERS_GROUPS + 1] = {};
+    uint16_t _pumpMillis[WATERINGSYSTEM_COUNTERS_GROUPS + 1] = {}; // Part seconds not yet counted
+    uint8_t _slotCount = 1;
+    uint32_t _dirtyMask = 0;
+    unsigned long _unsavedPumpSeconds = 0;
+    unsigned long _lastFlushMillis = 0;
+    unsigned long _flashWrites = 0;
+    size_t _logBytes = 0;
+
+    static uint32_t checksum(const CounterRecord& record);
+    int8_t findSlot(const char* name);
+    void addPumpMillis(uint8_t slot, unsigned long pumpMillis);
+    void writeRecord(File& file, uint8_t slot);
+    bool compact();
+
+  public:
+    void begin();
+    int8_t getGroupSlot(const String& group);
+    void recordPumpStart(int8_t slot);
+    void recordPumpRun(int8_t slot, unsigned long pumpMillis);
+    void recordLowWaterCutoff(int8_t slot);
+    bool flushIfDue();
+    bool flush();
+    void report(JsonObject countersJson);
+};
+/****************************************/
+
+uint32_t PersistentCounters::checksum(const CounterRecord& record) {
+    const uint8_t* bytes = (const uint8_t*)&record;
+    uint32_t hash = 2166136261UL;
+    for (size_t i = 0; i < offsetof(CounterRecord, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+int8_t PersistentCounters::findSlot(const char* name) {
+    for (uint8_t slot = 0; slot < _slotCount; slot++) {
+        if (strncmp(_names[slot], name, WATERINGSYSTEM_COUNTERS_NAMELENGTH - 1) == 0) {
+            return slot;
+        }
+    }
+    if (_slotCount > WATERINGSYSTEM_COUNTERS_GROUPS) {
+        return -1;
+    }
+    strncpy(_names[_slotCount], name, WATERINGSYSTEM_COUNTERS_NAMELENGTH - 1);
+    return _slotCount++;
+}
+
+//
+// Loads the counters, compacting the log if it holds superseded or torn records. Needs
+// LittleFS mounted, and is called before the sensor groups are configured.
+//
+void PersistentCounters::begin() {
+    // A compaction interrupted after removing the log leaves the complete compacted file,
+    // one interrupted before that leaves a partial one
+    if (!LittleFS.exists(_logFile) && LittleFS.exists(_compactFile)) {
+        LittleFS.rename(_compactFile, _logFile);
+    } else {
+        LittleFS.remove(_compactFile);
+    }
+
+    uint16_t recordCount = 0;
+    bool torn = false;
+    File file = LittleFS.open(_logFile, "r");
+    if (file) {
+        CounterRecord record;
+        while (file.readBytes((char*)&record, sizeof(record)) == sizeof(record)) {
+            if (record.magic != WATERINGSYSTEM_COUNTERS_MAGIC || record.checksum != checksum(record)) {
+                torn = true;
+                break;
+            }
+            record.name[WATERINGSYSTEM_COUNTERS_NAMELENGTH - 1] = 0;
+            int8_t slot = findSlot(record.name);
+            if (slot >= 0) {
+                _values[slot] = record.values;
+            }
+            recordCount++;
+        }
+        torn = torn || file.available() > 0;
+        _logBytes = recordCount * sizeof(CounterRecord);
+        file.close();
+    }
+    if (torn || recordCount > _slotCount) {
+        compact();
+    }
+    _lastFlushMillis = millis();
+}
+
+//
+// Returns the slot counting a group, or -1 if the table is full, in which case the
+// group is only counted in the totals
+//
+int8_t PersistentCounters::getGroupSlot(const String& group) {
+    if (group.length() == 0) {
+        return -1;
+    }
+    return findSlot(group.c_str());
+}
+
+void PersistentCounters::recordPumpStart(int8_t slot) {
+    _values[0].pumpStarts++;
+    _dirtyMask |= 1;
+    if (slot > 0) {
+        _values[slot].pumpStarts++;
+        _dirtyMask |= 1UL << slot;
+    }
+}
+
+void PersistentCounters::addPumpMillis(uint8_t slot, unsigned long pumpMillis) {
+    unsigned long millisTotal = _pumpMillis[slot] + pumpMillis;
+    _values[slot].pumpSeconds += millisTotal / 1000;
+    _pumpMillis[slot] = millisTotal % 1000;
+    _dirtyMask |= 1UL << slot;
+}
+
+void PersistentCounters::recordPumpRun(int8_t slot, unsigned long pumpMillis) {
+    addPumpMillis(0, pumpMillis);
+    if (slot > 0) {
+        addPumpMillis(slot, pumpMillis);
+    }
+    _unsavedPumpSeconds += pumpMillis / 1000;
+}
+
+void PersistentCounters::recordLowWaterCutoff(int8_t slot) {
+    _values[0].lowWaterCutoffs++;
+    _dirtyMask |= 1;
+    if (slot > 0) {
+        _values[slot].lowWaterCutoffs++;
+        _dirtyMask |= 1UL << slot;
+    }
+}
+
+void PersistentCounters::writeRecord(File& file, uint8_t slot) {
+    CounterRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = WATERINGSYSTEM_COUNTERS_MAGIC;
+    strncpy(record.name, _names[slot], WATERINGSYSTEM_COUNTERS_NAMELENGTH - 1);
+    record.values = _values[slot];
+    record.checksum = checksum(record);
+    file.write((const uint8_t*)&record, sizeof(record));
+}
+
+//
+// Rewrites the log with one record per slot, via a temporary file so a power cut
+// part way through leaves the old log
+//
+bool PersistentCounters::compact() {
+    File file = LittleFS.open(_compactFile, "w");
+    if (!file) {
+        serialConsole.println("Failed to open counters file for writing");
+        return false;
+    }
+    for (uint8_t slot = 0; slot < _slotCount; slot++) {
+        writeRecord(file, slot);
+    }
+    file.close();
+    LittleFS.remove(_logFile);
+    LittleFS.rename(_compactFile, _logFile);
+    _logBytes = _slotCount * sizeof(CounterRecord);
+    _flashWrites++;
+    return true;
+}
+
+//
+// Flushes changed counters when enough pumping is unsaved, or they have waited long
+// enough, but never more often than WATERINGSYSTEM_COUNTERS_MINFLUSHSECS. Called
+// from the telemetry task.
+//
+bool PersistentCounters::flushIfDue() {
+    unsigned long sinceFlush = millis() - _lastFlushMillis;
+    if (!_dirtyMask || sinceFlush < WATERINGSYSTEM_COUNTERS_MINFLUSHSECS * 1000UL) {
+        return false;
+    }
+    if (_unsavedPumpSeconds < WATERINGSYSTEM_COUNTERS_FLUSHPUMPSECS &&
+        sinceFlush < WATERINGSYSTEM_COUNTERS_FLUSHSECS * 1000UL) {
+        return false;
+    }
+    return flush();
+}
+
+//
+// Writes changed counters straight away, such as before an OTA update reboots
+//
+bool PersistentCounters::flush() {
+    if (!_dirtyMask) {
+        return true;
+    }
+    bool written;
+    if (_logBytes + __builtin_popcount(_dirtyMask) * sizeof(CounterRecord) > WATERINGSYSTEM_COUNTERS_LOGBYTES) {
+        written = compact();
+    } else {
+        File file = LittleFS.open(_logFile, "a");
+        written = (bool)file;
+        if (file) {
+            uint32_t remaining = _dirtyMask;
+            while (remaining) {
+                writeRecord(file, __builtin_ctz(remaining));
+                remaining &= remaining - 1;
+                _logBytes += sizeof(CounterRecord);
+            }
+            file.close();
+            _flashWrites++;
+        } else {
+            serialConsole.println("Failed to open counters file for writing");
+        }
+    }
+    _lastFlushMillis = millis();
+    if (written) {
+        _dirtyMask = 0;
+        _unsavedPumpSeconds = 0;
+    }
+    return written;
+}
+
+// Adds the current counters, including any not yet flushed, to a Json object
+void PersistentCounters::report(JsonObject countersJson) {
+    countersJson["flashWrites"] = _flashWrites;
+    countersJson["unsaved"] = _dirtyMask != 0;
+    for (uint8_t slot = 0; slot < _slotCount; slot++) {
+        JsonObject valuesJson = slot == 0 ? countersJson["total"].to<JsonObject>() :
+                                            countersJson["groups"][(const char*)_names[slot]].to<JsonObject>();
+        valuesJson["pumpStarts"] = _values[slot].pumpStarts;
+        valuesJson["pumpSeconds"] = _values[slot].pumpSeconds;
+        valuesJson["lowWaterCutoffs"] = _values[slot].lowWaterCutoffs;
+    }
+}
+
+#endif
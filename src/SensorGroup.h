@@ -5,7 +5,11 @@
 #include <list>
 #include "IrrigationLogger.h"
 #include "IrrigationTimer.h"
+#include "ControlClock.h"
 #include "AnalogueSensorHandler.h"
+#include "ActuatorOutputs.h"
+#include "PersistentCounters.h"
+#include "SerialConsole.h"
 
 
 #ifndef __WATERINGSYSTEM_SENSORGROUP_H__
@@ -20,58 +24,82 @@ class SensorGroup
 {
   private:
       AnalogueSensorHandler* _analogueSensorHandler;
+      ActuatorOutputs* _actuatorOutputs;
       String _groupName;
-      std::list<uint8_t> _pumpPinIds;
-      std::list<uint8_t> _moistureSensorChannelNumbers;
+      uint32_t _pumpOutputMask;   // Bit per actuator output driven by this group
+      uint32_t _moistureSensorChannelMask; // Bit per moisture sensor channel
       int _waterLevelChannelNumber;
       int _triggerMode;
       int _minThreshold;
       int _pumpPeriodSeconds;
       unsigned long _pumpStopTime;
+      unsigned long _pumpStartTime;
       IrrigationLogger* _logger;
-      std::list<int> _sensorValues;
+      PersistentCounters* _counters = NULL;
+      int8_t _counterSlot = -1;
       bool _isPumping = false;
+      bool _moistureUpdated = false;  // New moisture readings since the last evaluation
+      bool _lastNeedsWatering = false;
       unsigned long _waterCheckPeriodMs;
       unsigned long _pumpCheckPeriodMs;
       unsigned long _moistureCheckPeriodMs;
       IrrigationTimer waterLevelCheckTimer = IrrigationTimer("water");
       IrrigationTimer moistureCheckTimer = IrrigationTimer("moisture");
       IrrigationTimer pumpCheckTimer = IrrigationTimer("pump");
+      IrrigationTimer soakTimer = IrrigationTimer("soak");
+      template<int TriggerMode> bool needsWateringFor(bool logLevels);
+      void countPumpRun();
 
   public:
       SensorGroup(IrrigationLogger* logger,
                   AnalogueSensorHandler* sensorHandler,
+                  ActuatorOutputs* actuatorOutputs,
                   String groupName,
                           int triggerMode,
                           uint8_t waterLevelChannelNumber,
-                          std::list<uint8_t> moistureSensorChannelNumbers,
-                          std::list<uint8_t> pumpPinIds,
+                          uint32_t moistureSensorChannelMask,
+                          uint32_t pumpOutputMask,
                           int minThreshold,
                           int pumpPeriodSeconds,
                           unsigned long waterCheckPeriodMs,
                           unsigned long pumpCheckPeriodMs,
                           unsigned long moistureCheckPeriodMs);
       ~SensorGroup();
-      void checkMoistureLevelAndWaterAndWaterIfNeeded();
-      std::list<int> getSensorValues();
-      bool needsWatering();
+      void setCounters(PersistentCounters* counters);
+      void checkMoistureLevelAndWaterAndWaterIfNeeded(bool logLevels = true);
+      bool needsWatering(bool logLevels = true);
+      void notifyMoistureUpdate(uint32_t updatedChannels);
       String getGroupName();
-      std::list<uint8_t> getPumpPinIds();
+      uint32_t getPumpOutputMask();
+      uint32_t getMoistureSensorChannelMask();
+      int getWaterLevelChannel();
+      int getTriggerMode();
+      int getMinThreshold();
+      int getPumpPeriodSeconds();
+      unsigned long getWaterCheckPeriodMs();
+      unsigned long getPumpCheckPeriodMs();
+      unsigned long getMoistureCheckPeriodMs();
+      void setMinThreshold(int minThreshold);
       void startPumping();
+      void startPumpingFor(int pumpSeconds);
+      void finishPumping();
+      void stopPumping();
       bool isPumping();
       int getWaterLevel();
       void logWaterLevel();
       bool hasWater();
+      bool hasWaterAtLevel(int waterLevel);
       void loop();
 };
 
 SensorGroup::SensorGroup(IrrigationLogger* logger,
                          AnalogueSensorHandler* sensorHandler,
+                         ActuatorOutputs* actuatorOutputs,
                          String groupName,
                          int triggerMode,
                          uint8_t waterLevelChannelNumber,
-                         std::list<uint8_t> moistureSensorChannelNumbers,
-                         std::list<uint8_t> pumpPinIds,
+                         uint32_t moistureSensorChannelMask,
+                         uint32_t pumpOutputMask,
                          int minThreshold,
                          int pumpPeriodSeconds,
                          unsigned long waterCheckPeriodMs,
@@ -79,9 +107,10 @@ SensorGroup::SensorGroup(IrrigationLogger* logger,
                          unsigned long moistureCheckPeriodMs) {
     _logger = logger;
     _analogueSensorHandler = sensorHandler;
+    _actuatorOutputs = actuatorOutputs;
     _groupName = groupName;
-    _moistureSensorChannelNumbers = moistureSensorChannelNumbers;
-    _pumpPinIds = pumpPinIds;
+    _moistureSensorChannelMask = moistureSensorChannelMask;
+    _pumpOutputMask = pumpOutputMask;
     _waterLevelChannelNumber = waterLevelChannelNumber;
     _triggerMode = triggerMode;
     _minThreshold = minThreshold;
@@ -89,19 +118,27 @@ SensorGroup::SensorGroup(IrrigationLogger* logger,
     _waterCheckPeriodMs = waterCheckPeriodMs;
     _pumpCheckPeriodMs = pumpCheckPeriodMs;
     _moistureCheckPeriodMs = moistureCheckPeriodMs;
-  
-    for (auto & pumpPinId : _pumpPinIds) {    
-        pinMode(pumpPinId, OUTPUT);
-        digitalWrite(pumpPinId, false);
-    }
+    _actuatorOutputs->setOutputs(_pumpOutputMask, false);
 
     return;
 }
 
 SensorGroup::~SensorGroup() {
-    // Stop pumping upon destruction
-    for (auto & pumpPinId : _pumpPinIds) {
-        digitalWrite(pumpPinId, false);
+    // Stop pumping upon destruction. The owner commits the outputs.
+    _actuatorOutputs->setOutputs(_pumpOutputMask, false);
+    countPumpRun();
+}
+
+// Sets where pump starts, runtime and low water cutoffs are counted, by group name
+void SensorGroup::setCounters(PersistentCounters* counters) {
+    _counters = counters;
+    _counterSlot = counters->getGroupSlot(_groupName);
+}
+
+// Counts the runtime of the current pump run, if pumping
+void SensorGroup::countPumpRun() {
+    if (_isPumping && _counters) {
+        _counters->recordPumpRun(_counterSlot, controlClock.millis() - _pumpStartTime);
     }
 }
 
@@ -109,82 +146,160 @@ String SensorGroup::getGroupName() {
     return _groupName;
 }
 
-std::list<uint8_t> SensorGroup::getPumpPinIds() {
-    return _pumpPinIds;
+uint32_t SensorGroup::getPumpOutputMask() {
+    return _pumpOutputMask;
+}
+
+uint32_t SensorGroup::getMoistureSensorChannelMask() {
+    return _moistureSensorChannelMask;
+}
+
+int SensorGroup::getWaterLevelChannel() {
+    return _waterLevelChannelNumber;
+}
+
+int SensorGroup::getTriggerMode() {
+    return _triggerMode;
+}
+
+int SensorGroup::getMinThreshold() {
+    return _minThreshold;
+}
+
+int SensorGroup::getPumpPeriodSeconds() {
+    return _pumpPeriodSeconds;
+}
+
+unsigned long SensorGroup::getWaterCheckPeriodMs() {
+    return _waterCheckPeriodMs;
+}
+
+unsigned long SensorGroup::getPumpCheckPeriodMs() {
+    return _pumpCheckPeriodMs;
+}
+
+unsigned long SensorGroup::getMoistureCheckPeriodMs() {
+    return _moistureCheckPeriodMs;
+}
+
+// Changes the moisture threshold of the running group, until the configuration is reloaded.
+// The group evaluates the current readings against it on its next pass.
+void SensorGroup::setMinThreshold(int minThreshold) {
+    _minThreshold = minThreshold;
+    _moistureUpdated = true;
 }
 
 // If we're not already pumping, start the pump
 void SensorGroup::startPumping() {
+    startPumpingFor(_pumpPeriodSeconds);
+}
+
+// If we're not already pumping, start the pump for the given period
+void SensorGroup::startPumpingFor(int pumpSeconds) {
     if (!_isPumping) {
-        _pumpStopTime = millis() + _pumpPeriodSeconds * 1000;
-        for (auto & pumpPinId : _pumpPinIds) {
-            Serial.println("  *** Starting pumping on : " + String(pumpPinId) + ", " + String(millis()) + "->" + String(_pumpStopTime));
-            _logger->logPumpStatus(_groupName, true); // TODO This should probably move out of the loop
-            digitalWrite(pumpPinId, true);
-        }
+        _pumpStartTime = controlClock.millis();
+        _pumpStopTime = _pumpStartTime + pumpSeconds * 1000;
+        serialConsole.println("  *** Starting pumping on outputs : 0x" + String(_pumpOutputMask, HEX) + ", " + String(_pumpStartTime) + "->" + String(_pumpStopTime));
+        _logger->logPumpStatus(_groupName, true);
+        _actuatorOutputs->setOutputs(_pumpOutputMask, true);
         _isPumping = true;
+        if (_counters) {
+            _counters->recordPumpStart(_counterSlot);
+        }
     }
     return;
 }
 
+//
+// Switches the pumps off and logs the change, if pumping. Moisture isn't evaluated again
+// for a moisture check period, giving the water time to reach the sensors.
+//
+void SensorGroup::finishPumping() {
+    if (_isPumping) {
+        serialConsole.println("  ** Stopping pumping on outputs : 0x" + String(_pumpOutputMask, HEX) + ", " + String(controlClock.millis()));
+        _actuatorOutputs->setOutputs(_pumpOutputMask, false);
+        _logger->logPumpStatus(_groupName, false);
+        countPumpRun();
+        _isPumping = false;
+        soakTimer.setTimer(_moistureCheckPeriodMs);
+    }
+}
+
+// Switches the pumps off without logging, when the group is taken out of service
+void SensorGroup::stopPumping() {
+    _actuatorOutputs->setOutputs(_pumpOutputMask, false);
+    countPumpRun();
+    _isPumping = false;
+}
+
 // Returns the pumping status, stopping the pump
 // if we've exceeded the pump time.
 bool SensorGroup::isPumping() {
   if (_isPumping) {
       // Have we run out of water or pumped long enough?
-      if (!hasWater() || (_pumpStopTime < millis())) {
-          for (auto & pumpPinId : _pumpPinIds) {
-              Serial.println("  ** Stopping pumping on : " + String(pumpPinId) + ", " + String(millis()));
-              digitalWrite(pumpPinId, false);
+      if (!hasWater()) {
+          if (_counters) {
+              _counters->recordLowWaterCutoff(_counterSlot);
           }
-          _logger->logPumpStatus(_groupName, false);
-          _isPumping = false;
+          finishPumping();
+      } else if (_pumpStopTime < controlClock.millis()) {
+          finishPumping();
       }
   }
   return _isPumping;
 }
 
-std::list<int> SensorGroup::getSensorValues() {
-    _sensorValues = std::list<int>{};
-    int sensorValue;
-    // Loop through the sensors in the group, logging the values, and storing
-    for (auto const& channelNumber : _moistureSensorChannelNumbers) {
-        sensorValue = _analogueSensorHandler->getSensorSimpleMovingAverageReading(channelNumber);
-        _logger->logMoistureLevel(_groupName, channelNumber, sensorValue, _minThreshold);
-        _sensorValues.push_back(sensorValue);
-    }
-
-    return _sensorValues;
-}
-
-bool SensorGroup::needsWatering() {
+//
+// Reads each moisture sensor in the group, logging them if asked, returning true if the
+// trigger condition is met. Specialised per trigger mode, so "any" groups return on the
+// first dry sensor without the mode being tested for every reading.
+//
+template<int TriggerMode>
+bool SensorGroup::needsWateringFor(bool logLevels) {
+    int sensorCount = 0;
     int sensorsTriggeredCount = 0;
-    _sensorValues = getSensorValues();
-
-    if (_sensorValues.size() == 0) {
-        return false;
-    }
-    // Loop through the sensors, and if we're "ANY" mode, and
-    // any sensors are below threshold, return true. Maintain
-    // a count of total breached sensors.
-    for (auto const& sensorValue : _sensorValues) {
+    uint32_t remainingChannels = _moistureSensorChannelMask;
+    while (remainingChannels) {
+        uint8_t channelNumber = __builtin_ctz(remainingChannels);
+        remainingChannels &= remainingChannels - 1;
+        // Channels not polled since the configuration was applied have no moving average yet,
+        // rather than a bone dry one, so they're left out until they have
+        if (!_analogueSensorHandler->hasReadings(channelNumber)) {
+            continue;
+        }
+        int sensorValue = _analogueSensorHandler->getSensorSimpleMovingAverageReading(channelNumber);
+        if (logLevels) {
+            _logger->logMoistureLevel(_groupName, channelNumber, sensorValue, _minThreshold);
+        }
+        // Faulty channels don't count towards either trigger mode
+        if (!_analogueSensorHandler->isChannelHealthy(channelNumber)) {
+            continue;
+        }
+        sensorCount++;
         if (sensorValue < _minThreshold) {
-            if (_triggerMode == MOISTURE_CONTROLLER_TRIGGER_ANY) {
+            if (TriggerMode == MOISTURE_CONTROLLER_TRIGGER_ANY) {
                 return true;
-            } else {
-                sensorsTriggeredCount++;
             }
+            sensorsTriggeredCount++;
         }
     }
+    return sensorCount > 0 && sensorsTriggeredCount >= sensorCount;
+}
+
+bool SensorGroup::needsWatering(bool logLevels) {
+    if (_triggerMode == MOISTURE_CONTROLLER_TRIGGER_ANY) {
+        return needsWateringFor<MOISTURE_CONTROLLER_TRIGGER_ANY>(logLevels);
+    }
+    return needsWateringFor<MOISTURE_CONTROLLER_TRIGGER_ALL>(logLevels);
+}
 
-    //
-    // We reach here if we're in "ALL" sensors mode. If all sensors
-    // are below threshold, return true, otherwise return false.
-    //
-    if (sensorsTriggeredCount >= (int)_sensorValues.size()) {
-        return true;
-    } else {
-        return false;
+//
+// Called after each sensor poll with the channels that have new readings. Groups reading
+// none of them are left alone, others evaluate on their next pass.
+//
+void SensorGroup::notifyMoistureUpdate(uint32_t updatedChannels) {
+    if (updatedChannels & _moistureSensorChannelMask) {
+        _moistureUpdated = true;
     }
 }
 
@@ -199,33 +314,58 @@ int SensorGroup::getWaterLevel() {
 }
 
 bool SensorGroup::hasWater() {
-    return getWaterLevel() > IRRIGATION_MINIMUM_WATER_LEVEL;
+    return hasWaterAtLevel(getWaterLevel());
 }
 
-void SensorGroup::checkMoistureLevelAndWaterAndWaterIfNeeded() {
-    bool needsWateringResult = needsWatering();
-    _logger->logMoistureAlarmStatus(_groupName, needsWateringResult);
+//
+// A calibrated water level channel reads 0% at the calibrated empty level, so any level
+// above that has water. Raw readings need to be clear of the sensor's dry reading.
+//
+bool SensorGroup::hasWaterAtLevel(int waterLevel) {
+    if (_analogueSensorHandler->isCalibrated(_waterLevelChannelNumber)) {
+        return waterLevel > 0;
+    }
+    return waterLevel > IRRIGATION_MINIMUM_WATER_LEVEL;
+}
+
+//
+// Evaluates the moisture sensors, logging the alarm status when the levels are logged or
+// it changes
+//
+void SensorGroup::checkMoistureLevelAndWaterAndWaterIfNeeded(bool logLevels) {
+    bool needsWateringResult = needsWatering(logLevels);
+    if (logLevels || needsWateringResult != _lastNeedsWatering) {
+        _logger->logMoistureAlarmStatus(_groupName, needsWateringResult);
+    }
+    _lastNeedsWatering = needsWateringResult;
           
     // If it needs watering, and isn't already pumping, and we have water, start pumping
-    if (needsWateringResult && !isPumping() && hasWater()) {
+    if (needsWateringResult && !_isPumping && hasWater()) {
         startPumping();
     }
 }
 
 //
 // Main SensorGroup control logic, called from IrrigationSystem control cycle loop.
-// When respective timers have lapsed, check:
-// - Moisture levels, starting watering cycle if required
-// - Water level, reporting this to the logger
+// Check:
+// - Moisture levels, when there are new readings, starting watering cycle if required.
+//   Levels are logged once per moisture check period, and after pumping the next
+//   evaluation waits a moisture check period for the water to soak in.
+// - Water level, reporting this to the logger, when its timer lapses
 // - Pumping status, stopping the pump(s) if we've pumped long enough or
-//   run out of water.
+//   run out of water, when its timer lapses
 //
 void SensorGroup::loop() {
-    if (moistureCheckTimer.hasLapsed()) {
-        if (!isPumping()) {
-          checkMoistureLevelAndWaterAndWaterIfNeeded();
+    HEAP_SCOPE(HEAP_TAG_SENSORGROUP);
+    // The pump's water and stop time are left to the pump check timer, as checking
+    // the water level reads the sensor
+    if (_moistureUpdated && !_isPumping && soakTimer.hasLapsed()) {
+        _moistureUpdated = false;
+        bool logLevels = moistureCheckTimer.hasLapsed();
+        if (logLevels) {
+            moistureCheckTimer.setTimer(_moistureCheckPeriodMs);
         }
-        moistureCheckTimer.setTimer(_moistureCheckPeriodMs);
+        checkMoistureLevelAndWaterAndWaterIfNeeded(logLevels);
     }
     if (waterLevelCheckTimer.hasLapsed()) {
         logWaterLevel();
@@ -0,0 +1,366 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include "LittleFS.h"
+#include "SerialConsole.h"
+
+//
+// Compact on-device time-series history for the analogue sensor channels.
+//
+// Each channel owns a small ring of fixed size RAM blocks. Within a block, samples are
+// stored relative to the first sample of the block: timestamps as a delta-of-delta, and
+// values as a zigzag encoded delta. The common cases are packed into single byte tokens:
+//
+//   0vvvvvvv  - timestamp delta unchanged, value delta (zigzag) v of 0..127
+//   10nnnnnn  - run of n+1 samples with unchanged timestamp delta and unchanged value
+//   11000000  - escape, followed by zigzag varint delta-of-delta and zigzag varint value delta
+//
+// Timestamps are quantized to the sample period, so the jitter of the sensor polls
+// doesn't turn every delta-of-delta into an escape, and a steady channel sampled once a
+// minute costs well under a byte per sample. The blocks for a channel are allocated when
+// its first sample is recorded, and kept, so unused channels cost no RAM. When the ring
+// for a channel is full, the oldest block is optionally spilled to LittleFS before being
+// reused. Timestamps are seconds since boot, and spilled history is cleared on boot, as
+// it cannot be related to the new timebase.
+//
+
+#ifndef __WATERINGSYSTEM_SENSORHISTORY_H__
+#define __WATERINGSYSTEM_SENSORHISTORY_H__
+
+#define WATERINGSYSTEM_HISTORY_CHANNELS 32         // Matches WATERINGSYSTEM_MAXSENSORS
+#define WATERINGSYSTEM_HISTORY_BLOCKBYTES 128      // Encoded sample bytes per block
+#define WATERINGSYSTEM_HISTORY_BLOCKSPERCHANNEL 4  // RAM blocks per channel
+#define WATERINGSYSTEM_HISTORY_SPILLBLOCKS 48      // Blocks per spill file before it is rotated
+#define WATERINGSYSTEM_HISTORY_DEFAULTSAMPLESECS 60
+#define WATERINGSYSTEM_HISTORY_MAXTOKENBYTES 11    // Escape byte plus two 5 byte varints
+
+#define HISTORY_TOKEN_RUN 0x80
+#define HISTORY_TOKEN_ESCAPE 0xC0
+#define HISTORY_MAX_RUN 64
+
+struct HistoryBlock
+{
+    uint32_t startTime;      // Timestamp of the first sample in the block
+    uint32_t lastTime;       // Timestamp of the most recent sample
+    int32_t  lastInterval;   // Most recent timestamp delta, for delta-of-delta encoding
+    int16_t  startValue;
+    int16_t  lastValue;
+    uint16_t sampleCount;
+    uint16_t usedBytes;
+    int16_t  runTokenPos;    // Offset of the run token still open for extension, or -1
+    uint8_t  data[WATERINGSYSTEM_HISTORY_BLOCKBYTES];
+};
+
+class SensorHistory
+{
+  private:
+    HistoryBlock* _blocks[WATERINGSYSTEM_HISTORY_CHANNELS] = {}; // Ring of blocks per channel, NULL until first used
+    uint8_t  _headBlock[WATERINGSYSTEM_HISTORY_CHANNELS];   // Block currently being appended to
+    uint8_t  _blockCount[WATERINGSYSTEM_HISTORY_CHANNELS];  // Blocks in use
+    uint32_t _lastSampleTime[WATERINGSYSTEM_HISTORY_CHANNELS];
+    uint16_t _spilledBlocks[WATERINGSYSTEM_HISTORY_CHANNELS];
+    uint32_t _samplePeriodSecs = WATERINGSYSTEM_HISTORY_DEFAULTSAMPLESECS;
+    bool     _spillEnabled = false;
+
+    static uint32_t zigzag(int32_t value);
+    static int32_t unzigzag(uint32_t value);
+    static uint8_t writeVarint(uint8_t* buffer, uint32_t value);
+    static uint8_t readVarint(const uint8_t* buffer, uint16_t length, uint16_t* pos, uint32_t* value);
+    void startBlock(HistoryBlock* block, uint32_t timestamp, int value);
+    bool appendToBlock(HistoryBlock* block, uint32_t timestamp, int value);
+    void spillBlock(uint8_t channel, HistoryBlock* block);
+    String spillFileName(uint8_t channel, bool old);
+
+  public:
+    SensorHistory();
+    ~SensorHistory();
+    void configure(uint32_t samplePeriodSecs, bool spillEnabled);
+    void clear();
+    void recordSample(uint8_t channel, uint32_t timestamp, int value);
+    size_t getUsedBytes();
+
+    //
+    // Decodes the history for a channel, oldest first, calling the visitor with each
+    // sample in the [from,to] range. Spilled blocks are visited before RAM blocks.
+    //
+    template <typename Visitor>
+    void forEachSample(uint8_t channel, uint32_t from, uint32_t to, Visitor visitor);
+    template <typename Visitor>
+    static void decodeBlock(const HistoryBlock* block, uint32_t from, uint32_t to, Visitor& visitor);
+};
+/****************************************/
+
+SensorHistory::SensorHistory() {
+    clear();
+    return;
+}
+
+SensorHistory::~SensorHistory() {
+    for (uint8_t channel = 0; channel < WATERINGSYSTEM_HISTORY_CHANNELS; channel++) {
+        delete[] _blocks[channel];
+    }
+}
+
+//
+// Applies the history configuration. Spilled history from an earlier boot is
+// removed, as its timestamps are relative to a previous boot.
+//
+void SensorHistory::configure(uint32_t samplePeriodSecs, bool spillEnabled) {
+    _samplePeriodSecs = samplePeriodSecs;
+    if (_spillEnabled != spillEnabled) {
+        for (uint8_t channel = 0; channel < WATERINGSYSTEM_HISTORY_CHANNELS; channel++) {
+            LittleFS.remove(spillFileName(channel, false));
+            LittleFS.remove(spillFileName(channel, true));
+            _spilledBlocks[channel] = 0;
+        }
+    }
+    _spillEnabled = spillEnabled;
+}
+
+void SensorHistory::clear() {
+    memset(_headBlock, 0, sizeof(_headBlock));
+    memset(_blockCount, 0, sizeof(_blockCount));
+    memset(_lastSampleTime, 0, sizeof(_lastSampleTime));
+    memset(_spilledBlocks, 0, sizeof(_spilledBlocks));
+}
+
+uint32_t SensorHistory::zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+int32_t SensorHistory::unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+uint8_t SensorHistory::writeVarint(uint8_t* buffer, uint32_t value) {
+    uint8_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+// Returns the number of bytes consumed, or 0 if the varint runs past the end of the buffer
+uint8_t SensorHistory::readVarint(const uint8_t* buffer, uint16_t length, uint16_t* pos, uint32_t* value) {
+    uint32_t result = 0;
+    uint8_t shift = 0;
+    uint16_t start = *pos;
+    while (*pos < length && shift < 35) {
+        uint8_t byte = buffer[(*pos)++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return *pos - start;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+void SensorHistory::startBlock(HistoryBlock* block, uint32_t timestamp, int value) {
+    block->startTime = timestamp;
+    block->lastTime = timestamp;
+    block->lastInterval = 0;
+    block->startValue = value;
+    block->lastValue = value;
+    block->sampleCount = 1;
+    block->usedBytes = 0;
+    block->runTokenPos = -1;
+}
+
+// Appends a sample to a block, returning false if the block has no room left
+bool SensorHistory::appendToBlock(HistoryBlock* block, uint32_t timestamp, int value) {
+    int32_t interval = (int32_t)(timestamp - block->lastTime);
+    int32_t deltaOfDelta = interval - block->lastInterval;
+    int32_t valueDelta = value - block->lastValue;
+
+    if (deltaOfDelta == 0 && valueDelta == 0) {
+        // Extend an open run if we can, otherwise open a new one
+        if (block->runTokenPos >= 0 && (block->data[block->runTokenPos] & 0x3F) < HISTORY_MAX_RUN - 1) {
+            block->data[block->runTokenPos]++;
+        } else if (block->usedBytes < WATERINGSYSTEM_HISTORY_BLOCKBYTES) {
+            block->runTokenPos = block->usedBytes;
+            block->data[block->usedBytes++] = HISTORY_TOKEN_RUN;
+        } else {
+            return false;
+        }
+    } else {
+        uint32_t zigzagDelta = zigzag(valueDelta);
+        if (deltaOfDelta == 0 && zigzagDelta < 0x80) {
+            if (block->usedBytes >= WATERINGSYSTEM_HISTORY_BLOCKBYTES) {
+                return false;
+            }
+            block->data[block->usedBytes++] = (uint8_t)zigzagDelta;
+        } else {
+            uint8_t token[WATERINGSYSTEM_HISTORY_MAXTOKENBYTES];
+            uint8_t length = 0;
+            token[length++] = HISTORY_TOKEN_ESCAPE;
+            length += writeVarint(&token[length], zigzag(deltaOfDelta));
+            length += writeVarint(&token[length], zigzagDelta);
+            if (block->usedBytes + length > WATERINGSYSTEM_HISTORY_BLOCKBYTES) {
+                return false;
+            }
+            memcpy(&block->data[block->usedBytes], token, length);
+            block->usedBytes += length;
+        }
+        block->runTokenPos = -1;
+    }
+    block->lastTime = timestamp;
+    block->lastInterval = interval;
+    block->lastValue = value;
+    block->sampleCount++;
+    return true;
+}
+
+String SensorHistory::spillFileName(uint8_t channel, bool old) {
+    String name("/history");
+    name += channel;
+    name += old ? ".old" : ".bin";
+    return name;
+}
+
+//
+// Appends a full block to the channel's spill file. When the file reaches its limit it
+// is rotated to a single ".old" generation, bounding flash use per channel.
+//
+void SensorHistory::spillBlock(uint8_t channel, HistoryBlock* block) {
+    if (_spilledBlocks[channel] >= WATERINGSYSTEM_HISTORY_SPILLBLOCKS) {
+        LittleFS.remove(spillFileName(channel, true));
+        LittleFS.rename(spillFileName(channel, false), spillFileName(channel, true));
+        _spilledBlocks[channel] = 0;
+    }
+    File file = LittleFS.open(spillFileName(channel, false), "a");
+    if (!file) {
+        serialConsole.println("Failed to open history spill file for writing");
+        return;
+    }
+    if (file.write((const uint8_t*)block, sizeof(HistoryBlock)) == sizeof(HistoryBlock)) {
+        _spilledBlocks[channel]++;
+    }
+    file.close();
+}
+
+//
+// Records a sample for a channel, at the start of the sample period it falls in. Only
+// the first sample in each period is kept, so this can be fed directly from every
+// sensor poll.
+//
+void SensorHistory::recordSample(uint8_t channel, uint32_t timestamp, int value) {
+    if (channel >= WATERINGSYSTEM_HISTORY_CHANNELS) {
+        return;
+    }
+    timestamp -= timestamp % _samplePeriodSecs;
+    if (_blockCount[channel] > 0 && timestamp <= _lastSampleTime[channel]) {
+        return;
+    }
+    _lastSampleTime[channel] = timestamp;
+
+    if (_blockCount[channel] == 0) {
+        if (!_blocks[channel]) {
+            _blocks[channel] = new HistoryBlock[WATERINGSYSTEM_HISTORY_BLOCKSPERCHANNEL];
+        }
+        _headBlock[channel] = 0;
+        _blockCount[channel] = 1;
+        startBlock(&_blocks[channel][0], timestamp, value);
+        return;
+    }
+    if (appendToBlock(&_blocks[channel][_headBlock[channel]], timestamp, value)) {
+        return;
+    }
+
+    // Current block is full, move on to the next, spilling the oldest if the ring is full
+    uint8_t nextBlock = (_headBlock[channel] + 1) % WATERINGSYSTEM_HISTORY_BLOCKSPERCHANNEL;
+    if (_blockCount[channel] == WATERINGSYSTEM_HISTORY_BLOCKSPERCHANNEL) {
+        if (_spillEnabled) {
+            spillBlock(channel, &_blocks[channel][nextBlock]);
+        }
+    } else {
+        _blockCount[channel]++;
+    }
+    _headBlock[channel] = nextBlock;
+    startBlock(&_blocks[channel][nextBlock], timestamp, value);
+}
+
+// Returns the number of encoded bytes held in RAM across all channels
+size_t SensorHistory::getUsedBytes() {
+    size_t usedBytes = 0;
+    for (uint8_t channel = 0; channel < WATERINGSYSTEM_HISTORY_CHANNELS; channel++) {
+        for (uint8_t block = 0; block < _blockCount[channel]; block++) {
+            usedBytes += _blocks[channel][block].usedBytes;
+        }
+    }
+    return usedBytes;
+}
+
+template <typename Visitor>
+void SensorHistory::decodeBlock(const HistoryBlock* block, uint32_t from, uint32_t to, Visitor& visitor) {
+    if (block->sampleCount == 0 || block->lastTime < from || block->startTime > to) {
+        return;
+    }
+    uint32_t timestamp = block->startTime;
+    int32_t interval = 0;
+    int32_t value = block->startValue;
+    uint16_t pos = 0;
+    if (timestamp >= from) {
+        visitor(timestamp, value);
+    }
+    while (pos < block->usedBytes) {
+        uint8_t token = block->data[pos++];
+        uint16_t repeat = 1;
+        if ((token & 0xC0) == HISTORY_TOKEN_ESCAPE) {
+            uint32_t deltaOfDelta, valueDelta;
+            if (!readVarint(block->data, block->usedBytes, &pos, &deltaOfDelta) ||
+                !readVarint(block->data, block->usedBytes, &pos, &valueDelta)) {
+                return;
+            }
+            interval += unzigzag(deltaOfDelta);
+            value += unzigzag(valueDelta);
+        } else if (token & HISTORY_TOKEN_RUN) {
+            repeat = (token & 0x3F) + 1;
+        } else {
+            value += unzigzag(token);
+        }
+        while (repeat--) {
+            timestamp += interval;
+            if (timestamp > to) {
+                return;
+            }
+            if (timestamp >= from) {
+                visitor(timestamp, value);
+            }
+        }
+    }
+}
+
+template <typename Visitor>
+void SensorHistory::forEachSample(uint8_t channel, uint32_t from, uint32_t to, Visitor visitor) {
+    if (channel >= WATERINGSYSTEM_HISTORY_CHANNELS) {
+        return;
+    }
+    if (_spillEnabled) {
+        // Stream spilled blocks through a single block sized buffer, rather than loading files
+        HistoryBlock* spilled = new HistoryBlock;
+        for (int old = 1; old >= 0; old--) {
+            File file = LittleFS.open(spillFileName(channel, old), "r");
+            if (!file) {
+                continue;
+            }
+            while (file.readBytes((char*)spilled, sizeof(HistoryBlock)) == sizeof(HistoryBlock)) {
+                decodeBlock(spilled, from, to, visitor);
+            }
+            file.close();
+        }
+        delete spilled;
+    }
+    uint8_t oldestBlock = (_headBlock[channel] + WATERINGSYSTEM_HISTORY_BLOCKSPERCHANNEL + 1 - _blockCount[channel])
+                             % WATERINGSYSTEM_HISTORY_BLOCKSPERCHANNEL;
+    for (uint8_t i = 0; i < _blockCount[channel]; i++) {
+        decodeBlock(&_blocks[channel][(oldestBlock + i) % WATERINGSYSTEM_HISTORY_BLOCKSPERCHANNEL], from, to, visitor);
+    }
+}
+
+#endif
@@ -0,0 +1,333 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include "LittleFS.h"
+#include "SerialConsole.h"
+
+//
+// Optional recording of raw sensor readings and pump changes to a compact binary log in
+// LittleFS, for replaying the watering decisions offline with different parameters
+// (see SensorReplay.h and sensor_replay.py). Records are:
+//
+//   start   - 0x01, channel count (1 byte), sample period in seconds (2 bytes)
+//   sample  - 0x02, seconds since the previous record (2 bytes), then per channel the
+//             change since the previous sample as 1 signed byte, or 0x80 followed by
+//             the reading as 2 bytes
+//   pumps   - 0x03, seconds since the previous record (2 bytes), pump outputs on (4 bytes)
+//
+// Multi-byte values are little endian. A start record begins each boot or change in the
+// channel count, and the first sample after it has every reading in full. Records are
+// buffered in RAM and appended to flash when the buffer fills, so a reset loses at most
+// a buffer of records. When the file reaches its size limit it is rotated to a single
+// ".old" generation, bounding flash use.
+//
+
+#ifndef __WATERINGSYSTEM_SENSORRECORDER_H__
+#define __WATERINGSYSTEM_SENSORRECORDER_H__
+
+#define WATERINGSYSTEM_RECORDING_BUFFERBYTES 256
+#define WATERINGSYSTEM_RECORDING_DEFAULTSAMPLESECS 30
+#define WATERINGSYSTEM_RECORDING_DEFAULTMAXBYTES 65536 // Per file, with one older file kept
+#define WATERINGSYSTEM_RECORDING_CHANNELS 32
+#define WATERINGSYSTEM_RECORDING_MAXRECORDBYTES (3 + 3 * WATERINGSYSTEM_RECORDING_CHANNELS)
+
+#define RECORDING_TAG_START 0x01
+#define RECORDING_TAG_SAMPLE 0x02
+#define RECORDING_TAG_PUMPS 0x03
+#define RECORDING_ESCAPE 0x80
+
+class SensorRecorder
+{
+  private:
+    uint8_t _buffer[WATERINGSYSTEM_RECORDING_BUFFERBYTES];
+    size_t _length = 0;
+    bool _enabled = false;
+    uint32_t _sampleSecs = WATERINGSYSTEM_RECORDING_DEFAULTSAMPLESECS;
+    size_t _maxFileBytes = WATERINGSYSTEM_RECORDING_DEFAULTMAXBYTES;
+    size_t _fileBytes = 0;
+    bool _started = false;           // Start record written for this boot and channel count
+    uint8_t _channelCount = 0;
+    int16_t _lastReadings[WATERINGSYSTEM_RECORDING_CHANNELS];
+    uint32_t _lastRecordSecs = 0;
+    uint32_t _lastSampleSecs = 0;
+    bool _hasSample = false;
+
+    void appendRecord(const uint8_t* record, size_t length);
+    void rotate();
+    size_t writeRecordTime(uint8_t* record, uint8_t tag, uint32_t nowSecs);
+
+  public:
+    void configure(bool enabled, uint32_t sampleSecs, size_t maxFileBytes);
+    bool isEnabled();
+    void recordSample(uint32_t nowSecs, const int16_t* readings, uint8_t channelCount);
+    void recordPumps(uint32_t nowSecs, uint32_t outputs);
+    void flush();
+    void clear();
+    static String getFileName(bool old);
+};
+/****************************************/
+
+//
+// Applies the recording configuration. The recording carries on across configuration
+// changes, and is kept when recording is disabled until cleared.
+//
+void SensorRecorder::configure(bool enabled, uint32_t sampleSecs, size_t maxFileBytes) {
+    if (_enabled && !enabled) {
+        flush();
+    }
+    if (enabled && !_enabled) {
+        File file = LittleFS.open(getFileName(false), "r");
+        _fileBytes = file ? file.size() : 0;
+        if (file) {
+            file.close();
+        }
+    }
+    _enabled = enabled;
+    if (sampleSecs != _sampleSecs) {
+        _started = false;
+    }
+    _sampleSecs = sampleSecs;
+    _maxFileBytes = maxFileBytes;
+}
+
+bool SensorRecorder::isEnabled() {
+    return _enabled;
+}
+
+String SensorRecorder::getFileName(bool old) {
+    return old ? String("/recording.old") : String("/recording.bin");
+}
+
+size_t SensorRecorder::writeRecordTime(uint8_t* record, uint8_t tag, uint32_t nowSecs) {
+    uint32_t delta = min(nowSecs - _lastRecordSecs, (uint32_t)0xFFFF);
+    _lastRecordSecs = nowSecs;
+    record[0] = tag;
+    record[1] = delta & 0xFF;
+    record[2] = delta >> 8;
+    return 3;
+}
+
+//
+// Records the raw readings of a poll, decimated to the sample period
+//
+void SensorRecorder::recordSample(uint32_t nowSecs, const int16_t* readings, uint8_t channelCount) {
+    if (!_enabled || (_hasSample && nowSecs - _lastSampleSecs < _sampleSecs)) {
+        return;
+    }
+    channelCount = min(channelCount, (uint8_t)WATERINGSYSTEM_RECORDING_CHANNELS);
+    if (_fileBytes + _length + 4 + WATERINGSYSTEM_RECORDING_MAXRECORDBYTES > _maxFileBytes) {
+        rotate();
+    }
+    uint8_t record[WATERINGSYSTEM_RECORDING_MAXRECORDBYTES];
+    if (!_started || channelCount != _channelCount) {
+        record[0] = RECORDING_TAG_START;
+        record[1] = channelCount;
+        record[2] = _sampleSecs & 0xFF;
+        record[3] = _sampleSecs >> 8;
+        appendRecord(record, 4);
+        _started = true;
+        _channelCount = channelCount;
+        _lastRecordSecs = nowSecs;
+        memset(_lastReadings, 0, sizeof(_lastReadings));
+    }
+    size_t length = writeRecordTime(record, RECORDING_TAG_SAMPLE, nowSecs);
+    for (uint8_t channel = 0; channel < channelCount; channel++) {
+        int delta = readings[channel] - _lastReadings[channel];
+        if (delta > -128 && delta < 128) {
+            record[length++] = (uint8_t)(int8_t)delta;
+        } else {
+            record[length++] = RECORDING_ESCAPE;
+            record[length++] = readings[channel] & 0xFF;
+            record[length++] = (readings[channel] >> 8) & 0xFF;
+        }
+        _lastReadings[channel] = readings[channel];
+    }
+    appendRecord(record, length);
+    _lastSampleSecs = nowSecs;
+    _hasSample = true;
+}
+
+// Records the pump outputs after a change. Changes before the first sample aren't kept.
+void SensorRecorder::recordPumps(uint32_t nowSecs, uint32_t outputs) {
+    if (!_enabled || !_started) {
+        return;
+    }
+    uint8_t record[7];
+    size_t length = writeRecordTime(record, RECORDING_TAG_PUMPS, nowSecs);
+    for (uint8_t i = 0; i < 4; i++) {
+        record[length++] = (outputs >> (8 * i)) & 0xFF;
+    }
+    appendRecord(record, length);
+}
+
+void SensorRecorder::appendRecord(const uint8_t* record, size_t length) {
+    if (_length + length > WATERINGSYSTEM_RECORDING_BUFFERBYTES) {
+        flush();
+    }
+    memcpy(_buffer + _length, record, length);
+    _length += length;
+}
+
+// Appends the buffered records to the recording file
+void SensorRecorder::flush() {
+    if (_length == 0) {
+        return;
+    }
+    File file = LittleFS.open(getFileName(false), "a");
+    if (!file) {
+        serialConsole.println("Failed to open recording file for writing");
+    } else {
+        _fileBytes += file.write(_buffer, _length);
+        file.close();
+    }
+    _length = 0;
+}
+
+//
+// Moves the recording file to the old generation. The next sample starts the new file
+// with a start record and full readings, so each file can be read on its own.
+//
+void SensorRecorder::rotate() {
+    flush();
+    LittleFS.remove(getFileName(true));
+    LittleFS.rename(getFileName(false), getFileName(true));
+    _fileBytes = 0;
+    _started = false;
+}
+
+void SensorRecorder::clear() {
+    LittleFS.remove(getFileName(false));
+    LittleFS.remove(getFileName(true));
+    _length = 0;
+    _fileBytes = 0;
+    _started = false;
+}
+
+struct RecordingEvent
+{
+    uint8_t tag;
+    uint32_t timeSecs;       // From the start of the recording, run together across resets
+    uint8_t channelCount;
+    uint16_t sampleSecs;
+    int16_t readings[WATERINGSYSTEM_RECORDING_CHANNELS]; // Latest readings, after a sample
+    uint32_t outputs;        // Pump outputs on, after a pumps record
+};
+
+//
+// Decodes the recording files, oldest first. Stops at the first malformed record, such
+// as one cut short by a reset.
+//
+class SensorRecordingReader
+{
+  private:
+    File _file;
+    bool _readingOld = true;
+    bool _opened = false;
+    uint8_t _buffer[64];
+    size_t _length = 0;
+    size_t _position = 0;
+    RecordingEvent _event = {};
+
+    bool openNextFile();
+    bool readByte(uint8_t* value);
+    bool readValue(uint8_t bytes, uint32_t* value);
+
+  public:
+    ~SensorRecordingReader();
+    const RecordingEvent* next();
+};
+/****************************************/
+
+SensorRecordingReader::~SensorRecordingReader() {
+    if (_file) {
+        _file.close();
+    }
+}
+
+bool SensorRecordingReader::openNextFile() {
+    if (_opened) {
+        _file.close();
+        if (!_readingOld) {
+            return false;
+        }
+        _readingOld = false;
+    }
+    _opened = true;
+    _length = 0;
+    _position = 0;
+    if (!LittleFS.exists(SensorRecorder::getFileName(_readingOld))) {
+        return openNextFile();
+    }
+    _file = LittleFS.open(SensorRecorder::getFileName(_readingOld), "r");
+    return _file ? true : openNextFile();
+}
+
+bool SensorRecordingReader::readByte(uint8_t* value) {
+    while (_position >= _length) {
+        _length = _opened && _file ? _file.read(_buffer, sizeof(_buffer)) : 0;
+        _position = 0;
+        if (_length == 0 && !openNextFile()) {
+            return false;
+        }
+    }
+    *value = _buffer[_position++];
+    return true;
+}
+
+bool SensorRecordingReader::readValue(uint8_t bytes, uint32_t* value) {
+    *value = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        uint8_t byte;
+        if (!readByte(&byte)) {
+            return false;
+        }
+        *value |= (uint32_t)byte << (8 * i);
+    }
+    return true;
+}
+
+// Returns the next record, or NULL at the end of the recording
+const RecordingEvent* SensorRecordingReader::next() {
+    uint8_t tag;
+    uint32_t value;
+    if (!readByte(&tag)) {
+        return NULL;
+    }
+    _event.tag = tag;
+    if (tag == RECORDING_TAG_START) {
+        uint8_t channelCount;
+        if (!readByte(&channelCount) || channelCount > WATERINGSYSTEM_RECORDING_CHANNELS || !readValue(2, &value)) {
+            return NULL;
+        }
+        _event.channelCount = channelCount;
+        _event.sampleSecs = value;
+        memset(_event.readings, 0, sizeof(_event.readings));
+        return &_event;
+    }
+    if ((tag != RECORDING_TAG_SAMPLE && tag != RECORDING_TAG_PUMPS) || _event.channelCount == 0 || !readValue(2, &value)) {
+        return NULL;
+    }
+    _event.timeSecs += value;
+    if (tag == RECORDING_TAG_PUMPS) {
+        return readValue(4, &_event.outputs) ? &_event : NULL;
+    }
+    for (uint8_t channel = 0; channel < _event.channelCount; channel++) {
+        uint8_t delta;
+        if (!readByte(&delta)) {
+            return NULL;
+        }
+        if (delta == RECORDING_ESCAPE) {
+            if (!readValue(2, &value)) {
+                return NULL;
+            }
+            _event.readings[channel] = (int16_t)value;
+        } else {
+            _event.readings[channel] += (int8_t)delta;
+        }
+    }
+    return &_event;
+}
+
+#endif
@@ -0,0 +1,260 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <vector>
+#include "ControlClock.h"
+#include "SensorRecorder.h"
+#include "SensorSourceSimulated.h"
+#include "AnalogueSensorHandler.h"
+#include "SensorGroup.h"
+#include "IrrigationService.h"
+
+#ifndef __WATERINGSYSTEM_SENSORREPLAY_H__
+#define __WATERINGSYSTEM_SENSORREPLAY_H__
+
+#define WATERINGSYSTEM_REPLAY_STEPMILLIS 1000  // Virtual time between control passes
+#define WATERINGSYSTEM_REPLAY_MAXSCHEDULE 48   // Pump runs listed per group
+
+struct ReplayPumpTracker
+{
+    bool pumping;
+    unsigned long startMillis;
+    unsigned long starts;
+    unsigned long totalMillis;
+};
+
+struct ReplayGroup
+{
+    SensorGroup* group;
+    float litresPerMinute;
+    ReplayPumpTracker replayed;
+    ReplayPumpTracker recorded;
+    JsonArray schedule;
+};
+
+//
+// Replays the sensor recording through the real AnalogueSensorHandler filtering and
+// SensorGroup decisions, with the sensor groups' parameters optionally overridden, to
+// give the pump schedule and water use those parameters would have produced. Copies of
+// the configured groups and channel calibrations run against simulated channels fed
+// from the recording, under the virtual control clock, so days of recording replay in
+// seconds. Only the decisions are replayed: the recorded moisture readings still follow
+// the watering that actually happened.
+//
+// Replays run on the development machine, in the replay runner (tools/replay_runner.cpp),
+// with the recording fetched from the controller loaded into LittleFS, and the service
+// configured from the controller's configuration.
+//
+class SensorReplay
+{
+  private:
+    IrrigationService* _irrigationService;
+    AnalogueSensorHandler* _analogueSensorHandler;
+
+    static void trackPump(ReplayPumpTracker* tracker, bool pumping, unsigned long nowMillis, JsonArray schedule);
+
+  public:
+    SensorReplay(IrrigationService* irrigationService, AnalogueSensorHandler* analogueSensorHandler);
+    String run(JsonObject paramsJson, JsonObject resultJson);
+};
+/****************************************/
+
+SensorReplay::SensorReplay(IrrigationService* irrigationService, AnalogueSensorHandler* analogueSensorHandler) {
+    _irrigationService = irrigationService;
+    _analogueSensorHandler = analogueSensorHandler;
+}
+
+//
+// Counts pump runs as the pump state changes, adding completed runs to the schedule as
+// [start seconds, seconds pumped], if given one
+//
+void SensorReplay::trackPump(ReplayPumpTracker* tracker, bool pumping, unsigned long nowMillis, JsonArray schedule) {
+    if (pumping == tracker->pumping) {
+        return;
+    }
+    tracker->pumping = pumping;
+    if (pumping) {
+        tracker->startMillis = nowMillis;
+        tracker->starts++;
+        return;
+    }
+    unsigned long pumpMillis = nowMillis - tracker->startMillis;
+    tracker->totalMillis += pumpMillis;
+    if (!schedule.isNull() && schedule.size() < WATERINGSYSTEM_REPLAY_MAXSCHEDULE) {
+        JsonArray run = schedule.add<JsonArray>();
+        run.add(tracker->startMillis / 1000);
+        run.add(pumpMillis / 1000);
+    }
+}
+
+//
+// Runs a replay, returning an error message, or an empty string on success. Parameters
+// are "pumpLitresPerMinute" for the water use estimate, and "groups", an object of
+// overrides by group name of triggerType, minMoisture, pumpSecs and the check periods.
+//
+String SensorReplay::run(JsonObject paramsJson, JsonObject resultJson) {
+    const std::list<SensorGroup*>& liveGroups = _irrigationService->getSensorGroups();
+    if (liveGroups.empty()) {
+        return String("No sensor groups configured to replay");
+    }
+    JsonObject overridesJson = paramsJson["groups"];
+    for (JsonPair overrideJson : overridesJson) {
+        if (!_irrigationService->getSensorGroupByName(overrideJson.key().c_str())) {
+            return String("Unknown sensor group ") + overrideJson.key().c_str();
+        }
+        if (overrideJson.value().containsKey("triggerType")) {
+            String typeStr = overrideJson.value()["triggerType"].as<String>();
+            if (!typeStr.equals("any") && !typeStr.equals("all")) {
+                return String("Invalid trigger type ") + typeStr;
+            }
+        }
+    }
+    if (_irrigationService->getRecorder()) {
+        _irrigationService->getRecorder()->flush();
+    }
+    SensorRecordingReader reader;
+    const RecordingEvent* event = reader.next();
+    if (!event || event->tag != RECORDING_TAG_START) {
+        return String("No recording to replay");
+    }
+
+    // Copies of the channels, fed from the recording
+    SensorSourceSimulated* source = new SensorSourceSimulated(event->channelCount);
+    AnalogueSensorHandler* handler = new AnalogueSensorHandler(source);
+    for (uint8_t channel = 0; channel < event->channelCount; channel++) {
+        const uint8_t* calibration = _analogueSensorHandler->getChannelCalibration(channel);
+        if (calibration) {
+            uint8_t* table = new uint8_t[WATERINGSYSTEM_CALIBRATION_RANGE];
+            memcpy(table, calibration, WATERINGSYSTEM_CALIBRATION_RANGE);
+            handler->setChannelCalibration(channel, table);
+        }
+    }
+
+    // Copies of the groups, with their overrides, logging nowhere and driving no outputs
+    IrrigationLogger logger;
+    ActuatorOutputs outputs;
+    float defaultLitresPerMinute = 0;
+    if (paramsJson.containsKey("pumpLitresPerMinute")) {
+        defaultLitresPerMinute = paramsJson["pumpLitresPerMinute"].as<float>();
+    }
+    JsonObject groupsJson = resultJson["groups"].to<JsonObject>();
+    std::vector<ReplayGroup> groups;
+    for (auto & liveGroup : liveGroups) {
+        String name = liveGroup->getGroupName();
+        JsonObject overrideJson = overridesJson[name];
+        int triggerMode = liveGroup->getTriggerMode();
+        if (overrideJson.containsKey("triggerType")) {
+            triggerMode = overrideJson["triggerType"].as<String>().equals("all") ? MOISTURE_CONTROLLER_TRIGGER_ALL : MOISTURE_CONTROLLER_TRIGGER_ANY;
+        }
+        int minMoisture = liveGroup->getMinThreshold();
+        if (overrideJson.containsKey("minMoisture")) {
+            minMoisture = overrideJson["minMoisture"].as<int>();
+        }
+        unsigned long pumpSecs = liveGroup->getPumpPeriodSeconds();
+        if (overrideJson.containsKey("pumpSecs")) {
+            pumpSecs = overrideJson["pumpSecs"].as<unsigned long>();
+        }
+        unsigned long waterCheckPeriodMs = liveGroup->getWaterCheckPeriodMs();
+        if (overrideJson.containsKey("waterCheckPeriodMs")) {
+            waterCheckPeriodMs = overrideJson["waterCheckPeriodMs"].as<unsigned long>();
+        }
+        unsigned long pumpCheckPeriodMs = liveGroup->getPumpCheckPeriodMs();
+        if (overrideJson.containsKey("pumpCheckPeriodMs")) {
+            pumpCheckPeriodMs = overrideJson["pumpCheckPeriodMs"].as<unsigned long>();
+        }
+        unsigned long moistureCheckPeriodMs = liveGroup->getMoistureCheckPeriodMs();
+        if (overrideJson.containsKey("moistureCheckPeriodMs")) {
+            moistureCheckPeriodMs = overrideJson["moistureCheckPeriodMs"].as<unsigned long>();
+        }
+        ReplayGroup replayGroup = {};
+        replayGroup.group = new SensorGroup(&logger,
+                                            handler,
+                                            &outputs,
+                                            name,
+                                            triggerMode,
+                                            liveGroup->getWaterLevelChannel(),
+                                            liveGroup->getMoistureSensorChannelMask(),
+                                            liveGroup->getPumpOutputMask(),
+                                            minMoisture,
+                                            pumpSecs,
+                                            waterCheckPeriodMs,
+                                            pumpCheckPeriodMs,
+                                            moistureCheckPeriodMs);
+        replayGroup.litresPerMinute = defaultLitresPerMinute;
+        if (overrideJson.containsKey("pumpLitresPerMinute")) {
+            replayGroup.litresPerMinute = overrideJson["pumpLitresPerMinute"].as<float>();
+        }
+        replayGroup.schedule = groupsJson[name]["schedule"].to<JsonArray>();
+        groups.push_back(replayGroup);
+    }
+
+    // Step the virtual clock through the recording, polling the sensors and running the
+    // group logic as the control loop would, holding the latest recorded readings
+    unsigned long firstMillis = 0;
+    unsigned long nextPollMillis = 0;
+    unsigned long samples = 0;
+    bool started = false;
+    controlClock.startVirtual(0);
+    while ((event = reader.next())) {
+        unsigned long eventMillis = event->timeSecs * 1000UL;
+        if (!started && event->tag == RECORDING_TAG_SAMPLE) {
+            controlClock.startVirtual(eventMillis);
+            firstMillis = eventMillis;
+            nextPollMillis = eventMillis;
+            started = true;
+        }
+        while (started && controlClock.millis() < eventMillis) {
+            controlClock.advance(min(eventMillis - controlClock.millis(), (unsigned long)WATERINGSYSTEM_REPLAY_STEPMILLIS));
+            unsigned long nowMillis = controlClock.millis();
+            if (nowMillis >= nextPollMillis) {
+                handler->pollSensors();
+                nextPollMillis = nowMillis + WATERINGSYSTEM_SENSORPOLLSECS * 1000UL;
+                uint32_t updatedChannels = handler->takeUpdatedChannels();
+                for (auto & replayGroup : groups) {
+                    replayGroup.group->notifyMoistureUpdate(updatedChannels);
+                }
+            }
+            for (auto & replayGroup : groups) {
+                replayGroup.group->loop();
+                bool pumping = (outputs.getDesiredOutputs() & replayGroup.group->getPumpOutputMask()) != 0;
+                trackPump(&replayGroup.replayed, pumping, nowMillis, replayGroup.schedule);
+            }
+        }
+        if (event->tag == RECORDING_TAG_SAMPLE) {
+            for (uint8_t channel = 0; channel < source->getChannelCount() && channel < event->channelCount; channel++) {
+                source->setValue(channel, event->readings[channel]);
+            }
+            samples++;
+        } else if (event->tag == RECORDING_TAG_PUMPS && started) {
+            for (auto & replayGroup : groups) {
+                bool pumping = (event->outputs & replayGroup.group->getPumpOutputMask()) != 0;
+                trackPump(&replayGroup.recorded, pumping, eventMillis, JsonArray());
+            }
+        }
+    }
+
+    // Close off runs still going at the end, and report
+    unsigned long endMillis = controlClock.millis();
+    controlClock.stopVirtual();
+    for (auto & replayGroup : groups) {
+        trackPump(&replayGroup.replayed, false, endMillis, replayGroup.schedule);
+        trackPump(&replayGroup.recorded, false, endMillis, JsonArray());
+        JsonObject groupJson = groupsJson[replayGroup.group->getGroupName()];
+        groupJson["pumpStarts"] = replayGroup.replayed.starts;
+        groupJson["pumpSeconds"] = replayGroup.replayed.totalMillis / 1000;
+        groupJson["litres"] = replayGroup.litresPerMinute * replayGroup.replayed.totalMillis / 60000.0f;
+        groupJson["recordedPumpStarts"] = replayGroup.recorded.starts;
+        groupJson["recordedPumpSeconds"] = replayGroup.recorded.totalMillis / 1000;
+        groupJson["recordedLitres"] = replayGroup.litresPerMinute * replayGroup.recorded.totalMillis / 60000.0f;
+        delete replayGroup.group;
+    }
+    delete handler;
+    resultJson["samples"] = samples;
+    resultJson["replayedSecs"] = (endMillis - firstMillis) / 1000;
+    return String();
+}
+
+#endif
@@ -0,0 +1,52 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+#ifndef __WATERINGSYSTEM_SENSORSOURCE_H__
+#define __WATERINGSYSTEM_SENSORSOURCE_H__
+
+#define WATERINGSYSTEM_MAXOVERSAMPLE 16
+#define WATERINGSYSTEM_READING_FAILED -1 // Returned by readConversion when the source couldn't be read
+
+//
+// Pure virtual base class representing a source of analogue sensor channels, such as a
+// multiplexer on the ESP8266 A0 input, or an external I2C ADC. The AnalogueSensorHandler
+// maps global channel numbers onto the configured sources, in configuration order.
+//
+// Conversions are split into start/ready/read steps, so the handler can keep a
+// conversion running on every independent source at once during a scan. Readings are
+// scaled to the 10 bit range 0-1023, and inverted so higher values mean wetter, matching
+// the behaviour of the original multiplexer code. A conversion that fails, such as an
+// I2C transfer to an ADC that isn't responding, reads as WATERINGSYSTEM_READING_FAILED
+// rather than as a value in range.
+//
+// Settle time calibration is split into steps too, so it can run from the scheduler
+// between control passes. Sources without a settle time to calibrate refuse to start.
+//
+class SensorSource
+{
+    public:
+        virtual const char* getType() = 0;
+        virtual uint8_t getChannelCount() = 0;
+        virtual unsigned long getDefaultSettleMicros() = 0;
+        virtual void startConversion(uint8_t channel, unsigned long settleMicros, uint8_t oversampleCount) = 0;
+        virtual bool isConversionReady() = 0;
+        virtual int readConversion() = 0;
+        virtual bool startCalibration(uint8_t channel);
+        virtual bool stepCalibration(unsigned long* settleMicros, uint8_t* oversampleCount);
+        virtual ~SensorSource() {};
+};
+/****************************************/
+
+// Sources without a settle time to calibrate report that calibration is unsupported
+bool SensorSource::startCalibration(uint8_t channel) {
+    return false;
+}
+
+bool SensorSource::stepCalibration(unsigned long* settleMicros, uint8_t* oversampleCount) {
+    return true;
+}
+
+#endif
@@ -0,0 +1,140 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "SensorSource.h"
+
+#ifndef __WATERINGSYSTEM_SENSORSOURCEADS1115_H__
+#define __WATERINGSYSTEM_SENSORSOURCEADS1115_H__
+
+#define ADS1115_CHANNELS 4
+#define ADS1115_DEFAULT_ADDRESS 0x48
+#define ADS1115_REG_CONVERSION 0x00
+#define ADS1115_REG_CONFIG 0x01
+#define ADS1115_CONFIG_OS_SINGLE 0x8000     // Start a single conversion / conversion complete
+#define ADS1115_CONFIG_MUX_SINGLE_0 0x4000  // AIN0 against GND, channels follow in steps of 0x1000
+#define ADS1115_CONFIG_PGA_4_096V 0x0200
+#define ADS1115_CONFIG_MODE_SINGLE 0x0100
+#define ADS1115_CONFIG_DR_860SPS 0x00E0
+#define ADS1115_CONFIG_COMP_DISABLE 0x0003
+#define ADS1115_FULLSCALE_MILLIVOLTS 4096
+#define ADS1115_DEFAULT_SUPPLY_MILLIVOLTS 3300
+
+//
+// ADS1115 style 16 bit I2C ADC, read as four single ended channels. Each ADC converts
+// independently of the ESP8266 A0 input and of other ADCs on the bus, so their
+// conversions overlap during a scan. Readings are scaled so the sensor supply voltage
+// maps to the 10 bit range used by the rest of the system.
+//
+class SensorSourceAds1115 : public SensorSource
+{
+  private:
+    uint8_t _address;
+    unsigned long _supplyMillivolts;
+    unsigned long _conversionStartMicros = 0;
+    unsigned long _settleMicros = 0;
+    bool _conversionStarted = false;
+    bool _transferFailed = false; // An I2C transfer for the current conversion failed
+    uint8_t _channel = 0;
+    bool writeRegister(uint8_t reg, uint16_t value);
+    bool readRegister(uint8_t reg, uint16_t* value);
+
+  public:
+    SensorSourceAds1115(uint8_t address, unsigned long supplyMillivolts);
+    virtual const char* getType();
+    virtual uint8_t getChannelCount();
+    virtual unsigned long getDefaultSettleMicros();
+    virtual void startConversion(uint8_t channel, unsigned long settleMicros, uint8_t oversampleCount);
+    virtual bool isConversionReady();
+    virtual int readConversion();
+};
+/****************************************/
+
+SensorSourceAds1115::SensorSourceAds1115(uint8_t address, unsigned long supplyMillivolts) {
+    _address = address;
+    _supplyMillivolts = supplyMillivolts;
+    return;
+}
+
+const char* SensorSourceAds1115::getType() {
+    return "ads1115";
+}
+
+uint8_t SensorSourceAds1115::getChannelCount() {
+    return ADS1115_CHANNELS;
+}
+
+// The ADC has its own input multiplexer, so no settle time is needed by default
+unsigned long SensorSourceAds1115::getDefaultSettleMicros() {
+    return 0;
+}
+
+bool SensorSourceAds1115::writeRegister(uint8_t reg, uint16_t value) {
+    Wire.beginTransmission(_address);
+    Wire.write(reg);
+    Wire.write((uint8_t)(value >> 8));
+    Wire.write((uint8_t)(value & 0xFF));
+    return Wire.endTransmission() == 0;
+}
+
+bool SensorSourceAds1115::readRegister(uint8_t reg, uint16_t* value) {
+    Wire.beginTransmission(_address);
+    Wire.write(reg);
+    if (Wire.endTransmission() != 0 || Wire.requestFrom(_address, (uint8_t)2) != 2) {
+        return false;
+    }
+    *value = ((uint16_t)Wire.read() << 8);
+    *value |= (uint16_t)Wire.read();
+    return true;
+}
+
+//
+// Records the channel, and starts the single shot conversion once any configured settle
+// time has passed (see isConversionReady).
+//
+void SensorSourceAds1115::startConversion(uint8_t channel, unsigned long settleMicros, uint8_t oversampleCount) {
+    _channel = channel;
+    _settleMicros = settleMicros;
+    _conversionStartMicros = micros();
+    _conversionStarted = false;
+    _transferFailed = false;
+}
+
+bool SensorSourceAds1115::isConversionReady() {
+    if (!_conversionStarted) {
+        if ((micros() - _conversionStartMicros) < _settleMicros) {
+            return false;
+        }
+        uint16_t config = ADS1115_CONFIG_OS_SINGLE | (ADS1115_CONFIG_MUX_SINGLE_0 + 0x1000 * _channel) |
+                          ADS1115_CONFIG_PGA_4_096V | ADS1115_CONFIG_MODE_SINGLE |
+                          ADS1115_CONFIG_DR_860SPS | ADS1115_CONFIG_COMP_DISABLE;
+        if (!writeRegister(ADS1115_REG_CONFIG, config)) {
+            _transferFailed = true;
+            return true; // Report the failure from readConversion, rather than stall the scan
+        }
+        _conversionStarted = true;
+        return false;
+    }
+    uint16_t config;
+    if (!readRegister(ADS1115_REG_CONFIG, &config)) {
+        _transferFailed = true;
+        return true;
+    }
+    return (config & ADS1115_CONFIG_OS_SINGLE) != 0;
+}
+
+// A failed transfer reads as WATERINGSYSTEM_READING_FAILED, as 0 would be a bone dry reading
+int SensorSourceAds1115::readConversion() {
+    uint16_t raw;
+    if (_transferFailed || !_conversionStarted || !readRegister(ADS1115_REG_CONVERSION, &raw)) {
+        return WATERINGSYSTEM_READING_FAILED;
+    }
+    long counts = max((int16_t)raw, (int16_t)0);
+    long millivolts = counts * ADS1115_FULLSCALE_MILLIVOLTS / 32768;
+    long value = millivolts * 1023 / _supplyMillivolts;
+    return 1023 - constrain(value, 0L, 1023L);
+}
+
+#endif
@@ -0,0 +1,201 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <array>
+#include <vector>
+#include "SensorSource.h"
+
+#ifndef __WATERINGSYSTEM_SENSORSOURCEMUX_H__
+#define __WATERINGSYSTEM_SENSORSOURCEMUX_H__
+
+#define WATERINGSYSTEM_MUX_CHANNELS 8
+#define WATERINGSYSTEM_DEFAULTSETTLEMICROS 50000 // Multiplexer settle time used until a channel is calibrated
+
+// Settle time calibration parameters
+#define WATERINGSYSTEM_CALIBRATION_PASSES 3
+#define WATERINGSYSTEM_CALIBRATION_WINDOWMICROS 100000 // How long to watch a channel converge after switching
+#define WATERINGSYSTEM_CALIBRATION_STEPMICROS 500      // Interval between conversions while watching
+#define WATERINGSYSTEM_CALIBRATION_TOLERANCE 2         // ADC counts from the final value considered settled
+#define WATERINGSYSTEM_CALIBRATION_MINSETTLEMICROS 1000
+
+//get a bit from a variable
+#define GETBIT(var, bit)  (((var) >> (bit)) & 1)
+
+//
+// One or more 74HC4051 multiplexers feeding the ESP8266 A0 input. The multiplexers share
+// the three selector pins. When more than one is cascaded, each has its own enable (INH)
+// pin, and only the multiplexer holding the selected channel is enabled. All channels
+// share the single ADC, so only one conversion can be in progress at a time.
+//
+class SensorSourceMux : public SensorSource
+{
+  private:
+    std::array<int,3> _selectorPins;
+    std::vector<int> _enablePins;
+    const int _analogInPin = A0;   // ESP8266 Analog Pin ADC0 = A0
+    unsigned long _conversionStartMicros = 0;
+    unsigned long _settleMicros = 0;
+    uint8_t _oversampleCount = 1;
+    // Calibration in progress
+    uint8_t _calibrationChannel = 0;
+    uint8_t _calibrationPass = 0;
+    bool _calibrationSwitchedAway = false; // Settling on the inverted channel before a pass
+    unsigned long _calibrationSwitchedMicros = 0;
+    unsigned long _calibrationWorstSettleMicros = 0;
+    int _calibrationWorstNoise = 0;
+    void setActiveChannel(uint8_t channel);
+    void measureCalibrationPass();
+
+  public:
+    SensorSourceMux(std::array<int,3> selectorPins, std::vector<int> enablePins);
+    virtual const char* getType();
+    virtual uint8_t getChannelCount();
+    virtual unsigned long getDefaultSettleMicros();
+    virtual void startConversion(uint8_t channel, unsigned long settleMicros, uint8_t oversampleCount);
+    virtual bool isConversionReady();
+    virtual int readConversion();
+    virtual bool startCalibration(uint8_t channel);
+    virtual bool stepCalibration(unsigned long* settleMicros, uint8_t* oversampleCount);
+};
+/****************************************/
+
+SensorSourceMux::SensorSourceMux(std::array<int,3> selectorPins, std::vector<int> enablePins) {
+    _selectorPins = selectorPins;
+    _enablePins = enablePins;
+    for (auto & pin : _selectorPins) {
+        pinMode(pin, OUTPUT);
+    }
+    for (auto & pin : _enablePins) {
+        pinMode(pin, OUTPUT);
+        digitalWrite(pin, HIGH); // Inhibit until selected
+    }
+    return;
+}
+
+const char* SensorSourceMux::getType() {
+    return "mux";
+}
+
+uint8_t SensorSourceMux::getChannelCount() {
+    return _enablePins.empty() ? WATERINGSYSTEM_MUX_CHANNELS : WATERINGSYSTEM_MUX_CHANNELS * _enablePins.size();
+}
+
+unsigned long SensorSourceMux::getDefaultSettleMicros() {
+    return WATERINGSYSTEM_DEFAULTSETTLEMICROS;
+}
+
+void SensorSourceMux::setActiveChannel(uint8_t channel) {
+    digitalWrite(_selectorPins.at(0), GETBIT(channel,0));
+    digitalWrite(_selectorPins.at(1), GETBIT(channel,1));
+    digitalWrite(_selectorPins.at(2), GETBIT(channel,2));
+    // Enable only the multiplexer holding this channel
+    for (size_t mux = 0; mux < _enablePins.size(); mux++) {
+        digitalWrite(_enablePins[mux], (mux == channel / WATERINGSYSTEM_MUX_CHANNELS) ? LOW : HIGH);
+    }
+}
+
+// A conversion switches the multiplexer, so a calibration pass settling meanwhile starts again
+void SensorSourceMux::startConversion(uint8_t channel, unsigned long settleMicros, uint8_t oversampleCount) {
+    _calibrationSwitchedAway = false;
+    setActiveChannel(channel);
+    _conversionStartMicros = micros();
+    _settleMicros = settleMicros;
+    _oversampleCount = oversampleCount;
+}
+
+// The conversion itself is immediate, so we're ready once the multiplexer has settled
+bool SensorSourceMux::isConversionReady() {
+    return (micros() - _conversionStartMicros) >= _settleMicros;
+}
+
+int SensorSourceMux::readConversion() {
+    int sensorValue = 0;
+    for (uint8_t sample = 0; sample < _oversampleCount; sample++) {
+        sensorValue += analogRead(_analogInPin);
+    }
+    return 1023 - (sensorValue + _oversampleCount / 2) / _oversampleCount;
+}
+
+//
+// Measures how quickly conversions on a channel converge after switching to it from the
+// channel with every selector bit inverted. Conversions are taken at fixed intervals
+// across the calibration window, and the settle time is the point after which every
+// conversion stays within tolerance of the final value. The worst of several passes is
+// doubled for margin. Channels that stay noisy once settled are given oversampling.
+//
+bool SensorSourceMux::startCalibration(uint8_t channel) {
+    _calibrationChannel = channel;
+    _calibrationPass = 0;
+    _calibrationSwitchedAway = false;
+    _calibrationWorstSettleMicros = 0;
+    _calibrationWorstNoise = 0;
+    return true;
+}
+
+//
+// Runs one step of the calibration, returning true with the results once every pass is
+// done. Waiting on the inverted channel takes a step of its own, so the longest step is
+// a single calibration window.
+//
+bool SensorSourceMux::stepCalibration(unsigned long* settleMicros, uint8_t* oversampleCount) {
+    if (!_calibrationSwitchedAway) {
+        setActiveChannel(_calibrationChannel ^ 0x07);
+        _calibrationSwitchedMicros = micros();
+        _calibrationSwitchedAway = true;
+        return false;
+    }
+    if ((micros() - _calibrationSwitchedMicros) < WATERINGSYSTEM_DEFAULTSETTLEMICROS) {
+        return false;
+    }
+    measureCalibrationPass();
+    _calibrationSwitchedAway = false;
+    if (++_calibrationPass < WATERINGSYSTEM_CALIBRATION_PASSES) {
+        return false;
+    }
+
+    *settleMicros = max((unsigned long)WATERINGSYSTEM_CALIBRATION_MINSETTLEMICROS, _calibrationWorstSettleMicros * 2);
+    if (_calibrationWorstNoise <= WATERINGSYSTEM_CALIBRATION_TOLERANCE) {
+        *oversampleCount = 1;
+    } else if (_calibrationWorstNoise <= WATERINGSYSTEM_CALIBRATION_TOLERANCE * 4) {
+        *oversampleCount = 4;
+    } else {
+        *oversampleCount = WATERINGSYSTEM_MAXOVERSAMPLE;
+    }
+    return true;
+}
+
+// Switches to the channel being calibrated and watches it converge across one window
+void SensorSourceMux::measureCalibrationPass() {
+    const int steps = WATERINGSYSTEM_CALIBRATION_WINDOWMICROS / WATERINGSYSTEM_CALIBRATION_STEPMICROS;
+    short int readings[steps];
+    setActiveChannel(_calibrationChannel);
+    unsigned long startMicros = micros();
+    for (int step = 0; step < steps; step++) {
+        while ((micros() - startMicros) < (unsigned long)step * WATERINGSYSTEM_CALIBRATION_STEPMICROS) {
+            // Busy wait, as yielding here would distort the conversion timing
+        }
+        readings[step] = analogRead(_analogInPin);
+    }
+
+    // Walk back from the end until a conversion falls outside tolerance of the final value
+    int finalValue = readings[steps - 1];
+    int settledStep = steps - 1;
+    while (settledStep > 0 && abs(readings[settledStep - 1] - finalValue) <= WATERINGSYSTEM_CALIBRATION_TOLERANCE) {
+        settledStep--;
+    }
+    unsigned long passSettleMicros = (unsigned long)settledStep * WATERINGSYSTEM_CALIBRATION_STEPMICROS;
+    _calibrationWorstSettleMicros = max(_calibrationWorstSettleMicros, passSettleMicros);
+
+    // Noise is the spread of the conversions across the last quarter of the window
+    int minValue = 1023;
+    int maxValue = 0;
+    for (int step = steps - steps / 4; step < steps; step++) {
+        minValue = min(minValue, (int)readings[step]);
+        maxValue = max(maxValue, (int)readings[step]);
+    }
+    _calibrationWorstNoise = max(_calibrationWorstNoise, maxValue - minValue);
+}
+
+#endif
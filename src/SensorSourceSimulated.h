@@ -0,0 +1,93 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <vector>
+#include "SensorSource.h"
+
+#ifndef __WATERINGSYSTEM_SENSORSOURCESIMULATED_H__
+#define __WATERINGSYSTEM_SENSORSOURCESIMULATED_H__
+
+struct SimulatedChannelProfile
+{
+    int base = 512;                  // Mean reading
+    int amplitude = 0;               // Peak deviation of a sine wave around the base
+    unsigned long periodSecs = 3600; // Period of the sine wave
+    int noise = 0;                   // Peak random noise added to each reading
+};
+
+//
+// Simulated channels for testing without hardware. Each channel follows a scripted
+// profile, unless a fixed value has been set on it. Conversions complete immediately.
+//
+class SensorSourceSimulated : public SensorSource
+{
+  private:
+    std::vector<SimulatedChannelProfile> _profiles;
+    std::vector<int> _fixedValues;
+    uint8_t _channel = 0;
+
+  public:
+    SensorSourceSimulated(uint8_t channelCount);
+    void setProfile(uint8_t channel, SimulatedChannelProfile profile);
+    void setValue(uint8_t channel, int value);
+    virtual const char* getType();
+    virtual uint8_t getChannelCount();
+    virtual unsigned long getDefaultSettleMicros();
+    virtual void startConversion(uint8_t channel, unsigned long settleMicros, uint8_t oversampleCount);
+    virtual bool isConversionReady();
+    virtual int readConversion();
+};
+/****************************************/
+
+SensorSourceSimulated::SensorSourceSimulated(uint8_t channelCount) {
+    _profiles.resize(channelCount);
+    _fixedValues.resize(channelCount, -1);
+    return;
+}
+
+void SensorSourceSimulated::setProfile(uint8_t channel, SimulatedChannelProfile profile) {
+    _profiles.at(channel) = profile;
+    _fixedValues.at(channel) = -1;
+}
+
+// Fixes a channel at a value. A negative value returns the channel to its profile.
+void SensorSourceSimulated::setValue(uint8_t channel, int value) {
+    _fixedValues.at(channel) = value;
+}
+
+const char* SensorSourceSimulated::getType() {
+    return "simulated";
+}
+
+uint8_t SensorSourceSimulated::getChannelCount() {
+    return _profiles.size();
+}
+
+unsigned long SensorSourceSimulated::getDefaultSettleMicros() {
+    return 0;
+}
+
+void SensorSourceSimulated::startConversion(uint8_t channel, unsigned long settleMicros, uint8_t oversampleCount) {
+    _channel = channel;
+}
+
+bool SensorSourceSimulated::isConversionReady() {
+    return true;
+}
+
+int SensorSourceSimulated::readConversion() {
+    if (_fixedValues[_channel] >= 0) {
+        return _fixedValues[_channel];
+    }
+    const SimulatedChannelProfile& profile = _profiles[_channel];
+    float phase = (float)(millis() / 1000 % profile.periodSecs) / profile.periodSecs;
+    int value = profile.base + (int)(profile.amplitude * sin(2 * PI * phase));
+    if (profile.noise > 0) {
+        value += random(-profile.noise, profile.noise + 1);
+    }
+    return constrain(value, 0, 1023);
+}
+
+#endif
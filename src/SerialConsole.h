@@ -0,0 +1,73 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <vector>
+
+#ifndef __WATERINGSYSTEM_SERIALCONSOLE_H__
+#define __WATERINGSYSTEM_SERIALCONSOLE_H__
+
+#define WATERINGSYSTEM_CONSOLE_MAXLINE 256 // Longer printf messages are cut short
+
+// Takes console messages into an output that also writes to the serial port
+class SerialConsoleSink
+{
+  public:
+    virtual void queueConsoleLine(const char* line, size_t length) = 0;
+};
+
+//
+// Diagnostic messages for the serial port. A serial logger queues its lines and sends
+// them as the UART has room, so a message printed straight to Serial could land part way
+// through one of them. While a serial logger is active, messages are queued behind its
+// lines instead. Otherwise they're printed directly.
+//
+class SerialConsole
+{
+  private:
+    std::vector<SerialConsoleSink*> _sinks; // The most recently added takes messages
+
+  public:
+    void println(const String& message);
+    void printf(const char* format, ...);
+    void addSink(SerialConsoleSink* sink);
+    void removeSink(SerialConsoleSink* sink);
+};
+/****************************************/
+
+void SerialConsole::println(const String& message) {
+    if (_sinks.empty()) {
+        Serial.println(message);
+        return;
+    }
+    _sinks.back()->queueConsoleLine(message.c_str(), message.length());
+}
+
+// Prints a formatted message as a line of its own
+void SerialConsole::printf(const char* format, ...) {
+    char line[WATERINGSYSTEM_CONSOLE_MAXLINE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    println(String(line));
+}
+
+void SerialConsole::addSink(SerialConsoleSink* sink) {
+    _sinks.push_back(sink);
+}
+
+void SerialConsole::removeSink(SerialConsoleSink* sink) {
+    for (auto it = _sinks.begin(); it != _sinks.end(); it++) {
+        if (*it == sink) {
+            _sinks.erase(it);
+            return;
+        }
+    }
+}
+
+SerialConsole serialConsole;
+
+#endif
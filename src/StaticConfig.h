@@ -0,0 +1,133 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <array>
+#include "SensorGroup.h"
+#include "AnalogueSensorHandler.h"
+
+//
+// Build time configuration. The nodemcuv2_staticconfig environment runs static_config.py,
+// which turns a Json configuration into the constant tables in StaticConfigData.h. These
+// are checked here at compile time, and applied by the ConfigManager at boot without
+// parsing Json or allocating sensor groups. A configuration posted at runtime is still
+// stored, and overrides the static configuration until it is deleted.
+//
+// Static configurations use the default sensor source and pump outputs, so channels are
+// 0-7 on the multiplexer and pumps are outputs 0-4 (D0-D4).
+//
+
+#ifndef __WATERINGSYSTEM_STATICCONFIG_H__
+#define __WATERINGSYSTEM_STATICCONFIG_H__
+
+#ifdef WATERINGSYSTEM_STATIC_CONFIG
+
+#define STATIC_LOGGER_SERIAL 0
+#define STATIC_LOGGER_LOKI   1
+#define STATIC_LOGGER_MQTT   2
+
+#define STATIC_CONFIG_PUMPOUTPUTS 5 // The default gpio pump outputs, D0-D4
+
+struct StaticLoggerConfig
+{
+    uint8_t type;
+    const char* server;
+    int port;                // 0 for the default port of the logger type
+    const char* topicPrefix;
+};
+
+struct StaticGroupConfig
+{
+    const char* name;
+    int triggerMode;
+    uint8_t waterSensorChannel;
+    uint32_t moistureSensorChannelMask;
+    uint32_t pumpOutputMask;
+    int minMoisture;
+    int pumpSecs;
+    unsigned long waterCheckPeriodMs;
+    unsigned long pumpCheckPeriodMs;
+    unsigned long moistureCheckPeriodMs;
+};
+
+// Generated by static_config.py
+#include <StaticConfigData.h>
+
+constexpr bool staticStringsEqual(const char* a, const char* b) {
+    return *a == *b && (*a == '\0' || staticStringsEqual(a + 1, b + 1));
+}
+
+constexpr bool staticLoggersValid() {
+    for (size_t i = 0; i < staticLoggers.size(); i++) {
+        const StaticLoggerConfig& logger = staticLoggers[i];
+        if (logger.type != STATIC_LOGGER_SERIAL && logger.server[0] == '\0') {
+            return false;
+        }
+        if (logger.type == STATIC_LOGGER_MQTT && logger.topicPrefix[0] == '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr size_t staticStringLength(const char* a) {
+    return *a == '\0' ? 0 : 1 + staticStringLength(a + 1);
+}
+
+constexpr bool staticGroupNamesUnique() {
+    for (size_t i = 0; i < staticGroups.size(); i++) {
+        if (staticGroups[i].name[0] == '\0' || staticStringLength(staticGroups[i].name) > WATERINGSYSTEM_GROUPNAME_MAXLENGTH) {
+            return false;
+        }
+        for (size_t j = i + 1; j < staticGroups.size(); j++) {
+            if (staticStringsEqual(staticGroups[i].name, staticGroups[j].name)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+constexpr bool staticGroupChannelsValid() {
+    for (size_t i = 0; i < staticGroups.size(); i++) {
+        const StaticGroupConfig& group = staticGroups[i];
+        if (group.waterSensorChannel >= WATERINGSYSTEM_NUMBEROFSENSORS ||
+            (group.moistureSensorChannelMask >> WATERINGSYSTEM_NUMBEROFSENSORS) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr bool staticGroupPumpsValid() {
+    for (size_t i = 0; i < staticGroups.size(); i++) {
+        const StaticGroupConfig& group = staticGroups[i];
+        if (group.pumpOutputMask == 0 || (group.pumpOutputMask >> STATIC_CONFIG_PUMPOUTPUTS) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr bool staticGroupSettingsValid() {
+    for (size_t i = 0; i < staticGroups.size(); i++) {
+        const StaticGroupConfig& group = staticGroups[i];
+        if ((group.triggerMode != MOISTURE_CONTROLLER_TRIGGER_ANY && group.triggerMode != MOISTURE_CONTROLLER_TRIGGER_ALL) ||
+            group.minMoisture < 0 || group.minMoisture > 1023 || group.pumpSecs <= 0 ||
+            group.waterCheckPeriodMs == 0 || group.pumpCheckPeriodMs == 0 || group.moistureCheckPeriodMs == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(staticLoggersValid(), "Static configuration: loki and mqtt loggers need a server, and mqtt loggers a topicPrefix");
+static_assert(staticGroupNamesUnique(), "Static configuration: sensor group names must be present, unique and at most 23 characters");
+static_assert(staticGroupChannelsValid(), "Static configuration: sensor channels must be 0-7");
+static_assert(staticGroupPumpsValid(), "Static configuration: each sensor group needs pumps on outputs D0-D4");
+static_assert(staticGroupSettingsValid(), "Static configuration: invalid trigger type, moisture level or check period");
+
+#endif
+
+#endif
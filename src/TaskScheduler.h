@@ -0,0 +1,176 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include <vector>
+
+#ifndef __WATERINGSYSTEM_TASKSCHEDULER_H__
+#define __WATERINGSYSTEM_TASKSCHEDULER_H__
+
+//
+// Task priorities, highest first
+//
+enum TaskPriority : uint8_t {
+    TASK_PRIORITY_CONTROL = 0, // Sensor group decisions and pump outputs
+    TASK_PRIORITY_SENSORS,     // Sensor sampling
+    TASK_PRIORITY_TELEMETRY,   // Sending queued log events
+    TASK_PRIORITY_NETWORK      // HTTP, OTA and Wi-Fi connection
+};
+
+struct SchedulerTask
+{
+    const char* name;
+    uint8_t priority;
+    unsigned long budgetMicros;     // Time allowed per pass, 0 for no limit
+    std::function<bool()> step;     // Runs one step, returning true if more work is pending
+    // Per pass state
+    bool done;
+    unsigned long spentMicros;
+    // Stats since the last report
+    unsigned long steps;
+    unsigned long maxStepMicros;
+    unsigned long maxIntervalMicros; // Longest gap between the starts of consecutive steps
+    unsigned long overruns;          // Passes ended by the budget with work still pending
+    unsigned long lastStepMicros;
+    bool stepped;                    // Whether lastStepMicros has been set by a step
+};
+
+//
+// Cooperative, priority based scheduler for the main loop. Tasks are resumable state
+// machines: each step does a bounded piece of work and returns whether more is pending.
+// Each call to loop() is one pass, which runs the highest priority task with work until
+// it is done or out of budget, then the next. After every step, higher priority tasks are
+// polled again before a lower priority task continues, so pump control and sensor
+// sampling run between every telemetry send and HTTP request.
+//
+// The latency of a higher priority task is bounded by the longest single step of any
+// lower priority task, reported as maxIntervalMicros of that task.
+//
+class TaskScheduler
+{
+  private:
+    std::vector<SchedulerTask> _tasks; // In priority order
+    unsigned long _passCount = 0;
+    unsigned long _passMicrosTotal = 0;
+    unsigned long _passMicrosMax = 0;
+
+    bool runStep(SchedulerTask& task);
+    static bool hasBudget(const SchedulerTask& task);
+
+  public:
+    void addTask(const char* name, uint8_t priority, unsigned long budgetMicros, std::function<bool()> step);
+    void loop();
+    void reportStats(JsonObject statsJson);
+};
+/****************************************/
+
+//
+// Adds a task, after any others of the same priority. Tasks are added at setup, as
+// the task list isn't changed while running. Tasks can be added during global
+// construction, before the clock is running, so intervals start from the first step.
+//
+void TaskScheduler::addTask(const char* name, uint8_t priority, unsigned long budgetMicros, std::function<bool()> step) {
+    SchedulerTask task = {name, priority, budgetMicros, step, false, 0, 0, 0, 0, 0, 0, false};
+    auto position = _tasks.begin();
+    while (position != _tasks.end() && position->priority <= priority) {
+        position++;
+    }
+    _tasks.insert(position, task);
+}
+
+bool TaskScheduler::hasBudget(const SchedulerTask& task) {
+    return task.budgetMicros == 0 || task.spentMicros < task.budgetMicros;
+}
+
+bool TaskScheduler::runStep(SchedulerTask& task) {
+    unsigned long startMicros = micros();
+    unsigned long interval = startMicros - task.lastStepMicros;
+    if (task.stepped && interval > task.maxIntervalMicros) {
+        task.maxIntervalMicros = interval;
+    }
+    task.lastStepMicros = startMicros;
+    task.stepped = true;
+
+    bool morePending = task.step();
+
+    unsigned long stepMicros = micros() - startMicros;
+    task.spentMicros += stepMicros;
+    task.steps++;
+    if (stepMicros > task.maxStepMicros) {
+        task.maxStepMicros = stepMicros;
+    }
+    return morePending;
+}
+
+void TaskScheduler::loop() {
+    unsigned long passStartMicros = micros();
+    for (auto & task : _tasks) {
+        task.done = false;
+        task.spentMicros = 0;
+    }
+
+    size_t index = 0;
+    while (index < _tasks.size()) {
+        SchedulerTask& task = _tasks[index];
+        if (task.done) {
+            index++;
+            continue;
+        }
+        bool morePending = runStep(task);
+        if (!morePending) {
+            task.done = true;
+        } else if (!hasBudget(task)) {
+            task.done = true;
+            task.overruns++;
+        }
+
+        // Yield point, poll the higher priority tasks again before carrying on
+        bool rearmed = false;
+        for (size_t higher = 0; higher < index; higher++) {
+            if (_tasks[higher].priority < task.priority && hasBudget(_tasks[higher])) {
+                _tasks[higher].done = false;
+                rearmed = true;
+            }
+        }
+        if (rearmed) {
+            index = 0;
+        }
+    }
+
+    unsigned long passMicros = micros() - passStartMicros;
+    _passCount++;
+    _passMicrosTotal += passMicros;
+    if (passMicros > _passMicrosMax) {
+        _passMicrosMax = passMicros;
+    }
+}
+
+//
+// Adds loop and per task stats to a Json object, resetting them for the next report
+//
+void TaskScheduler::reportStats(JsonObject statsJson) {
+    statsJson["loopCount"] = _passCount;
+    statsJson["loopMicrosAvg"] = _passCount ? _passMicrosTotal / _passCount : 0;
+    statsJson["loopMicrosMax"] = _passMicrosMax;
+    _passCount = 0;
+    _passMicrosTotal = 0;
+    _passMicrosMax = 0;
+
+    JsonObject tasksJson = statsJson["tasks"].to<JsonObject>();
+    for (auto & task : _tasks) {
+        JsonObject taskJson = tasksJson[task.name].to<JsonObject>();
+        taskJson["steps"] = task.steps;
+        taskJson["maxStepMicros"] = task.maxStepMicros;
+        taskJson["maxIntervalMicros"] = task.maxIntervalMicros;
+        taskJson["overruns"] = task.overruns;
+        task.steps = 0;
+        task.maxStepMicros = 0;
+        task.maxIntervalMicros = 0;
+        task.overruns = 0;
+    }
+}
+
+#endif
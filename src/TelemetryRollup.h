@@ -0,0 +1,168 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "LoggerFilter.h"
+
+#ifndef __WATERINGSYSTEM_TELEMETRYROLLUP_H__
+#define __WATERINGSYSTEM_TELEMETRYROLLUP_H__
+
+#define WATERINGSYSTEM_ROLLUP_SERIES 24        // Series (metric, group and channel) rolled up per logger
+#define WATERINGSYSTEM_ROLLUP_SERIESPEREVENT 6 // Keeps each event inside a serial line
+#define WATERINGSYSTEM_ROLLUP_DEFAULTWINDOWSECS 300
+
+struct RollupSeries
+{
+    uint8_t  metric;
+    int8_t   channel;  // -1 for group level metrics
+    char     group[WATERINGSYSTEM_GROUPNAME_MAXLENGTH + 1];
+    uint32_t count;    // Values in the current window
+    int16_t  min;
+    int16_t  max;
+    int16_t  last;
+    int32_t  sum;
+};
+
+//
+// Per logger rollup of numeric metrics over tumbling windows. Rather than each reading
+// being sent, the count, min, max, sum and last value of each series are kept for the
+// current window, and one event with every series is sent when the window closes (more
+// only with many series). State is fixed per series, however many readings a window
+// sees. Series are kept from window to window, so building the table only happens as
+// groups and channels are first seen. Readings for a series that doesn't fit in the
+// table are sent as they are.
+//
+class TelemetryRollup
+{
+  private:
+    uint32_t _metricMask;
+    unsigned long _windowMillis;
+    unsigned long _windowStartMillis;
+    RollupSeries _series[WATERINGSYSTEM_ROLLUP_SERIES];
+    uint8_t _seriesCount = 0;
+    unsigned long _windows = 0;
+    unsigned long _passedThrough = 0;
+
+    RollupSeries* findSeries(LogMetric metric, const String& group, int channel);
+
+  public:
+    TelemetryRollup(uint32_t metricMask, unsigned long windowSecs);
+    bool rollsUp(LogMetric metric);
+    bool add(LogMetric metric, const String& group, int channel, int value);
+    bool isWindowClosed();
+    void closeWindow();
+    bool takeEvent(JsonDocument& valueDoc);
+    void reportStats(JsonObject statsJson);
+};
+/****************************************/
+
+TelemetryRollup::TelemetryRollup(uint32_t metricMask, unsigned long windowSecs) {
+    _metricMask = metricMask;
+    _windowMillis = windowSecs * 1000;
+    _windowStartMillis = millis();
+}
+
+bool TelemetryRollup::rollsUp(LogMetric metric) {
+    return _metricMask & (1UL << metric);
+}
+
+//
+// Finds a series, adding it if there's room. Group names are limited by the configuration
+// to WATERINGSYSTEM_GROUPNAME_MAXLENGTH, so they're compared whole.
+//
+RollupSeries* TelemetryRollup::findSeries(LogMetric metric, const String& group, int channel) {
+    for (uint8_t i = 0; i < _seriesCount; i++) {
+        RollupSeries& series = _series[i];
+        if (series.metric == metric && series.channel == channel && strcmp(series.group, group.c_str()) == 0) {
+            return &series;
+        }
+    }
+    if (_seriesCount >= WATERINGSYSTEM_ROLLUP_SERIES) {
+        return NULL;
+    }
+    RollupSeries& series = _series[_seriesCount++];
+    memset(&series, 0, sizeof(series));
+    series.metric = metric;
+    series.channel = channel;
+    strncpy(series.group, group.c_str(), WATERINGSYSTEM_GROUPNAME_MAXLENGTH);
+    return &series;
+}
+
+//
+// Adds a reading to its series, returning false if there's no room for the series, in
+// which case the reading should be sent on its own
+//
+bool TelemetryRollup::add(LogMetric metric, const String& group, int channel, int value) {
+    RollupSeries* series = findSeries(metric, group, channel);
+    if (!series) {
+        _passedThrough++;
+        return false;
+    }
+    if (series->count == 0 || value < series->min) {
+        series->min = value;
+    }
+    if (series->count == 0 || value > series->max) {
+        series->max = value;
+    }
+    series->last = value;
+    series->sum += value;
+    series->count++;
+    return true;
+}
+
+bool TelemetryRollup::isWindowClosed() {
+    return millis() - _windowStartMillis >= _windowMillis;
+}
+
+// Starts the next window. The window just closed is then sent using takeEvent().
+void TelemetryRollup::closeWindow() {
+    _windowStartMillis += _windowMillis * ((millis() - _windowStartMillis) / _windowMillis);
+    _windows++;
+}
+
+//
+// Builds an event from series with readings in the window just closed, clearing them.
+// Each series is an array of [metric, group, channel, min, max, mean, count, last].
+// Returns false, building nothing, once there are no series left to send.
+//
+bool TelemetryRollup::takeEvent(JsonDocument& valueDoc) {
+    uint8_t pending = 0;
+    while (pending < _seriesCount && _series[pending].count == 0) {
+        pending++;
+    }
+    if (pending == _seriesCount) {
+        return false;
+    }
+    valueDoc["windowSecs"] = _windowMillis / 1000;
+    JsonArray seriesJson = valueDoc["series"].to<JsonArray>();
+    uint8_t taken = 0;
+    for (uint8_t i = pending; i < _seriesCount && taken < WATERINGSYSTEM_ROLLUP_SERIESPEREVENT; i++) {
+        RollupSeries& series = _series[i];
+        if (series.count == 0) {
+            continue;
+        }
+        JsonArray valuesJson = seriesJson.add<JsonArray>();
+        valuesJson.add(logMetricNames[series.metric]);
+        valuesJson.add((const char*)series.group);
+        valuesJson.add(series.channel);
+        valuesJson.add(series.min);
+        valuesJson.add(series.max);
+        valuesJson.add(round(series.sum * 10.0f / series.count) / 10.0f);
+        valuesJson.add(series.count);
+        valuesJson.add(series.last);
+        series.count = 0;
+        series.sum = 0;
+        taken++;
+    }
+    return true;
+}
+
+void TelemetryRollup::reportStats(JsonObject statsJson) {
+    statsJson["rollupWindows"] = _windows;
+    statsJson["rollupSeries"] = _seriesCount;
+    statsJson["rollupPassedThrough"] = _passedThrough;
+}
+
+#endif
@@ -0,0 +1,161 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include "LoggerFilter.h"
+
+#ifndef __WATERINGSYSTEM_TRACERECORDER_H__
+#define __WATERINGSYSTEM_TRACERECORDER_H__
+
+#define WATERINGSYSTEM_TRACE_EVENTS 256   // Events held in the trace ring, must be a power of two
+#define WATERINGSYSTEM_TRACE_MINMICROS 100 // Shorter spans with nothing nested are not kept
+
+enum TraceEvent : uint8_t {
+    TRACE_EVENT_POLLSENSORS = 0,
+    TRACE_EVENT_SENSORGROUP,
+    TRACE_EVENT_LOGGERSEND,
+    TRACE_EVENT_HTTP,
+    TRACE_EVENT_PUMP,
+    TRACE_EVENT_COUNT
+};
+
+const char* const traceEventNames[TRACE_EVENT_COUNT] = {
+    "pollSensors", "SensorGroup::loop", "logger send", "http", "pump"
+};
+
+struct TraceRecord
+{
+    uint32_t micros;
+    uint8_t  event;
+    char     phase;   // 'B' for begin, 'E' for end
+    uint16_t arg;     // Sensor group index, LogMetric or pump output
+};
+
+//
+// Always on trace of what the loop is doing, for diagnosing stalls in the field. Begin and
+// end events are written with microsecond timestamps into a fixed ring of 8 byte records,
+// overwriting the oldest, and exported by GET /trace in Chrome trace_event format.
+// Events are identified by a sequence number, counting all events recorded.
+//
+class TraceRecorder
+{
+  private:
+    TraceRecord _records[WATERINGSYSTEM_TRACE_EVENTS];
+    uint32_t _recorded = 0;      // Sequence of the next event, its slot is this modulo the ring size
+    uint32_t _firstValid = 0;    // Events before this have been overwritten by a discarded event
+
+  public:
+    void record(TraceEvent event, char phase, uint16_t arg);
+    void discardLast();
+    uint32_t getRecorded();
+    uint32_t getFirst();
+    const TraceRecord& getRecord(uint32_t sequence);
+    static void appendChromeEvent(String& out, const TraceRecord& record, uint32_t baseMicros);
+};
+/****************************************/
+
+void TraceRecorder::record(TraceEvent event, char phase, uint16_t arg) {
+    TraceRecord& record = _records[_recorded++ & (WATERINGSYSTEM_TRACE_EVENTS - 1)];
+    record.micros = micros();
+    record.event = event;
+    record.phase = phase;
+    record.arg = arg;
+}
+
+//
+// Removes the most recent event. Its slot held the oldest event, which is now lost.
+//
+void TraceRecorder::discardLast() {
+    _recorded--;
+    if (_recorded >= WATERINGSYSTEM_TRACE_EVENTS) {
+        _firstValid = _recorded - WATERINGSYSTEM_TRACE_EVENTS + 1;
+    }
+}
+
+uint32_t TraceRecorder::getRecorded() {
+    return _recorded;
+}
+
+// Returns the sequence of the oldest event still held
+uint32_t TraceRecorder::getFirst() {
+    uint32_t oldest = _recorded > WATERINGSYSTEM_TRACE_EVENTS ? _recorded - WATERINGSYSTEM_TRACE_EVENTS : 0;
+    return max(oldest, _firstValid);
+}
+
+// Returns an event by its sequence, from getFirst() up to getRecorded()
+const TraceRecord& TraceRecorder::getRecord(uint32_t sequence) {
+    return _records[sequence & (WATERINGSYSTEM_TRACE_EVENTS - 1)];
+}
+
+//
+// Appends an event as a Chrome trace_event object. Timestamps are relative to baseMicros,
+// so they stay in order across a micros() wrap as long as the ring spans under 71 minutes.
+// Pumps get a track (tid) per output, as their on/off spans overlap with the loop.
+//
+void TraceRecorder::appendChromeEvent(String& out, const TraceRecord& record, uint32_t baseMicros) {
+    uint8_t event = record.event < TRACE_EVENT_COUNT ? record.event : TRACE_EVENT_HTTP;
+    out += "{\"name\":\"";
+    out += traceEventNames[event];
+    out += "\",\"ph\":\"";
+    out += record.phase;
+    out += "\",\"ts\":";
+    out += (uint32_t)(record.micros - baseMicros);
+    out += ",\"pid\":1,\"tid\":";
+    out += event == TRACE_EVENT_PUMP ? 1 + record.arg : 0;
+    if (event == TRACE_EVENT_SENSORGROUP) {
+        out += ",\"args\":{\"group\":";
+        out += record.arg;
+        out += "}";
+    } else if (event == TRACE_EVENT_LOGGERSEND && record.arg < LOG_METRIC_COUNT) {
+        out += ",\"args\":{\"metric\":\"";
+        out += logMetricNames[record.arg];
+        out += "\"}";
+    } else if (event == TRACE_EVENT_PUMP) {
+        out += ",\"args\":{\"output\":";
+        out += record.arg;
+        out += "}";
+    }
+    out += "}";
+}
+
+TraceRecorder traceRecorder;
+
+//
+// RAII helper recording begin and end events around a block of code. Passes that do
+// nothing, such as a sensor group loop with no timer due, finish within
+// WATERINGSYSTEM_TRACE_MINMICROS and are dropped, so they don't flush the ring.
+//
+class TraceScope
+{
+  private:
+    TraceEvent _event;
+    uint16_t _arg;
+    uint32_t _sequence;
+    unsigned long _startMicros;
+  public:
+    TraceScope(TraceEvent event, uint16_t arg);
+    ~TraceScope();
+};
+
+TraceScope::TraceScope(TraceEvent event, uint16_t arg) {
+    _event = event;
+    _arg = arg;
+    _sequence = traceRecorder.getRecorded();
+    _startMicros = micros();
+    traceRecorder.record(event, 'B', arg);
+}
+
+TraceScope::~TraceScope() {
+    if (traceRecorder.getRecorded() == _sequence + 1 && micros() - _startMicros < WATERINGSYSTEM_TRACE_MINMICROS) {
+        traceRecorder.discardLast();
+    } else {
+        traceRecorder.record(_event, 'E', _arg);
+    }
+}
+
+#define TRACE_SCOPE_CONCAT(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_SCOPE_CONCAT(traceScope, line)
+#define TRACE_SCOPE(event, arg) TraceScope TRACE_SCOPE_NAME(__LINE__)(event, arg)
+
+#endif
@@ -0,0 +1,157 @@
+# Generates include/StaticConfigData.h from a Json configuration, for builds with
+# WATERINGSYSTEM_STATIC_CONFIG. See "Static configuration" in README.md.
+#
+# As a PlatformIO pre script, the configuration file is taken from the custom_static_config
+# project option:
+#
+# extra_scripts = pre:static_config.py
+# custom_static_config = staticconfig.json
+#
+# It can also be run by hand:
+#
+# python static_config.py staticconfig.json include/StaticConfigData.h
+#
+# Names are resolved to channel and output masks here. Range checks are done by the
+# compiler, in StaticConfig.h.
+
+import json
+import os
+import sys
+
+TRIGGER_TYPES = {"any": "MOISTURE_CONTROLLER_TRIGGER_ANY", "all": "MOISTURE_CONTROLLER_TRIGGER_ALL"}
+LOGGER_TYPES = {"serial": "STATIC_LOGGER_SERIAL", "loki": "STATIC_LOGGER_LOKI", "mqtt": "STATIC_LOGGER_MQTT"}
+PUMP_PINS = ["D0", "D1", "D2", "D3", "D4"]
+GROUP_NAME_MAX_LENGTH = 23  # WATERINGSYSTEM_GROUPNAME_MAXLENGTH
+GROUP_FIELDS = ["name", "triggerType", "waterSensorChannel", "moistureSensorChannels", "pumpPinIds",
+                "minMoisture", "pumpSecs", "waterCheckPeriodMs", "pumpCheckPeriodMs", "moistureCheckPeriodMs"]
+UNSUPPORTED_ENTRIES = ["sensorSources", "sensorChannels", "actuator", "history", "recording"]
+
+
+class StaticConfigError(Exception):
+    pass
+
+
+def c_string(value):
+    # Json string escapes are also valid C++ string literal escapes
+    return json.dumps(str(value))
+
+
+def pump_output(pin):
+    if pin in PUMP_PINS:
+        return PUMP_PINS.index(pin)
+    if len(pin) > 1 and pin[0] == "P" and pin[1:].isdigit():
+        return int(pin[1:])
+    raise StaticConfigError("Invalid pump pin identifier " + pin)
+
+
+def generate_logger(logger):
+    if "type" not in logger:
+        raise StaticConfigError("Failed to find field loggers.type in config")
+    if logger["type"] not in LOGGER_TYPES:
+        raise StaticConfigError("Invalid logger type " + str(logger["type"]))
+    if logger.get("encoding", "json") != "json":
+        raise StaticConfigError("Only json logger encoding is supported in static configurations")
+    if logger.get("format", "json") != "json" or logger.get("overflow", "drop-newest") != "drop-newest":
+        raise StaticConfigError("Only the default serial logger format and overflow are supported in static configurations")
+    if "filter" in logger:
+        raise StaticConfigError("Logger filters are not supported in static configurations, post them as a runtime override")
+    if "rollup" in logger:
+        raise StaticConfigError("Logger rollups are not supported in static configurations, post them as a runtime override")
+    return "    {%s, %s, %d, %s}," % (LOGGER_TYPES[logger["type"]],
+                                      c_string(logger.get("server", "")),
+                                      int(logger.get("port", 0)),
+                                      c_string(logger.get("topicPrefix", "")))
+
+
+def generate_group(group):
+    for field in GROUP_FIELDS:
+        if field not in group:
+            raise StaticConfigError("Failed to find field groups." + field + " in config")
+    if len(str(group["name"])) > GROUP_NAME_MAX_LENGTH:
+        raise StaticConfigError("Sensor group names can be at most %d characters" % GROUP_NAME_MAX_LENGTH)
+    if group["triggerType"] not in TRIGGER_TYPES:
+        raise StaticConfigError("Invalid trigger type " + str(group["triggerType"]))
+    channel_mask = 0
+    for channel in group["moistureSensorChannels"]:
+        channel_mask |= 1 << int(channel)
+    output_mask = 0
+    for pin in group["pumpPinIds"]:
+        output_mask |= 1 << pump_output(str(pin))
+    return "    {%s, %s, %d, 0x%x, 0x%x, %d, %d, %d, %d, %d}," % (
+        c_string(group["name"]), TRIGGER_TYPES[group["triggerType"]],
+        int(group["waterSensorChannel"]), channel_mask, output_mask,
+        int(group["minMoisture"]), int(group["pumpSecs"]), int(group["waterCheckPeriodMs"]),
+        int(group["pumpCheckPeriodMs"]), int(group["moistureCheckPeriodMs"]))
+
+
+def fnv1a(data):
+    # Matches ConfigManager::setConfigHash, so the static configuration has an ETag
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def generate_table(type_name, name, rows):
+    if not rows:
+        return "constexpr std::array<%s, 0> %s = {};\n" % (type_name, name)
+    return "constexpr std::array<%s, %d> %s = {{\n%s\n}};\n" % (type_name, len(rows), name, "\n".join(rows))
+
+
+def generate(config, source_name):
+    if "instance" not in config:
+        raise StaticConfigError("Failed to find field instance in config")
+    for entry in UNSUPPORTED_ENTRIES:
+        if entry in config:
+            raise StaticConfigError(entry + " is not supported in static configurations, post it as a runtime override")
+
+    loggers = [generate_logger(logger) for logger in config.get("loggers", [])]
+    groups = [generate_group(group) for group in config.get("groups", [])]
+    compact_json = json.dumps(config, separators=(",", ":"))
+    if ")staticconfig\"" in compact_json:
+        raise StaticConfigError("Configuration cannot be embedded")
+
+    return ("//\n"
+            "// Generated by static_config.py from %s. Do not edit.\n"
+            "//\n\n"
+            "#define WATERINGSYSTEM_STATIC_INSTANCE %s\n"
+            "#define WATERINGSYSTEM_STATIC_CONFIGHASH 0x%08xu\n\n"
+            "%s\n%s\n"
+            "// The source configuration, returned by GET /config\n"
+            "const char staticConfigJson[] PROGMEM = R\"staticconfig(%s)staticconfig\";\n") % (
+        source_name, c_string(config["instance"]), fnv1a(compact_json.encode("utf-8")),
+        generate_table("StaticLoggerConfig", "staticLoggers", loggers),
+        generate_table("StaticGroupConfig", "staticGroups", groups),
+        compact_json)
+
+
+def write_header(config_path, header_path):
+    with open(config_path) as config_file:
+        config = json.load(config_file)
+    header = generate(config, os.path.basename(config_path))
+    # Only rewrite when changed, so unchanged configurations don't trigger a rebuild
+    if os.path.exists(header_path):
+        with open(header_path) as existing:
+            if existing.read() == header:
+                return
+    with open(header_path, "w") as header_file:
+        header_file.write(header)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("Usage: static_config.py <config.json> <header.h>")
+    try:
+        write_header(sys.argv[1], sys.argv[2])
+    except (StaticConfigError, ValueError) as error:
+        sys.exit("Static configuration: " + str(error))
+else:
+    Import("env")
+    project_dir = env.subst("$PROJECT_DIR")
+    config_path = os.path.join(project_dir, env.GetProjectOption("custom_static_config", "staticconfig.json"))
+    header_path = os.path.join(env.subst("$PROJECT_INCLUDE_DIR"), "StaticConfigData.h")
+    print("Generating static configuration from " + config_path)
+    try:
+        write_header(config_path, header_path)
+    except (StaticConfigError, ValueError, OSError) as error:
+        sys.exit("Static configuration: " + str(error))
@@ -0,0 +1,247 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+//
+// The parts of the Arduino core used by the headers built for the host, by the tests and
+// the host programs in tools. The clock is driven through hostMillis, Serial output goes
+// to stdout, and pins read as low.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_ARDUINO_H__
+#define __WATERINGSYSTEM_TEST_ARDUINO_H__
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define DEC 10
+#define HEX 16
+
+// NodeMCU pin names, as GPIO numbers
+#define D0 16
+#define D1 5
+#define D2 4
+#define D3 0
+#define D4 2
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+#define A0 17
+
+#define PI 3.1415926535897932384626433832795
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline unsigned long hostMillis = 0;
+
+inline unsigned long millis() {
+    return hostMillis;
+}
+
+inline unsigned long micros() {
+    return hostMillis * 1000;
+}
+
+inline void yield() {
+}
+
+inline void delay(unsigned long ms) {
+    hostMillis += ms;
+}
+
+inline void delayMicroseconds(unsigned int us) {
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+}
+
+inline int digitalRead(uint8_t pin) {
+    return LOW;
+}
+
+inline int analogRead(uint8_t pin) {
+    return 0;
+}
+
+inline void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t value) {
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline void randomSeed(unsigned long seed) {
+    srand(seed);
+}
+
+inline long random(long howBig) {
+    return howBig > 0 ? rand() % howBig : 0;
+}
+
+inline long random(long howSmall, long howBig) {
+    return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+class String
+{
+  private:
+    std::string _value;
+
+  public:
+    String() {}
+    String(const char* value) : _value(value ? value : "") {}
+    String(const String& value) = default;
+    explicit String(char value) : _value(1, value) {}
+    explicit String(int value) : _value(std::to_string(value)) {}
+    explicit String(unsigned int value) : _value(std::to_string(value)) {}
+    explicit String(long value) : _value(std::to_string(value)) {}
+    explicit String(unsigned long value) : _value(std::to_string(value)) {}
+    String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+    String(unsigned long value, unsigned char base) {
+        char text[24];
+        snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", value);
+        _value = text;
+    }
+    explicit String(float value, unsigned char decimals = 2) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.*f", decimals, value);
+        _value = text;
+    }
+    String& operator=(const String& value) = default;
+
+    const char* c_str() const { return _value.c_str(); }
+    unsigned int length() const { return _value.size(); }
+    bool isEmpty() const { return _value.empty(); }
+    char charAt(unsigned int index) const { return _value[index]; }
+    char operator[](unsigned int index) const { return _value[index]; }
+    bool equals(const String& other) const { return _value == other._value; }
+    bool equals(const char* other) const { return _value == other; }
+    bool operator==(const String& other) const { return _value == other._value; }
+    bool operator==(const char* other) const { return _value == other; }
+    bool operator!=(const String& other) const { return _value != other._value; }
+    bool startsWith(const String& prefix) const { return _value.compare(0, prefix._value.size(), prefix._value) == 0; }
+    int indexOf(char c) const { size_t index = _value.find(c); return index == std::string::npos ? -1 : (int)index; }
+    String substring(unsigned int from) const { return substring(from, _value.size()); }
+    String substring(unsigned int from, unsigned int to) const {
+        from = std::min(from, length());
+        to = std::max(from, std::min(to, length()));
+        return String(_value.substr(from, to - from).c_str());
+    }
+    long toInt() const { return atol(_value.c_str()); }
+    float toFloat() const { return atof(_value.c_str()); }
+    bool reserve(unsigned int size) { _value.reserve(size); return true; }
+
+    bool concat(const String& value) { _value += value._value; return true; }
+    bool concat(const char* value) { _value += value; return true; }
+    bool concat(const char* value, unsigned int length) { _value.append(value, length); return true; }
+    bool concat(char value) { _value += value; return true; }
+    bool concat(unsigned char value) { _value += std::to_string(value); return true; }
+    bool concat(int value) { _value += std::to_string(value); return true; }
+    bool concat(unsigned int value) { _value += std::to_string(value); return true; }
+    bool concat(long value) { _value += std::to_string(value); return true; }
+    bool concat(unsigned long value) { _value += std::to_string(value); return true; }
+
+    template <typename T>
+    String& operator+=(const T& value) { concat(value); return *this; }
+};
+
+inline String operator+(const String& left, const String& right) {
+    String result(left);
+    result += right;
+    return result;
+}
+
+inline String operator+(const String& left, const char* right) {
+    String result(left);
+    result += right;
+    return result;
+}
+
+inline String operator+(const char* left, const String& right) {
+    String result(left);
+    result += right;
+    return result;
+}
+
+template <typename T>
+inline String operator+(const String& left, T right) {
+    String result(left);
+    result += right;
+    return result;
+}
+
+class IPAddress
+{
+  public:
+    String toString() const { return String("127.0.0.1"); }
+};
+
+// The system calls logged in system stats, reporting no heap or flash constraints
+// Reset reasons, as in the ESP8266 SDK's user_interface.h
+enum rst_reason {
+    REASON_DEFAULT_RST = 0,
+    REASON_WDT_RST = 1,
+    REASON_EXCEPTION_RST = 2,
+    REASON_SOFT_WDT_RST = 3,
+    REASON_SOFT_RESTART = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST = 6
+};
+
+struct rst_info
+{
+    uint32_t reason;
+};
+
+class EspClass
+{
+  private:
+    rst_info _resetInfo = {REASON_DEFAULT_RST};
+
+  public:
+    rst_info* getResetInfoPtr() { return &_resetInfo; }
+    uint32_t getFreeHeap() { return 0; }
+    uint8_t getHeapFragmentation() { return 0; }
+    uint32_t getMaxFreeBlockSize() { return 0; }
+    uint32_t getFreeSketchSpace() { return 0; }
+};
+
+inline EspClass ESP;
+
+class HostSerial
+{
+  public:
+    void print(const String& value) { fputs(value.c_str(), stdout); }
+    void print(const char* value) { fputs(value, stdout); }
+    void println(const String& value) { puts(value.c_str()); }
+    void println(const char* value) { puts(value); }
+    void println() { puts(""); }
+    template <typename... Args>
+    void printf(const char* format, Args... args) { ::printf(format, args...); }
+    size_t write(const uint8_t* buffer, size_t length) { return fwrite(buffer, 1, length, stdout); }
+    int availableForWrite() { return 128; }
+    void flush() { fflush(stdout); }
+};
+
+inline HostSerial Serial;
+
+#endif
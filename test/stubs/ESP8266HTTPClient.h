@@ -0,0 +1,53 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+//
+// HTTP client for host builds. Requests are handed to the HostHttpServer set in
+// hostHttpServer, standing in for the servers the firmware posts to. Without one,
+// connections are refused.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_ESP8266HTTPCLIENT_H__
+#define __WATERINGSYSTEM_TEST_ESP8266HTTPCLIENT_H__
+
+#define HTTPC_ERROR_CONNECTION_REFUSED -1
+
+class HostHttpServer
+{
+  public:
+    // Returns the HTTP status code for a request posted to url
+    virtual int handlePost(const String& url, const String& contentType, const uint8_t* body, size_t length) = 0;
+};
+
+inline HostHttpServer* hostHttpServer = NULL;
+
+class HTTPClient
+{
+  private:
+    String _url;
+    String _contentType;
+
+  public:
+    bool begin(WiFiClient& client, const String& url) { _url = url; return true; }
+    void setTimeout(uint16_t timeout) {}
+    void addHeader(const String& name, const String& value) {
+        if (name == "Content-Type") {
+            _contentType = value;
+        }
+    }
+    int POST(const uint8_t* payload, size_t size) {
+        if (!hostHttpServer) {
+            return HTTPC_ERROR_CONNECTION_REFUSED;
+        }
+        return hostHttpServer->handlePost(_url, _contentType, payload, size);
+    }
+    int POST(const String& payload) { return POST((const uint8_t*)payload.c_str(), payload.length()); }
+    String getString() { return String(); }
+    void end() {}
+};
+
+#endif
@@ -0,0 +1,49 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <functional>
+#include <WiFiClient.h>
+
+//
+// Web server for host builds, taking route registrations but never receiving requests.
+// Host programs call the handlers they need directly.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_ESP8266WEBSERVER_H__
+#define __WATERINGSYSTEM_TEST_ESP8266WEBSERVER_H__
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+class Uri
+{
+  public:
+    Uri(const char* uri) {}
+    virtual ~Uri() {}
+};
+
+class ESP8266WebServer
+{
+  public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    ESP8266WebServer(int port) {}
+    void on(const Uri& uri, HTTPMethod method, THandlerFunction handler) {}
+    void collectHeaders(const char* headerKeys[], size_t headerKeysCount) {}
+    void begin() {}
+    void handleClient() {}
+    String arg(const String& name) { return String(); }
+    bool hasArg(const String& name) { return false; }
+    String pathArg(unsigned int index) { return String(); }
+    String header(const String& name) { return String(); }
+    void send(int code, const char* contentType = NULL, const String& content = String()) {}
+    void sendHeader(const String& name, const String& value, bool first = false) {}
+    void setContentLength(size_t contentLength) {}
+    void sendContent(const String& content) {}
+    void sendContent(const char* content, size_t size) {}
+};
+
+#endif
@@ -0,0 +1,7 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <WiFiUdp.h>
@@ -0,0 +1,107 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+//
+// In memory stand in for LittleFS, holding each file as a string, for host tests
+//
+
+#ifndef __WATERINGSYSTEM_TEST_LITTLEFS_H__
+#define __WATERINGSYSTEM_TEST_LITTLEFS_H__
+
+class File
+{
+  private:
+    std::string* _contents = NULL;
+    size_t _position = 0;
+
+  public:
+    File() {}
+    File(std::string* contents, size_t position) : _contents(contents), _position(position) {}
+    operator bool() const { return _contents != NULL; }
+
+    size_t write(const uint8_t* buffer, size_t length) {
+        _contents->replace(_position, std::min(length, _contents->size() - _position), (const char*)buffer, length);
+        _position += length;
+        return length;
+    }
+
+    size_t write(const char* buffer, size_t length) {
+        return write((const uint8_t*)buffer, length);
+    }
+
+    int read() {
+        return _position < _contents->size() ? (uint8_t)(*_contents)[_position++] : -1;
+    }
+
+    size_t read(uint8_t* buffer, size_t length) {
+        length = std::min(length, _contents->size() - _position);
+        memcpy(buffer, _contents->data() + _position, length);
+        _position += length;
+        return length;
+    }
+
+    size_t readBytes(char* buffer, size_t length) {
+        return read((uint8_t*)buffer, length);
+    }
+
+    String readString() {
+        String contents;
+        contents.concat(_contents->data() + _position, _contents->size() - _position);
+        _position = _contents->size();
+        return contents;
+    }
+
+    bool seek(size_t position) {
+        _position = std::min(position, _contents->size());
+        return true;
+    }
+
+    bool isDirectory() { return false; }
+    size_t position() { return _position; }
+    size_t size() { return _contents->size(); }
+    int available() { return _contents->size() - _position; }
+    void flush() {}
+    void close() { _contents = NULL; }
+};
+
+class HostFS
+{
+  public:
+    std::map<std::string, std::string> files;
+
+    bool begin() { return true; }
+
+    File open(const String& path, const char* mode) {
+        auto file = files.find(path.c_str());
+        if (mode[0] == 'r' && file == files.end()) {
+            return File();
+        }
+        std::string& contents = files[path.c_str()];
+        if (mode[0] == 'w') {
+            contents.clear();
+        }
+        return File(&contents, mode[0] == 'a' ? contents.size() : 0);
+    }
+
+    bool exists(const String& path) { return files.count(path.c_str()) > 0; }
+    bool remove(const String& path) { return files.erase(path.c_str()) > 0; }
+
+    bool rename(const String& from, const String& to) {
+        auto file = files.find(from.c_str());
+        if (file == files.end()) {
+            return false;
+        }
+        files[to.c_str()] = file->second;
+        files.erase(from.c_str());
+        return true;
+    }
+};
+
+inline HostFS LittleFS;
+
+#endif
@@ -0,0 +1,27 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+//
+// NTP client for host builds, giving the epoch time from the host clock. Host programs
+// set hostEpochAtBoot to the epoch time at which hostMillis was 0.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_NTPCLIENT_H__
+#define __WATERINGSYSTEM_TEST_NTPCLIENT_H__
+
+inline unsigned long hostEpochAtBoot = 1700000000;
+
+class NTPClient
+{
+  public:
+    NTPClient(WiFiUDP& udp, const char* poolServerName) {}
+    void begin() {}
+    bool update() { return true; }
+    unsigned long getEpochTime() { return hostEpochAtBoot + millis() / 1000; }
+};
+
+#endif
@@ -0,0 +1,54 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+//
+// Mqtt client for host builds. Publishes are handed to the HostMqttBroker set in
+// hostMqttBroker, standing in for the broker. Without one, connections fail. As with
+// the real client, publishes that don't fit the client's buffer fail.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_PUBSUBCLIENT_H__
+#define __WATERINGSYSTEM_TEST_PUBSUBCLIENT_H__
+
+#define MQTT_MAX_HEADER_SIZE 5
+
+class HostMqttBroker
+{
+  public:
+    virtual bool handlePublish(const char* clientId, const char* topic, const uint8_t* payload, size_t length) = 0;
+};
+
+inline HostMqttBroker* hostMqttBroker = NULL;
+
+class PubSubClient
+{
+  private:
+    String _clientId;
+    bool _connected = false;
+    uint16_t _bufferSize = 256;
+
+  public:
+    PubSubClient(Client& client) {}
+    PubSubClient& setServer(const char* domain, uint16_t port) { return *this; }
+    PubSubClient& setSocketTimeout(uint16_t timeout) { return *this; }
+    bool setBufferSize(uint16_t size) { _bufferSize = size; return true; }
+    bool connect(const char* id) {
+        _clientId = id;
+        _connected = hostMqttBroker != NULL;
+        return _connected;
+    }
+    bool connected() { return _connected; }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length) {
+        if (!_connected || MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + length > _bufferSize) {
+            return false;
+        }
+        return hostMqttBroker->handlePublish(_clientId.c_str(), topic, payload, length);
+    }
+    bool loop() { return _connected; }
+};
+
+#endif
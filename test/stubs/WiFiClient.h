@@ -0,0 +1,25 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+//
+// Network clients for host builds. Connections are made by the HTTP and Mqtt client
+// stand ins, so these only carry settings.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_WIFICLIENT_H__
+#define __WATERINGSYSTEM_TEST_WIFICLIENT_H__
+
+class Client
+{
+};
+
+class WiFiClient : public Client
+{
+  public:
+    void setTimeout(unsigned long timeout) {}
+};
+
+#endif
@@ -0,0 +1,14 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+#ifndef __WATERINGSYSTEM_TEST_WIFIUDP_H__
+#define __WATERINGSYSTEM_TEST_WIFIUDP_H__
+
+class WiFiUDP
+{
+};
+
+#endif
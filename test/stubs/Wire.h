@@ -0,0 +1,27 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+
+//
+// I2C bus for host builds, with no devices on it
+//
+
+#ifndef __WATERINGSYSTEM_TEST_WIRE_H__
+#define __WATERINGSYSTEM_TEST_WIRE_H__
+
+class TwoWire
+{
+  public:
+    void begin(int sda, int scl) {}
+    void beginTransmission(uint8_t address) {}
+    size_t write(uint8_t value) { return 1; }
+    uint8_t endTransmission(bool sendStop = true) { return 2; } // Address not acknowledged
+    uint8_t requestFrom(uint8_t address, uint8_t quantity) { return 0; }
+    int read() { return -1; }
+};
+
+inline TwoWire Wire;
+
+#endif
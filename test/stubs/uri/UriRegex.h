@@ -0,0 +1,16 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <ESP8266WebServer.h>
+
+#ifndef __WATERINGSYSTEM_TEST_URIREGEX_H__
+#define __WATERINGSYSTEM_TEST_URIREGEX_H__
+
+class UriRegex : public Uri
+{
+  public:
+    UriRegex(const char* uri) : Uri(uri) {}
+};
+
+#endif
@@ -0,0 +1,131 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <unity.h>
+#include <map>
+#include "HeapAccounting.h"
+
+//
+// Runs the heap accounting tag and scope bookkeeping on the host. The malloc wrappers
+// are only built for the ESP8266, so allocations are recorded directly, with made up
+// heap addresses.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_HEAPACCOUNTING_H__
+#define __WATERINGSYSTEM_TEST_HEAPACCOUNTING_H__
+
+static void* heapAddress(uint32_t block) {
+    return (void*)(uintptr_t)(0x3FFE8000u + block * 16);
+}
+
+void test_heap_accounting_counts_per_tag() {
+    HeapAccounting* accounting = new HeapAccounting();
+    accounting->setCurrentTag(HEAP_TAG_LOKI);
+    accounting->recordAlloc(heapAddress(1), 100);
+    accounting->recordAlloc(heapAddress(2), 50);
+    accounting->setCurrentTag(HEAP_TAG_MQTT);
+    accounting->recordAlloc(heapAddress(3), 30);
+    accounting->recordFree(heapAddress(1));
+
+    TEST_ASSERT_EQUAL_UINT32(50, accounting->getStats(HEAP_TAG_LOKI).liveBytes);
+    TEST_ASSERT_EQUAL_UINT32(150, accounting->getStats(HEAP_TAG_LOKI).peakBytes);
+    TEST_ASSERT_EQUAL_UINT32(2, accounting->getStats(HEAP_TAG_LOKI).allocations);
+    TEST_ASSERT_EQUAL_UINT32(1, accounting->getStats(HEAP_TAG_LOKI).frees);
+    TEST_ASSERT_EQUAL_UINT32(30, accounting->getStats(HEAP_TAG_MQTT).liveBytes);
+    TEST_ASSERT_EQUAL_UINT32(3, accounting->getTotalAllocations());
+    delete accounting;
+}
+
+// Frees are charged to the tag the block was allocated under, whatever scope frees it
+void test_heap_accounting_frees_against_allocating_tag() {
+    HeapAccounting* accounting = new HeapAccounting();
+    accounting->setCurrentTag(HEAP_TAG_CONFIG);
+    accounting->recordAlloc(heapAddress(7), 64);
+    accounting->setCurrentTag(HEAP_TAG_HTTP);
+    accounting->recordFree(heapAddress(7));
+    TEST_ASSERT_EQUAL_UINT32(0, accounting->getStats(HEAP_TAG_CONFIG).liveBytes);
+    TEST_ASSERT_EQUAL_UINT32(1, accounting->getStats(HEAP_TAG_CONFIG).frees);
+    TEST_ASSERT_EQUAL_UINT32(0, accounting->getStats(HEAP_TAG_HTTP).frees);
+    delete accounting;
+}
+
+void test_heap_scopes_nest_and_restore() {
+    uint8_t outerTag = heapAccounting.setCurrentTag(HEAP_TAG_OTHER);
+    {
+        HEAP_SCOPE(HEAP_TAG_LOGGER);
+        {
+            HEAP_SCOPE(HEAP_TAG_SERIAL);
+            TEST_ASSERT_EQUAL_UINT8(HEAP_TAG_SERIAL, heapAccounting.setCurrentTag(HEAP_TAG_SERIAL));
+        }
+        TEST_ASSERT_EQUAL_UINT8(HEAP_TAG_LOGGER, heapAccounting.setCurrentTag(HEAP_TAG_LOGGER));
+    }
+    TEST_ASSERT_EQUAL_UINT8(HEAP_TAG_OTHER, heapAccounting.setCurrentTag(outerTag));
+}
+
+//
+// Random allocations and frees with the table nearly full, so probe runs are long and
+// frees shift entries back, checked against a simple model after every step
+//
+void test_heap_accounting_matches_model_under_load() {
+    HeapAccounting* accounting = new HeapAccounting();
+    std::map<uint32_t, std::pair<uint32_t, uint8_t>> live; // Block to size and tag
+    uint32_t modelBytes[HEAP_TAG_COUNT] = {};
+    uint32_t seed = 12345;
+    for (int step = 0; step < 20000; step++) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t block = (seed >> 8) % 2048;
+        auto existing = live.find(block);
+        if (existing != live.end()) {
+            accounting->recordFree(heapAddress(block));
+            modelBytes[existing->second.second] -= existing->second.first;
+            live.erase(existing);
+        } else if (live.size() < WATERINGSYSTEM_HEAP_TRACKEDBLOCKS - 32) {
+            uint8_t tag = (seed >> 20) % HEAP_TAG_COUNT;
+            uint32_t size = 8 + (seed >> 4) % 500;
+            accounting->setCurrentTag(tag);
+            accounting->recordAlloc(heapAddress(block), size);
+            live[block] = std::make_pair(size, tag);
+            modelBytes[tag] += size;
+        }
+        for (uint8_t tag = 0; tag < HEAP_TAG_COUNT; tag++) {
+            TEST_ASSERT_EQUAL_UINT32(modelBytes[tag], accounting->getStats(tag).liveBytes);
+        }
+    }
+    for (auto& entry : live) {
+        accounting->recordFree(heapAddress(entry.first));
+    }
+    for (uint8_t tag = 0; tag < HEAP_TAG_COUNT; tag++) {
+        TEST_ASSERT_EQUAL_UINT32(0, accounting->getStats(tag).liveBytes);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, accounting->getUntrackedAllocations());
+    delete accounting;
+}
+
+// Once the table is full, allocations are counted but not tracked, and freeing them is harmless
+void test_heap_accounting_counts_untracked_when_full() {
+    HeapAccounting* accounting = new HeapAccounting();
+    accounting->setCurrentTag(HEAP_TAG_SENSORGROUP);
+    for (uint32_t block = 0; block < WATERINGSYSTEM_HEAP_TRACKEDBLOCKS + 10; block++) {
+        accounting->recordAlloc(heapAddress(block), 4);
+    }
+    TEST_ASSERT_EQUAL_UINT32(10, accounting->getUntrackedAllocations());
+    TEST_ASSERT_EQUAL_UINT32(WATERINGSYSTEM_HEAP_TRACKEDBLOCKS + 10, accounting->getTotalAllocations());
+    TEST_ASSERT_EQUAL_UINT32(WATERINGSYSTEM_HEAP_TRACKEDBLOCKS * 4, accounting->getStats(HEAP_TAG_SENSORGROUP).liveBytes);
+    for (uint32_t block = 0; block < WATERINGSYSTEM_HEAP_TRACKEDBLOCKS + 10; block++) {
+        accounting->recordFree(heapAddress(block));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, accounting->getStats(HEAP_TAG_SENSORGROUP).liveBytes);
+    TEST_ASSERT_EQUAL_UINT32(WATERINGSYSTEM_HEAP_TRACKEDBLOCKS, accounting->getStats(HEAP_TAG_SENSORGROUP).frees);
+    delete accounting;
+}
+
+void runHeapAccountingTests() {
+    RUN_TEST(test_heap_accounting_counts_per_tag);
+    RUN_TEST(test_heap_accounting_frees_against_allocating_tag);
+    RUN_TEST(test_heap_scopes_nest_and_restore);
+    RUN_TEST(test_heap_accounting_matches_model_under_load);
+    RUN_TEST(test_heap_accounting_counts_untracked_when_full);
+}
+
+#endif
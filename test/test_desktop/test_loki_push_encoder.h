@@ -0,0 +1,194 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <unity.h>
+#include <string>
+#include <ArduinoJson.h>
+#include <snappy.h>
+#include <google/protobuf/io/coded_stream.h>
+#include "LokiPushEncoder.h"
+
+//
+// Round trips push requests from the LokiPushEncoder through the reference snappy and
+// protobuf decoders, as Loki would decode them. Fields are read by number and wire type,
+// following logproto.PushRequest, so no generated code is needed.
+//
+
+#ifndef __WATERINGSYSTEM_TEST_LOKIPUSHENCODER_H__
+#define __WATERINGSYSTEM_TEST_LOKIPUSHENCODER_H__
+
+using google::protobuf::io::CodedInputStream;
+
+struct DecodedPush
+{
+    int streams = 0;
+    int entries = 0;
+    std::string labels;
+    int64_t seconds = -1;
+    std::string line;
+};
+
+static bool decodeTimestamp(CodedInputStream& input, DecodedPush& push) {
+    uint32_t tag;
+    while ((tag = input.ReadTag()) != 0) {
+        uint64_t seconds;
+        if (tag != ((1 << 3) | 0) || !input.ReadVarint64(&seconds)) {
+            return false;
+        }
+        push.seconds = seconds;
+    }
+    return true;
+}
+
+static bool decodeEntry(CodedInputStream& input, DecodedPush& push) {
+    uint32_t tag;
+    while ((tag = input.ReadTag()) != 0) {
+        uint32_t length;
+        if ((tag & 7) != 2 || !input.ReadVarint32(&length)) {
+            return false;
+        }
+        if (tag >> 3 == 1) {
+            CodedInputStream::Limit limit = input.PushLimit(length);
+            if (!decodeTimestamp(input, push) || !input.ConsumedEntireMessage()) {
+                return false;
+            }
+            input.PopLimit(limit);
+        } else if (tag >> 3 != 2 || !input.ReadString(&push.line, length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool decodeStream(CodedInputStream& input, DecodedPush& push) {
+    uint32_t tag;
+    while ((tag = input.ReadTag()) != 0) {
+        uint32_t length;
+        if ((tag & 7) != 2 || !input.ReadVarint32(&length)) {
+            return false;
+        }
+        if (tag >> 3 == 1) {
+            if (!input.ReadString(&push.labels, length)) {
+                return false;
+            }
+        } else if (tag >> 3 == 2) {
+            push.entries++;
+            CodedInputStream::Limit limit = input.PushLimit(length);
+            if (!decodeEntry(input, push) || !input.ConsumedEntireMessage()) {
+                return false;
+            }
+            input.PopLimit(limit);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decompresses and parses the encoder's payload, failing the test if either step fails
+static DecodedPush decodePush(LokiPushEncoder& encoder) {
+    std::string protobuf;
+    TEST_ASSERT_TRUE(snappy::Uncompress((const char*)encoder.getPayload(), encoder.getPayloadLength(), &protobuf));
+    TEST_ASSERT_EQUAL_UINT32(encoder.getUncompressedLength(), protobuf.size());
+
+    DecodedPush push;
+    CodedInputStream input((const uint8_t*)protobuf.data(), protobuf.size());
+    uint32_t tag;
+    while ((tag = input.ReadTag()) != 0) {
+        uint32_t length;
+        TEST_ASSERT_EQUAL_UINT32((1 << 3) | 2, tag); // PushRequest.streams
+        TEST_ASSERT_TRUE(input.ReadVarint32(&length));
+        push.streams++;
+        CodedInputStream::Limit limit = input.PushLimit(length);
+        TEST_ASSERT_TRUE(decodeStream(input, push));
+        TEST_ASSERT_TRUE(input.ConsumedEntireMessage());
+        input.PopLimit(limit);
+    }
+    TEST_ASSERT_TRUE(input.ConsumedEntireMessage());
+    return push;
+}
+
+// Encodes a line given as compact Json, which ArduinoJson serialises back unchanged
+static void assertRoundTrips(const String& labels, uint64_t seconds, const std::string& line) {
+    LokiPushEncoder* encoder = new LokiPushEncoder();
+    JsonDocument lineDoc;
+    TEST_ASSERT_FALSE(deserializeJson(lineDoc, line.c_str()));
+    TEST_ASSERT_TRUE(encoder->encode(labels, seconds, lineDoc));
+
+    DecodedPush push = decodePush(*encoder);
+    TEST_ASSERT_EQUAL_INT(1, push.streams);
+    TEST_ASSERT_EQUAL_INT(1, push.entries);
+    TEST_ASSERT_EQUAL_STRING(labels.c_str(), push.labels.c_str());
+    TEST_ASSERT_TRUE(push.seconds == (int64_t)seconds);
+    TEST_ASSERT_EQUAL_STRING(line.c_str(), push.line.c_str());
+    delete encoder;
+}
+
+static String pushLabels(const String& group) {
+    String labels;
+    LokiPushEncoder::appendLabel(labels, "job", "testserver");
+    LokiPushEncoder::appendLabel(labels, "metric", "moisture");
+    LokiPushEncoder::appendLabel(labels, "group", group);
+    labels += "}";
+    return labels;
+}
+
+void test_loki_push_round_trips_a_reading() {
+    assertRoundTrips(pushLabels("strawberries"), 1700000000ULL,
+                     "{\"group\":\"strawberries\",\"channel\":3,\"level\":412,\"threshold\":250}");
+}
+
+void test_loki_push_escapes_labels() {
+    String labels = pushLabels("say \"hi\" \\ bye");
+    TEST_ASSERT_EQUAL_STRING("{job=\"testserver\", metric=\"moisture\", group=\"say \\\"hi\\\" \\\\ bye\"}", labels.c_str());
+    assertRoundTrips(labels, 0, "{\"level\":0}");
+}
+
+// Repeated text is compressed with back references, including ones longer than 64 bytes
+void test_loki_push_round_trips_repetitive_lines() {
+    std::string line = "{\"series\":[";
+    for (int i = 0; i < 10; i++) {
+        line += "[\"moisture\",\"strawberries\",3,402,417,410.5,5,415],";
+    }
+    line += "\"" + std::string(300, 'a') + "\"]}";
+    assertRoundTrips(pushLabels("strawberries"), 4102444800ULL, line);
+
+    LokiPushEncoder* encoder = new LokiPushEncoder();
+    JsonDocument lineDoc;
+    deserializeJson(lineDoc, line.c_str());
+    encoder->encode(pushLabels("strawberries"), 0, lineDoc);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(encoder->getUncompressedLength() / 4, encoder->getPayloadLength());
+    delete encoder;
+}
+
+// Text without repeats is sent as literals, including ones needing two length bytes
+void test_loki_push_round_trips_long_literals() {
+    std::string text;
+    uint32_t seed = 7;
+    for (int i = 0; i < 700; i++) {
+        seed = seed * 1103515245u + 12345u;
+        text += (char)('a' + (seed >> 16) % 26);
+    }
+    assertRoundTrips(pushLabels("bed1"), 1, "{\"note\":\"" + text + "\"}");
+    assertRoundTrips(pushLabels("bed1"), 1, "{\"note\":\"" + text.substr(0, 100) + "\"}");
+}
+
+void test_loki_push_rejects_oversized_requests() {
+    LokiPushEncoder* encoder = new LokiPushEncoder();
+    JsonDocument lineDoc;
+    std::string line = "{\"note\":\"" + std::string(WATERINGSYSTEM_LOKI_MAXPROTOBUF, 'x') + "\"}";
+    deserializeJson(lineDoc, line.c_str());
+    TEST_ASSERT_FALSE(encoder->encode(pushLabels("bed1"), 0, lineDoc));
+    delete encoder;
+}
+
+void runLokiPushEncoderTests() {
+    RUN_TEST(test_loki_push_round_trips_a_reading);
+    RUN_TEST(test_loki_push_escapes_labels);
+    RUN_TEST(test_loki_push_round_trips_repetitive_lines);
+    RUN_TEST(test_loki_push_round_trips_long_literals);
+    RUN_TEST(test_loki_push_rejects_oversized_requests);
+}
+
+#endif
@@ -0,0 +1,27 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+//
+// Host tests, run with "pio test -e native". Like the firmware, the headers under test
+// are built as a single translation unit, so each module's tests are in a header.
+//
+
+#include <unity.h>
+#include "test_sensor_history.h"
+#include "test_heap_accounting.h"
+#include "test_loki_push_encoder.h"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    runSensorHistoryTests();
+    runHeapAccountingTests();
+    runLokiPushEncoderTests();
+    return UNITY_END();
+}
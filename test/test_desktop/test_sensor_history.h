@@ -0,0 +1,140 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <unity.h>
+#include <vector>
+#include "SensorHistory.h"
+
+//
+// Round trips samples through the SensorHistory encoder and decoder, fed the way the
+// sensor handler feeds it: every poll, with the poll period jittering around 5 seconds
+//
+
+#ifndef __WATERINGSYSTEM_TEST_SENSORHISTORY_H__
+#define __WATERINGSYSTEM_TEST_SENSORHISTORY_H__
+
+struct HistorySample
+{
+    uint32_t timestamp;
+    int value;
+};
+
+// Feeds a channel from jittered polls, returning the samples the history should keep
+static std::vector<HistorySample> feedHistory(SensorHistory& history, uint8_t channel, uint32_t fromMillis,
+                                              uint32_t toMillis, uint32_t sampleSecs, int (*reading)(uint32_t)) {
+    std::vector<HistorySample> expected;
+    uint32_t nowMillis = fromMillis;
+    uint32_t poll = 0;
+    while (nowMillis < toMillis) {
+        uint32_t nowSecs = nowMillis / 1000;
+        uint32_t quantized = nowSecs - nowSecs % sampleSecs;
+        if (expected.empty() || expected.back().timestamp != quantized) {
+            expected.push_back({quantized, reading(nowSecs)});
+        }
+        history.recordSample(channel, nowSecs, reading(nowSecs));
+        nowMillis += 5000 + (poll++ * 397) % 700; // 5 to 5.7 seconds between polls
+    }
+    return expected;
+}
+
+static std::vector<HistorySample> decodeHistory(SensorHistory& history, uint8_t channel, uint32_t from, uint32_t to) {
+    std::vector<HistorySample> decoded;
+    history.forEachSample(channel, from, to, [&](uint32_t timestamp, int value) {
+        decoded.push_back({timestamp, value});
+    });
+    return decoded;
+}
+
+static void assertSamplesEqual(const std::vector<HistorySample>& expected, const std::vector<HistorySample>& decoded) {
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), decoded.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(expected[i].timestamp, decoded[i].timestamp);
+        TEST_ASSERT_EQUAL_INT(expected[i].value, decoded[i].value);
+    }
+}
+
+static int steadyReading(uint32_t secs) {
+    return 512;
+}
+
+static int driftingReading(uint32_t secs) {
+    return 600 - (int)(secs / 900) + (int)((secs * 7919) % 5) - 2;
+}
+
+// Large steps and values near the ends of the range, to exercise the escape token
+static int steppedReading(uint32_t secs) {
+    return (secs / 600) % 2 ? 1023 : -40 + (int)((secs / 30) % 3);
+}
+
+void test_history_round_trips_jittered_polls() {
+    SensorHistory* history = new SensorHistory();
+    history->configure(60, false);
+    std::vector<HistorySample> expected = feedHistory(*history, 2, 0, 3600000UL, 60, driftingReading);
+    assertSamplesEqual(expected, decodeHistory(*history, 2, 0, UINT32_MAX));
+    delete history;
+}
+
+void test_history_round_trips_large_steps() {
+    SensorHistory* history = new SensorHistory();
+    history->configure(30, false);
+    std::vector<HistorySample> expected = feedHistory(*history, 0, 0, 3600000UL, 30, steppedReading);
+    assertSamplesEqual(expected, decodeHistory(*history, 0, 0, UINT32_MAX));
+    delete history;
+}
+
+// Quantized timestamps keep a steady channel in run tokens, despite the poll jitter
+void test_history_quantizes_jittered_timestamps() {
+    SensorHistory* history = new SensorHistory();
+    history->configure(60, false);
+    std::vector<HistorySample> expected = feedHistory(*history, 0, 0, 6 * 3600000UL, 60, steadyReading);
+    TEST_ASSERT_EQUAL_UINT32(360, expected.size());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(12, history->getUsedBytes());
+    assertSamplesEqual(expected, decodeHistory(*history, 0, 0, UINT32_MAX));
+    delete history;
+}
+
+void test_history_decodes_a_time_range() {
+    SensorHistory* history = new SensorHistory();
+    history->configure(60, false);
+    std::vector<HistorySample> expected = feedHistory(*history, 1, 0, 3600000UL, 60, driftingReading);
+    std::vector<HistorySample> inRange;
+    for (const HistorySample& sample : expected) {
+        if (sample.timestamp >= 600 && sample.timestamp <= 1800) {
+            inRange.push_back(sample);
+        }
+    }
+    assertSamplesEqual(inRange, decodeHistory(*history, 1, 600, 1800));
+    delete history;
+}
+
+void test_history_records_every_sensor_channel() {
+    SensorHistory* history = new SensorHistory();
+    history->configure(60, false);
+    std::vector<HistorySample> expected = feedHistory(*history, WATERINGSYSTEM_HISTORY_CHANNELS - 1, 0, 600000UL, 60, driftingReading);
+    assertSamplesEqual(expected, decodeHistory(*history, WATERINGSYSTEM_HISTORY_CHANNELS - 1, 0, UINT32_MAX));
+    TEST_ASSERT_EQUAL_UINT32(0, decodeHistory(*history, 0, 0, UINT32_MAX).size());
+    delete history;
+}
+
+// Blocks spilled to flash are decoded ahead of those in RAM, with nothing lost between
+void test_history_round_trips_spilled_blocks() {
+    LittleFS.files.clear();
+    SensorHistory* history = new SensorHistory();
+    history->configure(30, true);
+    std::vector<HistorySample> expected = feedHistory(*history, 3, 0, 24 * 3600000UL, 30, steppedReading);
+    TEST_ASSERT_TRUE(LittleFS.exists("/history3.bin"));
+    assertSamplesEqual(expected, decodeHistory(*history, 3, 0, UINT32_MAX));
+    delete history;
+}
+
+void runSensorHistoryTests() {
+    RUN_TEST(test_history_round_trips_jittered_polls);
+    RUN_TEST(test_history_round_trips_large_steps);
+    RUN_TEST(test_history_quantizes_jittered_timestamps);
+    RUN_TEST(test_history_decodes_a_time_range);
+    RUN_TEST(test_history_records_every_sensor_channel);
+    RUN_TEST(test_history_round_trips_spilled_blocks);
+}
+
+#endif
@@ -0,0 +1,388 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESP8266WebServer.h>
+#include <ESP8266HTTPClient.h>
+#include <PubSubClient.h>
+#include <NTPClient.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "ConfigManager.h"
+#include "SerialConsole.h"
+
+//
+// Runs a fleet of simulated controllers in one process, against stand in Loki and Mqtt
+// servers, to size a shared backend before a rollout and to measure telemetry changes.
+// Built by the fleet_simulator environment, see "Fleet simulator" in README.md.
+//
+// Each instance is a full IrrigationService configured through ConfigManager from a
+// device configuration, with simulated sensor sources following the configuration's
+// profiles. The real Loki and Mqtt loggers send through the host HTTP and Mqtt clients
+// in test/stubs, which hand each request to the stand in servers here. Instances boot
+// at staggered times, each with its own clock, and are stepped through the simulated
+// period in turn.
+//
+
+#define FLEETSIM_EPOCHSTART 1700000000UL // Epoch time at the start of the simulation
+#define FLEETSIM_RATEWINDOWSECS 60       // Window for the peak message rates
+
+const char* defaultFleetConfig = R"({
+    "instance": "sim",
+    "loggers": [
+        {"type": "loki", "server": "loki.local"},
+        {"type": "mqtt", "server": "mqtt.local", "topicPrefix": "irrigation/"}
+    ],
+    "sensorSources": [
+        {"type": "simulated", "channels": 5, "profiles": [
+            {"base": 700, "noise": 3},
+            {"base": 450, "amplitude": 120, "periodSecs": 86400, "noise": 5},
+            {"base": 470, "amplitude": 100, "periodSecs": 86400, "noise": 5},
+            {"base": 430, "amplitude": 140, "periodSecs": 43200, "noise": 8},
+            {"base": 500, "amplitude": 80, "periodSecs": 43200, "noise": 8}
+        ]}
+    ],
+    "actuator": {"type": "simulated", "outputs": 2},
+    "groups": [
+        {"name": "bed1", "triggerType": "any", "waterSensorChannel": 0, "moistureSensorChannels": [1, 2],
+         "pumpPinIds": ["P0"], "minMoisture": 400, "pumpSecs": 30,
+         "waterCheckPeriodMs": 60000, "pumpCheckPeriodMs": 1000, "moistureCheckPeriodMs": 60000},
+        {"name": "bed2", "triggerType": "all", "waterSensorChannel": 0, "moistureSensorChannels": [3, 4],
+         "pumpPinIds": ["P1"], "minMoisture": 400, "pumpSecs": 30,
+         "waterCheckPeriodMs": 60000, "pumpCheckPeriodMs": 1000, "moistureCheckPeriodMs": 60000}
+    ]
+})";
+
+struct TransportStats
+{
+    unsigned long messages = 0;
+    unsigned long bytes = 0;
+    unsigned long failures = 0; // Requests refused by the stand in server
+};
+
+struct FleetSimulatorOptions
+{
+    String configFile;
+    unsigned long instances = 10;
+    unsigned long simulatedSecs = 86400;
+    unsigned long stepMillis = 100;
+    unsigned long staggerSecs = 600;
+    int profileJitter = 20;
+    unsigned long seed = 1;
+    bool json = false;
+};
+
+//
+// One controller in the fleet, with its own sensor handler, service and configuration
+//
+struct SimulatedInstance
+{
+    String name;
+    unsigned long bootMillis = 0;   // Simulation time at which the instance boots
+    bool booted = false;
+    AnalogueSensorHandler* sensors = NULL;
+    IrrigationService* service = NULL;
+    ESP8266WebServer* server = NULL;
+    ConfigManager* configManager = NULL;
+    TransportStats loki;
+    TransportStats mqtt;
+    unsigned long loops = 0;
+    double loopMicros = 0;
+    double maxLoopMicros = 0;
+};
+
+//
+// Stands in for the Loki push endpoint and the Mqtt broker, counting what each instance
+// sends. Loki requests are checked for the push path and content type, as Loki would.
+//
+class StandInBackends : public HostHttpServer, public HostMqttBroker
+{
+  private:
+    SimulatedInstance* _current = NULL;
+    unsigned long _windowMillis = 0;
+
+  public:
+    TransportStats loki;
+    TransportStats mqtt;
+    std::vector<unsigned long> lokiWindowMessages; // Messages per rate window
+    std::vector<unsigned long> mqttWindowMessages;
+
+    StandInBackends(unsigned long simulatedSecs);
+    void setCurrent(SimulatedInstance* instance, unsigned long simulationMillis);
+    virtual int handlePost(const String& url, const String& contentType, const uint8_t* body, size_t length);
+    virtual bool handlePublish(const char* clientId, const char* topic, const uint8_t* payload, size_t length);
+};
+/****************************************/
+
+StandInBackends::StandInBackends(unsigned long simulatedSecs) {
+    size_t windows = simulatedSecs / FLEETSIM_RATEWINDOWSECS + 1;
+    lokiWindowMessages.resize(windows, 0);
+    mqttWindowMessages.resize(windows, 0);
+}
+
+// Attributes the following requests to an instance, at a point in simulation time
+void StandInBackends::setCurrent(SimulatedInstance* instance, unsigned long simulationMillis) {
+    _current = instance;
+    _windowMillis = simulationMillis;
+}
+
+int StandInBackends::handlePost(const String& url, const String& contentType, const uint8_t* body, size_t length) {
+    std::string path(url.c_str());
+    int status = 204;
+    if (path.size() < strlen(LOKI_PATH) || path.compare(path.size() - strlen(LOKI_PATH), std::string::npos, LOKI_PATH) != 0) {
+        status = 404;
+    } else if (contentType != "application/json" && contentType != "application/x-protobuf") {
+        status = 415;
+    }
+    if (status != 204) {
+        loki.failures++;
+        _current->loki.failures++;
+        return status;
+    }
+    loki.messages++;
+    loki.bytes += length;
+    _current->loki.messages++;
+    _current->loki.bytes += length;
+    lokiWindowMessages[_windowMillis / 1000 / FLEETSIM_RATEWINDOWSECS]++;
+    return status;
+}
+
+bool StandInBackends::handlePublish(const char* clientId, const char* topic, const uint8_t* payload, size_t length) {
+    size_t bytes = strlen(topic) + length;
+    mqtt.messages++;
+    mqtt.bytes += bytes;
+    _current->mqtt.messages++;
+    _current->mqtt.bytes += bytes;
+    mqttWindowMessages[_windowMillis / 1000 / FLEETSIM_RATEWINDOWSECS]++;
+    return true;
+}
+
+//
+// Takes the messages the firmware prints, such as pumps starting, so the report isn't
+// lost among them
+//
+class DiscardingConsoleSink : public SerialConsoleSink
+{
+  public:
+    unsigned long lines = 0;
+    virtual void queueConsoleLine(const char* line, size_t length) { lines++; }
+};
+
+//
+// Prepares an instance's configuration from the fleet configuration: its own instance
+// name, without serial loggers, which don't load the backend, and with the simulated
+// sensor profiles offset by up to the jitter, so instances don't read the same
+//
+JsonDocument instanceConfig(JsonDocument fleetConfig, const String& name, int profileJitter) {
+    JsonDocument configDoc = fleetConfig;
+    configDoc["instance"] = name;
+    JsonArray loggersJson = configDoc["loggers"];
+    for (size_t i = loggersJson.size(); i > 0; i--) {
+        if (loggersJson[i - 1]["type"] == "serial") {
+            loggersJson.remove(i - 1);
+        }
+    }
+    for (JsonVariant sourceJson : configDoc["sensorSources"].as<JsonArray>()) {
+        if (sourceJson["type"] != "simulated") {
+            continue;
+        }
+        for (JsonVariant profileJson : sourceJson["profiles"].as<JsonArray>()) {
+            int base = profileJson.containsKey("base") ? profileJson["base"].as<int>() : SimulatedChannelProfile().base;
+            profileJson["base"] = constrain(base + random(-profileJitter, profileJitter + 1), 0, 1023);
+        }
+    }
+    return configDoc;
+}
+
+//
+// Boots an instance, applying its configuration and bringing up its loggers as the
+// firmware does once the network is attached
+//
+String bootInstance(SimulatedInstance* instance, JsonDocument& fleetConfig, int profileJitter) {
+    instance->sensors = new AnalogueSensorHandler({D5, D6, D7});
+    instance->service = new IrrigationService(instance->sensors);
+    instance->server = new ESP8266WebServer(8080);
+    instance->configManager = new ConfigManager(instance->server, instance->service, instance->sensors);
+    String error = instance->configManager->processJsonConfig(instanceConfig(fleetConfig, instance->name, profileJitter), true);
+    if (!error.isEmpty()) {
+        return error;
+    }
+    IrrigationLogger* logger = instance->service->getLogger();
+    logger->setNetworkAvailable(true);
+    logger->logStartup(IPAddress(), instance->service->getFirstControlMillis(), millis());
+    instance->booted = true;
+    return String();
+}
+
+bool parseOptions(int argc, char** argv, FleetSimulatorOptions* options) {
+    for (int i = 1; i < argc; i++) {
+        String option(argv[i]);
+        bool hasValue = i + 1 < argc;
+        if (option == "--json") {
+            options->json = true;
+        } else if (option == "--config" && hasValue) {
+            options->configFile = argv[++i];
+        } else if (option == "--instances" && hasValue) {
+            options->instances = strtoul(argv[++i], NULL, 10);
+        } else if (option == "--hours" && hasValue) {
+            options->simulatedSecs = (unsigned long)(atof(argv[++i]) * 3600);
+        } else if (option == "--step-ms" && hasValue) {
+            options->stepMillis = strtoul(argv[++i], NULL, 10);
+        } else if (option == "--stagger-secs" && hasValue) {
+            options->staggerSecs = strtoul(argv[++i], NULL, 10);
+        } else if (option == "--jitter" && hasValue) {
+            options->profileJitter = atoi(argv[++i]);
+        } else if (option == "--seed" && hasValue) {
+            options->seed = strtoul(argv[++i], NULL, 10);
+        } else {
+            return false;
+        }
+    }
+    return options->instances > 0 && options->simulatedSecs > 0 && options->stepMillis > 0 && options->profileJitter >= 0;
+}
+
+unsigned long peakWindowMessages(const std::vector<unsigned long>& windowMessages) {
+    unsigned long peak = 0;
+    for (unsigned long messages : windowMessages) {
+        peak = max(peak, messages);
+    }
+    return peak;
+}
+
+void addTransportReport(JsonObject transportJson, const TransportStats& stats, unsigned long simulatedSecs, unsigned long peakWindow) {
+    transportJson["messages"] = stats.messages;
+    transportJson["bytes"] = stats.bytes;
+    transportJson["failures"] = stats.failures;
+    transportJson["messagesPerSec"] = (float)stats.messages / simulatedSecs;
+    transportJson["bytesPerSec"] = (float)stats.bytes / simulatedSecs;
+    transportJson["peakMessagesPerSec"] = (float)peakWindow / FLEETSIM_RATEWINDOWSECS;
+}
+
+void printTextReport(JsonDocument& reportDoc) {
+    printf("Simulated %lu instances for %lu seconds in %.1f seconds\n",
+           reportDoc["instances"].as<unsigned long>(), reportDoc["simulatedSecs"].as<unsigned long>(), reportDoc["runSecs"].as<float>());
+    printf("\n%-6s %10s %12s %12s %12s %14s %10s\n", "", "messages", "bytes", "messages/s", "bytes/s", "peak msgs/s", "failures");
+    for (const char* transport : {"loki", "mqtt"}) {
+        JsonObject transportJson = reportDoc[transport];
+        printf("%-6s %10lu %12lu %12.2f %12.1f %14.2f %10lu\n", transport,
+               transportJson["messages"].as<unsigned long>(), transportJson["bytes"].as<unsigned long>(),
+               transportJson["messagesPerSec"].as<float>(), transportJson["bytesPerSec"].as<float>(),
+               transportJson["peakMessagesPerSec"].as<float>(), transportJson["failures"].as<unsigned long>());
+    }
+    printf("\n%-20s %10s %12s %10s %12s %10s %14s %14s\n", "instance", "loki msgs", "loki bytes", "mqtt msgs", "mqtt bytes",
+           "loops", "mean loop us", "max loop us");
+    for (JsonVariant instanceJson : reportDoc["perInstance"].as<JsonArray>()) {
+        printf("%-20s %10lu %12lu %10lu %12lu %10lu %14.2f %14.1f\n", instanceJson["name"].as<const char*>(),
+               instanceJson["lokiMessages"].as<unsigned long>(), instanceJson["lokiBytes"].as<unsigned long>(),
+               instanceJson["mqttMessages"].as<unsigned long>(), instanceJson["mqttBytes"].as<unsigned long>(),
+               instanceJson["loops"].as<unsigned long>(), instanceJson["meanLoopMicros"].as<float>(),
+               instanceJson["maxLoopMicros"].as<float>());
+    }
+}
+
+int main(int argc, char** argv) {
+    FleetSimulatorOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        fprintf(stderr, "Usage: %s [--config device-config.json] [--instances N] [--hours H] [--step-ms MS]\n"
+                        "          [--stagger-secs S] [--jitter J] [--seed S] [--json]\n", argv[0]);
+        return 2;
+    }
+    randomSeed(options.seed);
+
+    JsonDocument fleetConfig;
+    std::string configText = defaultFleetConfig;
+    if (!options.configFile.isEmpty()) {
+        std::ifstream configFile(options.configFile.c_str());
+        if (!configFile) {
+            fprintf(stderr, "Unable to read %s\n", options.configFile.c_str());
+            return 1;
+        }
+        std::stringstream contents;
+        contents << configFile.rdbuf();
+        configText = contents.str();
+    }
+    DeserializationError parseError = deserializeJson(fleetConfig, configText.c_str(), configText.size());
+    if (parseError) {
+        fprintf(stderr, "Unable to parse the configuration: %s\n", parseError.c_str());
+        return 1;
+    }
+
+    DiscardingConsoleSink console;
+    serialConsole.addSink(&console);
+    StandInBackends backends(options.simulatedSecs);
+    hostHttpServer = &backends;
+    hostMqttBroker = &backends;
+
+    std::vector<SimulatedInstance> instances(options.instances);
+    for (size_t i = 0; i < instances.size(); i++) {
+        instances[i].name = fleetConfig["instance"].as<String>() + "-" + (unsigned long)i;
+        instances[i].bootMillis = options.staggerSecs ? random(options.staggerSecs * 1000) : 0;
+    }
+
+    auto runStart = std::chrono::steady_clock::now();
+    unsigned long endMillis = options.simulatedSecs * 1000;
+    for (unsigned long simulationMillis = 0; simulationMillis < endMillis; simulationMillis += options.stepMillis) {
+        for (SimulatedInstance& instance : instances) {
+            if (simulationMillis < instance.bootMillis) {
+                continue;
+            }
+            // Each instance's clock starts at its boot
+            hostMillis = simulationMillis - instance.bootMillis;
+            hostEpochAtBoot = FLEETSIM_EPOCHSTART + instance.bootMillis / 1000;
+            backends.setCurrent(&instance, simulationMillis);
+            if (!instance.booted) {
+                String error = bootInstance(&instance, fleetConfig, options.profileJitter);
+                if (!error.isEmpty()) {
+                    fprintf(stderr, "Invalid configuration: %s\n", error.c_str());
+                    return 1;
+                }
+            }
+            auto loopStart = std::chrono::steady_clock::now();
+            instance.service->loop();
+            double loopMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - loopStart).count();
+            instance.loops++;
+            instance.loopMicros += loopMicros;
+            instance.maxLoopMicros = std::max(instance.maxLoopMicros, loopMicros);
+        }
+    }
+    double runSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+    JsonDocument reportDoc;
+    reportDoc["instances"] = options.instances;
+    reportDoc["simulatedSecs"] = options.simulatedSecs;
+    reportDoc["runSecs"] = runSecs;
+    addTransportReport(reportDoc["loki"].to<JsonObject>(), backends.loki, options.simulatedSecs, peakWindowMessages(backends.lokiWindowMessages));
+    addTransportReport(reportDoc["mqtt"].to<JsonObject>(), backends.mqtt, options.simulatedSecs, peakWindowMessages(backends.mqttWindowMessages));
+    reportDoc["consoleLines"] = console.lines;
+    JsonArray perInstanceJson = reportDoc["perInstance"].to<JsonArray>();
+    for (SimulatedInstance& instance : instances) {
+        JsonObject instanceJson = perInstanceJson.add<JsonObject>();
+        instanceJson["name"] = instance.name;
+        instanceJson["lokiMessages"] = instance.loki.messages;
+        instanceJson["lokiBytes"] = instance.loki.bytes;
+        instanceJson["mqttMessages"] = instance.mqtt.messages;
+        instanceJson["mqttBytes"] = instance.mqtt.bytes;
+        instanceJson["loops"] = instance.loops;
+        instanceJson["meanLoopMicros"] = instance.loops ? instance.loopMicros / instance.loops : 0;
+        instanceJson["maxLoopMicros"] = instance.maxLoopMicros;
+    }
+    if (options.json) {
+        String report;
+        serializeJson(reportDoc, report);
+        Serial.println(report);
+    } else {
+        printTextReport(reportDoc);
+    }
+
+    for (SimulatedInstance& instance : instances) {
+        delete instance.configManager;
+        delete instance.server;
+        delete instance.service;
+        delete instance.sensors;
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+//
+// Distributed under MIT license. See https://raw.githubusercontent.com/petersymphonyconnect/irrigation-system/main/LICENSE
+//
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESP8266WebServer.h>
+#include <LittleFS.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "ConfigManager.h"
+#include "SensorRecorder.h"
+#include "SensorReplay.h"
+#include "SerialConsole.h"
+
+//
+// Replays a sensor recording fetched from a controller through the firmware's sensor
+// filtering and group decisions, with sets of overridden group parameters, on the
+// development machine. Built by the replay_runner environment, and run by
+// sensor_replay.py, see "Recording and replay" in README.md.
+//
+// The service is configured through ConfigManager from the controller's configuration,
+// without its loggers, so the groups and channel calibrations match the controller's.
+// Each line of standard input is a JSON object of replay parameters, as described in
+// SensorReplay.h, and each gives a line of JSON results on standard output, or an
+// object with an "error".
+//
+
+//
+// Sends the messages the firmware prints to standard error, keeping standard output
+// to the results
+//
+class StderrConsoleSink : public SerialConsoleSink
+{
+  public:
+    virtual void queueConsoleLine(const char* line, size_t length) { fprintf(stderr, "%.*s\n", (int)length, line); }
+};
+
+bool readFile(const char* fileName, std::string* contents) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    *contents = stream.str();
+    return true;
+}
+
+void printResult(JsonDocument& resultDoc) {
+    String result;
+    serializeJson(resultDoc, result);
+    Serial.println(result);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s recording.bin device-config.json < parameter-sets.jsonl\n", argv[0]);
+        return 2;
+    }
+    std::string recording;
+    if (!readFile(argv[1], &recording)) {
+        fprintf(stderr, "Unable to read %s\n", argv[1]);
+        return 1;
+    }
+    std::string configText;
+    if (!readFile(argv[2], &configText)) {
+        fprintf(stderr, "Unable to read %s\n", argv[2]);
+        return 1;
+    }
+    JsonDocument configDoc;
+    DeserializationError parseError = deserializeJson(configDoc, configText.c_str(), configText.size());
+    if (parseError) {
+        fprintf(stderr, "Unable to parse the configuration: %s\n", parseError.c_str());
+        return 1;
+    }
+    configDoc.remove("loggers");
+
+    StderrConsoleSink console;
+    serialConsole.addSink(&console);
+    // GET /recording streams the old file then the current one, which read back the
+    // same as a single current file
+    LittleFS.files[SensorRecorder::getFileName(false).c_str()] = recording;
+
+    AnalogueSensorHandler sensors({D5, D6, D7});
+    IrrigationService service(&sensors);
+    ESP8266WebServer server(8080);
+    ConfigManager configManager(&server, &service, &sensors);
+    String error = configManager.processJsonConfig(configDoc, true);
+    if (!error.isEmpty()) {
+        fprintf(stderr, "Invalid configuration: %s\n", error.c_str());
+        return 1;
+    }
+
+    SensorReplay replay(&service, &sensors);
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        JsonDocument paramsDoc;
+        JsonDocument resultDoc;
+        parseError = deserializeJson(paramsDoc, line.c_str(), line.size());
+        if (parseError) {
+            resultDoc["error"] = String("Unable to parse the parameters: ") + parseError.c_str();
+            printResult(resultDoc);
+            continue;
+        }
+        auto runStart = std::chrono::steady_clock::now();
+        error = replay.run(paramsDoc.as<JsonObject>(), resultDoc.to<JsonObject>());
+        if (!error.isEmpty()) {
+            resultDoc.clear();
+            resultDoc["error"] = error;
+        } else {
+            resultDoc["runMillis"] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+        }
+        printResult(resultDoc);
+    }
+    return 0;
+}